@@ -11,7 +11,6 @@
 
 #include "main.h"
 
-extern char **environ;
 
 
 /*
@@ -491,7 +490,7 @@ void EndpointAppPBX::action_init_partyline(void)
 	struct port_list *portlist = ea_endpoint->ep_portlist;
 	struct lcr_msg *message;
 	struct route_param *rparam;
-	int partyline, jingle = 0;
+	int partyline, jingle = 0, talkers = 0;
 	struct join_relation *relation;
 
 	portlist = ea_endpoint->ep_portlist;
@@ -516,6 +515,8 @@ void EndpointAppPBX::action_init_partyline(void)
 	partyline = rparam->integer_value;
 	if ((rparam = routeparam(e_action, PARAM_JINGLE)))
 		jingle = 1;
+	if ((rparam = routeparam(e_action, PARAM_TALKERS)))
+		talkers = rparam->integer_value;
 
 	/* don't create join if partyline exists */
 	join = join_first;
@@ -556,10 +557,13 @@ void EndpointAppPBX::action_init_partyline(void)
 	trace_header("ACTION partyline (calling)", DIRECTION_NONE);
 	add_trace("room", NULL, "%d", partyline);
 	add_trace("jingle", NULL, (jingle)?"on":"off");
+	if (talkers)
+		add_trace("talkers", NULL, "%d", talkers);
 	end_trace();
 	message = message_create(ea_endpoint->ep_serial, ea_endpoint->ep_join_id, EPOINT_TO_JOIN, MESSAGE_SETUP);
 	message->param.setup.partyline = partyline;
 	message->param.setup.partyline_jingle = jingle;
+	message->param.setup.partyline_talkers = talkers;
 	memcpy(&message->param.setup.dialinginfo, &e_dialinginfo, sizeof(struct dialing_info));
 	memcpy(&message->param.setup.redirinfo, &e_redirinfo, sizeof(struct redir_info));
 	memcpy(&message->param.setup.callerinfo, &e_callerinfo, sizeof(struct caller_info));
@@ -1968,9 +1972,6 @@ void EndpointAppPBX::action_hangup_execute(void)
 void EndpointAppPBX::action_execute(void)
 {
 	struct route_param *rparam;
-	pid_t pid;
-	pid_t pid2;
-	int iWaitStatus;
 	char *command = (char *)"";
 	char isdn_port[10];
 	char *argv[12]; /* check also number of args below */
@@ -2001,27 +2002,14 @@ void EndpointAppPBX::action_execute(void)
 	argv[i++] = isdn_port;
 	argv[i++] = e_callerinfo.imsi;
 	argv[i++] = NULL; /* check also number of args above */
-	switch (pid = fork ()) {
-		case -1:
-			trace_header("ACTION execute (fork failed)", DIRECTION_NONE);
-			end_trace();
-			break;
-		case 0:
-			/* To be shure there are no zombies created double fork */
-			if ((pid2 = fork()) == 0) {
-				execve(command, argv, environ);
-			}
-			/* Exit immediately and release the waiting parent. The subprocess falls to init because the parent died */
-			exit(0);
-			break;
-		default:
-			trace_header("ACTION execute", DIRECTION_NONE);
-			add_trace("command", NULL, "%s", command);
-			end_trace();
-
-			/* Wait for the pid. The forked process will exit immediately so there is no problem waiting. */
-			waitpid(pid, &iWaitStatus, 0);
-			break;
+	/* the child is reaped by the main loop, we don't wait for it */
+	if (!process_start(argv, 0, NULL, NULL)) {
+		trace_header("ACTION execute (fork failed)", DIRECTION_NONE);
+		end_trace();
+	} else {
+		trace_header("ACTION execute", DIRECTION_NONE);
+		add_trace("command", NULL, "%s", command);
+		end_trace();
 	}
 }
 
@@ -2290,7 +2278,7 @@ void EndpointAppPBX::process_dialing(int timeout)
 			goto process_action;
 		}
 
-		gettimeofday(&current_time, NULL);
+		get_timer_time(&current_time);
 		if (e_match_to_action && TIME_SMALLER(&e_match_timeout.timeout, &current_time)) {
 			/* return timeout rule */
 			PDEBUG(DEBUG_EPOINT, "EPOINT(%d): terminal '%s' dialing: '%s', timeout in ruleset '%s'\n", ea_endpoint->ep_serial, e_ext.number, e_dialinginfo.id, e_ruleset->name);
@@ -124,51 +124,31 @@ void EndpointAppPBX::action_init_vbox_play(void)
  */
 void EndpointAppPBX::vbox_index_read(int num)
 {
-	FILE *fp;
-	char filename[256];
-	char buffer[256];
-	char name[sizeof(buffer)];
-	char callerid[sizeof(buffer)];
-	int year, mon, mday, hour, min;
-	int i;
+	struct vbox_store_record rec;
 
 	e_vbox_index_num = 0;
 
-	SPRINT(filename, "%s/%s/vbox/index", EXTENSION_DATA, e_vbox);
-	if (!(fp = fopen(filename, "r"))) {
-		PDEBUG(DEBUG_EPOINT, "EPOINT(%d) no files in index\n", ea_endpoint->ep_serial);
-		return;
-	}
-	fduse++;
-
-	i = 0;
-	while((GETLINE(buffer, fp))) {
-		name[0] = callerid[0] = '\0';
-		mon = mday = hour = min = 0;
-		sscanf(buffer, "%s %d %d %d %d %d %s", name, &year, &mon, &mday, &hour, &min, callerid);
-
-		if (name[0]=='\0' || name[0]=='#')
-			continue;
-
-		/* the selected entry */
-		if (i == num) {
-			SCPY(e_vbox_index_file, name);
-			e_vbox_index_year = year;
-			e_vbox_index_mon = mon;
-			e_vbox_index_mday = mday;
-			e_vbox_index_hour = hour;
-			e_vbox_index_min = min;
-			SCPY(e_vbox_index_callerid, callerid);
-			PDEBUG(DEBUG_EPOINT, "EPOINT(%d) read entry #%d: '%s', %02d:%02d %02d:%02d cid='%s'\n", ea_endpoint->ep_serial, i, name, mon+1, mday, hour, min, callerid);
+	/* the store is kept open while the menu is used */
+	if (e_vbox_store.fd < 0 || !!strcmp(e_vbox_store.extension, e_vbox)) {
+		if (vbox_store_open(&e_vbox_store, e_vbox)) {
+			PDEBUG(DEBUG_EPOINT, "EPOINT(%d) no files in index\n", ea_endpoint->ep_serial);
+			return;
 		}
-
-		i++;
 	}
 
-	e_vbox_index_num = i;
+	e_vbox_index_num = vbox_store_num(&e_vbox_store);
 
-	fclose(fp);
-	fduse--;
+	/* the selected entry */
+	if (vbox_store_get(&e_vbox_store, num, &rec))
+		return;
+	SCPY(e_vbox_index_file, rec.name);
+	e_vbox_index_year = rec.year;
+	e_vbox_index_mon = rec.mon;
+	e_vbox_index_mday = rec.mday;
+	e_vbox_index_hour = rec.hour;
+	e_vbox_index_min = rec.min;
+	SCPY(e_vbox_index_callerid, rec.callerid);
+	PDEBUG(DEBUG_EPOINT, "EPOINT(%d) read entry #%d: '%s', %02d:%02d %02d:%02d cid='%s'\n", ea_endpoint->ep_serial, num, rec.name, rec.mon+1, rec.mday, rec.hour, rec.min, rec.callerid);
 }
 
 
@@ -179,47 +159,9 @@ void EndpointAppPBX::vbox_index_read(int num)
  */
 void EndpointAppPBX::vbox_index_remove(int num)
 {
-	FILE *fpr, *fpw;
-	char buffer[256];
-	int i;
-	char filename1[256], filename2[256];
-
 	PDEBUG(DEBUG_EPOINT, "EPOINT(%d) removing entrie #%d\n", ea_endpoint->ep_serial, num);
 
-	SPRINT(filename1, "%s/%s/vbox/index", EXTENSION_DATA, e_vbox);
-	SPRINT(filename2, "%s/%s/vbox/index-temp", EXTENSION_DATA, e_vbox);
-	if (!(fpr = fopen(filename1, "r"))) {
-		return;
-	}
-	if (!(fpw = fopen(filename2, "w"))) {
-		fclose(fpr);
-		return;
-	}
-	fduse += 2;
-
-	i = 0;
-	while((fgets(buffer,sizeof(buffer),fpr))) {
-		buffer[sizeof(buffer)-1] = '\0';
-		if (buffer[0]) buffer[strlen(buffer)-1] = '\0';
-
-		if (buffer[0]=='\0' || buffer[0]=='#') {
-			fprintf(fpw, "%s\n", buffer);
-			continue;	
-		}
-
-		/* the selected entry will not be written */
-		if (i != num) {
-			fprintf(fpw, "%s\n", buffer);
-		}
-
-		i++;
-	}
-
-	fclose(fpr);
-	fclose(fpw);
-	fduse -= 2;
-
-	rename(filename2, filename1);
+	vbox_store_remove(&e_vbox_store, num);
 }
 
 
@@ -9,6 +9,15 @@
 **                                                                           **
 \*****************************************************************************/ 
 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_SIMD
+#include <immintrin.h>
+#endif
+#include "alawulaw.h"
+
 signed int *audio_law_to_s32;
 
 /* ulaw -> signed 16-bit */
@@ -149,8 +158,9 @@ static signed int audio_alaw_to_s32[] =
 	0x0000327c, 0xffffcd84, 0x0000032c, 0xfffffcd4
 };
 
-/* signed 16-bit -> Xlaw */
-unsigned char audio_s16_to_law[65536];
+/* signed 16-bit -> Xlaw
+ * padded, so a 32 bit gather at the last index stays inside */
+unsigned char audio_s16_to_law[65536 + 3];
 
 
 /* table is used to generate s16_to_alaw */
@@ -222,12 +232,430 @@ static short audio_alaw_relations[] =
 	0x6d7c, 0x94, 0x717c, 0x14, 0x757c, 0xd4, 0x797c, 0x54
 };
 
+/*
+ * block kernels
+ *
+ * the law conversions use the tables above, so all kernels give exactly
+ * the same result. AVX2 gathers eight table entries at once, SSE2 has no
+ * gather, so it uses the scalar law conversion. bit flipping, gain, mixing
+ * and summing are calculated with SSE2 or AVX2. the kernels are selected at
+ * runtime by generate_tables().
+ */
+
+void (*audio_decode)(signed short *s16, const unsigned char *law, int len);
+void (*audio_encode)(unsigned char *law, const signed short *s16, int len);
+void (*audio_flip)(unsigned char *to, const unsigned char *from, int len);
+void (*audio_gain)(signed short *s16, int len, int gain);
+void (*audio_mix)(signed short *to, const signed short *from, int len);
+void (*audio_sum)(signed int *sum, const signed short *s16, int len);
+void (*audio_minus)(signed short *to, const signed int *sum, const signed short *own, int len);
+
+static unsigned char audio_flip_table[256];
+
+/* gain factors of volume shift 1..8 (like mISDN dsp), 8 bit fraction */
+static int audio_gain_up[8] = { 282, 320, 384, 448, 512, 768, 1024, 1280 };
+static int audio_gain_down[8] = { 233, 205, 171, 146, 128, 85, 64, 51 };
+
+static int gain_factor(int gain)
+{
+	if (gain > 8)
+		gain = 8;
+	if (gain < -8)
+		gain = -8;
+	if (gain > 0)
+		return audio_gain_up[gain - 1];
+	return audio_gain_down[-gain - 1];
+}
+
+static void decode_scalar(signed short *s16, const unsigned char *law, int len)
+{
+	const signed int *table = audio_law_to_s32;
+
+	/* independent loads, so they are not serialized */
+	while (len >= 4) {
+		s16[0] = table[law[0]];
+		s16[1] = table[law[1]];
+		s16[2] = table[law[2]];
+		s16[3] = table[law[3]];
+		s16 += 4;
+		law += 4;
+		len -= 4;
+	}
+	while (len--)
+		*s16++ = table[*law++];
+}
+
+static void encode_scalar(unsigned char *law, const signed short *s16, int len)
+{
+	while (len >= 4) {
+		law[0] = audio_s16_to_law[s16[0] & 0xffff];
+		law[1] = audio_s16_to_law[s16[1] & 0xffff];
+		law[2] = audio_s16_to_law[s16[2] & 0xffff];
+		law[3] = audio_s16_to_law[s16[3] & 0xffff];
+		law += 4;
+		s16 += 4;
+		len -= 4;
+	}
+	while (len--)
+		*law++ = audio_s16_to_law[*s16++ & 0xffff];
+}
+
+static void flip_scalar(unsigned char *to, const unsigned char *from, int len)
+{
+	while (len--)
+		*to++ = audio_flip_table[*from++];
+}
+
+static void gain_scalar(signed short *s16, int len, int gain)
+{
+	int factor = gain_factor(gain);
+	signed int sample;
+
+	while (len--) {
+		sample = (*s16 * factor) >> 8;
+		if (sample < -32768)
+			sample = -32768;
+		if (sample > 32767)
+			sample = 32767;
+		*s16++ = sample;
+	}
+}
+
+static void mix_scalar(signed short *to, const signed short *from, int len)
+{
+	signed int sample;
+
+	while (len--) {
+		sample = *to + *from++;
+		if (sample < -32768)
+			sample = -32768;
+		if (sample > 32767)
+			sample = 32767;
+		*to++ = sample;
+	}
+}
+
+static void sum_scalar(signed int *sum, const signed short *s16, int len)
+{
+	while (len--)
+		*sum++ += *s16++;
+}
+
+static void minus_scalar(signed short *to, const signed int *sum, const signed short *own, int len)
+{
+	signed int sample;
+
+	while (len--) {
+		sample = *sum++;
+		if (own)
+			sample -= *own++;
+		if (sample < -32768)
+			sample = -32768;
+		if (sample > 32767)
+			sample = 32767;
+		*to++ = sample;
+	}
+}
+
+#ifdef AUDIO_SIMD
+__attribute__((target("sse2")))
+static void flip_sse2(unsigned char *to, const unsigned char *from, int len)
+{
+	__m128i x, m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0f);
+
+	/* swap bits, pairs and nibbles, the masks keep bits inside the byte */
+	while (len >= 16) {
+		x = _mm_loadu_si128((const __m128i *)from);
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 1), m1), _mm_slli_epi16(_mm_and_si128(x, m1), 1));
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 2), m2), _mm_slli_epi16(_mm_and_si128(x, m2), 2));
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 4), m4), _mm_slli_epi16(_mm_and_si128(x, m4), 4));
+		_mm_storeu_si128((__m128i *)to, x);
+		from += 16;
+		to += 16;
+		len -= 16;
+	}
+	flip_scalar(to, from, len);
+}
+
+__attribute__((target("sse2")))
+static void gain_sse2(signed short *s16, int len, int gain)
+{
+	__m128i x, lo, hi, g = _mm_set1_epi16(gain_factor(gain));
+
+	while (len >= 8) {
+		x = _mm_loadu_si128((const __m128i *)s16);
+		lo = _mm_mullo_epi16(x, g);
+		hi = _mm_mulhi_epi16(x, g);
+		x = _mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 8),
+			_mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 8));
+		_mm_storeu_si128((__m128i *)s16, x);
+		s16 += 8;
+		len -= 8;
+	}
+	gain_scalar(s16, len, gain);
+}
+
+__attribute__((target("sse2")))
+static void mix_sse2(signed short *to, const signed short *from, int len)
+{
+	while (len >= 8) {
+		_mm_storeu_si128((__m128i *)to, _mm_adds_epi16(
+			_mm_loadu_si128((const __m128i *)to),
+			_mm_loadu_si128((const __m128i *)from)));
+		to += 8;
+		from += 8;
+		len -= 8;
+	}
+	mix_scalar(to, from, len);
+}
+
+__attribute__((target("sse2")))
+static void sum_sse2(signed int *sum, const signed short *s16, int len)
+{
+	__m128i x;
+
+	while (len >= 8) {
+		x = _mm_loadu_si128((const __m128i *)s16);
+		/* sign extend to 32 bit */
+		_mm_storeu_si128((__m128i *)sum, _mm_add_epi32(_mm_loadu_si128((const __m128i *)sum), _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));
+		_mm_storeu_si128((__m128i *)(sum + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(sum + 4)), _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)));
+		s16 += 8;
+		sum += 8;
+		len -= 8;
+	}
+	sum_scalar(sum, s16, len);
+}
+
+__attribute__((target("sse2")))
+static void minus_sse2(signed short *to, const signed int *sum, const signed short *own, int len)
+{
+	__m128i a, b, x;
+
+	while (len >= 8) {
+		a = _mm_loadu_si128((const __m128i *)sum);
+		b = _mm_loadu_si128((const __m128i *)(sum + 4));
+		if (own) {
+			x = _mm_loadu_si128((const __m128i *)own);
+			a = _mm_sub_epi32(a, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+			b = _mm_sub_epi32(b, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+			own += 8;
+		}
+		_mm_storeu_si128((__m128i *)to, _mm_packs_epi32(a, b));
+		sum += 8;
+		to += 8;
+		len -= 8;
+	}
+	minus_scalar(to, sum, own, len);
+}
+
+__attribute__((target("avx2")))
+static void decode_avx2(signed short *s16, const unsigned char *law, int len)
+{
+	__m256i a, b;
+
+	while (len >= 16) {
+		a = _mm256_i32gather_epi32((const int *)audio_law_to_s32, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)law)), 4);
+		b = _mm256_i32gather_epi32((const int *)audio_law_to_s32, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(law + 8))), 4);
+		/* pack works inside 128 bit lanes, so reorder */
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+		_mm256_storeu_si256((__m256i *)s16, a);
+		law += 16;
+		s16 += 16;
+		len -= 16;
+	}
+	/* the tail is done by non-avx code, clear upper registers to avoid transition penalty */
+	_mm256_zeroupper();
+	decode_scalar(s16, law, len);
+}
+
+__attribute__((target("avx2")))
+static void encode_avx2(unsigned char *law, const signed short *s16, int len)
+{
+	__m256i a, b, m = _mm256_set1_epi32(0xff);
+
+	while (len >= 16) {
+		/* the sample is the byte offset into the table */
+		a = _mm256_i32gather_epi32((const int *)audio_s16_to_law, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)s16)), 1);
+		b = _mm256_i32gather_epi32((const int *)audio_s16_to_law, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(s16 + 8))), 1);
+		a = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_and_si256(a, m), _mm256_and_si256(b, m)), 0xd8);
+		_mm_storeu_si128((__m128i *)law, _mm_packus_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+		s16 += 16;
+		law += 16;
+		len -= 16;
+	}
+	_mm256_zeroupper();
+	encode_scalar(law, s16, len);
+}
+
+__attribute__((target("avx2")))
+static void flip_avx2(unsigned char *to, const unsigned char *from, int len)
+{
+	__m256i x, m1 = _mm256_set1_epi8(0x55), m2 = _mm256_set1_epi8(0x33), m4 = _mm256_set1_epi8(0x0f);
+
+	while (len >= 32) {
+		x = _mm256_loadu_si256((const __m256i *)from);
+		x = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(x, 1), m1), _mm256_slli_epi16(_mm256_and_si256(x, m1), 1));
+		x = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(x, 2), m2), _mm256_slli_epi16(_mm256_and_si256(x, m2), 2));
+		x = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(x, 4), m4), _mm256_slli_epi16(_mm256_and_si256(x, m4), 4));
+		_mm256_storeu_si256((__m256i *)to, x);
+		from += 32;
+		to += 32;
+		len -= 32;
+	}
+	_mm256_zeroupper();
+	flip_sse2(to, from, len);
+}
+
+__attribute__((target("avx2")))
+static void gain_avx2(signed short *s16, int len, int gain)
+{
+	__m256i x, lo, hi, g = _mm256_set1_epi16(gain_factor(gain));
+
+	while (len >= 16) {
+		x = _mm256_loadu_si256((const __m256i *)s16);
+		lo = _mm256_mullo_epi16(x, g);
+		hi = _mm256_mulhi_epi16(x, g);
+		x = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_unpacklo_epi16(lo, hi), 8),
+			_mm256_srai_epi32(_mm256_unpackhi_epi16(lo, hi), 8));
+		_mm256_storeu_si256((__m256i *)s16, x);
+		s16 += 16;
+		len -= 16;
+	}
+	_mm256_zeroupper();
+	gain_sse2(s16, len, gain);
+}
+
+__attribute__((target("avx2")))
+static void mix_avx2(signed short *to, const signed short *from, int len)
+{
+	while (len >= 16) {
+		_mm256_storeu_si256((__m256i *)to, _mm256_adds_epi16(
+			_mm256_loadu_si256((const __m256i *)to),
+			_mm256_loadu_si256((const __m256i *)from)));
+		to += 16;
+		from += 16;
+		len -= 16;
+	}
+	_mm256_zeroupper();
+	mix_sse2(to, from, len);
+}
+
+__attribute__((target("avx2")))
+static void sum_avx2(signed int *sum, const signed short *s16, int len)
+{
+	while (len >= 8) {
+		_mm256_storeu_si256((__m256i *)sum, _mm256_add_epi32(
+			_mm256_loadu_si256((const __m256i *)sum),
+			_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)s16))));
+		s16 += 8;
+		sum += 8;
+		len -= 8;
+	}
+	_mm256_zeroupper();
+	sum_scalar(sum, s16, len);
+}
+
+__attribute__((target("avx2")))
+static void minus_avx2(signed short *to, const signed int *sum, const signed short *own, int len)
+{
+	__m256i a, b;
+
+	while (len >= 16) {
+		a = _mm256_loadu_si256((const __m256i *)sum);
+		b = _mm256_loadu_si256((const __m256i *)(sum + 8));
+		if (own) {
+			a = _mm256_sub_epi32(a, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)own)));
+			b = _mm256_sub_epi32(b, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(own + 8))));
+			own += 16;
+		}
+		_mm256_storeu_si256((__m256i *)to, _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+		sum += 16;
+		to += 16;
+		len -= 16;
+	}
+	_mm256_zeroupper();
+	minus_sse2(to, sum, own, len);
+}
+#endif
+
+/* change volume of law data, gain is the volume shift (-8 .. 8) */
+void audio_law_gain(unsigned char *law, int len, int gain)
+{
+	signed short s16[160];
+	int n;
+
+	if (!gain)
+		return;
+
+	while (len) {
+		n = (len > 160) ? 160 : len;
+		audio_decode(s16, law, n);
+		audio_gain(s16, n, gain);
+		audio_encode(law, s16, n);
+		law += n;
+		len -= n;
+	}
+}
+
+/* kernel levels, each level uses the kernels of lower levels it has none of */
+#define AUDIO_SCALAR	0
+#define AUDIO_SSE2	1
+#define AUDIO_AVX2	2
+static const char *audio_level_name[] = { "scalar", "sse2", "avx2" };
+
+/* highest level this cpu supports */
+static int audio_cpu_level(void)
+{
+#ifdef AUDIO_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return AUDIO_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return AUDIO_SSE2;
+#endif
+	return AUDIO_SCALAR;
+}
+
+/* select block kernels of given level */
+static void use_kernels(int level)
+{
+	audio_decode = decode_scalar;
+	audio_encode = encode_scalar;
+	audio_flip = flip_scalar;
+	audio_gain = gain_scalar;
+	audio_mix = mix_scalar;
+	audio_sum = sum_scalar;
+	audio_minus = minus_scalar;
+#ifdef AUDIO_SIMD
+	if (level >= AUDIO_SSE2) {
+		audio_flip = flip_sse2;
+		audio_gain = gain_sse2;
+		audio_mix = mix_sse2;
+		audio_sum = sum_sse2;
+		audio_minus = minus_sse2;
+	}
+	if (level >= AUDIO_AVX2) {
+		audio_decode = decode_avx2;
+		audio_encode = encode_avx2;
+		audio_flip = flip_avx2;
+		audio_gain = gain_avx2;
+		audio_mix = mix_avx2;
+		audio_sum = sum_avx2;
+		audio_minus = minus_avx2;
+	}
+#endif
+}
+
 /* generate tables for conversion of s16 to alaw/ulaw
  */
 void generate_tables(char law)
 {
 	int i, j;
 
+	/* bit order of RTP <-> mISDN */
+	for (i = 0; i < 256; i++)
+		audio_flip_table[i] = ((i & 1) << 7) + ((i & 2) << 5) + ((i & 4) << 3) + ((i & 8) << 1) + ((i & 16) >> 1) + ((i & 32) >> 3) + ((i & 64) >> 5) + ((i & 128) >> 7);
+
 	if (law == 'a') {
 		audio_law_to_s32=audio_alaw_to_s32;
 		/* generating alaw-table */
@@ -259,6 +687,230 @@ void generate_tables(char law)
 			i++;
 		}
 	}
+
+	use_kernels(audio_cpu_level());
 }
 
+/*
+ * compare and measure block kernels
+ *
+ * every kernel of every level this cpu supports is checked against the
+ * scalar kernel, with random and extreme samples at different lengths and
+ * alignments. then each kernel processes 'count' frames, to show what the
+ * kernels of each level cost.
+ */
+#define AUDIO_BENCH_LEN		4096	/* samples of test data */
+#define AUDIO_BENCH_FRAME	160	/* samples of a frame to measure */
+#define AUDIO_BENCH_KERNELS	7
+
+static const char *audio_kernel_name[AUDIO_BENCH_KERNELS] = { "decode", "encode", "flip", "gain", "mix", "sum", "minus" };
+static unsigned char bench_law[AUDIO_BENCH_LEN + 3], bench_ref_law[AUDIO_BENCH_LEN + 3], bench_out_law[AUDIO_BENCH_LEN + 3];
+static signed short bench_s16[AUDIO_BENCH_LEN + 3], bench_neg16[AUDIO_BENCH_LEN + 3], bench_ref16[AUDIO_BENCH_LEN + 3], bench_out16[AUDIO_BENCH_LEN + 3];
+static signed int bench_sum[AUDIO_BENCH_LEN + 3], bench_ref32[AUDIO_BENCH_LEN + 3], bench_out32[AUDIO_BENCH_LEN + 3];
+
+static void audio_bench_data(void)
+{
+	unsigned int seed = 1;
+	int i;
+
+	for (i = 0; i < AUDIO_BENCH_LEN + 3; i++) {
+		seed = seed * 1103515245 + 12345;
+		/* all law values, then random ones */
+		bench_law[i] = (i < 256) ? i : (seed >> 16);
+		bench_s16[i] = seed >> 16;
+		/* full scale samples, to check saturation */
+		if ((i % 7) == 3)
+			bench_s16[i] = (i & 8) ? 32767 : -32768;
+		bench_neg16[i] = (bench_s16[i] == -32768) ? 32767 : -bench_s16[i];
+		bench_sum[i] = (signed int)(seed >> 15) - 65536;
+	}
+}
+
+static int audio_bench_differs(int level, int kernel, int gain, int len, const void *ref, const void *out, int size)
+{
+	if (!memcmp(ref, out, size))
+		return 0;
+	printf("%s %s (gain %d) differs from scalar kernel at length %d.\n", audio_level_name[level], audio_kernel_name[kernel], gain, len);
+	return 1;
+}
+
+/* returns number of differences */
+static int audio_bench_verify(int level)
+{
+	int lens[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 159, AUDIO_BENCH_FRAME, 161, AUDIO_BENCH_LEN };
+	unsigned char *law;
+	signed short *s16, *b16;
+	signed int *sum;
+	int i, len, o, gain, errors = 0;
+
+	for (i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); i++) {
+		len = lens[i];
+		/* unaligned buffers, if not full length */
+		o = (len == AUDIO_BENCH_LEN) ? 0 : (i % 3) + 1;
+		law = bench_law + o;
+		s16 = bench_s16 + o;
+		b16 = bench_neg16 + 3 - o;
+		sum = bench_sum + o;
+
+		decode_scalar(bench_ref16, law, len);
+		audio_decode(bench_out16 + o, law, len);
+		errors += audio_bench_differs(level, 0, 0, len, bench_ref16, bench_out16 + o, len * sizeof(signed short));
+
+		encode_scalar(bench_ref_law, s16, len);
+		audio_encode(bench_out_law + o, s16, len);
+		errors += audio_bench_differs(level, 1, 0, len, bench_ref_law, bench_out_law + o, len);
+
+		flip_scalar(bench_ref_law, law, len);
+		audio_flip(bench_out_law + o, law, len);
+		errors += audio_bench_differs(level, 2, 0, len, bench_ref_law, bench_out_law + o, len);
+
+		for (gain = -8; gain <= 8; gain++) {
+			if (!gain)
+				continue;
+			memcpy(bench_ref16, s16, len * sizeof(signed short));
+			gain_scalar(bench_ref16, len, gain);
+			memcpy(bench_out16 + o, s16, len * sizeof(signed short));
+			audio_gain(bench_out16 + o, len, gain);
+			errors += audio_bench_differs(level, 3, gain, len, bench_ref16, bench_out16 + o, len * sizeof(signed short));
+		}
+
+		memcpy(bench_ref16, s16, len * sizeof(signed short));
+		mix_scalar(bench_ref16, s16, len);
+		memcpy(bench_out16 + o, s16, len * sizeof(signed short));
+		audio_mix(bench_out16 + o, s16, len);
+		errors += audio_bench_differs(level, 4, 0, len, bench_ref16, bench_out16 + o, len * sizeof(signed short));
+		memcpy(bench_ref16, s16, len * sizeof(signed short));
+		mix_scalar(bench_ref16, b16, len);
+		memcpy(bench_out16 + o, s16, len * sizeof(signed short));
+		audio_mix(bench_out16 + o, b16, len);
+		errors += audio_bench_differs(level, 4, 0, len, bench_ref16, bench_out16 + o, len * sizeof(signed short));
+
+		memcpy(bench_ref32, sum, len * sizeof(signed int));
+		sum_scalar(bench_ref32, s16, len);
+		memcpy(bench_out32 + o, sum, len * sizeof(signed int));
+		audio_sum(bench_out32 + o, s16, len);
+		errors += audio_bench_differs(level, 5, 0, len, bench_ref32, bench_out32 + o, len * sizeof(signed int));
+
+		minus_scalar(bench_ref16, sum, s16, len);
+		audio_minus(bench_out16 + o, sum, s16, len);
+		errors += audio_bench_differs(level, 6, 0, len, bench_ref16, bench_out16 + o, len * sizeof(signed short));
+		minus_scalar(bench_ref16, sum, NULL, len);
+		audio_minus(bench_out16 + o, sum, NULL, len);
+		errors += audio_bench_differs(level, 6, 0, len, bench_ref16, bench_out16 + o, len * sizeof(signed short));
+	}
+
+	return errors;
+}
+
+/* selected kernel, to find out if a level has its own kernel */
+static void *audio_bench_kernel(int kernel)
+{
+	switch (kernel) {
+	case 0: return (void *)audio_decode;
+	case 1: return (void *)audio_encode;
+	case 2: return (void *)audio_flip;
+	case 3: return (void *)audio_gain;
+	case 4: return (void *)audio_mix;
+	case 5: return (void *)audio_sum;
+	case 6: return (void *)audio_minus;
+	}
+	return NULL;
+}
+
+/* returns nanoseconds per frame */
+static double audio_bench_measure(int kernel, int count)
+{
+	struct timespec start, end;
+	int i;
+
+	memcpy(bench_out16, bench_s16, sizeof(bench_out16));
+	memcpy(bench_out32, bench_sum, sizeof(bench_out32));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch (kernel) {
+	case 0:
+		for (i = 0; i < count; i++)
+			audio_decode(bench_out16, bench_law, AUDIO_BENCH_FRAME);
+		break;
+	case 1:
+		for (i = 0; i < count; i++)
+			audio_encode(bench_out_law, bench_s16, AUDIO_BENCH_FRAME);
+		break;
+	case 2:
+		for (i = 0; i < count; i++)
+			audio_flip(bench_out_law, bench_law, AUDIO_BENCH_FRAME);
+		break;
+	case 3:
+		for (i = 0; i < count; i++)
+			audio_gain(bench_out16, AUDIO_BENCH_FRAME, (i & 1) ? 4 : -4);
+		break;
+	case 4:
+		for (i = 0; i < count; i++)
+			audio_mix(bench_out16, bench_s16, AUDIO_BENCH_FRAME);
+		break;
+	case 5:
+		/* add and subtract, so the sum does not overflow */
+		for (i = 0; i < count; i++)
+			audio_sum(bench_out32, (i & 1) ? bench_neg16 : bench_s16, AUDIO_BENCH_FRAME);
+		break;
+	case 6:
+		for (i = 0; i < count; i++)
+			audio_minus(bench_out16, bench_sum, bench_s16, AUDIO_BENCH_FRAME);
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((double)(end.tv_sec - start.tv_sec) * 1000000000.0 + (double)(end.tv_nsec - start.tv_nsec)) / count;
+}
+
+int audio_bench(int count)
+{
+	const char *laws = "au";
+	double ns[AUDIO_BENCH_KERNELS][AUDIO_AVX2 + 1];
+	void *used[AUDIO_BENCH_KERNELS];
+	int level, max, kernel, errors = 0;
+
+	if (count < 1)
+		count = 1;
+	max = audio_cpu_level();
+	audio_bench_data();
+
+	while (*laws) {
+		generate_tables(*laws);
+		for (level = AUDIO_SCALAR; level <= max; level++) {
+			use_kernels(level);
+			errors += audio_bench_verify(level);
+			for (kernel = 0; kernel < AUDIO_BENCH_KERNELS; kernel++) {
+				/* a level without own kernel is not measured again */
+				if (level > AUDIO_SCALAR && audio_bench_kernel(kernel) == used[kernel]) {
+					ns[kernel][level] = 0;
+					continue;
+				}
+				used[kernel] = audio_bench_kernel(kernel);
+				ns[kernel][level] = audio_bench_measure(kernel, count);
+			}
+		}
+
+		printf("%s-law, %d frames of %d samples, ns per frame:\n", (*laws == 'a') ? "a" : "u", count, AUDIO_BENCH_FRAME);
+		for (kernel = 0; kernel < AUDIO_BENCH_KERNELS; kernel++) {
+			printf("  %-8s", audio_kernel_name[kernel]);
+			for (level = AUDIO_SCALAR; level <= max; level++) {
+				if (level > AUDIO_SCALAR && ns[kernel][level] == 0) {
+					printf("  %s %8s        ", audio_level_name[level], "-");
+					continue;
+				}
+				printf("  %s %8.1f", audio_level_name[level], ns[kernel][level]);
+				if (level > AUDIO_SCALAR && ns[kernel][level] > 0)
+					printf(" (%4.1fx)", ns[kernel][AUDIO_SCALAR] / ns[kernel][level]);
+			}
+			printf("\n");
+		}
+		laws++;
+	}
+	if (errors)
+		printf("%d differences between kernels found!\n", errors);
+	else
+		printf("All kernels match the scalar kernels.\n");
+
+	return (errors) ? -1 : 0;
+}
 
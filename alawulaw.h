@@ -9,6 +9,16 @@
 **                                                                           **
 \*****************************************************************************/ 
 extern signed int *audio_law_to_s32;
-extern unsigned char audio_s16_to_law[65536];
-extern short audio_alaw_relations[];
+extern unsigned char audio_s16_to_law[65536 + 3];
 void generate_tables(char law);
+
+/* block kernels, selected for the cpu by generate_tables() */
+extern void (*audio_decode)(signed short *s16, const unsigned char *law, int len);
+extern void (*audio_encode)(unsigned char *law, const signed short *s16, int len);
+extern void (*audio_flip)(unsigned char *to, const unsigned char *from, int len);
+extern void (*audio_gain)(signed short *s16, int len, int gain);
+extern void (*audio_mix)(signed short *to, const signed short *from, int len);
+extern void (*audio_sum)(signed int *sum, const signed short *s16, int len);
+extern void (*audio_minus)(signed short *to, const signed int *sum, const signed short *own, int len);
+void audio_law_gain(unsigned char *law, int len, int gain);
+int audio_bench(int count);
@@ -0,0 +1,360 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** announcement player                                                       **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO play announcements?
+
+An announcement file is read only once, when it is played the first time.
+It is converted to law and stored in a memory map that is made read-only,
+so all ports that play the same announcement share the same pages and no
+port needs a file descriptor. The file itself is not mapped, because an
+announcement may be recorded again while it is played, and a truncated
+mapping would fault.
+
+Each time an announcement is started, the file is stat'ed. If it has
+changed, it is read again. The old version is freed when the last port
+stops playing it. Announcements that are not played are kept, so a greeting
+that is played again does not need to be read again. Only the
+ANNOUNCE_UNUSED announcements that were played most recently are kept,
+because there is a greeting for each voice box.
+
+All players are driven by one timer, which ticks every PORT_TRANSMIT
+samples. The samples a player must have sent are calculated from the
+monotonic clock, so the announcement does not drift, even if the main loop
+is delayed. One chunk of PORT_TRANSMIT samples is sent in advance, so the
+receiver does not run empty between two ticks. If the main loop was delayed
+too much, at most two chunks are sent at once, the rest is sent at the
+following ticks.
+
+*/
+
+#include "main.h"
+
+static struct announce_file *announce_hash[ANNOUNCE_HASH];
+static struct announce_player *announce_first = NULL;
+static struct announce_file *announce_unused_first = NULL, *announce_unused_last = NULL;
+static int announce_unused_num = 0;
+static struct announce_player *announce_next = NULL; /* next player to process by current tick */
+static struct lcr_timer announce_timer;
+static int announce_timer_added = 0;
+
+static unsigned int announce_key(const char *filename)
+{
+	unsigned int hash = 5381;
+
+	while (*filename)
+		hash = hash * 33 + (unsigned char)*filename++;
+
+	return hash & (ANNOUNCE_HASH - 1);
+}
+
+/* current time of the sample clock */
+static long long announce_clock(void)
+{
+	struct timeval now;
+
+	get_timer_time(&now);
+	return (now.tv_sec * MICRO_SECONDS + now.tv_usec) / 125;
+}
+
+/* schedule the next tick at the next border of PORT_TRANSMIT samples */
+static void announce_schedule(long long now)
+{
+	long long next = (now / PORT_TRANSMIT + 1) * PORT_TRANSMIT;
+
+	schedule_timer(&announce_timer, 0, (int)(next - now) * 125);
+}
+
+/* read file and convert it to law */
+static struct announce_file *announce_load(const char *filename, struct file_stamp *stamp)
+{
+	struct announce_file *file;
+	int fh, codec;
+	signed int size, left;
+	unsigned char *data;
+	void *map;
+	int l, len;
+
+	fh = open_tone((char *)filename, &codec, &size, &left);
+	if (fh < 0)
+		return(NULL);
+
+	file = (struct announce_file *)MALLOC(sizeof(struct announce_file));
+	memuse++;
+	SCPY(file->filename, filename);
+	memcpy(&file->stamp, stamp, sizeof(struct file_stamp));
+
+	if (size > 0) {
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map == MAP_FAILED) {
+			PERROR("Cannot map %d bytes for announcement '%s'.\n", size, filename);
+			close(fh);
+			FREE(file, sizeof(struct announce_file));
+			memuse--;
+			return(NULL);
+		}
+		file->data = (unsigned char *)map;
+		file->map_size = size;
+		data = file->data;
+		len = size;
+		while (len) {
+			l = read_tone(fh, data, codec, (len > ANNOUNCE_READ_CHUNK) ? ANNOUNCE_READ_CHUNK : len, size, &left, 1);
+			if (l <= 0)
+				break;
+			data += l;
+			len -= l;
+		}
+		file->size = size - len;
+
+		/* from now on, the announcement is shared */
+		mprotect(map, file->map_size, PROT_READ);
+	}
+	close(fh);
+
+	PDEBUG(DEBUG_PORT, "loaded announcement '%s' (%d samples)\n", filename, file->size);
+
+	return(file);
+}
+
+/* remove file from list of unused files */
+static void announce_used(struct announce_file *file)
+{
+	if (file->unused_prev)
+		file->unused_prev->unused_next = file->unused_next;
+	else if (announce_unused_first == file)
+		announce_unused_first = file->unused_next;
+	else
+		return; /* not in list */
+	if (file->unused_next)
+		file->unused_next->unused_prev = file->unused_prev;
+	else
+		announce_unused_last = file->unused_prev;
+	file->unused_prev = file->unused_next = NULL;
+	announce_unused_num--;
+}
+
+static void announce_free(struct announce_file *file)
+{
+	struct announce_file **filep;
+
+	announce_used(file);
+
+	filep = &announce_hash[announce_key(file->filename)];
+	while (*filep) {
+		if (*filep == file) {
+			*filep = file->next;
+			break;
+		}
+		filep = &((*filep)->next);
+	}
+
+	PDEBUG(DEBUG_PORT, "freeing announcement '%s'\n", file->filename);
+	if (file->data)
+		munmap(file->data, file->map_size);
+	FREE(file, sizeof(struct announce_file));
+	memuse--;
+}
+
+/* file is not played anymore, free the least recently played, if too many */
+static void announce_unused(struct announce_file *file)
+{
+	if (file->stale) {
+		announce_free(file);
+		return;
+	}
+
+	file->unused_prev = NULL;
+	file->unused_next = announce_unused_first;
+	if (announce_unused_first)
+		announce_unused_first->unused_prev = file;
+	else
+		announce_unused_last = file;
+	announce_unused_first = file;
+	announce_unused_num++;
+
+	while (announce_unused_num > ANNOUNCE_UNUSED)
+		announce_free(announce_unused_last);
+}
+
+/* get current version of announcement, load it, if required */
+static struct announce_file *announce_get(const char *filename)
+{
+	struct announce_file *file, *next;
+	struct file_stamp stamp;
+	char name[256];
+
+	SPRINT(name, "%s.isdn", filename);
+	if (file_stamp(name, &stamp)) {
+		SPRINT(name, "%s.wav", filename);
+		if (file_stamp(name, &stamp))
+			return(NULL);
+	}
+
+	file = announce_hash[announce_key(filename)];
+	while (file) {
+		next = file->next;
+		if (!file->stale && !strcmp(file->filename, filename)) {
+			if (!memcmp(&file->stamp, &stamp, sizeof(stamp)))
+				return(file);
+			/* file has changed */
+			file->stale = 1;
+			if (!file->users)
+				announce_free(file);
+		}
+		file = next;
+	}
+
+	file = announce_load(filename, &stamp);
+	if (!file)
+		return(NULL);
+	file->next = announce_hash[announce_key(filename)];
+	announce_hash[announce_key(filename)] = file;
+
+	return(file);
+}
+
+/* send samples that are due */
+static void announce_send(struct announce_player *player, long long now)
+{
+	unsigned char buffer[PORT_TRANSMIT + PORT_TRANSMIT];
+	announce_cb *cb;
+	void *instance;
+	int len, left;
+
+	if (now < player->start)
+		return;
+	len = (int)(now - player->start) + PORT_TRANSMIT - player->pos;
+	if (len <= 0)
+		return;
+	if (len > (int)sizeof(buffer))
+		len = sizeof(buffer);
+
+	left = player->file->size - player->pos;
+	if (left <= 0) {
+		/* end of announcement, the port may be destroyed by the callback */
+		cb = player->cb;
+		instance = player->instance;
+		announce_stop(player);
+		cb(instance, NULL, 0);
+		return;
+	}
+	if (len > left)
+		len = left;
+
+	/* the receiver may change the data, so it is copied */
+	memcpy(buffer, player->file->data + player->pos, len);
+	player->pos += len;
+	player->cb(player->instance, buffer, len);
+}
+
+static int announce_tick(struct lcr_timer *timer, void *instance, int index)
+{
+	struct announce_player *player;
+	long long now = announce_clock();
+
+	player = announce_first;
+	while (player) {
+		announce_next = player->next;
+		announce_send(player, now);
+		player = announce_next;
+	}
+	announce_next = NULL;
+
+	if (announce_first)
+		announce_schedule(now);
+
+	return 0;
+}
+
+/*
+ * start playing announcement after delay (in samples)
+ *
+ * returns -1, if the announcement does not exist
+ */
+int announce_play(struct announce_player *player, const char *filename, int delay, announce_cb *cb, void *instance)
+{
+	struct announce_file *file;
+	long long now;
+
+	announce_stop(player);
+
+	file = announce_get(filename);
+	if (!file)
+		return(-1);
+
+	if (!announce_timer_added) {
+		memset(&announce_timer, 0, sizeof(announce_timer));
+		add_timer(&announce_timer, announce_tick, NULL, 0);
+		announce_timer_added = 1;
+	}
+
+	now = announce_clock();
+	if (!file->users++)
+		announce_used(file);
+	player->file = file;
+	player->pos = 0;
+	player->start = now + delay;
+	player->cb = cb;
+	player->instance = instance;
+	player->prev = NULL;
+	player->next = announce_first;
+	if (announce_first)
+		announce_first->prev = player;
+	else
+		announce_schedule(now);
+	announce_first = player;
+
+	return(0);
+}
+
+/* stop playing, the callback is not called */
+void announce_stop(struct announce_player *player)
+{
+	struct announce_file *file = player->file;
+
+	if (!file)
+		return;
+
+	if (announce_next == player)
+		announce_next = player->next;
+	if (player->prev)
+		player->prev->next = player->next;
+	else
+		announce_first = player->next;
+	if (player->next)
+		player->next->prev = player->prev;
+	player->prev = player->next = NULL;
+	player->file = NULL;
+
+	if (!announce_first)
+		unsched_timer(&announce_timer);
+
+	if (!--file->users)
+		announce_unused(file);
+}
+
+void announce_exit(void)
+{
+	int i;
+
+	while (announce_first)
+		announce_stop(announce_first);
+
+	for (i = 0; i < ANNOUNCE_HASH; i++) {
+		while (announce_hash[i])
+			announce_free(announce_hash[i]);
+	}
+
+	if (announce_timer_added) {
+		del_timer(&announce_timer);
+		announce_timer_added = 0;
+	}
+}
+
@@ -0,0 +1,45 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** announcement player header file                                           **
+**                                                                           **
+\*****************************************************************************/
+
+#define ANNOUNCE_HASH		64	/* buckets, must be a binary border */
+#define ANNOUNCE_READ_CHUNK	4096	/* samples that are read at once */
+#define ANNOUNCE_UNUSED		32	/* unused announcements that are kept */
+
+/* announcement in memory, key is the file name without extension */
+struct announce_file {
+	struct announce_file	*next;		/* next in hash bucket */
+	struct announce_file	*unused_prev, *unused_next; /* list of unused files, most recent first */
+	char			filename[256];
+	struct file_stamp	stamp;		/* version of file we have loaded */
+	int			users;		/* players of this version */
+	int			stale;		/* file has changed, free when unused */
+	unsigned char		*data;		/* law data, read-only */
+	int			size;		/* samples of data */
+	unsigned int		map_size;
+};
+
+/* called with law data of announcement, data is NULL at the end */
+typedef void (announce_cb)(void *instance, const unsigned char *data, int len);
+
+/* a port playing an announcement */
+struct announce_player {
+	struct announce_player	*prev, *next;	/* list of playing players */
+	struct announce_file	*file;		/* NULL, if not playing */
+	int			pos;		/* samples sent */
+	long long		start;		/* clock sample of first sample */
+	announce_cb		*cb;
+	void			*instance;
+};
+
+int announce_play(struct announce_player *player, const char *filename, int delay, announce_cb *cb, void *instance);
+void announce_stop(struct announce_player *player);
+void announce_exit(void);
+
@@ -214,10 +214,10 @@ fail:
 	/* FIXME: use mISDN bridge for mISDN ports */
 	bridge_id = join_serial++;
 	message = message_create(ea_endpoint->ep_serial, source_port_id, EPOINT_TO_PORT, MESSAGE_BRIDGE);
-	message->param.bridge_id = bridge_id;
+	message->param.bridge.id = bridge_id;
 	message_put(message);
 	message = message_create(ea_endpoint->ep_serial, port->p_serial, EPOINT_TO_PORT, MESSAGE_BRIDGE);
-	message->param.bridge_id = bridge_id;
+	message->param.bridge.id = bridge_id;
 	message_put(message);
 }
 
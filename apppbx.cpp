@@ -67,6 +67,8 @@ EndpointAppPBX::EndpointAppPBX(class Endpoint *epoint, int origin) : EndpointApp
 	e_ext.rights = 4; /* international */
 	e_ext.rx_gain = e_ext.tx_gain = 0;
         e_state = EPOINT_STATE_IDLE;
+	e_ringing = 0;
+	e_ringing_prev = e_ringing_next = NULL;
         e_ext.number[0] = '\0';
 	e_extension_interface[0] = '\0';
         memset(&e_callerinfo, 0, sizeof(struct caller_info));
@@ -83,6 +85,7 @@ EndpointAppPBX::EndpointAppPBX(class Endpoint *epoint, int origin) : EndpointApp
 	e_rule_nesting = 0;
         e_action = NULL;
 	e_match_to_action = NULL;
+	e_execute = NULL;
         e_select = 0;
         e_extdialing = e_dialinginfo.id;
 //        e_knocking = 0;
@@ -110,10 +113,12 @@ EndpointAppPBX::EndpointAppPBX(class Endpoint *epoint, int origin) : EndpointApp
 	e_crypt = CRYPT_OFF;
 	e_crypt_state = CM_ST_NULL;
 	e_crypt_keyengine_busy = 0;
+	e_crypt_keyengine_id = 0;
 	e_crypt_info[0] = '\0';
 #endif
 	e_overlap = 0;
 	e_vbox[0] = '\0';
+	vbox_store_init(&e_vbox_store);
 	e_tx_state = NOTIFY_STATE_ACTIVE;
 	e_rx_state = NOTIFY_STATE_ACTIVE;
 	e_join_cause = e_join_location = 0;
@@ -139,14 +144,17 @@ EndpointAppPBX::~EndpointAppPBX(void)
 	del_timer(&e_crypt_handler);
 #endif
 	del_timer(&e_vbox_refresh);
+	vbox_store_close(&e_vbox_store);
 	del_timer(&e_action_timeout);
 	del_timer(&e_match_timeout);
+	route_execute_flush();
 	del_timer(&e_redial_timeout);
 	del_timer(&e_powerdial_timeout);
 	del_timer(&e_cfnr_timeout);
 	del_timer(&e_cfnr_call_timeout);
 	del_timer(&e_callback_timeout);
 	del_timer(&e_password_timeout);
+	set_ringing(0);
 
 	/* detach */
 	temp =apppbx_first;
@@ -203,6 +211,47 @@ void EndpointAppPBX::new_state(int state)
 	}
 #endif
 	e_state = state;
+
+	/* alerting endpoints and endpoints answered by vbox can be picked up */
+	set_ringing(state == EPOINT_STATE_OUT_ALERTING
+		|| (state == EPOINT_STATE_CONNECT && e_connectinfo.itype == INFO_ITYPE_VBOX));
+}
+
+
+/* list of ringing endpoints
+ *
+ * endpoints that can be picked up are listed in the order they started
+ * ringing, so pick_join() does not search all endpoints.
+ */
+static class EndpointAppPBX *ringing_first = NULL, *ringing_last = NULL;
+
+void EndpointAppPBX::set_ringing(int ringing)
+{
+	if (!e_ringing == !ringing)
+		return;
+
+	if (ringing) {
+		e_ringing = 1;
+		e_ringing_next = NULL;
+		e_ringing_prev = ringing_last;
+		if (ringing_last)
+			ringing_last->e_ringing_next = this;
+		else
+			ringing_first = this;
+		ringing_last = this;
+		return;
+	}
+
+	if (e_ringing_prev)
+		e_ringing_prev->e_ringing_next = e_ringing_next;
+	else
+		ringing_first = e_ringing_next;
+	if (e_ringing_next)
+		e_ringing_next->e_ringing_prev = e_ringing_prev;
+	else
+		ringing_last = e_ringing_prev;
+	e_ringing_prev = e_ringing_next = NULL;
+	e_ringing = 0;
 }
 
 
@@ -1763,7 +1812,7 @@ void EndpointAppPBX::port_proceeding(struct port_list *portlist, int message_typ
 	/* signal to call tool */
 	admin_call_response(e_adminid, ADMIN_CALL_PROCEEDING, "", 0, 0, 0);
 
-	e_state = EPOINT_STATE_OUT_PROCEEDING;
+	new_state(EPOINT_STATE_OUT_PROCEEDING);
 	/* check if pattern is availatle */
 	if (!ea_endpoint->ep_portlist->next && (portlist->early_b || portlist->port_type==PORT_TYPE_VBOX_OUT)) { /* one port_list relation and tones available */
 		/* indicate patterns */
@@ -3348,46 +3397,39 @@ int match_list(char *list, char *item)
 	}
 }
 
+/* find a ringing endpoint to pick up, an endpoint answered by vbox is
+ * preferred, otherwise the endpoint that rings longest.
+ * list entries may be prefixes of extensions, so the list is matched against
+ * all ringing endpoints.
+ */
+static class EndpointAppPBX *find_ringing(class EndpointAppPBX *self, char *extensions)
+{
+	class EndpointAppPBX *eapp, *found = NULL;
+
+	eapp = ringing_first;
+	while(eapp) {
+		if (eapp != self && match_list(extensions, eapp->e_ext.number)) {
+			if (eapp->e_state == EPOINT_STATE_CONNECT)
+				return(eapp); /* vbox */
+			if (!found)
+				found = eapp;
+		}
+		eapp = eapp->e_ringing_next;
+	}
+
+	return(found);
+}
+
 void EndpointAppPBX::pick_join(char *extensions)
 {
 	struct lcr_msg *message;
-	struct port_list *portlist;
-	class Port *port;
 	class EndpointAppPBX *eapp, *found;
 	class Join *join;
 	class JoinPBX *joinpbx;
 	struct join_relation *relation;
-	int vbox;
 
 	/* find an endpoint that is ringing internally or vbox with higher priority */
-	vbox = 0;
-	found = NULL;
-	eapp = apppbx_first;
-	while(eapp) {
-		if (eapp!=this && ea_endpoint->ep_portlist) {
-			portlist = eapp->ea_endpoint->ep_portlist;
-			while(portlist) {
-				if ((port = find_port_id(portlist->port_id))) {
-					if (port->p_type == PORT_TYPE_VBOX_OUT) {
-						if (match_list(extensions, eapp->e_ext.number)) {
-							found = eapp;
-							vbox = 1;
-							break;
-						}
-					}
-					if ((portlist->port_type & PORT_CLASS_DIR_MASK) == PORT_CLASS_DIR_OUT
-					 && port->p_state==PORT_STATE_OUT_ALERTING)
-						if (match_list(extensions, eapp->e_ext.number)) {
-							found = eapp;
-						}
-				}
-				portlist = portlist->next;
-			}
-			if (portlist)
-				break;
-		}
-		eapp = eapp->next;
-	}
+	found = find_ringing(this, extensions);
 
 	/* if no endpoint found */
 	if (!found) {
@@ -3541,7 +3583,7 @@ void EndpointAppPBX::join_join(void)
 	class Join *our_join, *other_join;
 	class JoinPBX *our_joinpbx, *other_joinpbx;
 	class EndpointAppPBX *other_eapp; class Endpoint *temp_epoint;
-	class Port *our_port, *other_port;
+	class Port *our_port;
 	class Pdss1 *our_pdss1, *other_pdss1;
 
 	/* are we a candidate to join a join? */
@@ -3575,34 +3617,26 @@ void EndpointAppPBX::join_join(void)
 	our_pdss1 = (class Pdss1 *)our_port;
 
 	/* find an endpoint that is on hold and has the same mISDNport that we are on */
-	other_eapp = apppbx_first;
-	while(other_eapp) {
-		if (other_eapp == this) {
-			other_eapp = other_eapp->next;
-			continue;
-		}
-		PDEBUG(DEBUG_EPOINT, "EPOINT(%d) comparing other endpoint candiate: (ep%d) terminal='%s' port=%s join=%d.\n", ea_endpoint->ep_serial, other_eapp->ea_endpoint->ep_serial, other_eapp->e_ext.number, (other_eapp->ea_endpoint->ep_portlist)?"YES":"NO", other_eapp->ea_endpoint->ep_join_id);
-		if (other_eapp->e_ext.number[0] /* has terminal */
-		 && other_eapp->ea_endpoint->ep_portlist /* has port */
-		 && other_eapp->ea_endpoint->ep_join_id) { /* has join */
-			other_port = find_port_id(other_eapp->ea_endpoint->ep_portlist->port_id);
-			if (other_port) { /* port still exists */
-				if (other_port->p_type==PORT_TYPE_DSS1_NT_OUT
-				 || other_port->p_type==PORT_TYPE_DSS1_NT_IN) { /* port is isdn nt-mode */
-					other_pdss1 = (class Pdss1 *)other_port;
-					PDEBUG(DEBUG_EPOINT, "EPOINT(%d) comparing other endpoint's port is of type isdn! comparing our portnum=%d with other's portnum=%d hold=%s ces=%d\n", ea_endpoint->ep_serial, our_pdss1->p_m_mISDNport->portnum, other_pdss1->p_m_mISDNport->portnum, (other_pdss1->p_m_hold)?"YES":"NO", other_pdss1->p_m_d_ces);
-					if (other_pdss1->p_m_hold /* port is on hold */
-					 && other_pdss1->p_m_mISDNport == our_pdss1->p_m_mISDNport /* same isdn interface */
-					 && other_pdss1->p_m_d_ces == our_pdss1->p_m_d_ces) /* same tei+sapi */
-						break;
-				} else {
-					PDEBUG(DEBUG_EPOINT, "EPOINT(%d) comparing other endpoint's port is of other type!\n", ea_endpoint->ep_serial);
-				}
-			} else {
-				PDEBUG(DEBUG_EPOINT, "EPOINT(%d) comparing other endpoint's port doesn't exist enymore.\n", ea_endpoint->ep_serial);
-			}
+	other_eapp = NULL;
+	other_pdss1 = our_pdss1->p_m_mISDNport->hold_first;
+	while(other_pdss1) {
+		if (other_pdss1 != our_pdss1
+		 && other_pdss1->p_m_d_ces == our_pdss1->p_m_d_ces /* same tei+sapi */
+		 && (other_pdss1->p_type==PORT_TYPE_DSS1_NT_OUT
+		  || other_pdss1->p_type==PORT_TYPE_DSS1_NT_IN) /* port is isdn nt-mode */
+		 && (temp_epoint = find_epoint_id(ACTIVE_EPOINT(other_pdss1->p_epointlist)))
+		 && temp_epoint->ep_app_type == EAPP_TYPE_PBX) {
+			other_eapp = (class EndpointAppPBX *)temp_epoint->ep_app;
+			PDEBUG(DEBUG_EPOINT, "EPOINT(%d) comparing other endpoint candiate: (ep%d) terminal='%s' port=%s join=%d.\n", ea_endpoint->ep_serial, other_eapp->ea_endpoint->ep_serial, other_eapp->e_ext.number, (other_eapp->ea_endpoint->ep_portlist)?"YES":"NO", other_eapp->ea_endpoint->ep_join_id);
+			if (other_eapp != this
+			 && other_eapp->e_ext.number[0] /* has terminal */
+			 && other_eapp->ea_endpoint->ep_portlist /* has port */
+			 && other_eapp->ea_endpoint->ep_portlist->port_id == other_pdss1->p_serial /* it is the port on hold */
+			 && other_eapp->ea_endpoint->ep_join_id) /* has join */
+				break;
+			other_eapp = NULL;
 		}
-		other_eapp = other_eapp->next;
+		other_pdss1 = other_pdss1->p_m_d_hold_next;
 	}
 	if (!other_eapp) {
 		PDEBUG(DEBUG_EPOINT, "EPOINT(%d) cannot join: no other endpoint on same isdn terminal.\n", ea_endpoint->ep_serial);
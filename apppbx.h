@@ -68,7 +68,9 @@ class EndpointAppPBX : public EndpointApp
 	unsigned int		e_adminid;
 
 	/* states */
-	int			e_state;		/* state of endpoint */
+	int			e_state;		/* state of endpoint, use new_state() to change */
+	int			e_ringing;		/* set, if listed as ringing endpoint */
+	class EndpointAppPBX	*e_ringing_prev, *e_ringing_next; /* ringing endpoints, oldest first */
 	char			e_extension_interface[32];/* current internal isdn interface (usefull for callback to internal phone) */
 	struct caller_info	e_callerinfo;		/* information about the caller */
 	struct dialing_info	e_dialinginfo;		/* information about dialing */
@@ -84,6 +86,7 @@ class EndpointAppPBX : public EndpointApp
 	int			e_rule_nesting;		/* 'goto'/'menu' recrusion counter to prevent infinie loops */
 	struct route_action	*e_match_to_action;	/* what todo when timeout */
 	char			*e_match_to_extdialing;	/* dialing after matching timeout rule */
+	struct route_execute	*e_execute;		/* commands of 'execute' conditions while routing */
 	int			e_select;		/* current selection for various selector options */
 	char			*e_extdialing;		/* dialing after matching rule */
 	int		e_overlap;		/* is set if additional information is/are received after setup */
@@ -147,6 +150,7 @@ class EndpointAppPBX : public EndpointApp
 	int e_vbox_counter_last;		/* temp variable to recognise a change in seconds */
 	int e_vbox_play;			/* current file that is played */
 	int e_vbox_speed;			/* current speed to play */
+	struct vbox_store e_vbox_store;		/* messages of e_vbox */
 	int e_vbox_index_num;			/* number of files */
 	char e_vbox_index_file[128];		/* current file name */
 	int e_vbox_index_hour;			/* current time the file recorded... */
@@ -166,33 +170,17 @@ class EndpointAppPBX : public EndpointApp
 	int e_crypt;				/* current user level crypt state */
 	int e_crypt_state;			/* current crypt manager state */
 	char e_crypt_info[33];			/* last information text */
-	int e_crypt_timeout_sec;		/* timer */
-	int e_crypt_timeout_usec;		/* timer */
 	unsigned int e_crypt_random;		/* current random number for ident */
 	unsigned int e_crypt_bogomips;		/* bogomips for ident */
 	unsigned char e_crypt_key[256];		/* the session key */
 	int e_crypt_key_len;
 	unsigned char e_crypt_ckey[256];	/* the encrypted session key */
 	int e_crypt_ckey_len;
-	unsigned char e_crypt_rsa_n[512];	/* rsa key */
-	unsigned char e_crypt_rsa_e[16];
-	unsigned char e_crypt_rsa_d[512];
-	unsigned char e_crypt_rsa_p[512];
-	unsigned char e_crypt_rsa_q[512];
-	unsigned char e_crypt_rsa_dmp1[512];
-	unsigned char e_crypt_rsa_dmq1[512];
-	unsigned char e_crypt_rsa_iqmp[512];
-	int e_crypt_rsa_n_len;
-	int e_crypt_rsa_e_len;
-	int e_crypt_rsa_d_len;
-	int e_crypt_rsa_p_len;
-	int e_crypt_rsa_q_len;
-	int e_crypt_rsa_dmp1_len;
-	int e_crypt_rsa_dmq1_len;
-	int e_crypt_rsa_iqmp_len;
+	struct rsa_key e_crypt_rsa;		/* rsa key */
 	int e_crypt_keyengine_busy;		/* current job and busy state */
+	unsigned int e_crypt_keyengine_id;	/* number of current job */
 	int e_crypt_keyengine_return;		/* return */
-	struct lcr_timer e_crypt_handler; /* poll timer for crypt events */
+	struct lcr_timer e_crypt_handler; /* timeout of crypt manager */
 #endif
 
 	/* messages */
@@ -231,6 +219,7 @@ class EndpointAppPBX : public EndpointApp
 
 	/* epoint */
 	void new_state(int state);
+	void set_ringing(int ringing);
 	void release(int release, int joinlocation, int joincause, int portlocation, int portcause, int force);
 	void notify_active(void);
 	void keypad_function(char digit);
@@ -255,6 +244,8 @@ class EndpointAppPBX : public EndpointApp
 	/* routing */
 	struct route_ruleset *rulesetbyname(char *name);
 	struct route_action *route(struct route_ruleset *ruleset);
+	int route_execute(struct route_cond *cond);
+	void route_execute_flush(void);
 	struct route_param *routeparam(struct route_action *action, unsigned long long id);
 
 	/* init / dialing / hangup */
@@ -23,6 +23,10 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <mISDN/mISDNif.h>
 
 #include <mISDN/mISDNcompat.h>
@@ -284,6 +288,88 @@ void bchannel_destroy(struct bchannel *bchannel)
 }
 
 
+/*
+ * reverse the bits of each byte while copying
+ *
+ * neighbour bits, bit pairs and nibbles are swapped for 16 bytes (SSE2) or
+ * 8 bytes at once. the masks keep bits from moving into the next byte.
+ */
+void flip_copy(unsigned char *dst, const unsigned char *src, int len)
+{
+	uint64_t w;
+#ifdef __SSE2__
+	const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0f);
+	__m128i x;
+
+	while (len >= 16) {
+		x = _mm_loadu_si128((const __m128i *)src);
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 1), m1), _mm_slli_epi16(_mm_and_si128(x, m1), 1));
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 2), m2), _mm_slli_epi16(_mm_and_si128(x, m2), 2));
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 4), m4), _mm_slli_epi16(_mm_and_si128(x, m4), 4));
+		_mm_storeu_si128((__m128i *)dst, x);
+		src += 16;
+		dst += 16;
+		len -= 16;
+	}
+#endif
+	while (len >= 8) {
+		memcpy(&w, src, 8);
+		w = ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+		w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+		w = ((w >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((w & 0x0f0f0f0f0f0f0f0fULL) << 4);
+		memcpy(dst, &w, 8);
+		src += 8;
+		dst += 8;
+		len -= 8;
+	}
+	while (len-- > 0)
+		*dst++ = flip_bits[*src++];
+}
+
+/*
+ * put received audio into the ring of the call
+ *
+ * this is the only writer of rx_in. lcr_read() is the only writer of rx_out
+ * and is not locked, so the data must be complete before rx_in is changed.
+ * if rx_armed is not set after rx_in is changed, lcr_read() may have missed
+ * the new data, so rx_fd must be signalled.
+ */
+static void bchannel_rx_ring(struct chan_call *call, unsigned char *data, int len, int flip)
+{
+	unsigned int in = call->rx_in, pos, n;
+	uint64_t one = 1;
+
+	if (len > (int)(AUDIO_RING - (in - call->rx_out))) {
+		/* asterisk does not read, drop */
+		return;
+	}
+	while (len) {
+		pos = in & (AUDIO_RING - 1);
+		n = AUDIO_RING - pos;
+		if (n > (unsigned int)len)
+			n = len;
+		if (flip)
+			flip_copy(call->rx_ring + pos, data, n);
+		else
+			memcpy(call->rx_ring + pos, data, n);
+		/* repeat the start of the ring behind its end */
+		if (pos < AUDIO_FRAME)
+			memcpy(call->rx_ring + AUDIO_RING + pos, call->rx_ring + pos, (n < AUDIO_FRAME - pos) ? n : AUDIO_FRAME - pos);
+		in += n;
+		data += n;
+		len -= n;
+	}
+	__sync_synchronize();
+	call->rx_in = in;
+	__sync_synchronize();
+	if (!call->rx_armed) {
+		call->rx_armed = 1;
+		if (write(call->rx_fd, &one, sizeof(one)) < 0)
+			CDEBUG(call, NULL, "Failed to signal audio (errno=%d).\n", errno);
+	}
+}
+
+
 /*
  * whenever we get audio data from bchannel, we process it here
  */
@@ -292,8 +378,6 @@ static void bchannel_receive(struct bchannel *bchannel, unsigned char *buffer, i
 	struct mISDNhead *hh = (struct mISDNhead *)buffer;
 	unsigned char *data = buffer + MISDN_HEADER_LEN;
 	unsigned int cont = *((unsigned int *)data);
-	unsigned char *d;
-	int i;
 	struct bchannel *remote_bchannel;
 	int ret;
 
@@ -377,30 +461,13 @@ static void bchannel_receive(struct bchannel *bchannel, unsigned char *buffer, i
 		return;
 	}
 
-	if (bchannel->call->pipe[1] < 0) {
+	if (bchannel->call->rx_fd < 0) {
 		/* nobody there */
 		return;
 	}
 
-	/* if no hdlc */
-	if (bchannel->b_mode == 0 || bchannel->b_mode == 1) {
-		d = data;
-		for (i = 0; i < len; i++) {
-			*d = flip_bits[*d];
-			d++;
-		}
-	}
-
-	
-	len = write(bchannel->call->pipe[1], data, len);
-	if (len < 0)
-		goto errout;
-
-	return;
- errout:
-	close(bchannel->call->pipe[1]);
-	bchannel->call->pipe[1] = -1;
-	CDEBUG(bchannel->call, NULL, "broken pipe on bchannel pipe\n");
+	/* if no hdlc, bits are flipped while writing into the ring */
+	bchannel_rx_ring(bchannel->call, data, len, (bchannel->b_mode == 0 || bchannel->b_mode == 1));
 }
 
 
@@ -412,7 +479,6 @@ void bchannel_transmit(struct bchannel *bchannel, unsigned char *data, int len)
 	unsigned char buff[1024 + MISDN_HEADER_LEN], *p = buff + MISDN_HEADER_LEN;
 	struct mISDNhead *frm = (struct mISDNhead *)buff;
 	int ret;
-	int i;
 	int space, in;
 
 	if (bchannel->b_state != BSTATE_ACTIVE)
@@ -422,13 +488,11 @@ void bchannel_transmit(struct bchannel *bchannel, unsigned char *data, int len)
 	if (data) {
 		switch(bchannel->b_mode) {
 		case 0:
-			for (i = 0; i < len; i++)
-				*p++ = flip_bits[*data++];
+			flip_copy(p, data, len);
 			frm->prim = DL_DATA_REQ;
 			break;
 		case 1:
-			for (i = 0; i < len; i++)
-				*p++ = flip_bits[*data++];
+			flip_copy(p, data, len);
 			frm->prim = PH_DATA_REQ;
 			break;
 		case 2:
@@ -445,6 +509,7 @@ void bchannel_transmit(struct bchannel *bchannel, unsigned char *data, int len)
 	frm->id = 0;
 #ifdef SEAMLESS_TEST
 	unsigned char test_tone[8] = {0x2a, 0x24, 0xb4, 0x24, 0x2a, 0x25, 0xb5, 0x25};
+	int i;
 	p = buff + MISDN_HEADER_LEN;
 	for (i = 0; i < len; i++)
 		*p++ = test_tone[(bchannel->test + i) & 7];
@@ -458,7 +523,7 @@ void bchannel_transmit(struct bchannel *bchannel, unsigned char *data, int len)
 		}
 		p = buff + MISDN_HEADER_LEN;
 		in = bchannel->nodsp_queue_in;
-		for (i = 0; i < len; i++) {
+		while (p < buff + MISDN_HEADER_LEN + len) {
 			bchannel->nodsp_queue_buffer[in] = *p++;
 			in = (in + 1) & (QUEUE_BUFFER_SIZE - 1);
 		}
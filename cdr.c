@@ -0,0 +1,312 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** call detail record writer                                                 **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO write call details?
+
+When a call ends, write_log() only puts the record into a queue, so the
+main loop does not open files during hangup bursts. A writer thread takes
+all queued records every CDR_INTERVAL, or earlier, when the queue is half
+full. The lines for the same extension are appended to its log with a
+single write.
+
+If 'cdr' is given in options.conf, all records are also appended to this
+file as comma separated values. If the file exceeds 'cdr-size', it is
+renamed with the current time appended and a new file is started.
+
+If the queue is full, write_log() waits for the writer, so no record is
+lost. This is counted in cdr_waits. The depth of the queue and the time
+until records are written are shown by lcradmin.
+
+*/
+
+#include "main.h"
+
+volatile unsigned int cdr_depth = 0;
+volatile unsigned int cdr_depth_max = 0;
+volatile unsigned int cdr_latency = 0;
+volatile unsigned int cdr_latency_max = 0;
+volatile unsigned int cdr_waits = 0;
+
+static struct cdr_record cdr_queue[CDR_QUEUE];
+static unsigned int cdr_in = 0, cdr_out = 0; /* changed with lock only */
+static pthread_mutex_t cdr_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cdr_cond = PTHREAD_COND_INITIALIZER; /* wake writer */
+static pthread_cond_t cdr_space = PTHREAD_COND_INITIALIZER; /* writer has taken records */
+static pthread_t cdr_tid;
+static int cdr_running = 0;
+static int cdr_quit = 0;
+
+/* used by writer only */
+static struct cdr_record cdr_batch[CDR_BATCH];
+static char cdr_buffer[CDR_BATCH * 1024];
+static int cdr_done[CDR_BATCH];
+static int cdr_fd = -1;
+
+/* line of extension's log */
+static int cdr_log_line(char *buffer, int size, struct cdr_record *rec)
+{
+	const char *mon[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+	struct tm tm;
+	int len;
+
+	localtime_r(&rec->start, &tm);
+	len = snprintf(buffer, size, "%s %2d %04d %02d:%02d:%02d %s", mon[tm.tm_mon], tm.tm_mday, tm.tm_year+1900, tm.tm_hour, tm.tm_min, tm.tm_sec, rec->number);
+	if (rec->stop)
+		len += snprintf(buffer + len, size - len, " %2ld:%02d:%02d", (rec->stop-rec->start)/3600, (((unsigned int)(rec->stop-rec->start))/60)%60, ((unsigned int)(rec->stop-rec->start))%60);
+	else
+		len += snprintf(buffer + len, size - len, " --:--:--");
+	len += snprintf(buffer + len, size - len, " %s -> %s", rec->callerid, rec->calledid);
+	if (rec->cause >= 1 && rec->cause <=127 && rec->location>=0 && rec->location<=15)
+		len += snprintf(buffer + len, size - len, " (cause=%d '%s' location=%d '%s')", rec->cause, isdn_cause[rec->cause].german, rec->location, isdn_location[rec->location].german);
+	len += snprintf(buffer + len, size - len, "\n");
+
+	return (len < size) ? len : size - 1;
+}
+
+/* quoted field of csv line */
+static int cdr_csv_field(char *buffer, int size, const char *text)
+{
+	int len = 0;
+
+	if (size < 4)
+		return 0;
+	buffer[len++] = '"';
+	while (*text && len < size - 3) {
+		if (*text == '"')
+			buffer[len++] = '"';
+		buffer[len++] = *text++;
+	}
+	buffer[len++] = '"';
+	buffer[len] = '\0';
+
+	return len;
+}
+
+/* line of cdr file: start, duration, extension, caller, called, cause, location */
+static int cdr_csv_line(char *buffer, int size, struct cdr_record *rec)
+{
+	struct tm tm;
+	int len;
+
+	localtime_r(&rec->start, &tm);
+	len = snprintf(buffer, size, "%04d-%02d-%02d %02d:%02d:%02d,", tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+	if (rec->stop)
+		len += snprintf(buffer + len, size - len, "%ld", (long)(rec->stop - rec->start));
+	len += snprintf(buffer + len, size - len, ",");
+	len += cdr_csv_field(buffer + len, size - len, rec->number);
+	len += snprintf(buffer + len, size - len, ",");
+	len += cdr_csv_field(buffer + len, size - len, rec->callerid);
+	len += snprintf(buffer + len, size - len, ",");
+	len += cdr_csv_field(buffer + len, size - len, rec->calledid);
+	len += snprintf(buffer + len, size - len, ",%d,%d\n", rec->cause, rec->location);
+
+	return (len < size) ? len : size - 1;
+}
+
+static void cdr_write_all(int fd, const char *buffer, int len, const char *filename)
+{
+	int ret;
+
+	while (len > 0) {
+		ret = write(fd, buffer, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			PERROR("Cannot write \"%s\" (errno=%d)\n", filename, errno);
+			return;
+		}
+		buffer += ret;
+		len -= ret;
+	}
+}
+
+/* open cdr file, rename it first, if it is too large */
+static int cdr_open(int len)
+{
+	struct stat st;
+
+	if (cdr_fd >= 0 && options.cdr_size > 0 && !fstat(cdr_fd, &st) && st.st_size > 0
+	 && st.st_size + len > (off_t)options.cdr_size * 1024) {
+		close(cdr_fd);
+		cdr_fd = -1;
+		rotate_file(options.cdr);
+	}
+	if (cdr_fd < 0) {
+		cdr_fd = open(options.cdr, O_WRONLY | O_APPEND | O_CREAT, 0666);
+		if (cdr_fd < 0) {
+			PERROR("Cannot open cdr file: \"%s\" (errno=%d)\n", options.cdr, errno);
+			return -1;
+		}
+		if (!fstat(cdr_fd, &st) && st.st_size == 0) {
+			static const char header[] = "start,duration,extension,caller,called,cause,location\n";
+			cdr_write_all(cdr_fd, header, sizeof(header) - 1, options.cdr);
+		}
+	}
+
+	return 0;
+}
+
+/* write records, lines of the same extension are written at once */
+static void cdr_write(struct cdr_record *batch, int count)
+{
+	char filename[256];
+	struct timespec now;
+	unsigned int latency;
+	int i, j, fd, len;
+
+	memset(cdr_done, 0, count * sizeof(int));
+	for (i = 0; i < count; i++) {
+		if (cdr_done[i])
+			continue;
+		len = 0;
+		for (j = i; j < count; j++) {
+			if (cdr_done[j] || strcmp(batch[j].number, batch[i].number))
+				continue;
+			len += cdr_log_line(cdr_buffer + len, sizeof(cdr_buffer) - len, &batch[j]);
+			cdr_done[j] = 1;
+		}
+		SPRINT(filename, "%s/%s/log", EXTENSION_DATA, batch[i].number);
+		if ((fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666)) < 0) {
+			PERROR("Cannot open log: \"%s\"\n", filename);
+			continue;
+		}
+		cdr_write_all(fd, cdr_buffer, len, filename);
+		close(fd);
+	}
+
+	if (options.cdr[0]) {
+		len = 0;
+		for (i = 0; i < count; i++)
+			len += cdr_csv_line(cdr_buffer + len, sizeof(cdr_buffer) - len, &batch[i]);
+		if (!cdr_open(len))
+			cdr_write_all(cdr_fd, cdr_buffer, len, options.cdr);
+	}
+
+	/* the first record waited longest */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	latency = (now.tv_sec - batch[0].queued.tv_sec) * 1000 + (now.tv_nsec - batch[0].queued.tv_nsec) / 1000000;
+	cdr_latency = latency;
+	if (latency > cdr_latency_max)
+		cdr_latency_max = latency;
+}
+
+static void *cdr_child(void *arg)
+{
+	struct timespec timeout;
+	int count;
+
+	pthread_mutex_lock(&cdr_mutex);
+	while (1) {
+		count = 0;
+		while (cdr_out != cdr_in && count < CDR_BATCH)
+			memcpy(&cdr_batch[count++], &cdr_queue[cdr_out++ & CDR_MASK], sizeof(struct cdr_record));
+		if (count) {
+			pthread_cond_broadcast(&cdr_space);
+			pthread_mutex_unlock(&cdr_mutex);
+			cdr_write(cdr_batch, count);
+			pthread_mutex_lock(&cdr_mutex);
+			cdr_depth = cdr_in - cdr_out;
+			continue;
+		}
+		if (cdr_quit)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += CDR_INTERVAL * 1000000;
+		if (timeout.tv_nsec >= 1000000000) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&cdr_cond, &cdr_mutex, &timeout);
+	}
+	pthread_mutex_unlock(&cdr_mutex);
+
+	if (cdr_fd >= 0) {
+		close(cdr_fd);
+		cdr_fd = -1;
+	}
+
+	return NULL;
+}
+
+/* write log for extension
+ *
+ * the record is queued and written by the writer thread
+ */
+int write_log(char *number, char *callerid, char *calledid, time_t start, time_t stop, int aoce, int cause, int location)
+{
+	struct cdr_record *rec, single;
+	unsigned int depth;
+
+	if (callerid[0] == '\0')
+		callerid = (char *)"<unknown>";
+
+	if (!cdr_running) {
+		if (pthread_create(&cdr_tid, NULL, cdr_child, NULL)) {
+			PERROR("failed to create cdr writer thread, writing now.\n");
+			memset(&single, 0, sizeof(single));
+			SCPY(single.number, number);
+			SCPY(single.callerid, callerid);
+			SCPY(single.calledid, calledid);
+			single.start = start;
+			single.stop = stop;
+			single.cause = cause;
+			single.location = location;
+			clock_gettime(CLOCK_MONOTONIC, &single.queued);
+			cdr_write(&single, 1);
+			return(1);
+		}
+		cdr_running = 1;
+	}
+
+	pthread_mutex_lock(&cdr_mutex);
+	while (cdr_in - cdr_out >= CDR_QUEUE) {
+		cdr_waits++;
+		pthread_cond_signal(&cdr_cond);
+		pthread_cond_wait(&cdr_space, &cdr_mutex);
+	}
+	rec = &cdr_queue[cdr_in & CDR_MASK];
+	SCPY(rec->number, number);
+	SCPY(rec->callerid, callerid);
+	SCPY(rec->calledid, calledid);
+	rec->start = start;
+	rec->stop = stop;
+	rec->cause = cause;
+	rec->location = location;
+	clock_gettime(CLOCK_MONOTONIC, &rec->queued);
+	cdr_in++;
+	depth = cdr_in - cdr_out;
+	cdr_depth = depth;
+	if (depth > cdr_depth_max)
+		cdr_depth_max = depth;
+	/* don't wait for the interval, if the queue fills */
+	if (depth >= CDR_QUEUE / 2)
+		pthread_cond_signal(&cdr_cond);
+	pthread_mutex_unlock(&cdr_mutex);
+
+	return(1);
+}
+
+/* write all queued records and stop writer */
+void cdr_exit(void)
+{
+	if (!cdr_running)
+		return;
+
+	pthread_mutex_lock(&cdr_mutex);
+	cdr_quit = 1;
+	pthread_cond_signal(&cdr_cond);
+	pthread_mutex_unlock(&cdr_mutex);
+	pthread_join(cdr_tid, NULL);
+	cdr_running = 0;
+	cdr_quit = 0;
+}
+
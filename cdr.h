@@ -0,0 +1,35 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** call detail record writer header file                                     **
+**                                                                           **
+\*****************************************************************************/
+
+#define CDR_QUEUE	4096	/* records that can be queued, must be a binary border */
+#define CDR_MASK	(CDR_QUEUE - 1)
+#define CDR_BATCH	256	/* records written at once */
+#define CDR_INTERVAL	250	/* ms between writes */
+
+/* a call, as it is written to the log of the extension and to the cdr file */
+struct cdr_record {
+	char		number[32];	/* extension */
+	char		callerid[128];
+	char		calledid[256];
+	time_t		start, stop;
+	int		cause, location;
+	struct timespec	queued;		/* when the record was queued (monotonic) */
+};
+
+extern volatile unsigned int cdr_depth;		/* records queued */
+extern volatile unsigned int cdr_depth_max;	/* most records queued */
+extern volatile unsigned int cdr_latency;	/* ms from queueing until written (last write) */
+extern volatile unsigned int cdr_latency_max;	/* longest time until written */
+extern volatile unsigned int cdr_waits;		/* queue was full, so we had to wait */
+
+int write_log(char *number, char *callerid, char *calledid, time_t start, time_t stop, int aoce, int cause, int location);
+void cdr_exit(void);
+
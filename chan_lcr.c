@@ -16,6 +16,12 @@ Registering to LCR:
 To connect, open an LCR socket and send a MESSAGE_HELLO to socket with
 the application name. This name is unique an can be used for routing calls.
 Now the channel driver is linked to LCR and can receive and make calls.
+The hello message requests the compact protocol. Nothing else is sent
+until LCR confirms it with a hello message, then frames are used in both
+directions (see lcrsocket.h). An older LCR does not reply, so after
+SOCKET_HELLO_TIMER, the socket is opened again and the hello message does
+not request the compact protocol. Then admin messages are used as before.
+The connection is not kept, because a late reply would turn it to frames.
 
 
 Call is initiated by LCR:
@@ -103,6 +109,19 @@ if the lock is incremented and decremented there.
 Exception: Calling ast_queue_frame inside ast->tech->read is safe, because
 it is called from ast_channel process which has already locked ast_channel.
 
+
+Audio:
+
+Audio does not take chan_lock. Each call has a ring for received audio and
+a ring for audio to be transmitted, each with one writer and one reader.
+The bchannel writes received audio into rx_ring, flipping the bits on the
+way, and signals rx_fd, which is the fd of the asterisk channel. lcr_read()
+gives asterisk a frame that points into the ring. It is released at the
+next read. lcr_write() puts the frame into tx_ring and signals tx_fd, which
+chan_thread() waits for, to transmit it to the bchannel.
+The call instance is not freed while asterisk has its channel, so the tech
+functions may access the rings without chan_lock.
+
 */
 
 
@@ -116,6 +135,7 @@ it is called from ast_channel process which has already locked ast_channel.
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <stdint.h>
 #include <time.h>
 //#include <signal.h>
 #include <unistd.h>
@@ -123,6 +143,8 @@ it is called from ast_channel process which has already locked ast_channel.
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 
 #include <semaphore.h>
 
@@ -222,11 +244,21 @@ int glob_channel = 0;
 int lcr_sock = -1;
 struct lcr_fd socket_fd;
 struct lcr_timer socket_retry;
-
+struct lcr_timer socket_hello;
+struct lcr_timer queue_retry;
+int lcr_compact = 0; /* LCR confirmed compact protocol */
+int lcr_hello_wait = 0; /* hello is sent, wait for confirmation */
+int lcr_fixed = 0; /* LCR did not confirm, don't request compact protocol on next connection */
+static unsigned char lcr_in[ADMIN_BUFFER]; /* received frames */
+static unsigned int lcr_in_len = 0;
+
+/* queue of messages to LCR, stored as frames */
 struct admin_list {
 	struct admin_list *next;
-	struct admin_message msg;
-} *admin_first = NULL;
+	unsigned int len; /* length of frame */
+	unsigned char frame[0];
+} *admin_first = NULL, **admin_last = &admin_first;
+static unsigned int admin_first_off = 0; /* bytes of first frame that are written */
 
 static struct ast_channel_tech lcr_tech;
 
@@ -267,6 +299,8 @@ void chan_lcr_log(int type, const char *file, int line, const char *function, st
  * channel and call instances
  */
 struct chan_call *call_first;
+static struct chan_call *call_hash[CALL_HASH]; /* calls with ref */
+static struct chan_call *call_dirty = NULL, **call_dirty_last = &call_dirty; /* calls with queued events */
 
 /*
  * find call by ref
@@ -275,17 +309,54 @@ struct chan_call *call_first;
 
 struct chan_call *find_call_ref(unsigned int ref)
 {
-	struct chan_call *call = call_first;
-	int assigned = (ref > 0);
+	struct chan_call *call;
+
+	/* calls that wait for a ref are not hashed, there are only few */
+	if (!ref) {
+		call = call_first;
+		while(call) {
+			if (!call->ref && !call->ref_was_assigned)
+				break;
+			call = call->next;
+		}
+		return call;
+	}
 
+	call = call_hash[ref & (CALL_HASH - 1)];
 	while(call) {
-		if (call->ref == ref && call->ref_was_assigned == assigned)
+		if (call->ref == ref && call->ref_was_assigned)
 			break;
-		call = call->next;
+		call = call->hash_next;
 	}
 	return call;
 }
 
+/*
+ * change ref of call and rehash it
+ */
+void set_call_ref(struct chan_call *call, unsigned int ref)
+{
+	struct chan_call **callp;
+
+	if (call->ref) {
+		callp = &call_hash[call->ref & (CALL_HASH - 1)];
+		while(*callp) {
+			if (*callp == call) {
+				*callp = call->hash_next;
+				break;
+			}
+			callp = &((*callp)->hash_next);
+		}
+		call->hash_next = NULL;
+	}
+	call->ref = ref;
+	if (ref) {
+		callp = &call_hash[ref & (CALL_HASH - 1)];
+		call->hash_next = *callp;
+		*callp = call;
+	}
+}
+
 void free_call(struct chan_call *call)
 {
 	struct chan_call **temp = &call_first;
@@ -293,10 +364,22 @@ void free_call(struct chan_call *call)
 	while(*temp) {
 		if (*temp == call) {
 			*temp = (*temp)->next;
-			if (call->pipe[0] > -1)
-				close(call->pipe[0]);
-			if (call->pipe[1] > -1)
-				close(call->pipe[1]);
+			set_call_ref(call, 0);
+			if (call->dirty) {
+				/* remove from list of queued events */
+				temp = &call_dirty;
+				while(*temp != call)
+					temp = &((*temp)->dirty_next);
+				*temp = call->dirty_next;
+				if (call_dirty_last == &call->dirty_next)
+					call_dirty_last = temp;
+			}
+			if (call->rx_fd > -1)
+				close(call->rx_fd);
+			if (call->tx_fd.inuse)
+				unregister_fd(&call->tx_fd);
+			if (call->tx_fd.fd > -1)
+				close(call->tx_fd.fd);
 			if (call->bchannel) {
 				if (call->bchannel->call != call)
 					CERROR(call, NULL, "Linked bchannel structure has no link to us.\n");
@@ -321,6 +404,30 @@ void free_call(struct chan_call *call)
 	CERROR(call, NULL, "Call instance not found in list.\n");
 }
 
+/* transmit audio that lcr_write() has put into the ring */
+static int handle_tx(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	struct chan_call *call = (struct chan_call *)instance;
+	struct audio_slot *slot;
+	uint64_t count;
+
+	call->tx_armed = 0;
+	__sync_synchronize();
+	if (read(fd->fd, &count, sizeof(count)) < 0) {
+		/* may happen, if the ring was emptied without event */
+	}
+	while (call->tx_out != call->tx_in) {
+		__sync_synchronize();
+		slot = &call->tx_ring[call->tx_out & (AUDIO_TX_SLOTS - 1)];
+		if (call->bchannel)
+			bchannel_transmit(call->bchannel, slot->data, slot->len);
+		__sync_synchronize();
+		call->tx_out++;
+	}
+
+	return 0;
+}
+
 struct chan_call *alloc_call(void)
 {
 	struct chan_call **callp = &call_first;
@@ -331,12 +438,14 @@ struct chan_call *alloc_call(void)
 	*callp = (struct chan_call *)calloc(1, sizeof(struct chan_call));
 	if (*callp)
 		memset(*callp, 0, sizeof(struct chan_call));
-	if (pipe((*callp)->pipe) < 0) {
-		CERROR(*callp, NULL, "Failed to create pipe.\n");
+	(*callp)->rx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	(*callp)->tx_fd.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((*callp)->rx_fd < 0 || (*callp)->tx_fd.fd < 0) {
+		CERROR(*callp, NULL, "Failed to create eventfd.\n");
 		free_call(*callp);
 		return NULL;
 	}
-	fcntl((*callp)->pipe[0], F_SETFL, O_NONBLOCK);
+	register_fd(&(*callp)->tx_fd, LCR_FD_READ, handle_tx, *callp, 0);
 	CDEBUG(*callp, NULL, "Call instance allocated.\n");
 	return *callp;
 }
@@ -362,12 +471,42 @@ unsigned short new_bridge_id(void)
 	return id;
 }
 
+/*
+ * add call to list of calls with queued events for asterisk
+ */
+static void dirty_call(struct chan_call *call)
+{
+	if (call->dirty)
+		return;
+	call->dirty = 1;
+	call->dirty_next = NULL;
+	*call_dirty_last = call;
+	call_dirty_last = &call->dirty_next;
+}
+
+/*
+ * wake chan_thread, if given, the call has queued events for asterisk
+ */
+void wake_call(struct chan_call *call)
+{
+	if (call)
+		dirty_call(call);
+	if (!wake_global) {
+		wake_global = 1;
+		char byte = 0;
+		write(wake_pipe[1], &byte, 1);
+	}
+}
+
 /*
  * enque message to LCR
+ * the message is stored as frame, so only the used part of the parameter
+ * is allocated
  */
 int send_message(int message_type, unsigned int ref, union parameter *param)
 {
-	struct admin_list *admin, **adminp;
+	struct admin_list *admin;
+	unsigned int len;
 
 	if (lcr_sock < 0) {
 		CDEBUG(NULL, NULL, "Ignoring message %d, because socket is closed.\n", message_type);
@@ -375,26 +514,19 @@ int send_message(int message_type, unsigned int ref, union parameter *param)
 	}
 	CDEBUG(NULL, NULL, "Sending %s to socket. (ref=%d)\n", messages_txt[message_type], ref);
 
-	adminp = &admin_first;
-	while(*adminp)
-		adminp = &((*adminp)->next);
-	admin = (struct admin_list *)calloc(1, sizeof(struct admin_list));
+	len = sizeof(struct admin_frame) + admin_param_len(param);
+	admin = (struct admin_list *)malloc(sizeof(struct admin_list) + len);
 	if (!admin) {
 		CERROR(NULL, NULL, "No memory for message to LCR.\n");
 		return -1;
 	}
-	*adminp = admin;
+	admin->next = NULL;
+	admin->len = admin_frame_put(admin->frame, message_type, ref, param);
+	*admin_last = admin;
+	admin_last = &admin->next;
 
-	admin->msg.message = ADMIN_MESSAGE;
-	admin->msg.u.msg.type = message_type;
-	admin->msg.u.msg.ref = ref;
-	memcpy(&admin->msg.u.msg.param, param, sizeof(union parameter));
-	socket_fd.when |= LCR_FD_WRITE;
-	if (!wake_global) {
-		wake_global = 1;
-		char byte = 0;
-		write(wake_pipe[1], &byte, 1);
-	}
+	update_fd(&socket_fd, socket_fd.when | LCR_FD_WRITE);
+	wake_call(NULL);
 
 	return 0;
 }
@@ -572,7 +704,6 @@ void apply_opt(struct chan_call *call, char *data)
 			}
 			CDEBUG(call, call->ast, "Option 'r' (re-buffer 160 bytes)");
 			call->rebuffer = 1;
-			call->framepos = 0;
 			break;
 		case 's':
 			if (opt[1] != '\0') {
@@ -886,7 +1017,7 @@ CDEBUG(call, ast, "Got 'sending complete', but extension '%s' will not match at
 	/* release lcr */
 	CDEBUG(call, ast, "Releasing due to extension missmatch.\n");
 	send_release_and_import(call, cause, LOCATION_PRIVATE_LOCAL);
-	call->ref = 0;
+	set_call_ref(call, 0);
 	/* release asterisk */
 #if ASTERISK_VERSION_NUM < 110000
 	ast->hangupcause = call->cause;
@@ -967,11 +1098,11 @@ static void lcr_in_setup(struct chan_call *call, int message_type, union paramet
 #if ASTERISK_VERSION_NUM < 110000
 	ast->tech_pvt = call;
 	ast->tech = &lcr_tech;
-	ast->fds[0] = call->pipe[0];
+	ast->fds[0] = call->rx_fd;
 #else
 	ast_channel_tech_pvt_set(ast, call);
 	ast_channel_tech_set(ast, &lcr_tech);
-	ast_channel_set_fd(ast, 0, call->pipe[0]);
+	ast_channel_set_fd(ast, 0, call->rx_fd);
 #endif
 
 	/* fill setup information */
@@ -1233,11 +1364,7 @@ static void lcr_in_proceeding(struct chan_call *call, int message_type, union pa
 	call->state = CHAN_LCR_STATE_OUT_PROCEEDING;
 	/* queue event for asterisk */
 	if (call->ast && call->pbx_started) {
-		if (!wake_global) {
-			wake_global = 1;
-			char byte = 0;
-			write(wake_pipe[1], &byte, 1);
-		}
+		wake_call(call);
 		strncat(call->queue_string, "P", sizeof(call->queue_string)-1);
 	}
 
@@ -1254,11 +1381,7 @@ static void lcr_in_alerting(struct chan_call *call, int message_type, union para
 	call->state = CHAN_LCR_STATE_OUT_ALERTING;
 	/* queue event to asterisk */
 	if (call->ast && call->pbx_started) {
-		if (!wake_global) {
-			wake_global = 1;
-			char byte = 0;
-			write(wake_pipe[1], &byte, 1);
-		}
+		wake_call(call);
 		strncat(call->queue_string, "R", sizeof(call->queue_string)-1);
 	}
 }
@@ -1285,11 +1408,7 @@ static void lcr_in_connect(struct chan_call *call, int message_type, union param
 	memcpy(&call->connectinfo, &param->connectinfo, sizeof(struct connect_info));
 	/* queue event to asterisk */
 	if (call->ast && call->pbx_started) {
-		if (!wake_global) {
-			wake_global = 1;
-			char byte = 0;
-			write(wake_pipe[1], &byte, 1);
-		}
+		wake_call(call);
 		strncat(call->queue_string, "N", sizeof(call->queue_string)-1);
 	}
 }
@@ -1319,7 +1438,7 @@ static void lcr_in_disconnect(struct chan_call *call, int message_type, union pa
 #endif
 	/* release lcr with same cause */
 	send_release_and_import(call, call->cause, call->location);
-	call->ref = 0;
+	set_call_ref(call, 0);
 	/* change to release state */
 	call->state = CHAN_LCR_STATE_RELEASE;
 	/* queue release asterisk */
@@ -1330,11 +1449,7 @@ static void lcr_in_disconnect(struct chan_call *call, int message_type, union pa
 		ast_channel_hangupcause_set(ast, call->cause);
 #endif
 		if (call->pbx_started) {
-			if (!wake_global) {
-				wake_global = 1;
-				char byte = 0;
-				write(wake_pipe[1], &byte, 1);
-			}
+			wake_call(call);
 			strcpy(call->queue_string, "H"); // overwrite other indications
 		} else {
 			ast_hangup(ast); // call will be destroyed here
@@ -1352,7 +1467,7 @@ static void lcr_in_release(struct chan_call *call, int message_type, union param
 	CDEBUG(call, call->ast, "Incomming release from LCR, releasing ref. (cause=%d)\n", param->disconnectinfo.cause);
 
 	/* release ref */
-	call->ref = 0;
+	set_call_ref(call, 0);
 	/* change to release state */
 	call->state = CHAN_LCR_STATE_RELEASE;
 	/* copy release info */
@@ -1368,11 +1483,7 @@ static void lcr_in_release(struct chan_call *call, int message_type, union param
 		ast_channel_hangupcause_set(ast, call->cause);
 #endif
 		if (call->pbx_started) {
-			if (!wake_global) {
-				wake_global = 1;
-				char byte = 0;
-				write(wake_pipe[1], &byte, 1);
-			}
+			wake_call(call);
 			strcpy(call->queue_string, "H");
 		} else {
 			ast_hangup(ast); // call will be destroyed here
@@ -1415,11 +1526,7 @@ static void lcr_in_information(struct chan_call *call, int message_type, union p
 
 	/* queue digits */
 	if (call->state == CHAN_LCR_STATE_IN_DIALING && param->information.id[0]) {
-		if (!wake_global) {
-			wake_global = 1;
-			char byte = 0;
-			write(wake_pipe[1], &byte, 1);
-		}
+		wake_call(call);
 		strncat(call->queue_string, param->information.id, sizeof(call->queue_string)-1);
 	}
 
@@ -1491,11 +1598,7 @@ static void lcr_in_pattern(struct chan_call *call, int message_type, union param
 	}
 	/* queue PROGRESS, because tones are available */
 	if (call->ast && call->pbx_started) {
-		if (!wake_global) {
-			wake_global = 1;
-			char byte = 0;
-			write(wake_pipe[1], &byte, 1);
-		}
+		wake_call(call);
 		strncat(call->queue_string, "T", sizeof(call->queue_string)-1);
 	}
 }
@@ -1521,11 +1624,7 @@ void lcr_in_dtmf(struct chan_call *call, int val)
 	CDEBUG(call, call->ast, "Recognised DTMF digit '%c'.\n", val);
 	digit[0] = val;
 	digit[1] = '\0';
-	if (!wake_global) {
-		wake_global = 1;
-		char byte = 0;
-		write(wake_pipe[1], &byte, 1);
-	}
+	wake_call(call);
 	strncat(call->queue_string, digit, sizeof(call->queue_string)-1);
 }
 
@@ -1645,7 +1744,7 @@ int receive_message(int message_type, unsigned int ref, union parameter *param)
 			/* new state */
 			call->state = CHAN_LCR_STATE_IN_PREPARE;
 			/* set ref */
-			call->ref = ref;
+			set_call_ref(call, ref);
 			call->ref_was_assigned = 1;
 			/* set dtmf (default, use option 'n' to disable */
 			call->dsp_dtmf = 1;
@@ -1660,7 +1759,7 @@ int receive_message(int message_type, unsigned int ref, union parameter *param)
 				return 0;
 			}
 			/* store new ref */
-			call->ref = ref;
+			set_call_ref(call, ref);
 			call->ref_was_assigned = 1;
 			/* set dtmf (default, use option 'n' to disable */
 			call->dsp_dtmf = 1;
@@ -1777,7 +1876,7 @@ again:
 			continue;
 		}
 		/* release or queue release */
-		call->ref = 0;
+		set_call_ref(call, 0);
 		call->state = CHAN_LCR_STATE_RELEASE;
 		if (!call->pbx_started) {
 			CDEBUG(call, call->ast, "Releasing call, because no Asterisk channel is not started.\n");
@@ -1785,11 +1884,7 @@ again:
 			goto again;
 		}
 		CDEBUG(call, call->ast, "Queue call release, because Asterisk channel is running.\n");
-		if (!wake_global) {
-			wake_global = 1;
-			char byte = 0;
-			write(wake_pipe[1], &byte, 1);
-		}
+		wake_call(call);
 		strcpy(call->queue_string, "H");
 		call = call->next;
 	}
@@ -1807,10 +1902,38 @@ void close_socket(void);
  */
 static int handle_socket(struct lcr_fd *fd, unsigned int what, void *instance, int index)
 {
-	int len;
+	int len, type, i;
+	unsigned int ref, off;
 	struct admin_list *admin;
 	struct admin_message msg;
+	union parameter param;
+	struct iovec iov[SOCKET_IOV];
 
+	if ((what & LCR_FD_READ) && lcr_compact) {
+		/* read frames, as many as available */
+		len = read(lcr_sock, lcr_in + lcr_in_len, sizeof(lcr_in) - lcr_in_len);
+		if (len == 0) {
+			CERROR(NULL, NULL, "Socket closed.(read)\n");
+			goto error;
+		}
+		if (len < 0) {
+			CERROR(NULL, NULL, "Socket failed (errno %d).\n", errno);
+			goto error;
+		}
+		lcr_in_len += len;
+		off = 0;
+		while ((len = admin_frame_get(lcr_in + off, lcr_in_len - off, &type, &ref, &param)) > 0) {
+			off += len;
+			receive_message(type, ref, &param);
+		}
+		if (len < 0) {
+			CERROR(NULL, NULL, "Socket received invalid frame.\n");
+			goto error;
+		}
+		/* keep incomplete frame */
+		memmove(lcr_in, lcr_in + off, lcr_in_len - off);
+		lcr_in_len -= off;
+	} else
 	if ((what & LCR_FD_READ)) {
 		/* read from socket */
 		len = read(lcr_sock, &msg, sizeof(msg));
@@ -1832,21 +1955,75 @@ static int handle_socket(struct lcr_fd *fd, unsigned int what, void *instance, i
 				CERROR(NULL, NULL, "Socket received illegal message %d.\n", msg.message);
 				goto error;
 			}
-			receive_message(msg.u.msg.type, msg.u.msg.ref, &msg.u.msg.param);
+			if (msg.u.msg.type == MESSAGE_HELLO) {
+				/* LCR confirms compact protocol, the following data are frames */
+				if (!lcr_hello_wait || msg.u.msg.param.hello.protocol != ADMIN_PROTOCOL_COMPACT) {
+					CERROR(NULL, NULL, "Socket received unexpected hello.\n");
+					goto error;
+				}
+				CDEBUG(NULL, NULL, "LCR uses compact protocol.\n");
+				unsched_timer(&socket_hello);
+				lcr_hello_wait = 0;
+				lcr_compact = 1;
+				update_fd(&socket_fd, socket_fd.when | LCR_FD_WRITE);
+			} else
+				receive_message(msg.u.msg.type, msg.u.msg.ref, &msg.u.msg.param);
 		} else {
 			CERROR(NULL, NULL, "Socket failed (errno %d).\n", errno);
 			goto error;
 		}
 	}
 
+	if ((what & LCR_FD_WRITE) && lcr_hello_wait) {
+		/* nothing is sent until LCR confirmed or timeout */
+		update_fd(&socket_fd, socket_fd.when & ~LCR_FD_WRITE);
+	} else
+	if ((what & LCR_FD_WRITE) && lcr_compact) {
+		/* write queued frames at once */
+		if (!admin_first) {
+			update_fd(&socket_fd, socket_fd.when & ~LCR_FD_WRITE);
+			return 0;
+		}
+		i = 0;
+		admin = admin_first;
+		while(admin && i < SOCKET_IOV) {
+			iov[i].iov_base = admin->frame + (i ? 0 : admin_first_off);
+			iov[i].iov_len = admin->len - (i ? 0 : admin_first_off);
+			admin = admin->next;
+			i++;
+		}
+		len = writev(lcr_sock, iov, i);
+		if (len == 0) {
+			CERROR(NULL, NULL, "Socket closed.(write)\n");
+			goto error;
+		}
+		if (len < 0) {
+			CERROR(NULL, NULL, "Socket failed (errno %d).\n", errno);
+			goto error;
+		}
+		/* free written frames, remember how much of the next is written */
+		len += admin_first_off;
+		while(admin_first && len >= (int)admin_first->len) {
+			admin = admin_first;
+			len -= admin->len;
+			admin_first = admin->next;
+			free(admin);
+		}
+		admin_first_off = len;
+		if (!admin_first)
+			admin_last = &admin_first;
+		global_change = 1;
+	} else
 	if ((what & LCR_FD_WRITE)) {
-		/* write to socket */
+		/* write to socket, one admin message at a time */
 		if (!admin_first) {
-			socket_fd.when &= ~LCR_FD_WRITE;
+			update_fd(&socket_fd, socket_fd.when & ~LCR_FD_WRITE);
 			return 0;
 		}
 		admin = admin_first;
-		len = write(lcr_sock, &admin->msg, sizeof(msg));
+		msg.message = ADMIN_MESSAGE;
+		admin_frame_get(admin->frame, admin->len, &msg.u.msg.type, &msg.u.msg.ref, &msg.u.msg.param);
+		len = write(lcr_sock, &msg, sizeof(msg));
 		if (len == 0) {
 			CERROR(NULL, NULL, "Socket closed.(write)\n");
 			goto error;
@@ -1856,8 +2033,15 @@ static int handle_socket(struct lcr_fd *fd, unsigned int what, void *instance, i
 				CERROR(NULL, NULL, "Socket short write. (len %d)\n", len);
 				goto error;
 			}
+			/* after hello, wait for LCR to confirm compact protocol */
+			if (msg.u.msg.type == MESSAGE_HELLO && msg.u.msg.param.hello.protocol == ADMIN_PROTOCOL_COMPACT) {
+				lcr_hello_wait = 1;
+				schedule_timer(&socket_hello, SOCKET_HELLO_TIMER, 0);
+			}
 			/* free head */
 			admin_first = admin->next;
+			if (!admin_first)
+				admin_last = &admin_first;
 			free(admin);
 			global_change = 1;
 		} else {
@@ -1905,6 +2089,8 @@ int open_socket(void)
 	/* enque hello message */
 	memset(&param, 0, sizeof(param));
 	strcpy(param.hello.application, "asterisk");
+	param.hello.protocol = (lcr_fixed) ? ADMIN_PROTOCOL_FIXED : ADMIN_PROTOCOL_COMPACT;
+	lcr_fixed = 0;
 	send_message(MESSAGE_HELLO, 0, &param);
 
 	return lcr_sock;
@@ -1928,6 +2114,14 @@ void close_socket(void)
 		free(temp);
 	}
 	admin_first = NULL;
+	admin_last = &admin_first;
+	admin_first_off = 0;
+
+	/* back to admin messages for next connection */
+	unsched_timer(&socket_hello);
+	lcr_hello_wait = 0;
+	lcr_compact = 0;
+	lcr_in_len = 0;
 
 	/* close socket */
 	close(lcr_sock);
@@ -1948,24 +2142,38 @@ static int wake_event(struct lcr_fd *fd, unsigned int what, void *instance, int
 	return 0;
 }
 
+/* only calls with queued events are visited
+ * if the asterisk channel is locked, the call stays in the list and the
+ * queue is tried again later, so we don't wait while holding chan_lock */
 static void handle_queue()
 {
-	struct chan_call *call;
+	struct chan_call *call, *retry = NULL;
 	struct ast_channel *ast;
 	struct ast_frame fr;
 	char *p;
 
-again:
-	call = call_first;
-	while(call) {
+	while((call = call_dirty) && call != retry) {
+		/* take call from list */
+		call_dirty = call->dirty_next;
+		if (!call_dirty)
+			call_dirty_last = &call_dirty;
+		call->dirty = 0;
 		p = call->queue_string;
 		ast = call->ast;
-		if (*p && ast) {
+		if (*p && !ast) {
+			/* keep events until there is a channel */
+			dirty_call(call);
+			if (!retry)
+				retry = call;
+			continue;
+		}
+		if (*p) {
 			if (ast_channel_trylock(ast)) {
-				ast_mutex_unlock(&chan_lock);
-				usleep(1);
-				ast_mutex_lock(&chan_lock);
-				goto again;
+				dirty_call(call);
+				if (!retry)
+					retry = call;
+				schedule_timer(&queue_retry, 0, QUEUE_RETRY_USEC);
+				continue;
 			}
 			while(*p) {
 				switch (*p) {
@@ -2028,10 +2236,28 @@ again:
 			call->queue_string[0] = '\0';
 			ast_channel_unlock(ast);
 		}
-		call = call->next;
 	}
 }
 
+static int handle_queue_retry(struct lcr_timer *timer, void *instance, int index)
+{
+	/* handle_queue() is called when select returns */
+	return 0;
+}
+
+static int handle_hello(struct lcr_timer *timer, void *instance, int index)
+{
+	/* LCR may still confirm and send frames, so reconnect without compact protocol */
+	CDEBUG(NULL, NULL, "LCR does not confirm compact protocol, reconnecting to use admin messages.\n");
+	close_socket();
+	release_all_calls();
+	lcr_fixed = 1;
+	if (open_socket() < 0)
+		schedule_timer(&socket_retry, SOCKET_RETRY_TIMER, 0);
+
+	return 0;
+}
+
 static int handle_retry(struct lcr_timer *timer, void *instance, int index)
 {
 	CDEBUG(NULL, NULL, "Retry to open socket.\n");
@@ -2064,6 +2290,10 @@ static void *chan_thread(void *arg)
 
 	memset(&socket_retry, 0, sizeof(socket_retry));
 	add_timer(&socket_retry, handle_retry, NULL, 0);
+	memset(&socket_hello, 0, sizeof(socket_hello));
+	add_timer(&socket_hello, handle_hello, NULL, 0);
+	memset(&queue_retry, 0, sizeof(queue_retry));
+	add_timer(&queue_retry, handle_queue_retry, NULL, 0);
 
 	bchannel_pid = getpid();
 
@@ -2188,10 +2418,10 @@ struct ast_channel *lcr_request(const char *type, int format, void *data, int *c
 	call->ast = ast;
 #if ASTERISK_VERSION_NUM < 110000
 	ast->tech_pvt = call;
-	ast->fds[0] = call->pipe[0];
+	ast->fds[0] = call->rx_fd;
 #else
 	ast_channel_tech_pvt_set(ast, call);
-	ast_channel_set_fd(ast, 0, call->pipe[0]);
+	ast_channel_set_fd(ast, 0, call->rx_fd);
 #endif
 	call->pbx_started = 0;
 	/* set state */
@@ -2787,6 +3017,9 @@ static int lcr_write(struct ast_channel *ast, struct ast_frame *fr)
 {
 	struct chan_call *call;
 	struct ast_frame * f = fr;
+	struct audio_slot *slot;
+	unsigned int in;
+	uint64_t one = 1;
 
 #if ASTERISK_VERSION_NUM < 100000
 #ifdef AST_1_8_OR_HIGHER
@@ -2839,22 +3072,34 @@ static int lcr_write(struct ast_channel *ast, struct ast_frame *fr)
 #endif
 	}
 
-	ast_mutex_lock(&chan_lock);
+	/* the call is not freed while we have the channel */
 #if ASTERISK_VERSION_NUM < 110000
 	call = ast->tech_pvt;
 #else
 	call = ast_channel_tech_pvt(ast);
 #endif
 	if (!call) {
-		ast_mutex_unlock(&chan_lock);
 		if (f != fr) {
 			ast_frfree(f);
 		}
 		return -1;
 	}
-	if (call->bchannel && f->samples)
-		bchannel_transmit(call->bchannel, *((unsigned char **)&(f->data)), f->samples);
-	ast_mutex_unlock(&chan_lock);
+	if (f->samples > 0 && f->samples <= AUDIO_TX_SIZE) {
+		in = call->tx_in;
+		if (in - call->tx_out < AUDIO_TX_SLOTS) {
+			slot = &call->tx_ring[in & (AUDIO_TX_SLOTS - 1)];
+			memcpy(slot->data, *((unsigned char **)&(f->data)), f->samples);
+			slot->len = f->samples;
+			__sync_synchronize();
+			call->tx_in = in + 1;
+			__sync_synchronize();
+			if (!call->tx_armed) {
+				call->tx_armed = 1;
+				if (write(call->tx_fd.fd, &one, sizeof(one)) < 0)
+					CDEBUG(call, ast, "Failed to signal audio (errno=%d).\n", errno);
+			}
+		}
+	}
 	if (f != fr) {
 		ast_frfree(f);
 	}
@@ -2865,51 +3110,62 @@ static int lcr_write(struct ast_channel *ast, struct ast_frame *fr)
 static struct ast_frame *lcr_read(struct ast_channel *ast)
 {
 	struct chan_call *call;
-	int len = 0;
+	unsigned int in, avail, pos, len, need;
+	uint64_t count, one = 1;
 
-	ast_mutex_lock(&chan_lock);
+	/* the call is not freed while we have the channel */
 #if ASTERISK_VERSION_NUM < 110000
 	call = ast->tech_pvt;
 #else
 	call = ast_channel_tech_pvt(ast);
 #endif
-	if (!call) {
-		ast_mutex_unlock(&chan_lock);
+	if (!call)
 		return NULL;
-	}
-	if (call->pipe[0] > -1) {
-		if (call->rebuffer && !call->hdlc) {
-			/* Make sure we have a complete 20ms (160byte) frame */
-			len=read(call->pipe[0],call->read_buff + call->framepos, 160 - call->framepos);
-			if (len > 0) {
-				call->framepos += len;
-			}
-		} else {
-			len = read(call->pipe[0], call->read_buff, sizeof(call->read_buff));
-		}
-		if (len < 0 && errno == EAGAIN) {
-			ast_mutex_unlock(&chan_lock);
 
-			#ifdef LCR_FOR_ASTERISK
-			return &ast_null_frame;
-			#endif
-
-			#ifdef LCR_FOR_CALLWEAVER
-			return &nullframe;
-			#endif
+	/* release frame of previous read */
+	if (call->rx_hold) {
+		__sync_synchronize();
+		call->rx_out += call->rx_hold;
+		call->rx_hold = 0;
+	}
+
+	call->rx_armed = 0;
+	__sync_synchronize();
+	if (read(call->rx_fd, &count, sizeof(count)) < 0) {
+		/* not signalled, we check the ring anyway */
+	}
+	in = call->rx_in;
+	__sync_synchronize();
+	avail = in - call->rx_out;
+	pos = call->rx_out & (AUDIO_RING - 1);
+	if (call->rebuffer && !call->hdlc) {
+		/* Make sure we have a complete 20ms (160byte) frame */
+		need = AUDIO_FRAME;
+		len = AUDIO_FRAME;
+	} else {
+		/* a frame ends at the end of the ring */
+		need = 1;
+		len = AUDIO_RING - pos;
+		if (len > AUDIO_READ)
+			len = AUDIO_READ;
+		if (len > avail)
+			len = avail;
+	}
+	if (avail < need) {
+		/* Not a complete frame, so we send a null-frame */
+		#ifdef LCR_FOR_ASTERISK
+		return &ast_null_frame;
+		#endif
 
-		}
-		if (len <= 0) {
-			close(call->pipe[0]);
-			call->pipe[0] = -1;
-			global_change = 1;
-			ast_mutex_unlock(&chan_lock);
-			return NULL;
-		} else if (call->rebuffer && call->framepos < 160) {
-			/* Not a complete frame, so we send a null-frame */
-			ast_mutex_unlock(&chan_lock);
-			return &ast_null_frame;
-		}
+		#ifdef LCR_FOR_CALLWEAVER
+		return &nullframe;
+		#endif
+	}
+	call->rx_hold = len;
+	/* asterisk only reads again, if the fd is signalled */
+	if (avail - len >= need) {
+		if (write(call->rx_fd, &one, sizeof(one)) < 0)
+			CDEBUG(call, ast, "Failed to signal audio (errno=%d).\n", errno);
 	}
 
 	call->read_fr.frametype = AST_FRAME_VOICE;
@@ -2935,17 +3191,11 @@ static struct ast_frame *lcr_read(struct ast_channel *ast)
 	call->read_fr.subclass = ast_channel_nativeformats(ast);
 #endif
 #endif
-	if (call->rebuffer) {
-		call->read_fr.datalen = call->framepos;
-		call->read_fr.samples = call->framepos;
-		call->framepos = 0;
-	} else {
-		call->read_fr.datalen = len;
-		call->read_fr.samples = len;
-	}
+	call->read_fr.datalen = len;
+	call->read_fr.samples = len;
 	call->read_fr.delivery = ast_tv(0,0);
-	*((unsigned char **)&(call->read_fr.data)) = call->read_buff;
-	ast_mutex_unlock(&chan_lock);
+	/* no copy, the frame stays in the ring until next read */
+	*((unsigned char **)&(call->read_fr.data)) = call->rx_ring + pos;
 
 	return &call->read_fr;
 }
@@ -3661,6 +3911,8 @@ int unload_module(void)
 	close_socket();
 
 	del_timer(&socket_retry);
+	del_timer(&socket_hello);
+	del_timer(&queue_retry);
 
 	unregister_fd(&wake_fd);
 	close(wake_pipe[0]);
@@ -9,12 +9,27 @@
 **                                                                           **
 \*****************************************************************************/
 
+#define AUDIO_RING		8192	/* bytes of received audio, must be a binary border */
+#define AUDIO_FRAME		160	/* bytes of a rebuffered frame */
+#define AUDIO_READ		1024	/* largest frame given to asterisk */
+#define AUDIO_TX_SLOTS		16	/* frames to be transmitted, must be a binary border */
+#define AUDIO_TX_SIZE		1024	/* largest frame to be transmitted */
+
+/* frame from asterisk, as it is given to bchannel_transmit() */
+struct audio_slot {
+	int			len;
+	unsigned char		data[AUDIO_TX_SIZE];
+};
+
 /* structure for all calls */
 struct bchannel;
 struct chan_call {
 	struct chan_call	*next;	/* link to next call instance */
+	struct chan_call	*hash_next; /* link to next call with same hash of ref */
+	struct chan_call	*dirty_next; /* link to next call with queued events */
+	int			dirty;	/* call is in list of queued events */
 	int			state;	/* current call state CHAN_LCR_STATE */
-	unsigned int		ref;	/* callref for this channel */
+	unsigned int		ref;	/* callref for this channel, use set_call_ref() */
 	int			ref_was_assigned;
 	void			*ast;	/* current asterisk channel */
 	int			pbx_started;
@@ -37,10 +52,23 @@ struct chan_call {
 					/* current ID or 0 */
 	struct chan_call	*bridge_call;
 					/* remote instance or NULL */
-	int			pipe[2];
-					/* pipe for receive data */
-	unsigned char		read_buff[1024];
-					/* read buffer for frame */
+	int			rx_fd;	/* eventfd, readable when audio is in rx_ring */
+	unsigned char		rx_ring[AUDIO_RING + AUDIO_FRAME];
+					/* audio from bchannel, the first AUDIO_FRAME
+					   bytes are repeated behind the end, so a
+					   frame is never split */
+	volatile unsigned int	rx_in, rx_out;
+					/* written by bchannel / by lcr_read only */
+	unsigned int		rx_hold;/* bytes given to asterisk, released at next read */
+	volatile int		rx_armed;
+					/* rx_fd is signalled */
+	struct lcr_fd		tx_fd;	/* eventfd, readable when frames are in tx_ring */
+	struct audio_slot	tx_ring[AUDIO_TX_SLOTS];
+					/* audio from asterisk */
+	volatile unsigned int	tx_in, tx_out;
+					/* written by lcr_write / by chan_thread only */
+	volatile int		tx_armed;
+					/* tx_fd is signalled */
 	struct ast_frame	read_fr;
 					/* frame for read */
 	char			interface[32];
@@ -60,8 +88,6 @@ struct chan_call {
 					      requested by asterisk */
         int                     rebuffer; /* send only 160 bytes frames
 					     to asterisk */
-
-	int			framepos; /* send only 160 bytes frames to asterisk */
 	
         int                     on_hold; /* track hold management, since
 					    sip phones sometimes screw it up */
@@ -136,10 +162,16 @@ enum {
 };
 
 
+#define CALL_HASH		256	/* buckets to find call by ref, must be a binary border */
+#define QUEUE_RETRY_USEC	1000	/* retry queue, if asterisk channel is locked */
+#define SOCKET_IOV		64	/* frames written at once */
+
 #define SOCKET_RETRY_TIMER	5
+#define SOCKET_HELLO_TIMER	1	/* wait for LCR to confirm compact protocol */
 
 #define CERROR(call, ast, arg...) chan_lcr_log(__LOG_ERROR, __FILE__, __LINE__,  __FUNCTION__, call, ast, ##arg)
 #define CDEBUG(call, ast, arg...) chan_lcr_log(__LOG_NOTICE, __FILE__, __LINE__,  __FUNCTION__, call, ast, ##arg)
 void chan_lcr_log(int type, const char *file, int line, const char *function,  struct chan_call *call, struct ast_channel *ast, const char *fmt, ...);
 extern unsigned char flip_bits[256];
+void flip_copy(unsigned char *dst, const unsigned char *src, int len);
 void lcr_in_dtmf(struct chan_call *call, int val);
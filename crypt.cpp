@@ -141,6 +141,8 @@ the message type is encoded as element
 */
 
 #include "main.h"
+#include <poll.h>
+#include <sys/eventfd.h>
 #ifdef CRYPTO
 #include <openssl/rsa.h>
 #endif
@@ -302,45 +304,47 @@ static const char *statename(int state)
 
 /*
  * authentication key generation, encryption, decryption
+ *
+ * jobs are done by a pool of KEYENGINE_WORKERS threads. a done job is put
+ * into the list of done jobs and keyengine_fd is signalled, so the main loop
+ * gives the result to the endpoint. rsa key pairs are generated in advance,
+ * so usually a key pair is taken from keyengine_pool without waiting. each
+ * key pair is used once, the pool is refilled when the workers are idle.
  */
-struct auth_args {
-	class EndpointAppPBX *apppbx;
-	int	job;
-};
-
-static void *keyengine_child(void *arg)
+static struct keyengine_job *keyengine_jobs = NULL, **keyengine_jobs_last = &keyengine_jobs;
+static struct keyengine_job *keyengine_refills = NULL;	/* done when no other job is queued */
+static struct keyengine_job *keyengine_done = NULL, **keyengine_done_last = &keyengine_done;
+static struct rsa_key keyengine_pool[KEYENGINE_POOL];
+static int keyengine_pool_count = 0;
+static int keyengine_refilling = 0;		/* refill jobs not done yet */
+static pthread_mutex_t keyengine_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t keyengine_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t keyengine_tid[KEYENGINE_WORKERS];
+static int keyengine_threads = 0;
+static int keyengine_quit = 0;
+static unsigned int keyengine_id = 0;		/* number of last job */
+static struct lcr_fd keyengine_fd;
+
+unsigned int keyengine_pool_hits = 0;
+unsigned int keyengine_pool_misses = 0;
+unsigned int keyengine_latency = 0;
+unsigned int keyengine_latency_max = 0;
+
+/* do the job, this is called by the workers */
+static void keyengine_work(struct keyengine_job *job)
 {
-	struct auth_args *args = (struct auth_args *)arg;
-	class EndpointAppPBX *apppbx = args->apppbx;
-	int job = args->job;
 #ifdef CRYPTO
 	RSA *rsa;
 	int exponent;
 	int i;
 #endif
 
-	struct sched_param schedp;
-	int ret;
-
-	PDEBUG((DEBUG_EPOINT | DEBUG_CRYPT), "EPOINT(%d) child process started for using libcrypto\n", apppbx->ea_endpoint->ep_serial);
-
-	/* lower priority to keep pbx running fluently */
-	if (options.schedule > 0) {
-		memset(&schedp, 0, sizeof(schedp));
-		schedp.sched_priority = 0;
-		ret = sched_setscheduler(0, SCHED_OTHER, &schedp);
-		if (ret < 0) {
-			PERROR("Scheduling to normal priority failed (errno = %d).\nExitting child process...\n", errno);
-			goto done;
-		}
-	}
-
-	switch(job) {
+	switch(job->job) {
 		/* generate rsa key pair */
 		case CK_GENRSA_REQ:
 #ifndef CRYPTO
 		PERROR("Not compliled wiht crypto.\n");
-		apppbx->e_crypt_keyengine_return = -1;
+		job->ret = -1;
 #else
 		srandom(*((unsigned int *)mISDN_rand) ^ random());
 //		exponent = (((random()<<1)|1) & 0x7f) + 0x80; /* odd */
@@ -349,59 +353,42 @@ static void *keyengine_child(void *arg)
 		rsa = RSA_generate_key(RSA_BITS, exponent, NULL, NULL);
 		if (!rsa) {
 			PERROR("Failed to generate rsa key pair.\n");
-			apppbx->e_crypt_keyengine_return = -1;
+			job->ret = -1;
 			break;
 		}
-		ememuse++;
-		apppbx->e_crypt_rsa_n_len = BN_num_bytes(rsa->n);
-		if (apppbx->e_crypt_rsa_n_len > (int)sizeof(apppbx->e_crypt_rsa_n)) {
-			kerror_buffer:
-			PERROR("e_crypt_rsa_* too small for bignum.\n");
-			apppbx->e_crypt_keyengine_return = -1;
+		job->rsa.n_len = BN_num_bytes(rsa->n);
+		job->rsa.e_len = BN_num_bytes(rsa->e);
+		job->rsa.d_len = BN_num_bytes(rsa->d);
+		job->rsa.p_len = BN_num_bytes(rsa->p);
+		job->rsa.q_len = BN_num_bytes(rsa->q);
+		job->rsa.dmp1_len = BN_num_bytes(rsa->dmp1);
+		job->rsa.dmq1_len = BN_num_bytes(rsa->dmq1);
+		job->rsa.iqmp_len = BN_num_bytes(rsa->iqmp);
+		if (job->rsa.n_len > (int)sizeof(job->rsa.n)
+		 || job->rsa.e_len > (int)sizeof(job->rsa.e)
+		 || job->rsa.d_len > (int)sizeof(job->rsa.d)
+		 || job->rsa.p_len > (int)sizeof(job->rsa.p)
+		 || job->rsa.q_len > (int)sizeof(job->rsa.q)
+		 || job->rsa.dmp1_len > (int)sizeof(job->rsa.dmp1)
+		 || job->rsa.dmq1_len > (int)sizeof(job->rsa.dmq1)
+		 || job->rsa.iqmp_len > (int)sizeof(job->rsa.iqmp)) {
+			PERROR("struct rsa_key too small for bignum.\n");
+			job->ret = -1;
 			RSA_free(rsa);
-			ememuse--;
 			break;
 		}
-		BN_bn2bin(rsa->n, apppbx->e_crypt_rsa_n);
-		apppbx->e_crypt_rsa_n_len = BN_num_bytes(rsa->n);
-		if (apppbx->e_crypt_rsa_e_len > (int)sizeof(apppbx->e_crypt_rsa_e))
-			goto kerror_buffer;
-		BN_bn2bin(rsa->e, apppbx->e_crypt_rsa_e);
-		apppbx->e_crypt_rsa_e_len = BN_num_bytes(rsa->e);
-		if (apppbx->e_crypt_rsa_d_len > (int)sizeof(apppbx->e_crypt_rsa_d))
-			goto kerror_buffer;
-		BN_bn2bin(rsa->d, apppbx->e_crypt_rsa_d);
-		apppbx->e_crypt_rsa_p_len = BN_num_bytes(rsa->p);
-		if (apppbx->e_crypt_rsa_p_len > (int)sizeof(apppbx->e_crypt_rsa_p))
-			goto kerror_buffer;
-		BN_bn2bin(rsa->p, apppbx->e_crypt_rsa_p);
-		apppbx->e_crypt_rsa_q_len = BN_num_bytes(rsa->q);
-		if (apppbx->e_crypt_rsa_q_len > (int)sizeof(apppbx->e_crypt_rsa_q))
-			goto kerror_buffer;
-		BN_bn2bin(rsa->q, apppbx->e_crypt_rsa_q);
-		apppbx->e_crypt_rsa_dmp1_len = BN_num_bytes(rsa->dmp1);
-		if (apppbx->e_crypt_rsa_dmp1_len > (int)sizeof(apppbx->e_crypt_rsa_dmp1))
-			goto kerror_buffer;
-		BN_bn2bin(rsa->dmp1, apppbx->e_crypt_rsa_dmp1);
-		apppbx->e_crypt_rsa_dmq1_len = BN_num_bytes(rsa->dmq1);
-		if (apppbx->e_crypt_rsa_dmq1_len > (int)sizeof(apppbx->e_crypt_rsa_dmq1))
-			goto kerror_buffer;
-		BN_bn2bin(rsa->dmq1, apppbx->e_crypt_rsa_dmq1);
-		apppbx->e_crypt_rsa_iqmp_len = BN_num_bytes(rsa->iqmp);
-		if (apppbx->e_crypt_rsa_iqmp_len > (int)sizeof(apppbx->e_crypt_rsa_iqmp))
-			goto kerror_buffer;
-		BN_bn2bin(rsa->iqmp, apppbx->e_crypt_rsa_iqmp);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa n=%02x...\n", *apppbx->e_crypt_rsa_n);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa e=%02x...\n", *apppbx->e_crypt_rsa_e);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa d=%02x...\n", *apppbx->e_crypt_rsa_d);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa p=%02x...\n", *apppbx->e_crypt_rsa_p);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa q=%02x...\n", *apppbx->e_crypt_rsa_q);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa dmp1=%02x...\n", *apppbx->e_crypt_rsa_dmp1);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa dmq1=%02x...\n", *apppbx->e_crypt_rsa_dmq1);
-		PDEBUG(DEBUG_CRYPT, "gen: rsa iqmp=%02x...\n", *apppbx->e_crypt_rsa_iqmp);
-		apppbx->e_crypt_keyengine_return = 1;
+		BN_bn2bin(rsa->n, job->rsa.n);
+		BN_bn2bin(rsa->e, job->rsa.e);
+		BN_bn2bin(rsa->d, job->rsa.d);
+		BN_bn2bin(rsa->p, job->rsa.p);
+		BN_bn2bin(rsa->q, job->rsa.q);
+		BN_bn2bin(rsa->dmp1, job->rsa.dmp1);
+		BN_bn2bin(rsa->dmq1, job->rsa.dmq1);
+		BN_bn2bin(rsa->iqmp, job->rsa.iqmp);
+		PDEBUG(DEBUG_CRYPT, "gen: rsa n=%02x...\n", *job->rsa.n);
+		PDEBUG(DEBUG_CRYPT, "gen: rsa e=%02x...\n", *job->rsa.e);
+		job->ret = 1;
 		RSA_free(rsa);
-		ememuse--;
 #endif
 		break;
 
@@ -409,67 +396,60 @@ static void *keyengine_child(void *arg)
 		case CK_CPTRSA_REQ:
 #ifndef CRYPTO
 		PERROR("No crypto lib.\n");
-		apppbx->e_crypt_keyengine_return = -1;
+		job->ret = -1;
 #else
 		/* generating session key */
 		srandom(*((unsigned int *)mISDN_rand) ^ random());
 		i = 0;
 		while(i < 56) {
-			apppbx->e_crypt_key[i] = random();
-			apppbx->e_crypt_key[i] ^= mISDN_rand[random() & 0xff];
+			job->key[i] = random();
+			job->key[i] ^= mISDN_rand[random() & 0xff];
 			i++;
 		}
-		apppbx->e_crypt_key_len = i;
+		job->key_len = i;
 		/* encrypt via rsa */
 		rsa = RSA_new();
 		if (!rsa) {
 			PERROR("Failed to allocate rsa structure.\n");
-			apppbx->e_crypt_keyengine_return = 1;
+			job->ret = -1;
 			break;
 		}
-		ememuse++;
 		rsa->n = BN_new();
 		rsa->e = BN_new();
 		if (!rsa->n || !rsa->e) {
 			PERROR("Failed to generate rsa structure.\n");
-			apppbx->e_crypt_keyengine_return = -1;
+			job->ret = -1;
 			RSA_free(rsa);
-			ememuse--;
 			break;
 		}
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_n, apppbx->e_crypt_rsa_n_len, rsa->n)) {
-			eerror_bin2bn:
+		if (!BN_bin2bn(job->rsa.n, job->rsa.n_len, rsa->n)
+		 || !BN_bin2bn(job->rsa.e, job->rsa.e_len, rsa->e)) {
 			PERROR("Failed to convert binary to bignum.\n");
-			apppbx->e_crypt_keyengine_return = -1;
+			job->ret = -1;
 			RSA_free(rsa);
-			ememuse--;
 			break;
 		}
-		if ((apppbx->e_crypt_rsa_n_len*8) != BN_num_bits(rsa->n)) {
-			PERROR("SOFTWARE API ERROR: length not equal stored data. (%d != %d)\n", apppbx->e_crypt_rsa_n_len*8, BN_num_bits(rsa->n));
-			apppbx->e_crypt_keyengine_return = -1;
+		if ((job->rsa.n_len*8) != BN_num_bits(rsa->n)) {
+			PERROR("SOFTWARE API ERROR: length not equal stored data. (%d != %d)\n", job->rsa.n_len*8, BN_num_bits(rsa->n));
+			job->ret = -1;
 			RSA_free(rsa);
-			ememuse--;
 			break;
 		}
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_e, apppbx->e_crypt_rsa_e_len, rsa->e))
-			goto eerror_bin2bn;
-		PDEBUG(DEBUG_CRYPT, "crypt: rsa n=%02x...\n", *apppbx->e_crypt_rsa_n);
-		PDEBUG(DEBUG_CRYPT, "crypt: rsa e=%02x...\n", *apppbx->e_crypt_rsa_e);
-		PDEBUG(DEBUG_CRYPT, "crypt: key =%02x%02x%02x%02x... (len=%d)\n", apppbx->e_crypt_key[0], apppbx->e_crypt_key[1], apppbx->e_crypt_key[2], apppbx->e_crypt_key[3], apppbx->e_crypt_key_len);
-		apppbx->e_crypt_ckey_len = RSA_public_encrypt(
-			apppbx->e_crypt_key_len,
-			apppbx->e_crypt_key,
-			apppbx->e_crypt_ckey,
+		PDEBUG(DEBUG_CRYPT, "crypt: rsa n=%02x...\n", *job->rsa.n);
+		PDEBUG(DEBUG_CRYPT, "crypt: rsa e=%02x...\n", *job->rsa.e);
+		PDEBUG(DEBUG_CRYPT, "crypt: key =%02x%02x%02x%02x... (len=%d)\n", job->key[0], job->key[1], job->key[2], job->key[3], job->key_len);
+		job->ckey_len = RSA_public_encrypt(
+			job->key_len,
+			job->key,
+			job->ckey,
 			rsa,
 			RSA_PKCS1_PADDING);
-		PDEBUG(DEBUG_CRYPT, "crypt: ckey =%02x%02x%02x%02x... (len=%d)\n", apppbx->e_crypt_ckey[0], apppbx->e_crypt_ckey[1], apppbx->e_crypt_ckey[2], apppbx->e_crypt_ckey[3], apppbx->e_crypt_ckey_len);
+		PDEBUG(DEBUG_CRYPT, "crypt: ckey =%02x%02x%02x%02x... (len=%d)\n", job->ckey[0], job->ckey[1], job->ckey[2], job->ckey[3], job->ckey_len);
 		RSA_free(rsa);
-		ememuse--;
-		if (apppbx->e_crypt_ckey_len > 0)
-			apppbx->e_crypt_keyengine_return = 1;
+		if (job->ckey_len > 0)
+			job->ret = 1;
 		else
-			apppbx->e_crypt_keyengine_return = -1;
+			job->ret = -1;
 #endif
 		break;
 
@@ -477,15 +457,14 @@ static void *keyengine_child(void *arg)
 		case CK_DECRSA_REQ:
 #ifndef CRYPTO
 		PERROR("No crypto lib.\n");
-		apppbx->e_crypt_keyengine_return = -1;
+		job->ret = -1;
 #else
 		rsa = RSA_new();
 		if (!rsa) {
 			PERROR("Failed to allocate rsa structure.\n");
-			apppbx->e_crypt_keyengine_return = 1;
+			job->ret = -1;
 			break;
 		}
-		ememuse++;
 		rsa->n = BN_new();
 		rsa->e = BN_new();
 		rsa->d = BN_new();
@@ -499,135 +478,493 @@ static void *keyengine_child(void *arg)
 		 || !rsa->q || !rsa->dmp1
 		 || !rsa->dmq1 || !rsa->iqmp) {
 			PERROR("Failed to generate rsa structure.\n");
-			apppbx->e_crypt_keyengine_return = 1;
+			job->ret = -1;
 			RSA_free(rsa);
-			ememuse--;
 			break;
 		}
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_n, apppbx->e_crypt_rsa_n_len, rsa->n)) {
-			derror_bin2bn:
+		if (!BN_bin2bn(job->rsa.n, job->rsa.n_len, rsa->n)
+		 || !BN_bin2bn(job->rsa.e, job->rsa.e_len, rsa->e)
+		 || !BN_bin2bn(job->rsa.d, job->rsa.d_len, rsa->d)
+		 || !BN_bin2bn(job->rsa.p, job->rsa.p_len, rsa->p)
+		 || !BN_bin2bn(job->rsa.q, job->rsa.q_len, rsa->q)
+		 || !BN_bin2bn(job->rsa.dmp1, job->rsa.dmp1_len, rsa->dmp1)
+		 || !BN_bin2bn(job->rsa.dmq1, job->rsa.dmq1_len, rsa->dmq1)
+		 || !BN_bin2bn(job->rsa.iqmp, job->rsa.iqmp_len, rsa->iqmp)) {
 			PERROR("Failed to convert binary to bignum.\n");
-			apppbx->e_crypt_keyengine_return = -1;
+			job->ret = -1;
 			RSA_free(rsa);
-			ememuse--;
 			break;
 		}
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_e, apppbx->e_crypt_rsa_e_len, rsa->e))
-			goto derror_bin2bn;
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_d, apppbx->e_crypt_rsa_d_len, rsa->d))
-			goto derror_bin2bn;
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_p, apppbx->e_crypt_rsa_p_len, rsa->p))
-			goto derror_bin2bn;
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_q, apppbx->e_crypt_rsa_q_len, rsa->q))
-			goto derror_bin2bn;
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_dmp1, apppbx->e_crypt_rsa_dmp1_len, rsa->dmp1))
-			goto derror_bin2bn;
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_dmq1, apppbx->e_crypt_rsa_dmq1_len, rsa->dmq1))
-			goto derror_bin2bn;
-		if (!BN_bin2bn(apppbx->e_crypt_rsa_iqmp, apppbx->e_crypt_rsa_iqmp_len, rsa->iqmp))
-			goto derror_bin2bn;
-		PDEBUG(DEBUG_CRYPT, "decrypt: ckey =%02x%02x%02x%02x... (len=%d)\n", apppbx->e_crypt_ckey[0], apppbx->e_crypt_ckey[1], apppbx->e_crypt_ckey[2], apppbx->e_crypt_ckey[3], apppbx->e_crypt_ckey_len);
-		apppbx->e_crypt_key_len = RSA_private_decrypt(
-			apppbx->e_crypt_ckey_len,
-			apppbx->e_crypt_ckey,
-			apppbx->e_crypt_key,
+		PDEBUG(DEBUG_CRYPT, "decrypt: ckey =%02x%02x%02x%02x... (len=%d)\n", job->ckey[0], job->ckey[1], job->ckey[2], job->ckey[3], job->ckey_len);
+		job->key_len = RSA_private_decrypt(
+			job->ckey_len,
+			job->ckey,
+			job->key,
 			rsa,
 			RSA_PKCS1_PADDING);
-		PDEBUG(DEBUG_CRYPT, "decrypt: key =%02x%02x%02x%02x... (len=%d)\n", apppbx->e_crypt_key[0], apppbx->e_crypt_key[1], apppbx->e_crypt_key[2], apppbx->e_crypt_key[3], apppbx->e_crypt_key_len);
+		PDEBUG(DEBUG_CRYPT, "decrypt: key =%02x%02x%02x%02x... (len=%d)\n", job->key[0], job->key[1], job->key[2], job->key[3], job->key_len);
 		RSA_free(rsa);
-		ememuse--;
-		apppbx->e_crypt_keyengine_return = 1;
+		if (job->key_len > 0)
+			job->ret = 1;
+		else
+			job->ret = -1;
 #endif
 		break;
 
 		default:
-		PERROR("Unknown job %d\n", job);
-		apppbx->e_crypt_keyengine_return = -1;
+		PERROR("Unknown job %d\n", job->job);
+		job->ret = -1;
 	}
+}
 
-	done:
-	PDEBUG((DEBUG_EPOINT | DEBUG_CRYPT), "child process done after using libcrypto with return value %d\n", apppbx->e_crypt_keyengine_return);
+/* put job into list of done jobs, must be called with lock */
+static void keyengine_finish(struct keyengine_job *job)
+{
+	uint64_t one = 1;
 
-	/* exit process */
-	if (--apppbx->ea_endpoint->ep_use <= 0)
-		trigger_work(&apppbx->ea_endpoint->ep_delete);
-	FREE(args, sizeof(struct auth_args));
-	amemuse--;
-	return(NULL);
+	job->next = NULL;
+	*keyengine_done_last = job;
+	keyengine_done_last = &job->next;
+	if (write(keyengine_fd.fd, &one, sizeof(one)) < 0)
+		PERROR("Failed to signal key engine (errno=%d).\n", errno);
+}
+
+static void *keyengine_child(void *arg)
+{
+	struct keyengine_job *job;
+	struct sched_param schedp;
+	int ret;
+
+	/* lower priority to keep pbx running fluently */
+	if (options.schedule > 0) {
+		memset(&schedp, 0, sizeof(schedp));
+		schedp.sched_priority = 0;
+		ret = sched_setscheduler(0, SCHED_OTHER, &schedp);
+		if (ret < 0)
+			PERROR("Scheduling key engine to normal priority failed (errno = %d).\n", errno);
+	}
+
+	pthread_mutex_lock(&keyengine_mutex);
+	while (1) {
+		if ((job = keyengine_jobs)) {
+			if (!(keyengine_jobs = job->next))
+				keyengine_jobs_last = &keyengine_jobs;
+		} else if (!keyengine_quit && (job = keyengine_refills)) {
+			keyengine_refills = job->next;
+		} else {
+			if (keyengine_quit)
+				break;
+			pthread_cond_wait(&keyengine_cond, &keyengine_mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&keyengine_mutex);
+		keyengine_work(job);
+		pthread_mutex_lock(&keyengine_mutex);
+		if (job->refill) {
+			if (job->ret > 0 && keyengine_pool_count < KEYENGINE_POOL)
+				memcpy(&keyengine_pool[keyengine_pool_count++], &job->rsa, sizeof(struct rsa_key));
+			keyengine_refilling--;
+		}
+		keyengine_finish(job);
+	}
+	pthread_mutex_unlock(&keyengine_mutex);
+
+	return NULL;
+}
+
+/* take all done jobs */
+static struct keyengine_job *keyengine_take(void)
+{
+	struct keyengine_job *job;
+
+	pthread_mutex_lock(&keyengine_mutex);
+	job = keyengine_done;
+	keyengine_done = NULL;
+	keyengine_done_last = &keyengine_done;
+	pthread_mutex_unlock(&keyengine_mutex);
+
+	return job;
+}
+
+/* give result to the endpoint */
+static void keyengine_result(struct keyengine_job *job)
+{
+	class Endpoint *epoint;
+	class EndpointAppPBX *ea;
+	struct timespec now;
+	unsigned int latency;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	latency = (now.tv_sec - job->queued.tv_sec) * 1000 + (now.tv_nsec - job->queued.tv_nsec) / 1000000;
+	keyengine_latency = latency;
+	if (latency > keyengine_latency_max)
+		keyengine_latency_max = latency;
+
+	epoint = find_epoint_id(job->serial);
+	if (!epoint || !epoint->ep_app || epoint->ep_app_type != EAPP_TYPE_PBX) {
+		PDEBUG(DEBUG_CRYPT, "EPOINT(%d) is gone, result of key engine is dropped\n", job->serial);
+		return;
+	}
+	ea = (class EndpointAppPBX *)epoint->ep_app;
+	/* aborted or error was already given */
+	if (ea->e_crypt_keyengine_busy != job->job || ea->e_crypt_keyengine_id != job->id)
+		return;
+	PDEBUG((DEBUG_EPOINT | DEBUG_CRYPT), "EPOINT(%d) key engine done after %u ms with return value %d\n", job->serial, latency, job->ret);
+	ea->e_crypt_keyengine_busy = 0;
+	ea->e_crypt_keyengine_return = job->ret;
+	if (job->ret < 0) {
+		ea->cryptman_message(CK_ERROR_IND, NULL, 0);
+		return;
+	}
+	switch(job->job) {
+		case CK_GENRSA_REQ:
+		memcpy(&ea->e_crypt_rsa, &job->rsa, sizeof(struct rsa_key));
+		ea->cryptman_message(CK_GENRSA_CONF, NULL, 0);
+		break;
+		case CK_CPTRSA_REQ:
+		memcpy(ea->e_crypt_key, job->key, sizeof(ea->e_crypt_key));
+		ea->e_crypt_key_len = job->key_len;
+		memcpy(ea->e_crypt_ckey, job->ckey, sizeof(ea->e_crypt_ckey));
+		ea->e_crypt_ckey_len = job->ckey_len;
+		ea->cryptman_message(CK_CPTRSA_CONF, NULL, 0);
+		break;
+		case CK_DECRSA_REQ:
+		memcpy(ea->e_crypt_key, job->key, sizeof(ea->e_crypt_key));
+		ea->e_crypt_key_len = job->key_len;
+		ea->cryptman_message(CK_DECRSA_CONF, NULL, 0);
+		break;
+	}
+}
+
+/* main loop is woken by done jobs */
+static int keyengine_handler(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	struct keyengine_job *job, *next;
+	uint64_t count;
+
+	if (read(fd->fd, &count, sizeof(count)) < 0) {
+		/* may happen, if jobs were taken without event */
+	}
+	job = keyengine_take();
+	while (job) {
+		next = job->next;
+		if (!job->refill)
+			keyengine_result(job);
+		FREE(job, sizeof(struct keyengine_job));
+		memuse--;
+		job = next;
+	}
+
+	return 0;
+}
+
+/* start workers at first use */
+static void keyengine_start(void)
+{
+	if (keyengine_fd.inuse)
+		return;
+
+	memset(&keyengine_fd, 0, sizeof(keyengine_fd));
+	keyengine_fd.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (keyengine_fd.fd < 0)
+		FATAL("Failed to create eventfd for key engine (errno=%d)\n", errno);
+	register_fd(&keyengine_fd, LCR_FD_READ, keyengine_handler, NULL, 0);
+
+	while (keyengine_threads < KEYENGINE_WORKERS) {
+		if (pthread_create(&keyengine_tid[keyengine_threads], NULL, keyengine_child, NULL)) {
+			PERROR("failed to create keyengine-thread.\n");
+			break;
+		}
+		keyengine_threads++;
+	}
+}
+
+/* queue jobs to generate key pairs until pool will be full, must be called with lock
+ * without crypto, key pairs cannot be generated, so the pool stays empty
+ */
+static void keyengine_refill(void)
+{
+#ifdef CRYPTO
+	struct keyengine_job *job;
+
+	while (keyengine_pool_count + keyengine_refilling < KEYENGINE_POOL) {
+		job = (struct keyengine_job *)MALLOC(sizeof(struct keyengine_job));
+		memuse++;
+		job->job = CK_GENRSA_REQ;
+		job->refill = 1;
+		clock_gettime(CLOCK_MONOTONIC, &job->queued);
+		job->next = keyengine_refills;
+		keyengine_refills = job;
+		keyengine_refilling++;
+	}
+#endif
+}
+
+/* queue job, a key pair is taken from pool, if use_pool is set */
+static void keyengine_queue(struct keyengine_job *job, int use_pool)
+{
+	keyengine_start();
+	clock_gettime(CLOCK_MONOTONIC, &job->queued);
+
+	pthread_mutex_lock(&keyengine_mutex);
+	if (job->job == CK_GENRSA_REQ && use_pool) {
+		if (keyengine_pool_count) {
+			memcpy(&job->rsa, &keyengine_pool[--keyengine_pool_count], sizeof(struct rsa_key));
+			memset(&keyengine_pool[keyengine_pool_count], 0, sizeof(struct rsa_key));
+			job->ret = 1;
+			keyengine_finish(job);
+			keyengine_pool_hits++;
+			job = NULL;
+		} else
+			keyengine_pool_misses++;
+		keyengine_refill();
+	}
+	if (job && !keyengine_threads) {
+		/* no worker, do it now */
+		pthread_mutex_unlock(&keyengine_mutex);
+		keyengine_work(job);
+		pthread_mutex_lock(&keyengine_mutex);
+		keyengine_finish(job);
+		job = NULL;
+	}
+	if (job) {
+		job->next = NULL;
+		*keyengine_jobs_last = job;
+		keyengine_jobs_last = &job->next;
+	}
+	pthread_cond_broadcast(&keyengine_cond);
+	pthread_mutex_unlock(&keyengine_mutex);
 }
 
 void EndpointAppPBX::cryptman_keyengine(int job)
 {
-	struct auth_args *arg;
-	pthread_t tid;
+	struct keyengine_job *kj;
+
+	kj = (struct keyengine_job *)MALLOC(sizeof(struct keyengine_job));
+	memuse++;
+	kj->serial = ea_endpoint->ep_serial;
 
 	if (e_crypt_keyengine_busy) {
-		e_crypt_keyengine_return = -1;
 		PERROR("engine currently busy.\n");
+		/* give error for the current job */
+		kj->job = e_crypt_keyengine_busy;
+		kj->id = e_crypt_keyengine_id;
+		kj->ret = -1;
+		keyengine_start();
+		pthread_mutex_lock(&keyengine_mutex);
+		keyengine_finish(kj);
+		pthread_mutex_unlock(&keyengine_mutex);
 		return;
 	}
 
-	arg = (struct auth_args *)MALLOC(sizeof(struct auth_args));
-	arg->apppbx = this;
-	arg->job = job;
+	kj->job = job;
+	kj->id = ++keyengine_id;
+	switch(job) {
+		case CK_CPTRSA_REQ:
+		memcpy(&kj->rsa, &e_crypt_rsa, sizeof(struct rsa_key));
+		break;
+		case CK_DECRSA_REQ:
+		memcpy(&kj->rsa, &e_crypt_rsa, sizeof(struct rsa_key));
+		memcpy(kj->ckey, e_crypt_ckey, sizeof(kj->ckey));
+		kj->ckey_len = e_crypt_ckey_len;
+		break;
+	}
 	e_crypt_keyengine_return = 0;
 	e_crypt_keyengine_busy = job;
+	e_crypt_keyengine_id = kj->id;
 
-	ea_endpoint->ep_use++;
-	if ((pthread_create(&tid, NULL, keyengine_child, arg)<0)) {
-		ea_endpoint->ep_use--;
-		PERROR("failed to create keyengine-thread.\n");
-		e_crypt_keyengine_return = -1;
+	keyengine_queue(kj, 1);
+
+	PDEBUG((DEBUG_EPOINT | DEBUG_CRYPT), "EPOINT(%d) job %d queued for key engine\n", ea_endpoint->ep_serial, job);
+}
+
+/* stop workers, running jobs are finished, refill jobs are dropped */
+void keyengine_exit(void)
+{
+	struct keyengine_job *job;
+	int i;
+
+	if (!keyengine_fd.inuse)
 		return;
-	}
-	amemuse++;
 
-	PDEBUG((DEBUG_EPOINT | DEBUG_CRYPT), "send_mail(%d): child process created for doing crypto stuff\n", ea_endpoint->ep_serial);
+	pthread_mutex_lock(&keyengine_mutex);
+	keyengine_quit = 1;
+	pthread_cond_broadcast(&keyengine_cond);
+	pthread_mutex_unlock(&keyengine_mutex);
+	for (i = 0; i < keyengine_threads; i++)
+		pthread_join(keyengine_tid[i], NULL);
+	keyengine_threads = 0;
+	keyengine_quit = 0;
+
+	while ((job = keyengine_refills)) {
+		keyengine_refills = job->next;
+		FREE(job, sizeof(struct keyengine_job));
+		memuse--;
+	}
+	keyengine_refilling = 0;
+	/* results are not given anymore */
+	while ((job = keyengine_take())) {
+		while (job) {
+			struct keyengine_job *next = job->next;
+			FREE(job, sizeof(struct keyengine_job));
+			memuse--;
+			job = next;
+		}
+	}
+	memset(keyengine_pool, 0, sizeof(keyengine_pool));
+	keyengine_pool_count = 0;
 
+	unregister_fd(&keyengine_fd);
+	close(keyengine_fd.fd);
 }
 
+/* wait for done jobs, used when there is no main loop */
+static struct keyengine_job *keyengine_wait(void)
+{
+	struct keyengine_job *job;
+	struct pollfd pfd;
+	uint64_t count;
+
+	while (!(job = keyengine_take())) {
+		pfd.fd = keyengine_fd.fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll(&pfd, 1, -1);
+		if (read(keyengine_fd.fd, &count, sizeof(count)) < 0) {
+			/* may happen, if jobs were taken without event */
+		}
+	}
 
-/* handler for authentication (called by apppbx's handler)
+	return job;
+}
+
+/* do 'count' key exchanges at once and show how long they take
+ *
+ * an exchange is generating a key pair, encrypting a session key with the
+ * public key and decrypting it with the private key. it is done once with
+ * generating each key pair and once with key pairs taken from the pool.
  */
-int crypt_handler(struct lcr_timer *timer, void *instance, int index)
+int keyengine_bench(int count)
 {
-	class EndpointAppPBX *ea = (class EndpointAppPBX *)instance;
-	struct timeval current_time;
+#ifndef CRYPTO
+	printf("Not compiled with crypto.\n");
+	return -1;
+#else
+	struct bench_exchange {
+		struct timespec	start;
+		unsigned char	key[256];	/* session key before encryption */
+		int		key_len;
+	} *ex;
+	struct keyengine_job *job, *next;
+	struct timespec now;
+	unsigned int latency, min, max, total;
+	int round, done, failed, refilling, i;
+
+	if (count < 1)
+		count = 1;
+	ex = (struct bench_exchange *)MALLOC(count * sizeof(struct bench_exchange));
+	memuse++;
+
+	printf("Doing %d key exchanges at once with %d workers, %d bits rsa.\n", count, KEYENGINE_WORKERS, RSA_BITS);
+	keyengine_start();
+	for (round = 0; round < 2; round++) {
+		if (round == 1) {
+			printf("Filling pool with %d key pairs...\n", KEYENGINE_POOL);
+			pthread_mutex_lock(&keyengine_mutex);
+			keyengine_refill();
+			pthread_cond_broadcast(&keyengine_cond);
+			refilling = keyengine_refilling;
+			pthread_mutex_unlock(&keyengine_mutex);
+			while (refilling) {
+				job = keyengine_wait();
+				while (job) {
+					next = job->next;
+					FREE(job, sizeof(struct keyengine_job));
+					memuse--;
+					job = next;
+				}
+				pthread_mutex_lock(&keyengine_mutex);
+				refilling = keyengine_refilling;
+				pthread_mutex_unlock(&keyengine_mutex);
+			}
+		}
 
-	if (ea->e_crypt_keyengine_busy) {
-		if (ea->e_crypt_keyengine_return < 0) {
-			ea->e_crypt_keyengine_busy = 0;
-			ea->cryptman_message(CK_ERROR_IND, NULL, 0);
-		} else
-		if (ea->e_crypt_keyengine_return > 0) {
-			switch(ea->e_crypt_keyengine_busy) {
-				case CK_GENRSA_REQ:
-				ea->e_crypt_keyengine_busy = 0;
-				ea->cryptman_message(CK_GENRSA_CONF, NULL, 0);
-				break;
-				case CK_CPTRSA_REQ:
-				ea->e_crypt_keyengine_busy = 0;
-				ea->cryptman_message(CK_CPTRSA_CONF, NULL, 0);
-				break;
-				case CK_DECRSA_REQ:
-				ea->e_crypt_keyengine_busy = 0;
-				ea->cryptman_message(CK_DECRSA_CONF, NULL, 0);
-				break;
+		for (i = 0; i < count; i++) {
+			job = (struct keyengine_job *)MALLOC(sizeof(struct keyengine_job));
+			memuse++;
+			job->job = CK_GENRSA_REQ;
+			job->serial = i;
+			clock_gettime(CLOCK_MONOTONIC, &ex[i].start);
+			keyengine_queue(job, round);
+		}
+
+		done = failed = 0;
+		min = ~0;
+		max = total = 0;
+		while (done + failed < count) {
+			job = keyengine_wait();
+			while (job) {
+				next = job->next;
+				if (job->refill) {
+					/* pool is refilled in the background */
+				} else if (job->ret < 0) {
+					failed++;
+				} else if (job->job == CK_GENRSA_REQ) {
+					/* encrypt session key with public key */
+					job->job = CK_CPTRSA_REQ;
+					keyengine_queue(job, 0);
+					job = NULL;
+				} else if (job->job == CK_CPTRSA_REQ) {
+					/* decrypt session key with private key */
+					memcpy(ex[job->serial].key, job->key, sizeof(ex[job->serial].key));
+					ex[job->serial].key_len = job->key_len;
+					job->job = CK_DECRSA_REQ;
+					keyengine_queue(job, 0);
+					job = NULL;
+				} else if (job->key_len != ex[job->serial].key_len
+					|| memcmp(job->key, ex[job->serial].key, job->key_len)) {
+					printf("Exchange %d: decrypted session key differs.\n", job->serial);
+					failed++;
+				} else {
+					clock_gettime(CLOCK_MONOTONIC, &now);
+					latency = (now.tv_sec - ex[job->serial].start.tv_sec) * 1000 + (now.tv_nsec - ex[job->serial].start.tv_nsec) / 1000000;
+					if (latency < min)
+						min = latency;
+					if (latency > max)
+						max = latency;
+					total += latency;
+					done++;
+				}
+				if (job) {
+					FREE(job, sizeof(struct keyengine_job));
+					memuse--;
+				}
+				job = next;
 			}
 		}
+		if (done)
+			printf("%s pool: %d done, %d failed, latency min %u ms, avg %u ms, max %u ms\n", (round) ? "With" : "Without", done, failed, min, total / done, max);
+		else
+			printf("%s pool: all %d failed\n", (round) ? "With" : "Without", failed);
 	}
+	printf("%u key pairs taken from pool, %u generated while waiting.\n", keyengine_pool_hits, keyengine_pool_misses);
+
+	FREE(ex, count * sizeof(struct bench_exchange));
+	memuse--;
+	keyengine_exit();
+
+	return 0;
+#endif
+}
 
-	/* check for event, make next event */
-	gettimeofday(&current_time, NULL);
-	if (ea->e_crypt_timeout_sec) if (ea->e_crypt_timeout_sec<current_time.tv_sec || (ea->e_crypt_timeout_sec==current_time.tv_sec && ea->e_crypt_timeout_usec<current_time.tv_usec)) {
-		ea->e_crypt_timeout_sec = 0;
-		ea->e_crypt_timeout_usec = 0;
-		ea->cryptman_message(CT_TIMEOUT, NULL, 0);
-	}
 
-	/* trigger until state is 0 */
-	if (ea->e_crypt_state != CM_ST_NULL)
-		schedule_timer(&ea->e_crypt_handler, 0, 100000);
+/* handler for crypt manager timeout (called by apppbx's timer)
+ */
+int crypt_handler(struct lcr_timer *timer, void *instance, int index)
+{
+	class EndpointAppPBX *ea = (class EndpointAppPBX *)instance;
+
+	ea->cryptman_message(CT_TIMEOUT, NULL, 0);
 
 	return 0;
 }
@@ -883,8 +1220,8 @@ void EndpointAppPBX::cr_genrsa(int message, unsigned char *param, int len)
 	/* message */
 	msg = CMSG_PUBKEY;
 	CM_ADDINF(CM_INFO_MESSAGE, 1, &msg);
-	CM_ADDINF(CM_INFO_PUBKEY, e_crypt_rsa_n_len, &e_crypt_rsa_n);
-	CM_ADDINF(CM_INFO_PUBEXPONENT, e_crypt_rsa_e_len, &e_crypt_rsa_e);
+	CM_ADDINF(CM_INFO_PUBKEY, e_crypt_rsa.n_len, &e_crypt_rsa.n);
+	CM_ADDINF(CM_INFO_PUBEXPONENT, e_crypt_rsa.e_len, &e_crypt_rsa.e);
 	cryptman_msg2peer(buf);
 	/* set timeout */
 	cryptman_timeout(CM_TO_CSKEY);
@@ -916,7 +1253,7 @@ void EndpointAppPBX::cr_pubkey(int message, unsigned char *param, int len)
 	int l;
 
 	l = CM_SIZEOFINF(CM_INFO_PUBKEY);
-	if (l<1 || l>(int)sizeof(e_crypt_rsa_n)) {
+	if (l<1 || l>(int)sizeof(e_crypt_rsa.n)) {
 		size_error:
 		/* change to idle state */
 		cryptman_state(CM_ST_NULL);
@@ -929,13 +1266,13 @@ void EndpointAppPBX::cr_pubkey(int message, unsigned char *param, int len)
 		cryptman_msg2user(CU_ERROR_IND, "Remote Key Error");
 		return;
 	}
-	CM_GETINF(CM_INFO_PUBKEY, e_crypt_rsa_n);
-	e_crypt_rsa_n_len = l;
+	CM_GETINF(CM_INFO_PUBKEY, e_crypt_rsa.n);
+	e_crypt_rsa.n_len = l;
 	l = CM_SIZEOFINF(CM_INFO_PUBEXPONENT);
-	if (l<1 || l>(int)sizeof(e_crypt_rsa_e))
+	if (l<1 || l>(int)sizeof(e_crypt_rsa.e))
 		goto size_error;
-	CM_GETINF(CM_INFO_PUBEXPONENT, e_crypt_rsa_e);
-	e_crypt_rsa_e_len = l;
+	CM_GETINF(CM_INFO_PUBEXPONENT, e_crypt_rsa.e);
+	e_crypt_rsa.e_len = l;
 	/* change to generating encrypted sessnion key state */
 	cryptman_state(CM_ST_CSKEY);
 	/* start generation of crypted session key */
@@ -1497,8 +1834,9 @@ void EndpointAppPBX::cryptman_msg2user(int msg, const char *text)
 void EndpointAppPBX::cryptman_state(int state)
 {
 	PDEBUG(DEBUG_CRYPT, "Changing state from %s to %s\n", statename(e_crypt_state), statename(state));
-	if (state != CM_ST_NULL && e_crypt_state == CM_ST_NULL)
-		schedule_timer(&e_crypt_handler, 0, 100000);
+	/* no timeout in idle state */
+	if (state == CM_ST_NULL)
+		unsched_timer(&e_crypt_handler);
 	e_crypt_state = state;
 }
 
@@ -1507,16 +1845,11 @@ void EndpointAppPBX::cryptman_state(int state)
  */
 void EndpointAppPBX::cryptman_timeout(int secs)
 {
-	struct timeval current_time;
-
-	gettimeofday(&current_time, NULL);
 	if (secs) {
-		e_crypt_timeout_sec = current_time.tv_sec+secs;
-		e_crypt_timeout_usec = current_time.tv_usec;
+		schedule_timer(&e_crypt_handler, secs, 0);
 		PDEBUG(DEBUG_CRYPT, "Changing timeout to %d seconds\n", secs);
 	} else {
-		e_crypt_timeout_sec = 0;
-		e_crypt_timeout_usec = 0;
+		unsched_timer(&e_crypt_handler);
 		PDEBUG(DEBUG_CRYPT, "turning timeout off\n", secs);
 	}
 }
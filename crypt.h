@@ -22,6 +22,38 @@ enum { /* enpoint's user states */
 #define CM_TO_PUBKEY	60	/* timeout for public key generation */
 #define CM_TO_CSKEY	5	/* timeout for crypting session key */
 
+#define KEYENGINE_WORKERS	2	/* threads doing rsa jobs */
+#define KEYENGINE_POOL		4	/* rsa key pairs generated in advance */
+
+/* rsa key pair */
+struct rsa_key {
+	unsigned char	n[512];
+	unsigned char	e[16];
+	unsigned char	d[512];
+	unsigned char	p[512];
+	unsigned char	q[512];
+	unsigned char	dmp1[512];
+	unsigned char	dmq1[512];
+	unsigned char	iqmp[512];
+	int		n_len, e_len, d_len, p_len, q_len, dmp1_len, dmq1_len, iqmp_len;
+};
+
+/* job of the key engine, results are given to the endpoint by the main loop */
+struct keyengine_job {
+	struct keyengine_job	*next;
+	int			job;		/* CK_*_REQ */
+	int			refill;		/* key pair is for the pool */
+	unsigned int		id;		/* number of job, to drop results of aborted jobs */
+	unsigned int		serial;		/* endpoint that waits for the result */
+	int			ret;		/* 1 = done, -1 = failed */
+	struct timespec		queued;		/* when the job was queued (monotonic) */
+	struct rsa_key		rsa;
+	unsigned char		key[256];	/* session key */
+	int			key_len;
+	unsigned char		ckey[256];	/* encrypted session key */
+	int			ckey_len;
+};
+
 enum { /* crypt manager states */
 	CM_ST_NULL,		/* no encryption used */
 	CM_ST_IDENT,		/* find the remote pary */
@@ -171,3 +203,10 @@ void crc_init(void);
 unsigned int crc32(unsigned char *data, int len);
 int cryptman_encode_bch(unsigned char *data, int len, unsigned char *buf, int buf_len);
 int crypt_handler(struct lcr_timer *timer, void *instance, int index);
+
+extern unsigned int keyengine_pool_hits;	/* key pairs taken from pool */
+extern unsigned int keyengine_pool_misses;	/* key pairs generated while waiting */
+extern unsigned int keyengine_latency;		/* ms until job was done (last job) */
+extern unsigned int keyengine_latency_max;
+int keyengine_bench(int count);
+void keyengine_exit(void);
@@ -33,6 +33,8 @@ Pdss1::Pdss1(int type, struct mISDNport *mISDNport, char *portname, struct port_
 	p_m_d_ntmode = mISDNport->ntmode;
 	p_m_d_tespecial = mISDNport->tespecial;
 	p_m_d_l3id = 0;
+	p_m_d_l3id_next = NULL;
+	p_m_d_hold_next = NULL;
 	memset(&p_m_d_delete, 0, sizeof(p_m_d_delete));
 	add_work(&p_m_d_delete, delete_event, this, 0);
 	p_m_d_ces = -1;
@@ -51,6 +53,8 @@ Pdss1::Pdss1(int type, struct mISDNport *mISDNport, char *portname, struct port_
 Pdss1::~Pdss1()
 {
 	del_work(&p_m_d_delete);
+	set_l3id(0);
+	set_hold(0);
 
 	/* remove queued message */
 	if (p_m_d_notify_pending)
@@ -356,14 +360,9 @@ int Pdss1::hunt_bchannel(int channel, int exclusive)
 				if (p_m_mISDNport->b_reserved >= p_m_mISDNport->b_num)
 					break; /* all channel in use or reserverd */
 				/* find channel */
-				i = 0;
-				while(i < p_m_mISDNport->b_num) {
-					if (p_m_mISDNport->b_port[i] == NULL) {
-						channel = i+1+(i>=15);
-						break;
-					}
-					i++;
-				}
+				i = first_free_bchannel(p_m_mISDNport);
+				if (i >= 0)
+					channel = i+1+(i>=15);
 				break;
 
 				default:
@@ -433,7 +432,7 @@ void Pdss1::setup_ind(unsigned int cmd, unsigned int pid, struct l3_msg *l3m)
 		trigger_work(&p_m_d_delete);
 		return;
 	}
-	p_m_d_l3id = pid;
+	set_l3id(pid);
 	p_m_d_ces = pid >> 16;
 	end_trace();
 
@@ -1382,7 +1381,7 @@ void Pdss1::hold_ind(unsigned int cmd, unsigned int pid, struct l3_msg *l3m)
 	drop_bchannel();
 
 	/* set hold state */
-	p_m_hold = 1;
+	set_hold(1);
 #if 0
 	epoint = find_epoint_id(ACTIVE_EPOINT(p_epointlist));
 	if (epoint && p_m_d_ntmode) {
@@ -1444,7 +1443,7 @@ void Pdss1::retrieve_ind(unsigned int cmd, unsigned int pid, struct l3_msg *l3m)
 	bchannel_event(p_m_mISDNport, p_m_b_index, B_EVENT_USE);
 
 	/* set hold state */
-	p_m_hold = 0;
+	set_hold(0);
 	unsched_timer(&p_m_timeout);
 
 	/* acknowledge retrieve */
@@ -1553,7 +1552,7 @@ void Pdss1::resume_ind(unsigned int cmd, unsigned int pid, struct l3_msg *l3m)
 		trigger_work(&p_m_d_delete);
 		return;
 	}
-	p_m_d_l3id = pid;
+	set_l3id(pid);
 	p_m_d_ces = pid >> 16;
 	end_trace();
 
@@ -1819,7 +1818,7 @@ void Pdss1::message_isdn(unsigned int cmd, unsigned int pid, struct l3_msg *l3m)
 		l1l2l3_trace_header(p_m_mISDNport, this, L3_RELEASE_L3ID_IND, DIRECTION_IN);
 		add_trace("callref", NULL, "0x%x", p_m_d_l3id);
 		end_trace();
-		p_m_d_l3id = 0;
+		set_l3id(0);
 		trigger_work(&p_m_d_delete);
 		p_m_d_ces = -1;
 		/* sending release to endpoint in case we still have an endpoint
@@ -2020,10 +2019,10 @@ void Pdss1::message_setup(unsigned int epoint_id, int message_id, union paramete
 	mt_assign_pid = 0;
 	ret = p_m_mISDNport->ml3->to_layer3(p_m_mISDNport->ml3, MT_ASSIGN, 0, NULL);
 	if (mt_assign_pid == 0 || ret < 0)
-	p_m_d_l3id = mt_assign_pid;
+	set_l3id(mt_assign_pid);
 	mt_assign_pid = ~0;
 #else
-	p_m_d_l3id = request_new_pid(p_m_mISDNport->ml3);
+	set_l3id(request_new_pid(p_m_mISDNport->ml3));
 	if (p_m_d_l3id == MISDN_PID_NONE)
 #endif
 	{
@@ -2040,7 +2039,7 @@ void Pdss1::message_setup(unsigned int epoint_id, int message_id, union paramete
 		return;
 	}
 #ifdef OLD_MT_ASSIGN
-	p_m_d_l3id = mt_assign_pid;
+	set_l3id(mt_assign_pid);
 	mt_assign_pid = ~0;
 #endif
 	add_trace("callref", "new", "0x%x", p_m_d_l3id);
@@ -2894,6 +2893,99 @@ int Pdss1::message_epoint(unsigned int epoint_id, int message_id, union paramete
 /*
  * data from isdn-stack (layer-3) to pbx (port class)
  */
+/*
+ * call reference hash
+ *
+ * each mISDNport keeps its Pdss1 ports in a hash by the value of the call
+ * reference, so stack2manager() does not need to scan all ports of all
+ * mISDNports for every message. the ports of a bucket are ordered by serial,
+ * so if more ports match, the oldest one is found, as it was when scanning
+ * the port list.
+ */
+static inline int l3id_bucket(unsigned int l3id)
+{
+	return (l3id & MISDN_PID_CRVAL_MASK) & (L3ID_HASH - 1);
+}
+
+void Pdss1::set_l3id(unsigned int l3id)
+{
+	class Pdss1 **pdss1p;
+
+	/* unlink from old bucket */
+	if (p_m_d_l3id) {
+		pdss1p = &p_m_mISDNport->l3id_hash[l3id_bucket(p_m_d_l3id)];
+		while(*pdss1p && *pdss1p != this)
+			pdss1p = &((*pdss1p)->p_m_d_l3id_next);
+		if (*pdss1p)
+			*pdss1p = p_m_d_l3id_next;
+		p_m_d_l3id_next = NULL;
+	}
+
+	p_m_d_l3id = l3id;
+
+	/* link to new bucket */
+	if (p_m_d_l3id) {
+		pdss1p = &p_m_mISDNport->l3id_hash[l3id_bucket(p_m_d_l3id)];
+		while(*pdss1p && (*pdss1p)->p_serial < p_serial)
+			pdss1p = &((*pdss1p)->p_m_d_l3id_next);
+		p_m_d_l3id_next = *pdss1p;
+		*pdss1p = this;
+	}
+}
+
+/*
+ * ports on hold are listed at their mISDNport, so a terminal finds its
+ * held calls without searching all endpoints, see EndpointAppPBX::join_join()
+ */
+void Pdss1::set_hold(int hold)
+{
+	class Pdss1 **pdss1p;
+
+	if (p_m_hold == hold)
+		return;
+	p_m_hold = hold;
+
+	if (hold) {
+		p_m_d_hold_next = p_m_mISDNport->hold_first;
+		p_m_mISDNport->hold_first = this;
+		return;
+	}
+	pdss1p = &p_m_mISDNport->hold_first;
+	while(*pdss1p && *pdss1p != this)
+		pdss1p = &((*pdss1p)->p_m_d_hold_next);
+	if (*pdss1p)
+		*pdss1p = p_m_d_hold_next;
+	p_m_d_hold_next = NULL;
+}
+
+/* lookups of the current and of the last second */
+static unsigned int l3id_lookups = 0, l3id_lookups_last = 0;
+static time_t l3id_lookups_second = 0;
+
+static void count_l3id_lookup(void)
+{
+	time_t now = time(NULL);
+
+	if (now != l3id_lookups_second) {
+		l3id_lookups_last = (now == l3id_lookups_second + 1) ? l3id_lookups : 0;
+		l3id_lookups = 0;
+		l3id_lookups_second = now;
+	}
+	l3id_lookups++;
+}
+
+/* lookups per second */
+unsigned int l3id_lookup_rate(void)
+{
+	time_t now = time(NULL);
+
+	if (now == l3id_lookups_second)
+		return l3id_lookups_last;
+	if (now == l3id_lookups_second + 1)
+		return l3id_lookups;
+	return 0;
+}
+
 int stack2manager(struct mISDNport *mISDNport, unsigned int cmd, unsigned int pid, struct l3_msg *l3m)
 {
 	class Port *port;
@@ -2907,27 +2999,22 @@ int stack2manager(struct mISDNport *mISDNport, unsigned int cmd, unsigned int pi
 		return(0);
 	}
 
-	/* find Port object of type ISDN */
-	port = port_first;
-	while(port) {
-		/* are we ISDN ? */
-		if ((port->p_type & PORT_CLASS_mISDN_MASK) == PORT_CLASS_DSS1) {
-			pdss1 = (class Pdss1 *)port;
-			/* check out correct stack and id */
-			if (pdss1->p_m_mISDNport == mISDNport) {
-				if (pdss1->p_m_d_l3id & MISDN_PID_CR_FLAG) {
-					/* local callref, so match value only */
-					if ((pdss1->p_m_d_l3id & MISDN_PID_CRVAL_MASK) == (pid & MISDN_PID_CRVAL_MASK))
-						break; // found
-				} else {
-					/* remote callref, ref + channel id */
-					if (pdss1->p_m_d_l3id == pid)
-						break; // found
-				}
-			}
+	/* find Port object by call reference */
+	count_l3id_lookup();
+	pdss1 = mISDNport->l3id_hash[l3id_bucket(pid)];
+	while(pdss1) {
+		if (pdss1->p_m_d_l3id & MISDN_PID_CR_FLAG) {
+			/* local callref, so match value only */
+			if ((pdss1->p_m_d_l3id & MISDN_PID_CRVAL_MASK) == (pid & MISDN_PID_CRVAL_MASK))
+				break; // found
+		} else {
+			/* remote callref, ref + channel id */
+			if (pdss1->p_m_d_l3id == pid)
+				break; // found
 		}
-		port = port->next;
+		pdss1 = pdss1->p_m_d_l3id_next;
 	}
+	port = pdss1;
 
 	/* aktueller prozess */
 	if (port) {
@@ -2938,7 +3025,7 @@ int stack2manager(struct mISDNport *mISDNport, unsigned int cmd, unsigned int pi
 			/* nt-library now gives us a new id via CC_SETUP_CONFIRM */
 			if ((pdss1->p_m_d_l3id&MISDN_PID_CRTYPE_MASK) != MISDN_PID_MASTER)
 				PERROR("    strange setup-procid 0x%x\n", pdss1->p_m_d_l3id);
-			pdss1->p_m_d_l3id = pid;
+			pdss1->set_l3id(pid);
 			if (port->p_state == PORT_STATE_CONNECT)
 				pdss1->p_m_d_ces = pid >> 16;
 			add_trace("callref", "new", "0x%x", pdss1->p_m_d_l3id);
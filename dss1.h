@@ -15,7 +15,11 @@ class Pdss1 : public PmISDN
 	public:
 	Pdss1(int type, struct mISDNport *mISDNport, char *portname, struct port_settings *settings, int channel, int exclusive, int mode);
 	~Pdss1();
-	unsigned int p_m_d_l3id;		/* current l3 process id */
+	unsigned int p_m_d_l3id;		/* current l3 process id, use set_l3id() to change */
+	class Pdss1 *p_m_d_l3id_next;		/* next port in call reference hash */
+	void set_l3id(unsigned int l3id);
+	class Pdss1 *p_m_d_hold_next;		/* next port on hold at same mISDNport */
+	void set_hold(int hold);
 	struct lcr_work p_m_d_delete;		/* timer for audio transmission */
 	void message_isdn(unsigned int cmd, unsigned int pid, struct l3_msg *l3m);
 	int p_m_d_ces;				/* ntmode: tei&sapi */
@@ -103,4 +107,5 @@ class Pdss1 : public PmISDN
 
 };
 
+unsigned int l3id_lookup_rate(void);
 
@@ -0,0 +1,150 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** software DTMF decoder                                                     **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO decode DTMF?
+
+mISDN ports get DTMF from the DSP of the kernel. Ports that receive audio in
+userspace (SIP and GSM) may decode DTMF with this decoder, if 'inband-dtmf' is
+given for the interface.
+
+The received audio is cut into windows of DTMF_DECODER_NPOINTS samples. The
+windows of all lines are queued to one batch of the tone detector engine (see
+goertzel.c), which filters all eight DTMF frequencies of all windows at once.
+
+A window holds a digit, if the loudest frequency of each group is above
+DTMF_MIN_DB, the other frequencies of each group are DTMF_RELATIVE below and
+the levels of both groups do not differ more than the allowed twist. A digit
+is reported, if two windows in a row hold it. It is reported again only after
+two windows in a row did not hold it.
+
+*/
+
+#include "main.h"
+
+#define DTMF_MIN_DB	0.03162278	/* -30 db, each frequency */
+#define DTMF_RELATIVE	0.25		/* power of other frequencies of a group (-6 db) */
+#define DTMF_TWIST	6.30957344	/* power of high group may exceed low group (8 db) */
+#define DTMF_REV_TWIST	2.51188643	/* power of low group may exceed high group (4 db) */
+
+/* low group, high group */
+static const double dtmf_frequency[8] =
+	{ 697, 770, 852, 941, 1209, 1336, 1477, 1633 };
+
+static const char dtmf_digit[4][4] =
+{
+	{'1', '2', '3', 'A'},
+	{'4', '5', '6', 'B'},
+	{'7', '8', '9', 'C'},
+	{'*', '0', '#', 'D'}
+};
+
+static struct goertzel_tones dtmf_tones;
+static struct goertzel_batch dtmf_batch; /* windows of all lines */
+static int dtmf_tones_init = 0;
+static double dtmf_min_power; /* power of a frequency at DTMF_MIN_DB */
+
+/* digit of the squared magnitudes of one window */
+static char dtmf_window_digit(const long long *power)
+{
+	double low, high;
+	int row = 0, col = 4;
+	int i;
+
+	for (i = 1; i < 4; i++) {
+		if (power[i] > power[row])
+			row = i;
+		if (power[i + 4] > power[col])
+			col = i + 4;
+	}
+	low = (double)power[row];
+	high = (double)power[col];
+
+	/* must be at least -30 db */
+	if (low < dtmf_min_power || high < dtmf_min_power)
+		return ' ';
+	/* twist */
+	if (high > low * DTMF_TWIST || low > high * DTMF_REV_TWIST)
+		return ' ';
+	/* other frequencies of each group */
+	for (i = 0; i < 4; i++) {
+		if (i != row && (double)power[i] > low * DTMF_RELATIVE)
+			return ' ';
+		if (i + 4 != col && (double)power[i + 4] > high * DTMF_RELATIVE)
+			return ' ';
+	}
+
+	return dtmf_digit[row][col - 4];
+}
+
+static void dtmf_window(void *instance, const long long *power, int span)
+{
+	struct dtmf_decoder *decoder = (struct dtmf_decoder *)instance;
+	char digit = ' ';
+
+	if (power)
+		digit = dtmf_window_digit(power);
+
+	/* two windows in a row */
+	if (digit == decoder->last && digit != decoder->digit) {
+		decoder->digit = digit;
+		if (digit != ' ') {
+			PDEBUG(DEBUG_PORT, "DTMF digit '%c' detected\n", digit);
+			decoder->cb(decoder->instance, digit);
+		}
+	}
+	decoder->last = digit;
+}
+
+void dtmf_decoder_init(struct dtmf_decoder *decoder, void (*cb)(void *instance, char digit), void *instance)
+{
+	if (!dtmf_tones_init) {
+		goertzel_tones(&dtmf_tones, dtmf_frequency, 8, DTMF_DECODER_NPOINTS);
+		/* peak to peak of a single frequency at minimum level */
+		goertzel_batch_init(&dtmf_batch, &dtmf_tones, (int)(DTMF_MIN_DB * 65536.0));
+		dtmf_min_power = DTMF_MIN_DB * GOERTZEL_FULLSCALE * DTMF_DECODER_NPOINTS;
+		dtmf_min_power *= dtmf_min_power;
+		dtmf_tones_init = 1;
+	}
+
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->last = ' ';
+	decoder->digit = ' ';
+	decoder->cb = cb;
+	decoder->instance = instance;
+}
+
+/* windows still queued must not be reported */
+void dtmf_decoder_exit(struct dtmf_decoder *decoder)
+{
+	if (dtmf_tones_init)
+		goertzel_cancel(&dtmf_batch, decoder);
+}
+
+/* received audio of a line */
+void dtmf_decode(struct dtmf_decoder *decoder, unsigned char *data, int len)
+{
+	int tocopy;
+
+	while (len) {
+		tocopy = DTMF_DECODER_NPOINTS - decoder->count;
+		if (tocopy > len)
+			tocopy = len;
+		memcpy(decoder->buffer + decoder->count, data, tocopy);
+		decoder->count += tocopy;
+		data += tocopy;
+		len -= tocopy;
+		if (decoder->count < DTMF_DECODER_NPOINTS)
+			break;
+		goertzel_queue(&dtmf_batch, decoder->buffer, dtmf_window, decoder);
+		decoder->count = 0;
+	}
+}
+
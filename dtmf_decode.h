@@ -0,0 +1,27 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** software DTMF decoder header file                                         **
+**                                                                           **
+\*****************************************************************************/
+
+#define DTMF_DECODER_NPOINTS	102	/* size of goertzel window (12.75 ms) */
+
+/* decoder of one line */
+struct dtmf_decoder {
+	int			count;		/* samples in buffer */
+	unsigned char		buffer[DTMF_DECODER_NPOINTS];
+	char			last;		/* digit of last window */
+	char			digit;		/* digit that was reported, until it is gone */
+	void			(*cb)(void *instance, char digit);
+	void			*instance;
+};
+
+void dtmf_decoder_init(struct dtmf_decoder *decoder, void (*cb)(void *instance, char digit), void *instance);
+void dtmf_decoder_exit(struct dtmf_decoder *decoder);
+void dtmf_decode(struct dtmf_decoder *decoder, unsigned char *data, int len);
+
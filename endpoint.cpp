@@ -14,6 +14,7 @@
 unsigned int epoint_serial = 1; /* initial value must be 1, because 0== no epoint */
 
 class Endpoint *epoint_first = NULL;
+static struct id_hash epoint_hash; /* endpoints by serial */
 
 
 /*
@@ -21,16 +22,7 @@ class Endpoint *epoint_first = NULL;
  */ 
 class Endpoint *find_epoint_id(unsigned int epoint_id)
 {
-	class Endpoint *epoint = epoint_first;
-
-	while(epoint) {
-//printf("comparing: '%s' with '%s'\n", name, epoint->name);
-		if (epoint->ep_serial == epoint_id)
-			return(epoint);
-		epoint = epoint->next;
-	}
-
-	return(NULL);
+	return((class Endpoint *)id_hash_find(&epoint_hash, epoint_id));
 }
 
 int delete_endpoint(struct lcr_work *work, void *instance, int index);
@@ -62,6 +54,7 @@ Endpoint::Endpoint(unsigned int port_id, unsigned int join_id)
 
 	/* serial */
 	ep_serial = epoint_serial++;
+	id_hash_add(&epoint_hash, &ep_id_entry, ep_serial, this);
 
 	/* link to join or port */
 	if (port_id) {
@@ -131,6 +124,7 @@ Endpoint::~Endpoint(void)
 	if (temp == 0)
 		FATAL("Endpoint not in Endpoint's list.\n");
 	*tempp = next;
+	id_hash_remove(&epoint_hash, &ep_id_entry);
 
 	del_work(&ep_delete);
 
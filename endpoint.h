@@ -26,6 +26,7 @@ class Endpoint
 	~Endpoint();
 	class Endpoint		*next;		/* next in list */
 	unsigned int		ep_serial;	/* a unique serial to identify */
+	struct id_hash_entry	ep_id_entry;	/* entry in hash of endpoint serials */
 
 	/* applocaton relation */
 	int			ep_app_type;
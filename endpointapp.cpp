@@ -66,255 +66,211 @@ class EndpointApp *new_endpointapp(class Endpoint *epoint, int origin, int type)
 }
 
 #ifdef WITH_MISDN
+/* reasons for skipping a port, counted for the trace of hunt_port() */
+enum {
+	HUNT_SKIP_NOPORT,
+	HUNT_SKIP_BLOCKED,
+	HUNT_SKIP_L2DOWN,
+	HUNT_SKIP_BUSY,
+	HUNT_SKIP_NUM,
+};
+static const char *hunt_skip_name[HUNT_SKIP_NUM] = { "no port", "blocked", "l2 down", "busy" };
+static const char *hunt_name[] = { "linear", "roundrobin", "leastloaded", "weighted" };
+
 /*
- * hunts an mISDNport that is available for an outgoing call
- * if no ifname was given, any interface that is not an extension
- * will be searched.
+ * select channel from the out_channel list of a port
+ * returns 0, if there is no channel available
  */
-struct mISDNport *EndpointApp::hunt_port(char *ifname, int *channel)
+static int hunt_channel(struct interface_port *ifport, struct mISDNport *mISDNport)
 {
-	struct interface *interface;
-	struct interface_port *ifport, *ifport_start;
-	struct select_channel *selchannel; 
-	struct mISDNport *mISDNport;
-	int index, i;
-	int there_is_an_external = 0;
-
-	interface = interface_first;
+	struct select_channel *selchannel;
+	int i;
 
-	/* first find the given interface or, if not given, one with no extension */
-	checknext:
-	if (!interface) {
-		if (!there_is_an_external && !(ifname && ifname[0])) {
-			trace_header("CHANNEL SELECTION (no external interface specified)", DIRECTION_NONE);
-			add_trace("info", NULL, "Add 'extern' parameter to interface.conf.");
-			end_trace();
-		}
-		return(NULL);
+#ifdef WITH_SS5
+	if (mISDNport->ss5) {
+		class Pss5 *port;
+		port = ss5_hunt_line(mISDNport);
+		return((port) ? port->p_m_b_channel : 0);
 	}
-
-	/* check for given interface */
-	if (ifname && ifname[0]) {
-		if (!strcasecmp(interface->name, ifname)) {
-			/* found explicit interface */
-			trace_header("CHANNEL SELECTION (found given interface)", DIRECTION_NONE);
-			add_trace("interface", NULL, "%s", ifname);
-			end_trace();
-			goto foundif;
-		}
-
-	} else {
-		if (interface->external) {
-			there_is_an_external = 1;
-			/* found non extension */
-			trace_header("CHANNEL SELECTION (found external interface)", DIRECTION_NONE);
-			add_trace("interface", NULL, "%s", interface->name);
-			end_trace();
-			goto foundif;
+#endif
+	selchannel = ifport->out_channel;
+	while(selchannel) {
+		switch(selchannel->channel) {
+			case CHANNEL_FREE: /* free channel */
+			if (mISDNport->b_reserved >= mISDNport->b_num)
+				break; /* all channel in use or reserverd */
+			i = first_free_bchannel(mISDNport);
+			if (i >= 0)
+				return(i+1+(i>=15));
+			break;
+
+			case CHANNEL_ANY: /* don't ask for channel */
+			if (mISDNport->b_reserved >= mISDNport->b_num)
+				break; /* all channel in use or reserverd */
+			return(CHANNEL_ANY);
+
+			case CHANNEL_NO: /* call waiting */
+			return(CHANNEL_NO);
+
+			default:
+			if (selchannel->channel<1 || selchannel->channel==16)
+				break; /* invalid channels */
+			i = selchannel->channel-1-(selchannel->channel>=17);
+			if (i >= mISDNport->b_num)
+				break; /* channel not in port */
+			if (mISDNport->b_port[i] == NULL)
+				return(selchannel->channel);
+			break;
 		}
+		selchannel = selchannel->next;
 	}
 
-	interface = interface->next;
-	goto checknext;
-foundif:
+	return(0);
+}
 
-	/* see if interface has ports */
-	if (!interface->ifport) {
-		/* no ports */
-		trace_header("CHANNEL SELECTION (active ports, skipping)", DIRECTION_NONE);
-		add_trace("interface", NULL, "%s", interface->name);
-		end_trace();
-		interface = interface->next;
-		goto checknext;
-	}
+/*
+ * returns 1, if the hunt policy prefers port a to port b
+ */
+static int hunt_prefer(int hunt, struct interface_port *a, struct interface_port *b)
+{
+	int weight_a = (a->weight > 0) ? a->weight : 1;
+	int weight_b = (b->weight > 0) ? b->weight : 1;
 
-	/* select port by algorithm */
-	ifport_start = interface->ifport;
-	index = 0;
-	if (interface->hunt == HUNT_ROUNDROBIN) {
-		while(ifport_start->next && index<interface->hunt_next) {
-			ifport_start = ifport_start->next;
-			index++;
-		}
-		trace_header("CHANNEL SELECTION (starting round-robin)", DIRECTION_NONE);
-		add_trace("port", NULL, "%d", ifport_start->portnum);
-		add_trace("position", NULL, "%d", index);
-		end_trace();
+	switch(hunt) {
+		case HUNT_LEASTLOADED:
+		return(a->mISDNport->b_free_num > b->mISDNport->b_free_num);
+
+		case HUNT_WEIGHTED:
+		/* used channels per weight */
+		return((a->mISDNport->b_num - a->mISDNport->b_free_num) * weight_b
+			< (b->mISDNport->b_num - b->mISDNport->b_free_num) * weight_a);
 	}
 
-	/* loop ports */
-	ifport = ifport_start;
-	nextport:
+	return(0);
+}
 
-	/* see if port is available */
-	if (!ifport->mISDNport) {
-		trace_header("CHANNEL SELECTION (port not available, skipping)", DIRECTION_NONE);
-		add_trace("port", NULL, "%d", ifport->portnum);
-		add_trace("position", NULL, "%d", index);
-		end_trace();
-		goto portbusy;
-	}
-	mISDNport = ifport->mISDNport;
+/*
+ * hunts an mISDNport that is available for an outgoing call
+ * if no ifname was given, any interface that is not an extension
+ * will be searched.
+ * linear and round-robin hunting take the first port with a channel, the
+ * other policies compare all ports. the selection is traced as one record.
+ */
+struct mISDNport *EndpointApp::hunt_port(char *ifname, int *channel)
+{
+	struct interface *interface;
+	struct interface_port *ifport, *ifport_start, *found = NULL;
+	struct mISDNport *mISDNport;
+	int skipped[HUNT_SKIP_NUM], skipped_interfaces = 0;
+	int index, found_index = 0, found_channel = 0, ch, i;
+	int there_is_an_external = 0;
 
-	/* see if port is administratively blocked */
-	if (ifport->block) {
-		trace_header("CHANNEL SELECTION (port blocked by admin, skipping)", DIRECTION_NONE);
-		add_trace("port", NULL, "%d", ifport->portnum);
-		add_trace("position", NULL, "%d", index);
-		end_trace();
-		goto portbusy;
-	}
+	memset(skipped, 0, sizeof(skipped));
 
-	/* see if link is up on PTP*/
-	if (mISDNport->l2hold && mISDNport->l2link<1) {
-		trace_header("CHANNEL SELECTION (port's layer 2 is down, skipping)", DIRECTION_NONE);
-		add_trace("port", NULL, "%d", ifport->portnum);
-		add_trace("position", NULL, "%d", index);
-		end_trace();
-		goto portbusy;
-	}
+	/* find the given interface or, if not given, one with no extension */
+	interface = interface_first;
+	while(interface) {
+		if (ifname && ifname[0]) {
+			if (strcasecmp(interface->name, ifname)) {
+				interface = interface->next;
+				continue;
+			}
+		} else {
+			if (!interface->external) {
+				interface = interface->next;
+				continue;
+			}
+			there_is_an_external = 1;
+		}
 
-	/* check for channel form selection list */
-	*channel = 0;
-#ifdef WITH_SS5
-	if (mISDNport->ss5) {
-		class Pss5 *port;
-		port = ss5_hunt_line(mISDNport);
-		if (port) {
-			*channel = port->p_m_b_channel;
-			trace_header("CHANNEL SELECTION (selecting SS5 channel)", DIRECTION_NONE);
-			add_trace("port", NULL, "%d", ifport->portnum);
-			add_trace("position", NULL, "%d", index);
-			add_trace("channel", NULL, "%d", *channel);
-			end_trace();
+		/* see if interface has ports and free channels */
+		if (!interface->ifport || (!interface->b_free && !interface->hunt_nofree)) {
+			skipped_interfaces++;
+			goto nextif;
 		}
-	} else
-#endif
-	{
-		selchannel = ifport->out_channel;
-		while(selchannel) {
-			switch(selchannel->channel) {
-				case CHANNEL_FREE: /* free channel */
-				if (mISDNport->b_reserved >= mISDNport->b_num)
-					break; /* all channel in use or reserverd */
-				/* find channel */
-				i = 0;
-				while(i < mISDNport->b_num) {
-					if (mISDNport->b_port[i] == NULL) {
-						*channel = i+1+(i>=15);
-						trace_header("CHANNEL SELECTION (selecting free channel)", DIRECTION_NONE);
-						add_trace("port", NULL, "%d", ifport->portnum);
-						add_trace("position", NULL, "%d", index);
-						add_trace("channel", NULL, "%d", *channel);
-						end_trace();
-						break;
-					}
-					i++;
-				}
-				if (*channel)
-					break;
-				trace_header("CHANNEL SELECTION (no channel is 'free')", DIRECTION_NONE);
-				add_trace("port", NULL, "%d", ifport->portnum);
-				add_trace("position", NULL, "%d", index);
-				end_trace();
-				break;
-
-				case CHANNEL_ANY: /* don't ask for channel */
-				if (mISDNport->b_reserved >= mISDNport->b_num) {
-					trace_header("CHANNEL SELECTION (cannot ask for 'any' channel, all reserved)", DIRECTION_NONE);
-					add_trace("port", NULL, "%d", ifport->portnum);
-					add_trace("position", NULL, "%d", index);
-					add_trace("total", NULL, "%d", mISDNport->b_num);
-					add_trace("reserved", NULL, "%d", mISDNport->b_reserved);
-					end_trace();
-					break; /* all channel in use or reserverd */
-				}
-				trace_header("CHANNEL SELECTION (using 'any' channel)", DIRECTION_NONE);
-				add_trace("port", NULL, "%d", ifport->portnum);
-				add_trace("position", NULL, "%d", index);
-				end_trace();
-				*channel = CHANNEL_ANY;
-				break;
-
-				case CHANNEL_NO: /* call waiting */
-				trace_header("CHANNEL SELECTION (using 'no' channel, call-waiting)", DIRECTION_NONE);
-				add_trace("port", NULL, "%d", ifport->portnum);
-				add_trace("position", NULL, "%d", index);
-				end_trace();
-				*channel = CHANNEL_NO;
-				break;
-
-				default:
-				if (selchannel->channel<1 || selchannel->channel==16) {
-					trace_header("CHANNEL SELECTION (channel out of range)", DIRECTION_NONE);
-					add_trace("port", NULL, "%d", ifport->portnum);
-					add_trace("position", NULL, "%d", index);
-					add_trace("channel", NULL, "%d", selchannel->channel);
-					end_trace();
-					break; /* invalid channels */
-				}
-				i = selchannel->channel-1-(selchannel->channel>=17);
-				if (i >= mISDNport->b_num) {
-					trace_header("CHANNEL SELECTION (channel out of range)", DIRECTION_NONE);
-					add_trace("port", NULL, "%d", ifport->portnum);
-					add_trace("position", NULL, "%d", index);
-					add_trace("channel", NULL, "%d", selchannel->channel);
-					add_trace("channels", NULL, "%d", mISDNport->b_num);
-					end_trace();
-					break; /* channel not in port */
-				}
-				if (mISDNport->b_port[i] == NULL) {
-					*channel = selchannel->channel;
-					trace_header("CHANNEL SELECTION (selecting given channel)", DIRECTION_NONE);
-					add_trace("port", NULL, "%d", ifport->portnum);
-					add_trace("position", NULL, "%d", index);
-					add_trace("channel", NULL, "%d", *channel);
-					end_trace();
-					break;
-				}
-				break;
+
+		/* select first port by algorithm */
+		ifport_start = interface->ifport;
+		index = 0;
+		if (interface->hunt != HUNT_LINEAR) {
+			while(ifport_start->next && index<interface->hunt_next) {
+				ifport_start = ifport_start->next;
+				index++;
 			}
-			if (*channel)
-				break; /* found channel */
-			selchannel = selchannel->next;
 		}
-	}
 
-	/* if channel was found, return mISDNport and channel */
-	if (*channel) {
-		/* setting next port to start next time */
-		if (interface->hunt == HUNT_ROUNDROBIN) {
+		/* loop ports */
+		ifport = ifport_start;
+		do {
+			mISDNport = ifport->mISDNport;
+			if (!mISDNport)
+				skipped[HUNT_SKIP_NOPORT]++;
+			else if (ifport->block)
+				skipped[HUNT_SKIP_BLOCKED]++;
+			else if (mISDNport->l2hold && mISDNport->l2link<1)
+				skipped[HUNT_SKIP_L2DOWN]++;
+			else if (!(ch = hunt_channel(ifport, mISDNport)))
+				skipped[HUNT_SKIP_BUSY]++;
+			else if (!found || hunt_prefer(interface->hunt, ifport, found)) {
+				found = ifport;
+				found_index = index;
+				found_channel = ch;
+				if (interface->hunt == HUNT_LINEAR || interface->hunt == HUNT_ROUNDROBIN)
+					break;
+			}
+			/* go next port, until all ports are checked */
 			index++;
-			if (!ifport->next)
+			ifport = ifport->next;
+			if (!ifport) {
 				index = 0;
-			interface->hunt_next = index;
-		}
-		
-		return(mISDNport);
-	}
+				ifport = interface->ifport;
+			}
+		} while(ifport != ifport_start);
 
-	trace_header("CHANNEL SELECTION (skipping, no channel found)", DIRECTION_NONE);
-	add_trace("port", NULL, "%d", ifport->portnum);
-	add_trace("position", NULL, "%d", index);
-	end_trace();
+		if (found) {
+			/* setting next port to start next time */
+			if (interface->hunt != HUNT_LINEAR)
+				interface->hunt_next = (found->next) ? found_index + 1 : 0;
+			break;
+		}
 
-	portbusy:
-	/* go next port, until all ports are checked */
-	index++;
-	ifport = ifport->next;
-	if (!ifport) {
-		index = 0;
-		ifport = interface->ifport;
+		nextif:
+		if (ifname)
+			break;
+		interface = interface->next;
 	}
-	if (ifport != ifport_start)
-		goto nextport;
 
-	if (!ifname) {
-		interface = interface->next;
-		goto checknext;
+	trace_header("CHANNEL SELECTION", DIRECTION_NONE);
+	if (interface) {
+		add_trace("interface", NULL, "%s", interface->name);
+		add_trace("hunt", NULL, "%s", hunt_name[interface->hunt]);
+	} else if (ifname && ifname[0])
+		add_trace("interface", NULL, "%s (not found)", ifname);
+	if (skipped_interfaces)
+		add_trace("skipped", "interfaces", "%d", skipped_interfaces);
+	for (i = 0; i < HUNT_SKIP_NUM; i++) {
+		if (skipped[i])
+			add_trace("skipped", hunt_skip_name[i], "%d", skipped[i]);
+	}
+	if (!found) {
+		if (!there_is_an_external && !(ifname && ifname[0]))
+			add_trace("info", NULL, "Add 'extern' parameter to interface.conf.");
+		add_trace("conclusion", NULL, "no channel found");
+		end_trace();
+		return(NULL);
 	}
+	add_trace("port", NULL, "%d", found->portnum);
+	add_trace("position", NULL, "%d", found_index);
+	if (found_channel == CHANNEL_ANY)
+		add_trace("channel", NULL, "any");
+	else if (found_channel == CHANNEL_NO)
+		add_trace("channel", NULL, "no (call-waiting)");
+	else
+		add_trace("channel", NULL, "%d", found_channel);
+	end_trace();
 
-	return(NULL); /* no port found */
+	*channel = found_channel;
+	return(found->mISDNport);
 }
 #endif
 
@@ -29,11 +29,12 @@ const char *ext_yesno[] = {
 };
 
 
-/* read extension
+/* load extension
  *
  * reads extension from given extension number and fills structure
+ * lcr uses read_extension() of the extension store instead
  */
-int read_extension(struct extension *ext, char *num)
+int load_extension(struct extension *ext, char *num)
 {
 	FILE *fp=NULL;
 	char number[32];
@@ -765,23 +766,28 @@ int read_extension(struct extension *ext, char *num)
 }
 
 
-/* write extension
+/* store extension
  *
  * writes extension for given extension number from structure
+ * the file is written to a temporary file that replaces the settings after
+ * it is synced, so the settings are complete even after a crash.
+ * lcr uses write_extension() of the extension store instead
  */
-int write_extension(struct extension *ext, char *number)
+int store_extension(struct extension *ext, char *number)
 {
 	FILE *fp=NULL;
-	char filename[256];
-	int i;
+	char filename[256], tmpname[256], dirname[256];
+	int i, fd;
 
 	if (number[0] == '\0')
 		return(0);
 
-	SPRINT(filename, "%s/%s/settings", EXTENSION_DATA, number);
+	SPRINT(dirname, "%s/%s", EXTENSION_DATA, number);
+	SPRINT(filename, "%s/settings", dirname);
+	SPRINT(tmpname, "%s/settings.tmp", dirname);
 
-	if (!(fp = fopen(filename, "w"))) {
-		PERROR("Cannot open settings: \"%s\"\n", filename);
+	if (!(fp = fopen(tmpname, "w"))) {
+		PERROR("Cannot open settings: \"%s\"\n", tmpname);
 		return(0);
 	}
 
@@ -1159,427 +1165,27 @@ int write_extension(struct extension *ext, char *number)
 	}
 	fprintf(fp,"\n");
 
-
-	if (fp) fclose(fp);
-	return(1);
-}
-
-
-/* write log for extension
- *
- */
-int write_log(char *number, char *callerid, char *calledid, time_t start, time_t stop, int aoce, int cause, int location)
-{
-	const char *mon[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
-	FILE *fp=NULL;
-	char filename[256];
-	struct tm *tm;
-
-	if (callerid[0] == '\0')
-		callerid = (char *)"<unknown>";
-
-	SPRINT(filename, "%s/%s/log", EXTENSION_DATA, number);
-
-	if (!(fp = fopen(filename, "a"))) {
-		PERROR("Cannot open log: \"%s\"\n", filename);
-		return(0);
-	}
-
-	tm = localtime(&start);
-	fprintf(fp,"%s %2d %04d %02d:%02d:%02d %s", mon[tm->tm_mon], tm->tm_mday, tm->tm_year+1900, tm->tm_hour, tm->tm_min, tm->tm_sec, number);
-	if (stop)
-		fprintf(fp," %2ld:%02d:%02d", (stop-start)/3600, (((unsigned int)(stop-start))/60)%60, ((unsigned int)(stop-start))%60);
-	else
-		fprintf(fp," --:--:--");
-	fprintf(fp," %s -> %s", callerid, calledid);
-	if (cause >= 1 && cause <=127 && location>=0 && location<=15)
-		fprintf(fp," (cause=%d '%s' location=%d '%s')", cause, isdn_cause[cause].german, location, isdn_location[location].german);
-	fprintf(fp,"\n");
-
-	if (fp) fclose(fp);
-	return(1);
-}
-
-
-/* parse phonebook
- *
- * reads phone book of extextension and compares the given elements which
- * are: abreviation, phone number, name (name is not compared)
- * on success a 1 is returned and the pointers of elements are set to the
- * result.
- */
-int parse_phonebook(char *number, char **abbrev_pointer, char **phone_pointer, char **name_pointer)
-{
-	FILE *fp=NULL;
-	char filename[256];
-	char *p;
-	static char abbrev[32], phone[256], name[256];
-	unsigned int line,i;
-	char buffer[1024];
-	int found = 0, found_if_more_digits = 0;
-
-	SPRINT(filename, "%s/%s/phonebook", EXTENSION_DATA, number);
-
-	if (!(fp = fopen(filename, "r"))) {
-		PERROR("Cannot open phonebook: \"%s\"\n", filename);
+	if (fflush(fp) || fsync(fileno(fp))) {
+		PERROR("Cannot write settings: \"%s\" (errno=%d)\n", tmpname, errno);
+		fclose(fp);
+		unlink(tmpname);
 		return(0);
 	}
-
-	line=0;
-	while((GETLINE(buffer, fp))) {
-		line++;
-		p = buffer;
-
-		while(*p <= 32) { /* skip spaces */
-			if (*p == 0)
-				break;
-			p++;
-		}
-		if (*p==0 || *p=='#') /* ignore comments and empty line */
-			continue;
-
-		abbrev[0]=0;
-		phone[0]=0;
-		name[0]=0;
-
-		i=0; /* read abbrev */
-		while(*p > 32) {
-			if (i+1 >= sizeof(abbrev)) {
-				PERROR_RUNTIME("Error in %s (line %d): abbrev too long.\n",filename,line);
-				break;
-			}
-			abbrev[i+1] = '\0';
-			abbrev[i++] = *p++;
-		}
-
-		while(*p <= 32) { /* skip spaces */
-			if (*p == 0)
-				break;
-			p++;
-		}
-
-		if (*p!=0 && *p!='#') { /* phone */
-			i=0; /* read phone */
-			while(*p > 32) {
-				if (i+1 >= sizeof(phone)) {
-					PERROR_RUNTIME("Error in %s (line %d): phone too long.\n",filename,line);
-					break;
-				}
-				phone[i+1] = '\0';
-				phone[i++] = *p++;
-			}
-			while(*p <= 32) { /* skip spaces */
-				if (*p == 0)
-					break;
-				p++;
-			}
-		}
-
-		if (*p!=0 && *p!='#') { /* name */
-			i=0; /* read name */
-			while(*p > 0) {
-				if (i+1 >= sizeof(name)) {
-					PERROR_RUNTIME("Error in %s (line %d): name too long.\n",filename,line);
-					break;
-				}
-				name[i+1] = '\0';
-				name[i++] = *p++;
-			}
-		}
-
-		if (*abbrev_pointer) {
-			if (!strncmp(*abbrev_pointer, abbrev, strlen(*abbrev_pointer))) {
-				/* may match if abbreviation is longer */
-				found_if_more_digits = 1;
-			}
-			if (!!strcasecmp(*abbrev_pointer, abbrev))
-				continue;
-		}
-		if (*phone_pointer)
-			if (!!strcasecmp(*phone_pointer, phone))
-				continue;
-		if (*name_pointer)
-			if (!!strcasecmp(*name_pointer, name))
-				continue;
-
-		found = 1;
-		break; /* found entry */
-	}
-
-	if (fp) fclose(fp);
-
-	if (found) {
-		*abbrev_pointer = abbrev;
-		*phone_pointer = phone;
-		*name_pointer = name;
-	}
-
-	if (found == 0) {
-		if (found_if_more_digits)
-			found = -1;
-	}
-	return(found);
-}
-
-/* parsing secrets file
- *
- * 'number' specifies the externsion number, not the caller id
- * 'remote_id' specifies the dialed number, or the caller id for incoming calls
- * the result is the auth, crypt and key string, and 1 is returned.
- * on failure or not matching number, the 0 is returned
- */
-int parse_secrets(char *number, char *remote_id, char **auth_pointer, char **crypt_pointer, char **key_pointer)
-{
-	FILE *fp=NULL;
-	char filename[256];
-	char *p;
-	char remote[128];
-	static char auth[64], crypt[64], key[4096];
-	unsigned int line,i;
-	char buffer[4096];
-	int found = 0;
-
-	SPRINT(filename, "%s/%s/secrets", EXTENSION_DATA, number);
-
-	if (!(fp = fopen(filename, "r"))) {
-		PERROR("Cannot open secrets: \"%s\"\n", filename);
+	fclose(fp);
+	if (rename(tmpname, filename) < 0) {
+		PERROR("Cannot replace settings: \"%s\" (errno=%d)\n", filename, errno);
+		unlink(tmpname);
 		return(0);
 	}
-
-	line=0;
-	while((GETLINE(buffer, fp))) {
-		line++;
-		p = buffer;
-
-		while(*p <= 32) { /* skip spaces */
-			if (*p == 0)
-				break;
-			p++;
-		}
-		if (*p==0 || *p=='#') /* ignore comments and empty line */
-			continue;
-
-		remote[0]=0;
-		auth[0]=0;
-		crypt[0]=0;
-		key[0]=0;
-
-		i=0; /* read auth */
-		while(*p > 32) {
-			if (i+1 >= sizeof(remote)) {
-				PERROR_RUNTIME("Error in %s (line %d): remote too long.\n",filename,line);
-				break;
-			}
-			remote[i+1] = '\0';
-			remote[i++] = *p++;
-		}
-
-		while(*p <= 32) { /* skip spaces */
-			if (*p == 0)
-				break;
-			p++;
-		}
-
-		if (*p!=0 && *p!='#') { /* auth */
-			i=0; /* read auth */
-			while(*p > 32) {
-				if (i+1 >= sizeof(auth)) {
-					PERROR_RUNTIME("Error in %s (line %d): auth too long.\n",filename,line);
-					break;
-				}
-				auth[i+1] = '\0';
-				auth[i++] = *p++;
-			}
-			while(*p <= 32) { /* skip spaces */
-				if (*p == 0)
-					break;
-				p++;
-			}
-		}
-
-		if (*p!=0 && *p!='#') { /* crypt */
-			i=0; /* read crypt */
-			while(*p > 32) {
-				if (i+1 >= sizeof(crypt)) {
-					PERROR_RUNTIME("Error in %s (line %d): crypt too long.\n",filename,line);
-					break;
-				}
-				crypt[i+1] = '\0';
-				crypt[i++] = *p++;
-			}
-			while(*p <= 32) { /* skip spaces */
-				if (*p == 0)
-					break;
-				p++;
-			}
-		}
-
-		if (*p!=0 && *p!='#') { /* key */
-			i=0; /* read key */
-			while(*p > 0) {
-				if (i+1 >= sizeof(key)) {
-					PERROR_RUNTIME("Error in %s (line %d): key too long.\n",filename,line);
-					break;
-				}
-				key[i+1] = '\0';
-				key[i++] = *p++;
-			}
-		}
-//printf("COMPARING: '%s' with '%s' %s %s %s\n", remote_id, remote, auth, crypt, key);
-
-		if (!!strcasecmp(remote, remote_id))
-			continue;
-
-		found = 1;
-		break; /* found entry */
-	}
-
-	if (fp) fclose(fp);
-
-	if (found) {
-		*auth_pointer = auth;
-		*crypt_pointer = crypt;
-		*key_pointer = key;
+	/* make the rename durable */
+	if ((fd = open(dirname, O_RDONLY)) >= 0) {
+		fsync(fd);
+		close(fd);
 	}
 
-	return(found);
+	return(1);
 }
 
-/* parse directory
- *
- * the caller id is given and the name is returned. if the name is not found,
- * NULL is returned.
- * on success a 1 is returned and the pointers of elements are set to the
- * result.
- */
-char *parse_directory(char *number, int type)
-{
-	FILE *fp=NULL;
-	char filename[256];
-	char *p;
-	static char phone[32], name[64];
-	unsigned int line,i;
-	char buffer[256];
-	int found = 0;
-
-	SPRINT(filename, "%s/directory.list", CONFIG_DATA);
-
-	if (!(fp = fopen(filename, "r"))) {
-		PERROR("Cannot open directory: \"%s\"\n", filename);
-		return(NULL);
-	}
-
-	line=0;
-	while((GETLINE(buffer, fp))) {
-		line++;
-		p = buffer;
-
-		while(*p <= 32) { /* skip spaces */
-			if (*p == 0)
-				break;
-			p++;
-		}
-		if (*p==0 || *p=='#') /* ignore comments and empty line */
-			continue;
-
-		phone[0]=0;
-		name[0]=0;
-
-		i=0; /* read number */
-		while(*p > 32) {
-			if (i+1 >= sizeof(phone)) {
-				PERROR_RUNTIME("Error in %s (line %d): number too long.\n",filename,line);
-				break;
-			}
-			phone[i+1] = '\0';
-			phone[i++] = *p++;
-		}
-
-		while(*p <= 32) { /* skip spaces */
-			if (*p == 0)
-				break;
-			p++;
-		}
-
-		i=0; /* read name */
-		while(*p >= 32) {
-			if (i+1 >= sizeof(name)) {
-				PERROR_RUNTIME("Error in %s (line %d): name too long.\n",filename,line);
-				break;
-			}
-			name[i+1] = '\0';
-			name[i++] = *p++;
-		}
-
-		if (phone[0] == 'i') {
-			if (type != INFO_NTYPE_INTERNATIONAL)
-				continue;
-			if (!strcmp(number, phone+1)) {
-				found = 1;
-				break;
-			}
-			continue;
-		}
-		if (phone[0] == 'n') {
-			if (type != INFO_NTYPE_NATIONAL)
-				continue;
-			if (!strcmp(number, phone+1)) {
-				found = 1;
-				break;
-			}
-			continue;
-		}
-		if (phone[0] == 's') {
-			if (type==INFO_NTYPE_NATIONAL || type==INFO_NTYPE_INTERNATIONAL)
-				continue;
-			if (!strcmp(number, phone+1)) {
-				found = 1;
-				break;
-			}
-			continue;
-		}
-		if (!strncmp(phone, options.international, strlen(options.international))) {
-			if (type != INFO_NTYPE_INTERNATIONAL)
-				continue;
-			if (!strcmp(number, phone+strlen(options.international))) {
-				found = 1;
-				break;
-			}
-			continue;
-		}
-		if (!options.national[0]) { /* no national prefix */
-			if (type == INFO_NTYPE_INTERNATIONAL)
-				continue;
-			if (!strcmp(number, phone)) {
-				found = 1;
-				break;
-			}
-			continue;
-		}
-		if (!strncmp(phone, options.national, strlen(options.national))) {
-			if (type != INFO_NTYPE_NATIONAL)
-				continue;
-			if (!strcmp(number, phone+strlen(options.national))) {
-				found = 1;
-				break;
-			}
-			continue;
-		}
-		if (type==INFO_NTYPE_NATIONAL || type==INFO_NTYPE_INTERNATIONAL)
-			continue;
-		if (!strcmp(number, phone)) {
-			found = 1;
-			break;
-		}
-	}
-
-	if (fp) fclose(fp);
-
-	if (found)
-		return(name);
-	else
-		return(NULL);
-}
 
 /* parse callbackauth
  *
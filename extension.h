@@ -171,12 +171,8 @@ struct extension {
 	int no_seconds;		/* don't include seconds in the connect message */
 };
 
-int read_extension(struct extension *ext, char *number);
-int write_extension(struct extension *ext, char *number);
-int write_log(char *number, char *callerid, char *calledid, time_t start, time_t stop, int aoce, int cause, int location);
-int parse_phonebook(char *number, char **abbrev_pointer, char **phone_pointer, char **name_pointer);
-int parse_secrets(char *number, char *remote_id, char **auth_pointer, char **crypt_pointer, char **key_pointer);
-char *parse_directory(char *number, int type);
+int load_extension(struct extension *ext, char *number);
+int store_extension(struct extension *ext, char *number);
 struct caller_info;
 int parse_callbackauth(char *number, struct caller_info *callerinfo);
 void append_callbackauth(char *number, struct caller_info *callerinfo);
@@ -0,0 +1,494 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** extensions kept in memory                                                 **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO store extensions?
+
+read_extension() is called many times during a call, so all extensions are
+loaded at startup and kept in a hash table. Lookups just copy the extension.
+
+inotify watches EXTENSION_DATA for new and removed extensions and each
+extension's directory for changed settings. If settings are changed by
+others (editor, genextension, lcradmin), they are loaded again. Events caused
+by our own writes are detected by the stamp of the file (inode, size, mtime).
+
+write_extension() only changes the extension in memory. Changes are collected
+for EXTSTORE_DELAY and then given to a writer thread that replaces the
+settings file, so the main loop does not wait for the disk. As long as our
+changes are not written, events of the file are ignored.
+
+If inotify is not available, or a directory cannot be watched, the settings
+files are read and written on every access, as before.
+
+*/
+
+#include <sys/inotify.h>
+#include "main.h"
+
+static struct extstore_entry *extstore_hash[EXTSTORE_HASH];
+static struct extstore_entry *extstore_dirty = NULL;
+static int extstore_running = 0;
+static int extstore_inotify = -1;
+static int extstore_wd = -1; /* watch of EXTENSION_DATA */
+static struct lcr_fd extstore_fd;
+static struct lcr_timer extstore_timer;
+
+/* writer thread */
+static struct extstore_job *extstore_queue = NULL, **extstore_queue_tail = &extstore_queue;
+static struct extstore_job *extstore_done = NULL, **extstore_done_tail = &extstore_done;
+static int extstore_pending = 0; /* jobs not yet reaped */
+static pthread_mutex_t extstore_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t extstore_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t extstore_tid;
+static int extstore_writer = 0;
+static int extstore_quit = 0;
+
+#define EXTSTORE_WATCH_DIR	(IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR)
+#define EXTSTORE_WATCH_EXT	(IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR)
+
+static unsigned int extstore_key(const char *number)
+{
+	unsigned int key = 5381;
+
+	while (*number)
+		key = key * 33 + (unsigned char)*number++;
+
+	return key & (EXTSTORE_HASH - 1);
+}
+
+static struct extstore_entry *extstore_find(const char *number)
+{
+	struct extstore_entry *entry = extstore_hash[extstore_key(number)];
+
+	while (entry) {
+		if (!strcmp(entry->number, number))
+			return entry;
+		entry = entry->next;
+	}
+
+	return NULL;
+}
+
+/* events are rare, so we don't need a hash for watches */
+static struct extstore_entry *extstore_find_wd(int wd)
+{
+	struct extstore_entry *entry;
+	int i;
+
+	for (i = 0; i < EXTSTORE_HASH; i++) {
+		entry = extstore_hash[i];
+		while (entry) {
+			if (entry->wd == wd)
+				return entry;
+			entry = entry->next;
+		}
+	}
+
+	return NULL;
+}
+
+static int extstore_get_stamp(const char *number, struct file_stamp *stamp)
+{
+	char filename[256];
+
+	SPRINT(filename, "%s/%s/settings", EXTENSION_DATA, number);
+	return file_stamp(filename, stamp);
+}
+
+static void extstore_load(struct extstore_entry *entry)
+{
+	extstore_get_stamp(entry->number, &entry->stamp);
+	entry->exists = load_extension(&entry->ext, entry->number);
+}
+
+static void extstore_watch(struct extstore_entry *entry)
+{
+	char dirname[256];
+
+	SPRINT(dirname, "%s/%s", EXTENSION_DATA, entry->number);
+	entry->wd = inotify_add_watch(extstore_inotify, dirname, EXTSTORE_WATCH_EXT);
+	if (entry->wd < 0)
+		PERROR("Cannot watch extension '%s' (errno=%d), reading it from disk on each access.\n", entry->number, errno);
+}
+
+static struct extstore_entry *extstore_add(const char *number)
+{
+	struct extstore_entry *entry;
+	unsigned int key;
+
+	if (strlen(number) >= sizeof(entry->number))
+		return NULL;
+
+	entry = (struct extstore_entry *)MALLOC(sizeof(struct extstore_entry));
+	memuse++;
+	SCPY(entry->number, number);
+	key = extstore_key(number);
+	entry->next = extstore_hash[key];
+	extstore_hash[key] = entry;
+
+	/* watch before loading, so no change is missed */
+	extstore_watch(entry);
+	extstore_load(entry);
+
+	return entry;
+}
+
+/* settings file has an event */
+static void extstore_changed(struct extstore_entry *entry)
+{
+	struct file_stamp stamp;
+
+	/* our changes are newer than the file */
+	if (entry->dirty || entry->writing)
+		return;
+
+	if (extstore_get_stamp(entry->number, &stamp)) {
+		PDEBUG(DEBUG_CONFIG, "settings of extension '%s' removed\n", entry->number);
+		entry->exists = 0;
+		memset(&entry->stamp, 0, sizeof(entry->stamp));
+		return;
+	}
+	if (!memcmp(&stamp, &entry->stamp, sizeof(stamp)))
+		return; /* this is what we have */
+
+	PDEBUG(DEBUG_CONFIG, "settings of extension '%s' changed, loading\n", entry->number);
+	extstore_load(entry);
+}
+
+/* extension directory appeared */
+static void extstore_appeared(const char *number)
+{
+	struct extstore_entry *entry;
+
+	if (number[0] == '.')
+		return;
+	if (!(entry = extstore_find(number))) {
+		PDEBUG(DEBUG_CONFIG, "new extension '%s'\n", number);
+		extstore_add(number);
+		return;
+	}
+	if (entry->wd < 0)
+		extstore_watch(entry);
+	extstore_changed(entry);
+}
+
+/* read all extension directories */
+static int extstore_scan(void)
+{
+	DIR *dir;
+	struct dirent *dirent;
+	char dirname[256];
+	struct stat st;
+	int count = 0;
+
+	if (!(dir = opendir(EXTENSION_DATA)))
+		return -1;
+	while ((dirent = readdir(dir))) {
+		if (dirent->d_name[0] == '.')
+			continue;
+		if (dirent->d_type == DT_UNKNOWN) {
+			SPRINT(dirname, "%s/%s", EXTENSION_DATA, dirent->d_name);
+			if (stat(dirname, &st) < 0 || !S_ISDIR(st.st_mode))
+				continue;
+		} else if (dirent->d_type != DT_DIR)
+			continue;
+		extstore_appeared(dirent->d_name);
+		count++;
+	}
+	closedir(dir);
+
+	return count;
+}
+
+/* free what the writer has written */
+static void extstore_reap(void)
+{
+	struct extstore_job *job, *next;
+
+	pthread_mutex_lock(&extstore_mutex);
+	job = extstore_done;
+	extstore_done = NULL;
+	extstore_done_tail = &extstore_done;
+	pthread_mutex_unlock(&extstore_mutex);
+
+	while (job) {
+		next = job->next;
+		job->entry->writing--;
+		if (job->ok)
+			memcpy(&job->entry->stamp, &job->stamp, sizeof(struct file_stamp));
+		FREE(job, sizeof(struct extstore_job));
+		memuse--;
+		extstore_pending--;
+		job = next;
+	}
+}
+
+static void *extstore_child(void *arg)
+{
+	struct extstore_job *job;
+
+	pthread_mutex_lock(&extstore_mutex);
+	while (1) {
+		while (!extstore_queue && !extstore_quit)
+			pthread_cond_wait(&extstore_cond, &extstore_mutex);
+		if (!(job = extstore_queue))
+			break;
+		if (!(extstore_queue = job->next))
+			extstore_queue_tail = &extstore_queue;
+		pthread_mutex_unlock(&extstore_mutex);
+
+		job->ok = store_extension(&job->ext, job->ext.number);
+		if (job->ok)
+			extstore_get_stamp(job->ext.number, &job->stamp);
+
+		/* keep order, so the stamp of the last version is kept */
+		pthread_mutex_lock(&extstore_mutex);
+		job->next = NULL;
+		*extstore_done_tail = job;
+		extstore_done_tail = &job->next;
+	}
+	pthread_mutex_unlock(&extstore_mutex);
+
+	return NULL;
+}
+
+/* give changed extensions to the writer */
+static void extstore_flush(void)
+{
+	struct extstore_entry *entry;
+	struct extstore_job *job;
+
+	if (!extstore_dirty)
+		return;
+
+	if (!extstore_writer) {
+		if (pthread_create(&extstore_tid, NULL, extstore_child, NULL)) {
+			PERROR("failed to create extension writer thread, writing now.\n");
+			while ((entry = extstore_dirty)) {
+				extstore_dirty = entry->dirty_next;
+				entry->dirty_next = NULL;
+				entry->dirty = 0;
+				if (store_extension(&entry->ext, entry->number))
+					extstore_get_stamp(entry->number, &entry->stamp);
+			}
+			return;
+		}
+		extstore_writer = 1;
+	}
+
+	pthread_mutex_lock(&extstore_mutex);
+	while ((entry = extstore_dirty)) {
+		extstore_dirty = entry->dirty_next;
+		entry->dirty_next = NULL;
+		entry->dirty = 0;
+		entry->writing++;
+		job = (struct extstore_job *)MALLOC(sizeof(struct extstore_job));
+		memuse++;
+		extstore_pending++;
+		job->entry = entry;
+		memcpy(&job->ext, &entry->ext, sizeof(struct extension));
+		*extstore_queue_tail = job;
+		extstore_queue_tail = &job->next;
+	}
+	pthread_cond_signal(&extstore_cond);
+	pthread_mutex_unlock(&extstore_mutex);
+}
+
+static int extstore_timeout(struct lcr_timer *timer, void *instance, int index)
+{
+	extstore_reap();
+	extstore_flush();
+
+	/* check again, until writer is done */
+	if (extstore_pending)
+		schedule_timer(&extstore_timer, EXTSTORE_DELAY, 0);
+
+	return 0;
+}
+
+static int extstore_handler(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	struct extstore_entry *entry;
+	char *p;
+	int len;
+
+	/* write stamps first, so our own writes are detected */
+	extstore_reap();
+
+	while ((len = read(fd->fd, buffer, sizeof(buffer))) > 0) {
+		for (p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)p;
+			if ((event->mask & IN_Q_OVERFLOW)) {
+				PDEBUG(DEBUG_CONFIG, "too many changes, checking all extensions\n");
+				extstore_scan();
+				continue;
+			}
+			if (!event->len)
+				continue;
+			if (event->wd == extstore_wd) {
+				if (!(event->mask & IN_ISDIR))
+					continue;
+				if ((event->mask & (IN_CREATE | IN_MOVED_TO))) {
+					extstore_appeared(event->name);
+					continue;
+				}
+				/* directory is gone, so is the watch */
+				if ((entry = extstore_find(event->name))) {
+					PDEBUG(DEBUG_CONFIG, "extension '%s' removed\n", entry->number);
+					if (entry->wd >= 0)
+						inotify_rm_watch(extstore_inotify, entry->wd);
+					entry->wd = -1;
+					entry->exists = 0;
+				}
+				continue;
+			}
+			if (strcmp(event->name, "settings"))
+				continue;
+			if ((entry = extstore_find_wd(event->wd)))
+				extstore_changed(entry);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * load all extensions and watch them
+ * if this fails, extensions are read from disk on each access
+ */
+int extstore_init(void)
+{
+	int count;
+
+	extstore_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (extstore_inotify < 0) {
+		PERROR("Cannot watch extensions (errno=%d), reading them from disk on each access.\n", errno);
+		return -1;
+	}
+	extstore_wd = inotify_add_watch(extstore_inotify, EXTENSION_DATA, EXTSTORE_WATCH_DIR);
+	if (extstore_wd < 0) {
+		PERROR("Cannot watch extensions at '%s' (errno=%d), reading them from disk on each access.\n", EXTENSION_DATA, errno);
+		close(extstore_inotify);
+		extstore_inotify = -1;
+		return -1;
+	}
+
+	memset(&extstore_fd, 0, sizeof(extstore_fd));
+	extstore_fd.fd = extstore_inotify;
+	register_fd(&extstore_fd, LCR_FD_READ, extstore_handler, NULL, 0);
+	add_timer(&extstore_timer, extstore_timeout, NULL, 0);
+
+	count = extstore_scan();
+	PDEBUG(DEBUG_CONFIG, "%d extensions loaded\n", count);
+	extstore_running = 1;
+
+	return 0;
+}
+
+/* write all changes and free extensions */
+void extstore_exit(void)
+{
+	struct extstore_entry *entry;
+	int i;
+
+	if (!extstore_running)
+		return;
+
+	extstore_flush();
+	if (extstore_writer) {
+		pthread_mutex_lock(&extstore_mutex);
+		extstore_quit = 1;
+		pthread_cond_signal(&extstore_cond);
+		pthread_mutex_unlock(&extstore_mutex);
+		pthread_join(extstore_tid, NULL);
+		extstore_writer = 0;
+		extstore_quit = 0;
+	}
+	extstore_reap();
+
+	for (i = 0; i < EXTSTORE_HASH; i++) {
+		while ((entry = extstore_hash[i])) {
+			extstore_hash[i] = entry->next;
+			FREE(entry, sizeof(struct extstore_entry));
+			memuse--;
+		}
+	}
+	extstore_dirty = NULL;
+
+	del_timer(&extstore_timer);
+	unregister_fd(&extstore_fd);
+	close(extstore_inotify);
+	extstore_inotify = -1;
+	extstore_wd = -1;
+	extstore_running = 0;
+}
+
+/* read extension
+ *
+ * fills structure with the extension of given number
+ */
+int read_extension(struct extension *ext, char *num)
+{
+	struct extstore_entry *entry;
+	char number[32];
+
+	/* save number, so &ext and ext.number can be given as parameters - without overwriting itself */
+	SCPY(number, num);
+
+	if (number[0] == '\0')
+		return(0);
+
+	if (!extstore_running)
+		return load_extension(ext, number);
+	/* all directories are known, so there is no need to look at the disk */
+	entry = extstore_find(number);
+	if (entry && entry->wd < 0 && !entry->dirty && !entry->writing)
+		return load_extension(ext, number);
+
+	if (!entry || !entry->exists) {
+		PDEBUG(DEBUG_CONFIG, "the given extension doesn't exist: \"%s\"\n", number);
+		return(0);
+	}
+	memcpy(ext, &entry->ext, sizeof(struct extension));
+
+	return(1);
+}
+
+/* write extension
+ *
+ * changes the extension of given number, it will be written soon
+ */
+int write_extension(struct extension *ext, char *number)
+{
+	struct extstore_entry *entry;
+
+	if (number[0] == '\0')
+		return(0);
+
+	if (!extstore_running || (!(entry = extstore_find(number))) || entry->wd < 0)
+		return store_extension(ext, number);
+
+	if (ext != &entry->ext)
+		memcpy(&entry->ext, ext, sizeof(struct extension));
+	SCPY(entry->ext.number, number);
+	entry->exists = 1;
+	if (!entry->dirty) {
+		entry->dirty = 1;
+		entry->dirty_next = extstore_dirty;
+		extstore_dirty = entry;
+	}
+	if (!extstore_timer.active)
+		schedule_timer(&extstore_timer, EXTSTORE_DELAY, 0);
+
+	return(1);
+}
+
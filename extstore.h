@@ -0,0 +1,41 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** extension store header file                                               **
+**                                                                           **
+\*****************************************************************************/
+
+#define EXTSTORE_HASH	1024	/* buckets, must be a binary border */
+#define EXTSTORE_DELAY	1	/* seconds to collect changes before writing */
+
+/* extension in memory, one for each directory in EXTENSION_DATA */
+struct extstore_entry {
+	struct extstore_entry	*next;		/* next in hash bucket */
+	struct extstore_entry	*dirty_next;	/* next entry to be written */
+	char			number[32];
+	int			wd;		/* watch of directory, -1 = not watched, use files */
+	int			exists;		/* settings are loaded */
+	int			dirty;		/* changed, not yet given to writer */
+	int			writing;	/* number of versions given to writer */
+	struct file_stamp	stamp;		/* version of file we have loaded or written */
+	struct extension	ext;
+};
+
+/* a version of an extension given to the writer thread */
+struct extstore_job {
+	struct extstore_job	*next;
+	struct extstore_entry	*entry;
+	int			ok;		/* written successfully */
+	struct file_stamp	stamp;		/* version of file that was written */
+	struct extension	ext;
+};
+
+int extstore_init(void);
+void extstore_exit(void);
+int read_extension(struct extension *ext, char *number);
+int write_extension(struct extension *ext, char *number);
+
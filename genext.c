@@ -86,7 +86,7 @@ int main(int argc, char *argv[])
 	ext.callerid_type = INFO_NTYPE_UNKNOWN;
 	ext.change_forward = 1;
 	ext.facility = 1;
-	write_extension(&ext, argv[1]);
+	store_extension(&ext, argv[1]);
 
 	SPRINT(pathname, "%s/%s/phonebook", EXTENSION_DATA, argv[1]);
 	if (!(fp = fopen(pathname, "w"))) {
@@ -0,0 +1,330 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** tone detector engine                                                      **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO detect tones?
+
+A set of up to GOERTZEL_BINS frequencies is given by goertzel_tones(). Each
+frequency is a Goertzel filter with 32 bit state and a coefficient in 2.14
+fixed point. The filter needs 2*cos(w) * state, which is done with 16 bit
+multiplies by splitting the state into its upper bits and its lower 15 bits,
+so all eight filters of a window run in one AVX2 register (or two SSE2
+registers) with exactly the same result as the scalar code.
+
+The result of a window is the squared magnitude of each frequency. Levels are
+compared with squared thresholds, so no square root is needed. A level of 1.0
+(0 db) has the power (GOERTZEL_FULLSCALE * len)^2.
+
+Lines that decode the same frequencies share a batch. goertzel_queue() copies
+the window of a line into the batch. At the end of the current pass of the
+main loop (or if the batch is full), all windows of all lines are filtered at
+once, two windows at a time, so the filters of one window run while the other
+window waits for its multiplies. Then the callback of each window is called in
+the order of queueing. Windows with a peak to peak span below the minimum are
+not filtered at all, because there can't be any tone.
+
+A line that is destroyed must cancel its windows with goertzel_cancel().
+Callbacks must not queue windows.
+
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GOERTZEL_SIMD
+#include <immintrin.h>
+#endif
+#include "main.h"
+
+void (*goertzel_power)(const struct goertzel_tones *tones, const signed short *const *s16, int count, long long *power);
+
+/* squared magnitude from final states of the filters */
+static void goertzel_finish(const struct goertzel_tones *tones, const int *s, const int *s2, long long *power)
+{
+	int k;
+
+	for (k = 0; k < GOERTZEL_BINS; k++)
+		power[k] = (long long)s[k] * s[k] + (long long)s2[k] * s2[k] - (((long long)tones->coeff[k] * s[k]) >> 14) * s2[k];
+}
+
+static void power_scalar(const struct goertzel_tones *tones, const signed short *const *s16, int count, long long *power)
+{
+	int s1[GOERTZEL_BINS], s2[GOERTZEL_BINS], s;
+	const signed short *x;
+	int i, k, n;
+
+	for (i = 0; i < count; i++) {
+		memset(s1, 0, sizeof(s1));
+		memset(s2, 0, sizeof(s2));
+		x = s16[i];
+		for (n = 0; n < tones->len; n++) {
+			for (k = 0; k < GOERTZEL_BINS; k++) {
+				s = (int)(((long long)tones->coeff[k] * s1[k]) >> 14) - s2[k] + x[n];
+				s2[k] = s1[k];
+				s1[k] = s;
+			}
+		}
+		goertzel_finish(tones, s1, s2, power + i * GOERTZEL_BINS);
+	}
+}
+
+#ifdef GOERTZEL_SIMD
+/* coefficient as 16 bit pairs: (coeff, 0) for the lower bits, (0, coeff) for
+ * the upper bits of the state */
+static void split_coeff(const struct goertzel_tones *tones, int *cl, int *ch)
+{
+	int k;
+
+	for (k = 0; k < GOERTZEL_BINS; k++) {
+		cl[k] = (unsigned short)tones->coeff[k];
+		ch[k] = (int)((unsigned int)(unsigned short)tones->coeff[k] << 16);
+	}
+}
+
+/* (coeff * s) >> 14 */
+__attribute__((target("sse2")))
+static inline __m128i mul_sse2(__m128i s, __m128i cl, __m128i ch)
+{
+	__m128i p;
+
+	p = _mm_or_si128(_mm_and_si128(s, _mm_set1_epi32(0x7fff)), _mm_slli_epi32(_mm_srai_epi32(s, 15), 16));
+	return _mm_add_epi32(_mm_slli_epi32(_mm_madd_epi16(p, ch), 1), _mm_srai_epi32(_mm_madd_epi16(p, cl), 14));
+}
+
+__attribute__((target("sse2")))
+static void power_sse2(const struct goertzel_tones *tones, const signed short *const *s16, int count, long long *power)
+{
+	int cl[GOERTZEL_BINS], ch[GOERTZEL_BINS], s[GOERTZEL_BINS], s2[GOERTZEL_BINS];
+	long long spare[GOERTZEL_BINS];
+	__m128i cl0, cl1, ch0, ch1, a0, a1, a2, a3, b0, b1, b2, b3, t, x, y;
+	const signed short *u, *v;
+	int i, n;
+
+	split_coeff(tones, cl, ch);
+	cl0 = _mm_loadu_si128((const __m128i *)cl);
+	cl1 = _mm_loadu_si128((const __m128i *)(cl + 4));
+	ch0 = _mm_loadu_si128((const __m128i *)ch);
+	ch1 = _mm_loadu_si128((const __m128i *)(ch + 4));
+
+	for (i = 0; i < count; i += 2) {
+		/* a = state of window u, b = state of window v */
+		u = s16[i];
+		v = (i + 1 < count) ? s16[i + 1] : u;
+		a0 = a1 = a2 = a3 = b0 = b1 = b2 = b3 = _mm_setzero_si128();
+		for (n = 0; n < tones->len; n++) {
+			x = _mm_set1_epi32(u[n]);
+			y = _mm_set1_epi32(v[n]);
+			t = _mm_add_epi32(_mm_sub_epi32(mul_sse2(a0, cl0, ch0), a2), x);
+			a2 = a0;
+			a0 = t;
+			t = _mm_add_epi32(_mm_sub_epi32(mul_sse2(a1, cl1, ch1), a3), x);
+			a3 = a1;
+			a1 = t;
+			t = _mm_add_epi32(_mm_sub_epi32(mul_sse2(b0, cl0, ch0), b2), y);
+			b2 = b0;
+			b0 = t;
+			t = _mm_add_epi32(_mm_sub_epi32(mul_sse2(b1, cl1, ch1), b3), y);
+			b3 = b1;
+			b1 = t;
+		}
+		_mm_storeu_si128((__m128i *)s, a0);
+		_mm_storeu_si128((__m128i *)(s + 4), a1);
+		_mm_storeu_si128((__m128i *)s2, a2);
+		_mm_storeu_si128((__m128i *)(s2 + 4), a3);
+		goertzel_finish(tones, s, s2, power + i * GOERTZEL_BINS);
+		_mm_storeu_si128((__m128i *)s, b0);
+		_mm_storeu_si128((__m128i *)(s + 4), b1);
+		_mm_storeu_si128((__m128i *)s2, b2);
+		_mm_storeu_si128((__m128i *)(s2 + 4), b3);
+		goertzel_finish(tones, s, s2, (i + 1 < count) ? power + (i + 1) * GOERTZEL_BINS : spare);
+	}
+}
+
+/* (coeff * s) >> 14 */
+__attribute__((target("avx2")))
+static inline __m256i mul_avx2(__m256i s, __m256i cl, __m256i ch)
+{
+	__m256i p;
+
+	p = _mm256_or_si256(_mm256_and_si256(s, _mm256_set1_epi32(0x7fff)), _mm256_slli_epi32(_mm256_srai_epi32(s, 15), 16));
+	return _mm256_add_epi32(_mm256_slli_epi32(_mm256_madd_epi16(p, ch), 1), _mm256_srai_epi32(_mm256_madd_epi16(p, cl), 14));
+}
+
+__attribute__((target("avx2")))
+static void power_avx2(const struct goertzel_tones *tones, const signed short *const *s16, int count, long long *power)
+{
+	int cl[GOERTZEL_BINS], ch[GOERTZEL_BINS], s[GOERTZEL_BINS], s2[GOERTZEL_BINS];
+	long long spare[GOERTZEL_BINS];
+	__m256i cl0, ch0, a0, a2, b0, b2, t;
+	const signed short *u, *v;
+	int i, n;
+
+	split_coeff(tones, cl, ch);
+	cl0 = _mm256_loadu_si256((const __m256i *)cl);
+	ch0 = _mm256_loadu_si256((const __m256i *)ch);
+
+	for (i = 0; i < count; i += 2) {
+		u = s16[i];
+		v = (i + 1 < count) ? s16[i + 1] : u;
+		a0 = a2 = b0 = b2 = _mm256_setzero_si256();
+		for (n = 0; n < tones->len; n++) {
+			t = _mm256_add_epi32(_mm256_sub_epi32(mul_avx2(a0, cl0, ch0), a2), _mm256_set1_epi32(u[n]));
+			a2 = a0;
+			a0 = t;
+			t = _mm256_add_epi32(_mm256_sub_epi32(mul_avx2(b0, cl0, ch0), b2), _mm256_set1_epi32(v[n]));
+			b2 = b0;
+			b0 = t;
+		}
+		_mm256_storeu_si256((__m256i *)s, a0);
+		_mm256_storeu_si256((__m256i *)s2, a2);
+		goertzel_finish(tones, s, s2, power + i * GOERTZEL_BINS);
+		_mm256_storeu_si256((__m256i *)s, b0);
+		_mm256_storeu_si256((__m256i *)s2, b2);
+		goertzel_finish(tones, s, s2, (i + 1 < count) ? power + (i + 1) * GOERTZEL_BINS : spare);
+	}
+}
+#endif
+
+const char *goertzel_kernel_name[GOERTZEL_KERNELS] = { "scalar", "sse2", "avx2" };
+
+/* select filter kernel, returns -1, if the cpu does not support it */
+int goertzel_kernel(int kernel)
+{
+	switch (kernel) {
+	case GOERTZEL_SCALAR:
+		goertzel_power = power_scalar;
+		return 0;
+#ifdef GOERTZEL_SIMD
+	case GOERTZEL_SSE2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("sse2"))
+			break;
+		goertzel_power = power_sse2;
+		return 0;
+	case GOERTZEL_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			break;
+		goertzel_power = power_avx2;
+		return 0;
+#endif
+	}
+
+	return -1;
+}
+
+/* select best filter kernel for this cpu */
+void goertzel_init(void)
+{
+	int kernel = GOERTZEL_KERNELS - 1;
+
+	while (goertzel_kernel(kernel))
+		kernel--;
+}
+
+/* set frequencies (Hz) and window size */
+void goertzel_tones(struct goertzel_tones *tones, const double *frequency, int bins, int len)
+{
+	double coeff;
+	int k;
+
+	if (bins > GOERTZEL_BINS)
+		FATAL("Too many frequencies (%d) for tone detector\n", bins);
+	if (len > GOERTZEL_MAX_LEN)
+		FATAL("Window of tone detector too large (%d)\n", len);
+
+	memset(tones, 0, sizeof(*tones));
+	tones->bins = bins;
+	tones->len = len;
+	for (k = 0; k < bins; k++) {
+		coeff = floor(2.0 * cos(2.0 * M_PI * frequency[k] / 8000.0) * 16384.0 + 0.5);
+		if (coeff > 32767.0)
+			FATAL("Frequency %.0f too low for tone detector\n", frequency[k]);
+		tones->coeff[k] = (signed short)coeff;
+	}
+}
+
+static int goertzel_work(struct lcr_work *work, void *instance, int index)
+{
+	goertzel_flush((struct goertzel_batch *)instance);
+
+	return 0;
+}
+
+void goertzel_batch_init(struct goertzel_batch *batch, const struct goertzel_tones *tones, int min_span)
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->tones = tones;
+	batch->min_span = min_span;
+	add_work(&batch->work, goertzel_work, batch, 0);
+}
+
+/* queue a window of tones->len samples */
+void goertzel_queue(struct goertzel_batch *batch, const unsigned char *law, goertzel_cb *cb, void *instance)
+{
+	struct goertzel_window *window;
+	int n, low = 32767, high = -32768;
+
+	if (batch->count == GOERTZEL_BATCH)
+		goertzel_flush(batch);
+
+	window = &batch->window[batch->count++];
+	window->cb = cb;
+	window->instance = instance;
+	audio_decode(window->s16, law, batch->tones->len);
+	for (n = 0; n < batch->tones->len; n++) {
+		if (window->s16[n] < low)
+			low = window->s16[n];
+		if (window->s16[n] > high)
+			high = window->s16[n];
+	}
+	window->span = high - low;
+
+	trigger_work(&batch->work);
+}
+
+/* remove all windows of a line */
+void goertzel_cancel(struct goertzel_batch *batch, void *instance)
+{
+	int i;
+
+	for (i = 0; i < batch->count; i++) {
+		if (batch->window[i].instance == instance)
+			batch->window[i].cb = NULL;
+	}
+}
+
+/* filter all windows of the batch and report the results */
+void goertzel_flush(struct goertzel_batch *batch)
+{
+	const signed short *s16[GOERTZEL_BATCH];
+	long long power[GOERTZEL_BATCH * GOERTZEL_BINS];
+	int index[GOERTZEL_BATCH];
+	struct goertzel_window *window;
+	int i, count = 0;
+
+	for (i = 0; i < batch->count; i++) {
+		window = &batch->window[i];
+		index[i] = -1;
+		if (!window->cb || window->span < batch->min_span)
+			continue;
+		index[i] = count;
+		s16[count++] = window->s16;
+	}
+	if (count)
+		goertzel_power(batch->tones, s16, count, power);
+
+	for (i = 0; i < batch->count; i++) {
+		window = &batch->window[i];
+		if (!window->cb)
+			continue;
+		window->cb(window->instance, (index[i] < 0) ? NULL : power + index[i] * GOERTZEL_BINS, window->span);
+	}
+	batch->count = 0;
+}
+
@@ -0,0 +1,60 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** tone detector engine header file                                          **
+**                                                                           **
+\*****************************************************************************/
+
+#define GOERTZEL_BINS		8	/* frequencies evaluated at once */
+#define GOERTZEL_MAX_LEN	256	/* largest window, so the filters cannot overflow */
+#define GOERTZEL_BATCH		64	/* windows decoded in one pass */
+#define GOERTZEL_FULLSCALE	15872.0	/* sqrt(power) / len of a tone at 0 db */
+
+/* filter kernels, from slowest to fastest */
+#define GOERTZEL_SCALAR		0
+#define GOERTZEL_SSE2		1
+#define GOERTZEL_AVX2		2
+#define GOERTZEL_KERNELS	3
+
+/* frequencies to detect */
+struct goertzel_tones {
+	int			bins;		/* frequencies used */
+	int			len;		/* samples of one window */
+	signed short		coeff[GOERTZEL_BINS];	/* 2*cos(2*PI*f/8000) << 14 */
+};
+
+/* called with the squared magnitude of each frequency, power is NULL, if
+ * the window was below the minimum span and not filtered */
+typedef void (goertzel_cb)(void *instance, const long long *power, int span);
+
+/* a window waiting in a batch */
+struct goertzel_window {
+	goertzel_cb		*cb;		/* NULL, if canceled */
+	void			*instance;
+	int			span;		/* peak to peak of samples */
+	signed short		s16[GOERTZEL_MAX_LEN];
+};
+
+/* windows of all lines that use the same frequencies */
+struct goertzel_batch {
+	const struct goertzel_tones *tones;
+	int			min_span;	/* windows below are not filtered */
+	int			count;
+	struct goertzel_window	window[GOERTZEL_BATCH];
+	struct lcr_work		work;		/* flushes the batch */
+};
+
+extern const char *goertzel_kernel_name[GOERTZEL_KERNELS];
+int goertzel_kernel(int kernel);
+void goertzel_init(void);
+void goertzel_tones(struct goertzel_tones *tones, const double *frequency, int bins, int len);
+extern void (*goertzel_power)(const struct goertzel_tones *tones, const signed short *const *s16, int count, long long *power);
+void goertzel_batch_init(struct goertzel_batch *batch, const struct goertzel_tones *tones, int min_span);
+void goertzel_queue(struct goertzel_batch *batch, const unsigned char *law, goertzel_cb *cb, void *instance);
+void goertzel_cancel(struct goertzel_batch *batch, void *instance);
+void goertzel_flush(struct goertzel_batch *batch);
+
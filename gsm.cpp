@@ -153,6 +153,20 @@ void Pgsm::send_mncc_rtp_connect(void)
 
 static int delete_event(struct lcr_work *work, void *instance, int index);
 
+/* DTMF decoded from received audio */
+static void gsm_dtmf(void *instance, char digit)
+{
+	class Pgsm *pgsm = (class Pgsm *)instance;
+	struct lcr_msg *message;
+
+	PDEBUG(DEBUG_GSM, "GSMPort(%s) inband DTMF digit '%c'\n", pgsm->p_name, digit);
+	if (!pgsm->p_epointlist)
+		return;
+	message = message_create(pgsm->p_serial, ACTIVE_EPOINT(pgsm->p_epointlist), PORT_TO_EPOINT, MESSAGE_DTMF);
+	message->param.dtmf = digit;
+	message_put(message);
+}
+
 /*
  * constructor
  */
@@ -189,6 +203,8 @@ Pgsm::Pgsm(int type, char *portname, struct port_settings *settings, struct inte
 		trigger_work(&p_g_delete);
 	}
 	p_g_rxpos = 0;
+	p_g_inband_dtmf = interface->inband_dtmf;
+	dtmf_decoder_init(&p_g_dtmf_decoder, gsm_dtmf, this);
 	p_g_tch_connected = 0;
 	p_g_media_type = 0;
 
@@ -203,6 +219,7 @@ Pgsm::~Pgsm()
 	PDEBUG(DEBUG_GSM, "Destroyed GSM process(%s).\n", p_name);
 
 	del_work(&p_g_delete);
+	dtmf_decoder_exit(&p_g_dtmf_decoder);
 
 	/* remove queued message */
 	if (p_g_notify_pending)
@@ -260,6 +277,10 @@ void Pgsm::frame_receive(void *arg)
 	if (p_echotest)
 		bridge_rx(data, 160);
 
+	/* decode DTMF tones */
+	if (p_g_inband_dtmf)
+		dtmf_decode(&p_g_dtmf_decoder, data, 160);
+
 	/* send to remote*/
 	bridge_tx(data, 160);
 }
@@ -997,7 +1018,7 @@ static int mncc_q_enqueue(struct lcr_gsm *lcr_gsm, struct gsm_mncc *mncc, unsign
 		lcr_gsm->mncc_q_tail = qe;
 	}
 
-	lcr_gsm->mncc_lfd.when |= LCR_FD_WRITE;
+	update_fd(&lcr_gsm->mncc_lfd, lcr_gsm->mncc_lfd.when | LCR_FD_WRITE);
 
 	return 0;
 }
@@ -1044,8 +1065,8 @@ static int mncc_fd_close(struct lcr_gsm *lcr_gsm, struct lcr_fd *lfd)
 	struct lcr_msg *message;
 
 	PERROR("Lost MNCC socket, retrying in %u seconds\n", SOCKET_RETRY_TIMER);
-	close(lfd->fd);
 	unregister_fd(lfd);
+	close(lfd->fd);
 	lfd->fd = -1;
 
 	/* free all the calls that were running through the MNCC interface */
@@ -1085,7 +1106,7 @@ static int mncc_fd_write(struct lcr_fd *lfd, void *inst, int idx)
 	while (1) {
 		qe = lcr_gsm->mncc_q_hd;
 		if (!qe) {
-			lfd->when &= ~LCR_FD_WRITE;
+			update_fd(lfd, lfd->when & ~LCR_FD_WRITE);
 			break;
 		}
 		rc = write(lfd->fd, qe->data, qe->len);
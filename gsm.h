@@ -52,6 +52,8 @@ class Pgsm : public Port
 	void *p_g_encoder, *p_g_decoder;	/* gsm handle */
 	signed short p_g_rxdata[160]; /* receive audio buffer */
 	int p_g_rxpos; /* position in audio buffer 0..159 */
+	int p_g_inband_dtmf; /* decode DTMF from received audio */
+	struct dtmf_decoder p_g_dtmf_decoder;
 	int p_g_tch_connected; /* indicates if audio is connected */
 	int p_g_media_type; /* current payload type or 0 if not set */
 	int p_g_payload_type; /* current payload type */
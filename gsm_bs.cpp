@@ -986,8 +986,8 @@ int gsm_bs_exit(int rc)
 	/* free gsm instance */
 	if (gsm_bs) {
 		if (gsm_bs->mncc_lfd.fd > -1) {
-			close(gsm_bs->mncc_lfd.fd);
 			unregister_fd(&gsm_bs->mncc_lfd);
+			close(gsm_bs->mncc_lfd.fd);
 		}
 
 		del_timer(&gsm_bs->socket_retry);
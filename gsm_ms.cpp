@@ -794,8 +794,8 @@ int gsm_ms_delete(const char *name)
 #endif
 
 	if (gsm_ms->mncc_lfd.fd > -1) {
-		close(gsm_ms->mncc_lfd.fd);
 		unregister_fd(&gsm_ms->mncc_lfd);
+		close(gsm_ms->mncc_lfd.fd);
 	}
 	del_timer(&gsm_ms->socket_retry);
 
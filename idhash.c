@@ -0,0 +1,107 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** id hash to find ports, endpoints and joins by their serial                **
+**                                                                           **
+\*****************************************************************************/ 
+
+#include "main.h"
+
+#define ID_HASH_MIN	256
+
+/* serials are given in ascending order, so the lower bits are hash enough */
+#define ID_HASH_BUCKET(hash, id) ((id) & ((hash)->size - 1))
+
+/* rehash all entries into a table of given size */
+static void id_hash_resize(struct id_hash *hash, unsigned int size)
+{
+	struct id_hash_entry **table, *entry, *next;
+	unsigned int i, bucket;
+
+	table = (struct id_hash_entry **)MALLOC(size * sizeof(struct id_hash_entry *));
+	for (i = 0; i < hash->size; i++) {
+		entry = hash->table[i];
+		while(entry) {
+			next = entry->next;
+			bucket = entry->id & (size - 1);
+			entry->next = table[bucket];
+			table[bucket] = entry;
+			entry = next;
+		}
+	}
+	if (hash->table)
+		FREE(hash->table, hash->size * sizeof(struct id_hash_entry *));
+	hash->table = table;
+	hash->size = size;
+}
+
+/*
+ * add object with given id to hash
+ */
+void id_hash_add(struct id_hash *hash, struct id_hash_entry *entry, unsigned int id, void *object)
+{
+	unsigned int bucket;
+
+	if (!hash->table)
+		id_hash_resize(hash, ID_HASH_MIN);
+	else if (hash->count >= hash->size)
+		id_hash_resize(hash, hash->size << 1);
+
+	entry->id = id;
+	entry->object = object;
+	bucket = ID_HASH_BUCKET(hash, id);
+	entry->next = hash->table[bucket];
+	hash->table[bucket] = entry;
+	hash->count++;
+}
+
+/*
+ * remove entry from hash, the table is freed when the last entry is removed
+ */
+void id_hash_remove(struct id_hash *hash, struct id_hash_entry *entry)
+{
+	struct id_hash_entry **entryp;
+
+	if (!hash->table)
+		FATAL("id %u removed from empty hash\n", entry->id);
+	entryp = &hash->table[ID_HASH_BUCKET(hash, entry->id)];
+	while(*entryp) {
+		if (*entryp == entry)
+			break;
+		entryp = &(*entryp)->next;
+	}
+	if (!*entryp)
+		FATAL("id %u not in hash\n", entry->id);
+	*entryp = entry->next;
+	entry->next = NULL;
+
+	if (--hash->count == 0) {
+		FREE(hash->table, hash->size * sizeof(struct id_hash_entry *));
+		hash->table = NULL;
+		hash->size = 0;
+	}
+}
+
+/*
+ * find object by id, return NULL if not found
+ */
+void *id_hash_find(struct id_hash *hash, unsigned int id)
+{
+	struct id_hash_entry *entry;
+
+	if (!hash->table)
+		return(NULL);
+	entry = hash->table[ID_HASH_BUCKET(hash, id)];
+	while(entry) {
+		if (entry->id == id)
+			return(entry->object);
+		entry = entry->next;
+	}
+
+	return(NULL);
+}
+
@@ -0,0 +1,29 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** id hash header file                                                       **
+**                                                                           **
+\*****************************************************************************/ 
+
+/* entry of an object in the id hash, embedded into the object itself */
+struct id_hash_entry {
+	struct id_hash_entry	*next;	/* next entry in same bucket */
+	unsigned int		id;	/* serial of object */
+	void			*object;
+};
+
+/* hash table of objects, indexed by their serial */
+struct id_hash {
+	struct id_hash_entry	**table;
+	unsigned int		size;	/* number of buckets, power of two */
+	unsigned int		count;	/* number of entries */
+};
+
+void id_hash_add(struct id_hash *hash, struct id_hash_entry *entry, unsigned int id, void *object);
+void id_hash_remove(struct id_hash *hash, struct id_hash_entry *entry);
+void *id_hash_find(struct id_hash *hash, unsigned int id);
+
@@ -267,8 +267,14 @@ static int inter_hunt(struct interface *interface, char *filename, int line, cha
 	} else
 	if (!strcasecmp(value, "roundrobin")) {
 		interface->hunt = HUNT_ROUNDROBIN;
+	} else
+	if (!strcasecmp(value, "leastloaded")) {
+		interface->hunt = HUNT_LEASTLOADED;
+	} else
+	if (!strcasecmp(value, "weighted")) {
+		interface->hunt = HUNT_WEIGHTED;
 	} else {
-		SPRINT(interface_error, "Error in %s (line %d): parameter '%s' expects value 'linear' or 'roundrobin'.\n", filename, line, parameter);
+		SPRINT(interface_error, "Error in %s (line %d): parameter '%s' expects value 'linear', 'roundrobin', 'leastloaded' or 'weighted'.\n", filename, line, parameter);
 		return(-1);
 	}
 	return(0);
@@ -879,6 +885,26 @@ static int inter_dialmax(struct interface *interface, char *filename, int line,
 	ifport->dialmax = atoi(value);
 	return(0);
 }
+static int inter_weight(struct interface *interface, char *filename, int line, char *parameter, char *value)
+{
+	struct interface_port *ifport;
+
+	/* port in chain ? */
+	if (!interface->ifport) {
+		SPRINT(interface_error, "Error in %s (line %d): parameter '%s' expects previous 'port' definition.\n", filename, line, parameter);
+		return(-1);
+	}
+	if (atoi(value) < 1) {
+		SPRINT(interface_error, "Error in %s (line %d): parameter '%s' expects a weight of 1 or more.\n", filename, line, parameter);
+		return(-1);
+	}
+	/* goto end of chain */
+	ifport = interface->ifport;
+	while(ifport->next)
+		ifport = ifport->next;
+	ifport->weight = atoi(value);
+	return(0);
+}
 static int inter_tones_dir(struct interface *interface, char *filename, int line, char *parameter, char *value)
 {
 	struct interface_port *ifport;
@@ -999,6 +1025,61 @@ static int inter_rtp_bridge(struct interface *interface, char *filename, int lin
 
 	return(0);
 }
+static int inter_inband_dtmf(struct interface *interface, char *filename, int line, char *parameter, char *value)
+{
+	int supported = 0;
+
+#ifdef WITH_GSM_BS
+	if (interface->gsm_bs)
+		supported = 1;
+#endif
+#ifdef WITH_GSM_MS
+	if (interface->gsm_ms)
+		supported = 1;
+#endif
+#ifdef WITH_SIP
+	if (interface->sip)
+		supported = 1;
+#endif
+	if (!supported) {
+		SPRINT(interface_error, "Error in %s (line %d): Interface does not receive audio in userspace\n", filename, line);
+		return(-1);
+	}
+	interface->inband_dtmf = 1;
+
+	return(0);
+}
+static int inter_rtp_jitter(struct interface *interface, char *filename, int line, char *parameter, char *value)
+{
+#ifndef WITH_SIP
+	SPRINT(interface_error, "Error in %s (line %d): SIP not compiled in.\n", filename, line);
+	return(-1);
+#else
+	char *p;
+
+	if (!interface->sip) {
+		SPRINT(interface_error, "Error in %s (line %d): This parameter only works for SIP interface\n", filename, line);
+		return(-1);
+	}
+
+	/* default */
+	interface->rtp_jitter_min = 20;
+	interface->rtp_jitter_max = 200;
+
+	if (value && value[0]) {
+		p = get_seperated(value);
+		interface->rtp_jitter_min = atoi(value);
+		if (p[0])
+			interface->rtp_jitter_max = atoi(p);
+	}
+	if (interface->rtp_jitter_min < 20 || interface->rtp_jitter_max < interface->rtp_jitter_min || interface->rtp_jitter_max > 500) {
+		SPRINT(interface_error, "Error in %s (line %d): Given delay of jitter buffer out of range (20..500 ms).\n", filename, line);
+		return(-1);
+	}
+
+	return(0);
+#endif
+}
 #if 0
 static int inter_rtp_payload(struct interface *interface, char *filename, int line, char *parameter, char *value)
 {
@@ -1166,8 +1247,10 @@ struct interface_param interface_param[] = {
 	{"earlyb", &inter_earlyb, "yes | no",
 	"Interface receives and bridges tones during call setup and release, or not.\nBy default only TE-mode ports receive tones."},
 
-	{"hunt", &inter_hunt, "linear | roundrobin",
-	"Select the algorithm for selecting port with free channel."},
+	{"hunt", &inter_hunt, "linear | roundrobin | leastloaded | weighted",
+	"Select the algorithm for selecting port with free channel.\n"
+	"'leastloaded' selects the port with most free channels, 'weighted' selects the\n"
+	"port with fewest channels in use, relative to the 'weight' of the port."},
 
 	{"port", &inter_port, "<number>",
 	""},
@@ -1271,6 +1354,10 @@ struct interface_param interface_param[] = {
 	{"dialmax", &inter_dialmax, "<digits>",
 	"Limits the number of digits in setup/information message."},
 
+	{"weight", &inter_weight, "<weight>",
+	"Share of outgoing calls for this port, if 'hunt weighted' is used.\n"
+	"A port with weight 2 gets twice as many calls as a port with weight 1 (default)."},
+
 	{"tones_dir", &inter_tones_dir, "<path>",
 	"Overrides the given tone_dir in options.conf.\n"
 	"To used kernel tones in mISDN_dsp.ko, say 'american', 'german', or 'oldgerman'."},
@@ -1290,6 +1377,13 @@ struct interface_param interface_param[] = {
 	{"rtp-bridge", &inter_rtp_bridge, "",
 	"Enables RTP bridging directly from this interface.\n"
 	"This only works, if both ends support RTP. (like gsm-bs and sip)"},
+	{"rtp-jitter", &inter_rtp_jitter, "[<min delay> [<max delay>]]",
+	"Enables jitter buffer for RTP received from this SIP interface.\n"
+	"The delay adapts to the jitter of the network between the given minimum and\n"
+	"maximum delay in milliseconds. (Default is 20 and 200 ms.)"},
+	{"inband-dtmf", &inter_inband_dtmf, "",
+	"Decodes DTMF tones from the audio received from this SIP or GSM interface.\n"
+	"Use this, if the remote sends DTMF as tones only."},
 #if 0
 	not needed, since ms defines what is supports and remote (sip) tells what is selected
 	{"rtp-payload", &inter_rtp_payload, "<codec>",
@@ -1545,6 +1639,8 @@ void free_interfaces(struct interface *interface)
  */
 static void set_mISDN_defaults(struct interface_port *ifport)
 {
+	struct select_channel *selchannel;
+
 	/* default channel selection list */
 	if (!ifport->out_channel)
 		default_out_channel(ifport);
@@ -1568,6 +1664,16 @@ static void set_mISDN_defaults(struct interface_port *ifport)
 		ifport->mISDNport->locally = 1;
 	else
 		ifport->mISDNport->locally = 0;
+	/* count free channels of interface, they are kept by set_bchannel_port() */
+	ifport->interface->b_free += ifport->mISDNport->b_free_num;
+	selchannel = ifport->out_channel;
+	while(selchannel) {
+		if (selchannel->channel == CHANNEL_NO)
+			ifport->interface->hunt_nofree = 1;
+		selchannel = selchannel->next;
+	}
+	if (ifport->mISDNport->ss5)
+		ifport->interface->hunt_nofree = 1;
 }
 #endif
 
@@ -21,6 +21,8 @@ enum {	/* interface type */
 	/* port selection */
 enum {	HUNT_LINEAR = 0,
 	HUNT_ROUNDROBIN,
+	HUNT_LEASTLOADED,	/* port with most free channels */
+	HUNT_WEIGHTED,		/* port with fewest used channels per weight */
 };
 
 	/* filters */
@@ -67,6 +69,7 @@ struct interface_port {
 //	int			tout_hold;
 //	int			tout_park;
 	int			dialmax; /* maximum number of digits to dial */
+	int			weight; /* share of calls for weighted hunting (0 = 1) */
 	char			tones_dir[128];
 	int			nonotify; /* blocks outgoing notify messages  */
 };
@@ -98,6 +101,8 @@ struct interface {
 	int			shutdown; /* interface will not automatically be loaded */
 	int			hunt; /* select algorithm */
 	int			hunt_next; /* ifport index to start hunt */
+	int			hunt_nofree; /* a port may be selected without free channel (call waiting, SS5) */
+	int			b_free; /* free channels of all linked ports, see set_bchannel_port() */
 	struct interface_port	*ifport; /* link to interface port list */
 	struct interface_msn	*ifmsn; /* link to interface msn list */
 	struct interface_screen *ifscreen_in; /* link to screening list */
@@ -122,8 +127,11 @@ struct interface {
 	char			sip_local_peer[32];
 	char			sip_remote_peer[32];
 	void			*sip_inst; /* sip instance */
+	int			rtp_jitter_min; /* jitter buffer delay (ms), 0 = off */
+	int			rtp_jitter_max;
 #endif
 	int			rtp_bridge; /* bridge RTP directly (for calls comming from interface) */
+	int			inband_dtmf; /* decode DTMF from received audio (SIP and GSM) */
 };
 
 struct interface_param {
@@ -19,22 +19,14 @@ unsigned int join_serial = 1; /* must be 1, because 0== no join */
 //JOIN_STATES
 
 class Join *join_first = NULL;
+static struct id_hash join_hash; /* joins by serial */
 
 /*
  * find the join with join_id
  */ 
 class Join *find_join_id(unsigned int join_id)
 {
-	class Join *join = join_first;
-
-	while(join) {
-//printf("comparing: '%s' with '%s'\n", name, join->j_name);
-		if (join->j_serial == join_id)
-			return(join);
-		join = join->next;
-	}
-
-	return(NULL);
+	return((class Join *)id_hash_find(&join_hash, join_id));
 }
 
 
@@ -46,6 +38,7 @@ Join::Join(void)
 	class Join **joinp;
 
 	j_serial = join_serial++;
+	id_hash_add(&join_hash, &j_id_entry, j_serial, this);
 	j_type = JOIN_TYPE_NONE;
 
 	/* attach to chain */
@@ -79,6 +72,7 @@ Join::~Join()
 	if (!cl)
 		FATAL("software error, join not in chain!\n");
 	*clp = cl->next; /* detach from chain */
+	id_hash_remove(&join_hash, &j_id_entry);
 }
 
 
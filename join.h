@@ -27,6 +27,7 @@ class Join
 
 	unsigned int j_type;		/* join type (pbx or asterisk) */
 	unsigned int j_serial;		/* serial/unique number of join */
+	struct id_hash_entry j_id_entry;	/* entry in hash of join serials */
 }; 
 
 void join_free(void);
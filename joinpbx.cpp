@@ -226,6 +226,7 @@ JoinPBX::JoinPBX(class Endpoint *epoint) : Join()
 	j_pid = getpid();
 	j_partyline = 0;
 	j_partyline_jingle = 0;
+	j_partyline_talkers = 0;
 	j_multicause = 0;
 	j_multilocation = 0;
 	memset(&j_updatebridge, 0, sizeof(j_updatebridge));
@@ -370,10 +371,18 @@ void JoinPBX::bridge(void)
 		 * Bridge between port instances if:
 		 * - two relations
 		 * - one or all are not mISDN
+		 * If more than two relations, the connected ones are mixed.
 		 */
 		message = message_create(j_serial, relation->epoint_id, JOIN_TO_EPOINT, MESSAGE_BRIDGE);
-		message->param.bridge_id = (relations==2 && !allmISDN) ? j_serial : 0;
-		PDEBUG(DEBUG_JOIN, "join%u EP%u requests bridge=%u\n", j_serial, relation->epoint_id, message->param.bridge_id);
+		if (relations==2 && !allmISDN)
+			message->param.bridge.id = j_serial;
+		if (relations>2 && !allmISDN
+		 && relation->channel_state == 1
+		 && relation->rx_state != NOTIFY_STATE_HOLD
+		 && relation->rx_state != NOTIFY_STATE_SUSPEND)
+			message->param.bridge.id = j_serial;
+		message->param.bridge.talkers = j_partyline_talkers;
+		PDEBUG(DEBUG_JOIN, "join%u EP%u requests bridge=%u\n", j_serial, relation->epoint_id, message->param.bridge.id);
 		message_put(message);
 
 		relation = relation->next;
@@ -641,6 +650,7 @@ void JoinPBX::message_epoint(unsigned int epoint_id, int message_type, union par
 	if (message_type == MESSAGE_SETUP) if (param->setup.partyline && !j_partyline) {
 		j_partyline = param->setup.partyline;
 		j_partyline_jingle = param->setup.partyline_jingle;
+		j_partyline_talkers = param->setup.partyline_talkers;
 	}
 	if (j_partyline) {
 		switch(message_type) {
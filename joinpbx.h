@@ -64,6 +64,7 @@ class JoinPBX : public Join
 
 	int j_partyline;		/* if set, join is conference room */
 	int j_partyline_jingle;		/* also play jingle on join/leave */
+	int j_partyline_talkers;	/* mix only the loudest members, if not mISDN */
 
 	void bridge(void);
 	void remove_relation(struct join_relation *relation);
@@ -20,10 +20,12 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <curses.h>
 #include "macro.h"
 #include "options.h"
+#include "idhash.h"
 #include "join.h"
 #include "select.h"
 #include "joinpbx.h"
@@ -40,6 +42,7 @@
 int	lastlines, lastcols;
 int	show_interfaces = 2,
 	show_calls = 1,
+	show_stats = 0,
 	show_log = 1;
 
 enum {
@@ -47,6 +50,7 @@ enum {
 	MODE_PORTINFO,
 	MODE_INTERFACE,
 	MODE_ROUTE,
+	MODE_TONES,
 	MODE_DIAL,
 	MODE_RELEASE,
 	MODE_UNBLOCK,
@@ -208,6 +212,19 @@ int debug_port(struct admin_message *msg, struct admin_message *m, int line, int
 		}
 	}
 
+	if (m[i].u.p.jitter) {
+		color(cyan);
+		addstr(" jitter=");
+		color(white);
+		SPRINT(buffer, "%dms", m[i].u.p.jitter_depth);
+		addstr(buffer);
+		color(cyan);
+		addstr(" late/lost/reordered=");
+		color(yellow);
+		SPRINT(buffer, "%u/%u/%u", m[i].u.p.jitter_late, m[i].u.p.jitter_lost, m[i].u.p.jitter_reordered);
+		addstr(buffer);
+	}
+
 	return(line);
 }
 int debug_epoint(struct admin_message *msg, struct admin_message *m, int line, int i, int vline)
@@ -451,6 +468,7 @@ const char *admin_state(int sock, char *argv[])
 	char			enter_string[128] = "", ch;
 	fd_set			select_rfds;
 	struct timeval		select_tv;
+	struct stat		log_st, log_st_file;
 
 	/* flush logfile name */
 	logfile[0] = '\0';
@@ -610,6 +628,11 @@ const char *admin_state(int sock, char *argv[])
 				logline[logcur % LOGLINES][0] = '\0';
 			}
 		}
+		/* continue with new log, if it was renamed by lcr */
+		if (fstat(logfh, &log_st) || stat(logfile, &log_st_file) || log_st.st_ino != log_st_file.st_ino) {
+			close(logfh);
+			logfh = open(logfile, O_RDONLY|O_NONBLOCK);
+		}
 	}
 
 	/* display interfaces */
@@ -956,6 +979,38 @@ const char *admin_state(int sock, char *argv[])
 
 	}
 
+	/* show statistics */
+	if (show_stats) {
+		move(line++>1?line-1:1, 0);
+		color(blue);
+		hline(ACS_HLINE, COLS);
+		move(line++>1?line-1:1, 0);
+		color(white);
+		SPRINT(buffer, "Messages: %u from pool, %u allocated", msg.u.s.msg_pool_hits, msg.u.s.msg_pool_allocs);
+		addstr(buffer);
+		if (line+2 >= LINES) goto end;
+		move(line++>1?line-1:1, 0);
+		SPRINT(buffer, "Recording: %u blocks dropped, %u late writes", msg.u.s.record_dropped, msg.u.s.record_late);
+		addstr(buffer);
+		if (line+2 >= LINES) goto end;
+		move(line++>1?line-1:1, 0);
+		SPRINT(buffer, "CDR: %u queued (max %u), written after %u ms (max %u), %u waits", msg.u.s.cdr_depth, msg.u.s.cdr_depth_max, msg.u.s.cdr_latency, msg.u.s.cdr_latency_max, msg.u.s.cdr_waits);
+		addstr(buffer);
+		if (line+2 >= LINES) goto end;
+		move(line++>1?line-1:1, 0);
+		SPRINT(buffer, "Log: %u traces not written", msg.u.s.trace_lost);
+		addstr(buffer);
+		if (line+2 >= LINES) goto end;
+		move(line++>1?line-1:1, 0);
+		SPRINT(buffer, "Keys: %u from pool, %u generated, done after %u ms (max %u)", msg.u.s.key_pool_hits, msg.u.s.key_pool_misses, msg.u.s.key_latency, msg.u.s.key_latency_max);
+		addstr(buffer);
+		if (line+2 >= LINES) goto end;
+		move(line++>1?line-1:1, 0);
+		SPRINT(buffer, "D-channel: %u call references looked up per second", msg.u.s.l3id_lookups);
+		addstr(buffer);
+		if (line+2 >= LINES) goto end;
+	}
+
 	/* show log */
 	if (show_log) {
 		if (line+2 < LINES) {
@@ -1031,7 +1086,7 @@ const char *admin_state(int sock, char *argv[])
 		SPRINT(buffer, "-> %s", enter_string);
 	} else {
 		color(cyan);
-		SPRINT(buffer, "i=interfaces '%s'  c=calls '%s'  l=log  q=quit  +-*/=scroll  enter", text_interfaces[show_interfaces], text_calls[show_calls]);
+		SPRINT(buffer, "i=interfaces '%s'  c=calls '%s'  l=log  s=stats  q=quit  +-*/=scroll  enter", text_interfaces[show_interfaces], text_calls[show_calls]);
 	}
 	addstr(buffer);
 	refresh();
@@ -1057,6 +1112,7 @@ const char *admin_state(int sock, char *argv[])
 			SPRINT(logline[logcur++ % LOGLINES], "> %s", enter_string);
 			if (!!strncmp(enter_string, "interface", 10) &&
 			    !!strncmp(enter_string, "route", 6) &&
+			    !!strncmp(enter_string, "tones", 6) &&
 			    !!strncmp(enter_string, "release ", 8) &&
 			    !!strncmp(enter_string, "block ", 6) &&
 			    !!strncmp(enter_string, "unblock ", 8) &&
@@ -1065,6 +1121,7 @@ const char *admin_state(int sock, char *argv[])
 				SPRINT(logline[logcur++ % LOGLINES], "usage:");
 				SPRINT(logline[logcur++ % LOGLINES], "interface (reload interface.conf)");
 				SPRINT(logline[logcur++ % LOGLINES], "route (reload routing.conf)");
+				SPRINT(logline[logcur++ % LOGLINES], "tones (reload fetched tones)");
 				SPRINT(logline[logcur++ % LOGLINES], "release <EP> (release endpoint with given ID)");
 				SPRINT(logline[logcur++ % LOGLINES], "block <port> (block port for further calls)");
 				SPRINT(logline[logcur++ % LOGLINES], "unblock/load <port> (unblock port for further calls, load if not loaded)");
@@ -1140,6 +1197,11 @@ const char *admin_state(int sock, char *argv[])
 			if (show_log > 1) show_log = 0;
 			goto again;
 
+			case 's': /* toggle statistics */
+			show_stats++;
+			if (show_stats > 1) show_stats = 0;
+			goto again;
+
 			case '+': /* scroll down */
 			offset++;
 			goto again;
@@ -1344,6 +1406,9 @@ const char *admin_cmd(int sock, int mode, char *extension, char *number)
 		case MODE_ROUTE:
 		msg.message = ADMIN_REQUEST_CMD_ROUTE;
 		break;
+		case MODE_TONES:
+		msg.message = ADMIN_REQUEST_CMD_TONES;
+		break;
 		case MODE_DIAL:
 		msg.message = ADMIN_REQUEST_CMD_DIAL;
 		SPRINT(msg.u.x.message, "%s:%s", extension?:"", number?:"");
@@ -1384,6 +1449,10 @@ const char *admin_cmd(int sock, int mode, char *extension, char *number)
 		if (msg.message != ADMIN_RESPONSE_CMD_ROUTE)
 			return("Response not valid.");
 		break;
+		case MODE_TONES:
+		if (msg.message != ADMIN_RESPONSE_CMD_TONES)
+			return("Response not valid.");
+		break;
 		case MODE_DIAL:
 		if (msg.message != ADMIN_RESPONSE_CMD_DIAL)
 			return("Response not valid.");
@@ -1700,6 +1769,7 @@ int main(int argc, char *argv[])
 		printf("portinfo - Get info of current ports.\n");
 		printf("interface [<portname>] - Tell LCR to reload \"interface.conf\".\n");
 		printf("route - Tell LCR to reload \"route.conf\".\n");
+		printf("tones - Tell LCR to reload fetched tones in background.\n");
 		printf("dial <extension> <number> - Tell LCR the next number to dial for extension.\n");
 		printf("release <number> - Tell LCR to release endpoint with given number.\n");
 		printf("block <port> - Block given port.\n");
@@ -1728,6 +1798,9 @@ int main(int argc, char *argv[])
 	if (!(strcasecmp(argv[1],"route"))) {
 		mode = MODE_ROUTE;
 	} else
+	if (!(strcasecmp(argv[1],"tones"))) {
+		mode = MODE_TONES;
+	} else
 	if (!(strcasecmp(argv[1],"dial"))) {
 		if (argc <= 3)
 			goto usage;
@@ -1796,6 +1869,7 @@ int main(int argc, char *argv[])
 	
 		case MODE_INTERFACE:
 		case MODE_ROUTE:
+		case MODE_TONES:
 		ret = admin_cmd(sock, mode, NULL, NULL);
 		break;
 
@@ -43,6 +43,8 @@ enum { /* messages */
 	ADMIN_TRACE_REQUEST,
 	ADMIN_TRACE_RESPONSE,
 	ADMIN_MESSAGE,
+	ADMIN_REQUEST_CMD_TONES,
+	ADMIN_RESPONSE_CMD_TONES,
 };
 
 struct admin_response_cmd {
@@ -61,6 +63,22 @@ struct admin_response_state {
 	int		joins;
 	int		epoints;
 	int		ports;
+	/* statistics */
+	unsigned int	msg_pool_hits;	/* messages taken from message pool */
+	unsigned int	msg_pool_allocs; /* messages allocated from heap */
+	unsigned int	record_dropped;	/* recorded blocks dropped */
+	unsigned int	record_late;	/* record writes that took too long */
+	unsigned int	cdr_depth;	/* call detail records queued */
+	unsigned int	cdr_depth_max;
+	unsigned int	cdr_latency;	/* ms until records are written */
+	unsigned int	cdr_latency_max;
+	unsigned int	cdr_waits;	/* records that waited for a full queue */
+	unsigned int	trace_lost;	/* traces not written to log */
+	unsigned int	key_pool_hits;	/* rsa key pairs taken from pool */
+	unsigned int	key_pool_misses; /* rsa key pairs generated while waiting */
+	unsigned int	key_latency;	/* ms until key engine has done a job */
+	unsigned int	key_latency_max;
+	unsigned int	l3id_lookups;	/* call references looked up per second */
 };
 
 struct admin_response_interface {
@@ -124,6 +142,11 @@ struct admin_response_port {
 	int		isdn_chan; /* bchannel number */
 	int		isdn_hold; /* on hold */
 	int		isdn_ces; /* ces to use (>=0)*/
+	int		jitter; /* if port has a jitter buffer */
+	int		jitter_depth; /* current delay (ms) */
+	unsigned int	jitter_late; /* frames received too late */
+	unsigned int	jitter_lost; /* frames concealed */
+	unsigned int	jitter_reordered; /* frames received out of order */
 };
 
 struct admin_call {
@@ -177,6 +200,79 @@ struct admin_message {
 	} u;
 };
 
+/* compact protocol for remote applications
+ *
+ * The application requests it by setting 'protocol' in the parameter of
+ * its hello message. If supported, LCR replies with a hello message that
+ * has the protocol set. This reply is the last admin_message sent by LCR.
+ * The application must not send anything after its hello, until it gets
+ * the reply. If it gives up waiting (LCR without compact protocol), it must
+ * reconnect and send a hello without the protocol set, because LCR may
+ * still reply and switch to frames.
+ * After that, both sides send frames only: A header, followed by the
+ * parameter of the message without trailing zeros. The receiver clears
+ * the rest of the parameter.
+ */
+#define ADMIN_PROTOCOL_FIXED	0
+#define ADMIN_PROTOCOL_COMPACT	1
+
+struct admin_frame {
+	unsigned int	len; /* length of parameter that follows */
+	int		type; /* type of message */
+	unsigned int	ref; /* reference to individual endpoints */
+};
+
+#define ADMIN_FRAME_MAX	(sizeof(struct admin_frame) + sizeof(union parameter))
+#define ADMIN_BUFFER	65536 /* buffer for frames, must hold at least ADMIN_FRAME_MAX */
+
+/* length of parameter without trailing zeros */
+static inline unsigned int admin_param_len(union parameter *param)
+{
+	const unsigned char *p = (const unsigned char *)param;
+	unsigned int len = sizeof(union parameter);
+
+	while (len && !p[len - 1])
+		len--;
+
+	return len;
+}
+
+/* put message as frame into buffer, returns length of frame */
+static inline int admin_frame_put(unsigned char *buffer, int type, unsigned int ref, union parameter *param)
+{
+	struct admin_frame frame;
+	unsigned int len = admin_param_len(param);
+
+	frame.len = len;
+	frame.type = type;
+	frame.ref = ref;
+	memcpy(buffer, &frame, sizeof(frame));
+	memcpy(buffer + sizeof(frame), param, len);
+
+	return sizeof(frame) + len;
+}
+
+/* get message from frame in buffer, returns length of frame,
+ * 0 if frame is not complete, -1 if frame is invalid */
+static inline int admin_frame_get(const unsigned char *buffer, unsigned int size, int *type, unsigned int *ref, union parameter *param)
+{
+	struct admin_frame frame;
+
+	if (size < sizeof(frame))
+		return 0;
+	memcpy(&frame, buffer, sizeof(frame));
+	if (frame.len > sizeof(union parameter))
+		return -1;
+	if (size < sizeof(frame) + frame.len)
+		return 0;
+	*type = frame.type;
+	*ref = frame.ref;
+	memcpy(param, buffer + sizeof(frame), frame.len);
+	memset((unsigned char *)param + frame.len, 0, sizeof(union parameter) - frame.len);
+
+	return sizeof(frame) + frame.len;
+}
+
 /* call states */
 enum {
 	ADMIN_STATE_IDLE,
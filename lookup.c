@@ -0,0 +1,518 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** list files (directory, phonebook, secrets) kept in memory                 **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO look up?
+
+The directory is searched for the name of each incoming caller, the
+phonebook for each abbreviation and the secrets for each encrypted call.
+Large files took too long to parse on each call.
+
+When a file is used the first time, it is read at once and each line is
+added to a hash table by its key. The directory is loaded at startup.
+The key of the directory includes the type of number, so the number
+prefixes of the options are resolved when loading. The phonebook is also
+sorted by abbreviation, to find out if more digits could match.
+
+Before a file is used, it is checked for changes once in LOOKUP_CHECK
+seconds. If the file has changed, it is loaded again.
+
+*/
+
+#include <ctype.h>
+#include "main.h"
+
+static struct lookup_list *lookup_hash[LOOKUP_HASH];
+static const struct lookup_list *lookup_sorting; /* list that qsort sorts */
+
+static const char *lookup_name[] = {
+	"directory",
+	"phonebook",
+	"secrets",
+};
+
+int file_stamp(const char *filename, struct file_stamp *stamp)
+{
+	struct stat st;
+
+	memset(stamp, 0, sizeof(struct file_stamp));
+	if (stat(filename, &st) < 0)
+		return -1;
+	stamp->ino = st.st_ino;
+	stamp->size = st.st_size;
+	stamp->mtime = st.st_mtim.tv_sec;
+	stamp->mtime_nsec = st.st_mtim.tv_nsec;
+
+	return 0;
+}
+
+static unsigned int lookup_key(const char *key)
+{
+	unsigned int hash = 5381;
+
+	while (*key)
+		hash = hash * 33 + (unsigned char)*key++;
+
+	return hash;
+}
+
+/* returns the first entry with the given key, or -1 */
+static int lookup_find(struct lookup_list *list, const char *key)
+{
+	int i;
+
+	i = list->buckets[lookup_key(key) & list->mask];
+	while (i >= 0) {
+		if (!strcmp(list->entries[i].key, key))
+			return i;
+		i = list->entries[i].next;
+	}
+
+	return -1;
+}
+
+static void lookup_unload(struct lookup_list *list)
+{
+	if (list->strings) {
+		FREE(list->strings, list->strings_size);
+		memuse--;
+	}
+	if (list->entries) {
+		FREE(list->entries, 0);
+		memuse--;
+	}
+	if (list->buckets) {
+		FREE(list->buckets, 0);
+		memuse--;
+	}
+	if (list->sorted) {
+		FREE(list->sorted, 0);
+		memuse--;
+	}
+	list->strings = NULL;
+	list->entries = NULL;
+	list->buckets = NULL;
+	list->sorted = NULL;
+	list->count = 0;
+	list->loaded = 0;
+}
+
+/* cut word, skip spaces after it */
+static char *lookup_word(char **pp)
+{
+	char *word = *pp, *p = *pp;
+
+	while ((unsigned char)*p > 32)
+		p++;
+	if (*p)
+		*p++ = '\0';
+	while (*p && (unsigned char)*p <= 32)
+		p++;
+	*pp = p;
+
+	return word;
+}
+
+/* copy string that may be longer than the destination, the bound leaves room
+ * for the terminator */
+static void lookup_copy(char *to, const char *from, unsigned int size)
+{
+	UNCPY(to, from, size - 1);
+	to[size - 1] = '\0';
+}
+
+/* copy key, convert to lower case */
+static char *lookup_lower(char *to, const char *from)
+{
+	while (*from)
+		*to++ = tolower((unsigned char)*from++);
+	*to++ = '\0';
+
+	return to;
+}
+
+/* directory keys start with a character for the type of number:
+ * 'i' = international, 'n' = national, 's' = other than national or
+ * international, 'x' = other than international
+ */
+static char *lookup_directory_key(char *to, const char *phone)
+{
+	int len;
+
+	if (phone[0] == 'i' || phone[0] == 'n' || phone[0] == 's') {
+		*to++ = phone[0];
+		phone++;
+	} else if (!strncmp(phone, options.international, (len = strlen(options.international)))) {
+		*to++ = 'i';
+		phone += len;
+	} else if (!options.national[0]) {
+		*to++ = 'x';
+	} else if (!strncmp(phone, options.national, (len = strlen(options.national)))) {
+		*to++ = 'n';
+		phone += len;
+	} else
+		*to++ = 's';
+	strcpy(to, phone);
+
+	return to + strlen(to) + 1;
+}
+
+static int lookup_compare(const void *a, const void *b)
+{
+	return strcmp(lookup_sorting->entries[*(const int *)a].field[0], lookup_sorting->entries[*(const int *)b].field[0]);
+}
+
+static int lookup_load(struct lookup_list *list)
+{
+	struct lookup_entry *entry;
+	struct stat st;
+	char *p, *line, *eol, *keys, *rest;
+	int fd, size, len, lines, buckets, i;
+	unsigned int hash;
+
+	lookup_unload(list);
+
+	if ((fd = open(list->filename, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	memset(&list->stamp, 0, sizeof(list->stamp));
+	list->stamp.ino = st.st_ino;
+	list->stamp.size = st.st_size;
+	list->stamp.mtime = st.st_mtim.tv_sec;
+	list->stamp.mtime_nsec = st.st_mtim.tv_nsec;
+
+	/* content, then the keys, each key is at most two bytes longer than its line */
+	size = st.st_size;
+	list->strings_size = (size + 1) * 3;
+	list->strings = (char *)MALLOC(list->strings_size);
+	memuse++;
+	len = 0;
+	while (len < size) {
+		i = read(fd, list->strings + len, size - len);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0)
+			break;
+		len += i;
+	}
+	close(fd);
+	size = len;
+	list->strings[size] = '\0';
+	keys = list->strings + size + 1;
+
+	lines = 1;
+	p = list->strings;
+	while ((p = (char *)memchr(p, '\n', list->strings + size - p))) {
+		lines++;
+		p++;
+	}
+	list->entries = (struct lookup_entry *)MALLOC(lines * sizeof(struct lookup_entry));
+	memuse++;
+
+	p = list->strings;
+	while (p < list->strings + size) {
+		line = p;
+		if (!(eol = (char *)memchr(p, '\n', list->strings + size - p)))
+			eol = list->strings + size;
+		*eol = '\0';
+		if (eol > line && eol[-1] == '\r')
+			eol[-1] = '\0';
+		p = eol + 1;
+
+		while (*line && (unsigned char)*line <= 32) /* skip spaces */
+			line++;
+		if (*line == '\0' || *line == '#') /* ignore comments and empty line */
+			continue;
+
+		entry = &list->entries[list->count];
+		rest = line;
+		entry->field[0] = lookup_word(&rest);
+		switch (list->type) {
+		case LOOKUP_DIRECTORY:
+			/* name ends at control characters */
+			entry->field[1] = rest;
+			while ((unsigned char)*rest >= 32)
+				rest++;
+			*rest = '\0';
+			entry->key = keys;
+			keys = lookup_directory_key(keys, entry->field[0]);
+			break;
+		case LOOKUP_PHONEBOOK:
+			entry->field[1] = (*rest != '#') ? lookup_word(&rest) : "";
+			entry->field[2] = (*rest != '#') ? rest : "";
+			entry->key = keys;
+			keys = lookup_lower(keys, entry->field[0]);
+			break;
+		case LOOKUP_SECRETS:
+			entry->field[1] = (*rest != '#') ? lookup_word(&rest) : "";
+			entry->field[2] = (*rest != '#') ? lookup_word(&rest) : "";
+			entry->field[3] = (*rest != '#') ? rest : "";
+			entry->key = keys;
+			keys = lookup_lower(keys, entry->field[0]);
+			break;
+		}
+		list->count++;
+	}
+
+	/* hash, the first entry of each key is kept */
+	buckets = 16;
+	while (buckets < list->count * 2)
+		buckets <<= 1;
+	list->mask = buckets - 1;
+	list->buckets = (int *)MALLOC(buckets * sizeof(int));
+	memuse++;
+	for (i = 0; i < buckets; i++)
+		list->buckets[i] = -1;
+	for (i = 0; i < list->count; i++) {
+		entry = &list->entries[i];
+		entry->next = -1;
+		if (lookup_find(list, entry->key) >= 0)
+			continue;
+		hash = lookup_key(entry->key) & list->mask;
+		entry->next = list->buckets[hash];
+		list->buckets[hash] = i;
+	}
+
+	if (list->type == LOOKUP_PHONEBOOK) {
+		list->sorted = (int *)MALLOC((list->count + 1) * sizeof(int));
+		memuse++;
+		for (i = 0; i < list->count; i++)
+			list->sorted[i] = i;
+		lookup_sorting = list;
+		qsort(list->sorted, list->count, sizeof(int), lookup_compare);
+	}
+
+	list->loaded = 1;
+	PDEBUG(DEBUG_CONFIG, "%s '%s' loaded with %d entries\n", lookup_name[list->type], list->filename, list->count);
+
+	return 0;
+}
+
+/* get list file, load it if it is not loaded or has changed */
+static struct lookup_list *lookup_get(const char *filename, int type)
+{
+	struct lookup_list *list;
+	struct file_stamp stamp;
+	struct timeval now;
+	unsigned int hash = lookup_key(filename) & (LOOKUP_HASH - 1);
+
+	list = lookup_hash[hash];
+	while (list) {
+		if (!strcmp(list->filename, filename))
+			break;
+		list = list->next;
+	}
+	if (!list) {
+		list = (struct lookup_list *)MALLOC(sizeof(struct lookup_list));
+		memuse++;
+		lookup_copy(list->filename, filename, sizeof(list->filename));
+		list->type = type;
+		list->next = lookup_hash[hash];
+		lookup_hash[hash] = list;
+	}
+
+	get_timer_time(&now);
+	if (list->checked && now.tv_sec < list->checked + LOOKUP_CHECK)
+		return (list->loaded) ? list : NULL;
+	list->checked = now.tv_sec;
+
+	if (file_stamp(filename, &stamp)) {
+		PERROR("Cannot open %s: \"%s\"\n", lookup_name[type], filename);
+		lookup_unload(list);
+		return NULL;
+	}
+	if (!list->loaded || memcmp(&stamp, &list->stamp, sizeof(stamp))) {
+		if (lookup_load(list)) {
+			PERROR("Cannot open %s: \"%s\"\n", lookup_name[type], filename);
+			return NULL;
+		}
+	}
+
+	return list;
+}
+
+/* load directory, so the first call does not wait for it */
+void lookup_init(void)
+{
+	char filename[256];
+	struct file_stamp stamp;
+
+	SPRINT(filename, "%s/directory.list", CONFIG_DATA);
+	if (!file_stamp(filename, &stamp))
+		lookup_get(filename, LOOKUP_DIRECTORY);
+}
+
+void lookup_exit(void)
+{
+	struct lookup_list *list;
+	int i;
+
+	for (i = 0; i < LOOKUP_HASH; i++) {
+		while ((list = lookup_hash[i])) {
+			lookup_hash[i] = list->next;
+			lookup_unload(list);
+			FREE(list, sizeof(struct lookup_list));
+			memuse--;
+		}
+	}
+}
+
+
+/* parsing phonebook file
+ *
+ * 'number' specifies the externsion number, not the caller id
+ * the result is the abbreviation, the phone number and the name
+ * on success a 1 is returned and the pointers of elements are set to the
+ * result. on failure 0 is returned, -1 if more digits of the abbreviation
+ * could match
+ */
+int parse_phonebook(char *number, char **abbrev_pointer, char **phone_pointer, char **name_pointer)
+{
+	struct lookup_list *list;
+	struct lookup_entry *entry = NULL;
+	char filename[256], key[256];
+	static char abbrev[32], phone[256], name[256];
+	int i, low, high, mid, len;
+
+	SPRINT(filename, "%s/%s/phonebook", EXTENSION_DATA, number);
+
+	if (!(list = lookup_get(filename, LOOKUP_PHONEBOOK)))
+		return(0);
+
+	if (*abbrev_pointer && !*phone_pointer && !*name_pointer) {
+		/* abbreviation only */
+		if (strlen(*abbrev_pointer) < sizeof(key)) {
+			lookup_lower(key, *abbrev_pointer);
+			if ((i = lookup_find(list, key)) >= 0)
+				entry = &list->entries[i];
+		}
+	} else {
+		for (i = 0; i < list->count; i++) {
+			if (*abbrev_pointer && !!strcasecmp(*abbrev_pointer, list->entries[i].field[0]))
+				continue;
+			if (*phone_pointer && !!strcasecmp(*phone_pointer, list->entries[i].field[1]))
+				continue;
+			if (*name_pointer && !!strcasecmp(*name_pointer, list->entries[i].field[2]))
+				continue;
+			entry = &list->entries[i];
+			break;
+		}
+	}
+
+	if (entry) {
+		lookup_copy(abbrev, entry->field[0], sizeof(abbrev));
+		lookup_copy(phone, entry->field[1], sizeof(phone));
+		lookup_copy(name, entry->field[2], sizeof(name));
+		*abbrev_pointer = abbrev;
+		*phone_pointer = phone;
+		*name_pointer = name;
+		return(1);
+	}
+
+	/* may match if abbreviation is longer */
+	if (*abbrev_pointer) {
+		len = strlen(*abbrev_pointer);
+		low = 0;
+		high = list->count;
+		while (low < high) {
+			mid = (low + high) / 2;
+			if (strcmp(list->entries[list->sorted[mid]].field[0], *abbrev_pointer) < 0)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		if (low < list->count && !strncmp(*abbrev_pointer, list->entries[list->sorted[low]].field[0], len))
+			return(-1);
+	}
+
+	return(0);
+}
+
+/* parsing secrets file
+ *
+ * 'number' specifies the externsion number, not the caller id
+ * 'remote_id' specifies the dialed number, or the caller id for incoming calls
+ * the result is the auth, crypt and key string, and 1 is returned.
+ * on failure or not matching number, the 0 is returned
+ */
+int parse_secrets(char *number, char *remote_id, char **auth_pointer, char **crypt_pointer, char **key_pointer)
+{
+	struct lookup_list *list;
+	struct lookup_entry *entry;
+	char filename[256], remote[256];
+	static char auth[64], crypt[64], key[4096];
+	int i;
+
+	SPRINT(filename, "%s/%s/secrets", EXTENSION_DATA, number);
+
+	if (!(list = lookup_get(filename, LOOKUP_SECRETS)))
+		return(0);
+
+	if (strlen(remote_id) >= sizeof(remote))
+		return(0);
+	lookup_lower(remote, remote_id);
+	if ((i = lookup_find(list, remote)) < 0)
+		return(0);
+	entry = &list->entries[i];
+
+	lookup_copy(auth, entry->field[1], sizeof(auth));
+	lookup_copy(crypt, entry->field[2], sizeof(crypt));
+	lookup_copy(key, entry->field[3], sizeof(key));
+	*auth_pointer = auth;
+	*crypt_pointer = crypt;
+	*key_pointer = key;
+
+	return(1);
+}
+
+/* parse directory
+ *
+ * the caller id is given and the name is returned. if the name is not found,
+ * NULL is returned.
+ */
+char *parse_directory(char *number, int type)
+{
+	struct lookup_list *list;
+	char filename[256], key[256];
+	static char name[64];
+	const char *classes;
+	int i, found = -1;
+
+	SPRINT(filename, "%s/directory.list", CONFIG_DATA);
+
+	if (!(list = lookup_get(filename, LOOKUP_DIRECTORY)))
+		return(NULL);
+
+	if (strlen(number) + 2 > sizeof(key))
+		return(NULL);
+	if (type == INFO_NTYPE_INTERNATIONAL)
+		classes = "i";
+	else if (type == INFO_NTYPE_NATIONAL)
+		classes = "nx";
+	else
+		classes = "sx";
+	/* the first line of the file that matches */
+	while (*classes) {
+		key[0] = *classes++;
+		strcpy(key + 1, number);
+		i = lookup_find(list, key);
+		if (i >= 0 && (found < 0 || i < found))
+			found = i;
+	}
+	if (found < 0)
+		return(NULL);
+
+	lookup_copy(name, list->entries[found].field[1], sizeof(name));
+	return(name);
+}
+
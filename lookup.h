@@ -0,0 +1,65 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** indexed list files header file                                            **
+**                                                                           **
+\*****************************************************************************/
+
+#define LOOKUP_CHECK	1	/* seconds between checks for changed files */
+#define LOOKUP_HASH	256	/* buckets for loaded files, must be a binary border */
+#define LOOKUP_FIELDS	4
+
+/* identifies the version of a file */
+struct file_stamp {
+	ino_t			ino;
+	off_t			size;
+	time_t			mtime;
+	long			mtime_nsec;
+};
+
+int file_stamp(const char *filename, struct file_stamp *stamp);
+
+enum {
+	LOOKUP_DIRECTORY,	/* number, name */
+	LOOKUP_PHONEBOOK,	/* abbreviation, number, name */
+	LOOKUP_SECRETS		/* remote id, auth, crypt, key */
+};
+
+/* one line of a list file */
+struct lookup_entry {
+	const char		*key;		/* hashed key of line */
+	const char		*field[LOOKUP_FIELDS];
+	int			next;		/* next entry in bucket, -1 = none */
+};
+
+/* a list file in memory
+ *
+ * the entries are in the order of the file, so if a key exists more than
+ * once, the first one is found. the hash only holds the first one.
+ */
+struct lookup_list {
+	struct lookup_list	*next;		/* next in hash of files */
+	char			filename[256];
+	int			type;		/* LOOKUP_* */
+	struct file_stamp	stamp;		/* version of file that is loaded */
+	time_t			checked;	/* last check for changes */
+	int			loaded;
+	char			*strings;	/* content of file and keys */
+	int			strings_size;
+	struct lookup_entry	*entries;
+	int			count;
+	int			*buckets;
+	unsigned int		mask;		/* number of buckets - 1 */
+	int			*sorted;	/* entries sorted by first field (phonebook only) */
+};
+
+void lookup_init(void);
+void lookup_exit(void);
+int parse_phonebook(char *number, char **abbrev_pointer, char **phone_pointer, char **name_pointer);
+int parse_secrets(char *number, char *remote_id, char **auth_pointer, char **crypt_pointer, char **key_pointer);
+char *parse_directory(char *number, int type);
+
@@ -60,6 +60,12 @@ static int my_mISDNlib_debug(const char *file, int line, const char *func, int l
 
 static struct mi_ext_fn_s myfn;
 
+int load_timer(struct lcr_timer *timer, void *instance, int index);
+
+/* all ports that transmit audio are serviced by a common load tick */
+static class PmISDN *load_first = NULL;
+static struct lcr_timer load_tick;
+
 int mISDN_initialize(void)
 {
 	char filename[256];
@@ -95,6 +101,9 @@ int mISDN_initialize(void)
 	upqueue_fd.fd = upqueue_pipe[0];
 	register_fd(&upqueue_fd, LCR_FD_READ, mISDN_upqueue, NULL, 0);
 
+	memset(&load_tick, 0, sizeof(load_tick));
+	add_timer(&load_tick, load_timer, NULL, 0);
+
 	return(0);
 }
 
@@ -115,9 +124,10 @@ void mISDN_deinitialize(void)
 		close(upqueue_pipe[1]);
 	}
 	upqueue_avail = 0;
-}
 
-int load_timer(struct lcr_timer *timer, void *instance, int index);
+	if (load_tick.inuse)
+		del_timer(&load_tick);
+}
 
 /*
  * constructor
@@ -152,10 +162,10 @@ PmISDN::PmISDN(int type, mISDNport *mISDNport, char *portname, struct port_setti
 	SCPY(p_m_pipeline, mISDNport->ifport->interface->pipeline);
 	
 	/* audio */
-	memset(&p_m_loadtimer, 0, sizeof(p_m_loadtimer));
-	add_timer(&p_m_loadtimer, load_timer, this, 0);
+	p_m_load_next = p_m_load_prev = NULL;
+	p_m_load_active = 0;
 	p_m_load = 0;
-	p_m_last_tv_sec = 0;
+	p_m_last_sample = 0;
 
 	/* crypt */
 	p_m_crypt = 0;
@@ -203,7 +213,7 @@ PmISDN::~PmISDN()
 	struct lcr_msg *message;
 
 	del_timer(&p_m_timeout);
-	del_timer(&p_m_loadtimer);
+	load_stop();
 
 	/* remove bchannel relation */
 	drop_bchannel();
@@ -424,8 +434,8 @@ static int _bchannel_create(struct mISDNport *mISDNport, int i)
 	ret = bind(mISDNport->b_sock[i].fd, (struct sockaddr *)&addr, sizeof(addr));
 	if (ret < 0) {
 		PERROR("Error: Failed to bind bchannel-socket for index %d with mISDN-DSP layer (errno=%d). Did you load mISDN_dsp.ko?\n", i, errno);
-		close(mISDNport->b_sock[i].fd);
 		unregister_fd(&mISDNport->b_sock[i]);
+		close(mISDNport->b_sock[i].fd);
 		return(0);
 	}
 
@@ -537,8 +547,8 @@ static void _bchannel_destroy(struct mISDNport *mISDNport, int i)
 	add_trace("channel", NULL, "%d", i+1+(i>=15));
 	add_trace("socket", NULL, "%d", mISDNport->b_sock[i].fd);
 	end_trace();
-	close(mISDNport->b_sock[i].fd);
 	unregister_fd(&mISDNport->b_sock[i]);
+	close(mISDNport->b_sock[i].fd);
 }
 
 
@@ -980,6 +990,45 @@ void bchannel_event(struct mISDNport *mISDNport, int i, int event)
 }
 
 
+/*
+ * link port object to bchannel, or unlink, if port is NULL
+ * the free bchannels are counted for port and interface
+ */
+void set_bchannel_port(struct mISDNport *mISDNport, int i, class PmISDN *port)
+{
+	unsigned int bit = 1U << (i & 31);
+	int change;
+
+	if (!mISDNport->b_port[i] == !port) {
+		mISDNport->b_port[i] = port;
+		return;
+	}
+	mISDNport->b_port[i] = port;
+	if (port) {
+		mISDNport->b_free[i >> 5] &= ~bit;
+		change = -1;
+	} else {
+		mISDNport->b_free[i >> 5] |= bit;
+		change = 1;
+	}
+	mISDNport->b_free_num += change;
+	if (mISDNport->ifport)
+		mISDNport->ifport->interface->b_free += change;
+}
+
+/*
+ * return index of first bchannel without port object, or -1 if none
+ */
+int first_free_bchannel(struct mISDNport *mISDNport)
+{
+	int w;
+
+	for (w = 0; w < B_FREE_WORDS; w++) {
+		if (mISDNport->b_free[w])
+			return((w << 5) + __builtin_ctz(mISDNport->b_free[w]));
+	}
+	return(-1);
+}
 
 
 /*
@@ -1027,13 +1076,10 @@ int PmISDN::seize_bchannel(int channel, int exclusive)
 	}
 
 	/* search for channel */
-	i = 0;
-	while(i < p_m_mISDNport->b_num) {
-		if (!p_m_mISDNport->b_port[i]) {
-			channel = i+1+(i>=15);
-			goto seize;
-		}
-		i++;
+	i = first_free_bchannel(p_m_mISDNport);
+	if (i >= 0) {
+		channel = i+1+(i>=15);
+		goto seize;
 	}
 	return(-34); /* no free channel */
 
@@ -1041,7 +1087,7 @@ seize:
 	PDEBUG(DEBUG_BCHANNEL, "PmISDN(%s) seizing bchannel %d (index %d)\n", p_name, channel, i);
 
 	/* link Port, set parameters */
-	p_m_mISDNport->b_port[i] = this;
+	set_bchannel_port(p_m_mISDNport, i, this);
 	p_m_b_index = i;
 	p_m_b_channel = channel;
 	p_m_b_exclusive = exclusive;
@@ -1077,7 +1123,7 @@ void PmISDN::drop_bchannel(void)
 
 	if (p_m_mISDNport->b_state[p_m_b_index] != B_STATE_IDLE)
 		bchannel_event(p_m_mISDNport, p_m_b_index, B_EVENT_DROP);
-	p_m_mISDNport->b_port[p_m_b_index] = NULL;
+	set_bchannel_port(p_m_mISDNport, p_m_b_index, NULL);
 	p_m_mISDNport->b_mode[p_m_b_index] = 0;
 	p_m_b_index = -1;
 	p_m_b_channel = 0;
@@ -1194,7 +1240,13 @@ three sources of audio transmission:
 
 * elapsed
 a variable that temporarily shows the number of samples elapsed since last transmission process.
-p_m_last_tv_* is used to store that last timestamp. this is used to calculate the time elapsed.
+p_m_last_sample is used to store the sample clock of last process. this is used to calculate the time elapsed.
+the sample clock is derived from the monotonic clock at each load tick, so
+there is no drift by rounding elapsed time.
+
+* load tick
+all ports that transmit audio are attached to a list that is serviced by one
+common timer (load tick), instead of having a timer for each port.
 
 * load
 a variable that is increased whenever data is transmitted.
@@ -1242,41 +1294,85 @@ void PmISDN::update_load(void)
 		return;
 
 	/* don't trigger load event if event already active */
-	if (p_m_loadtimer.active)
+	if (p_m_load_active)
 		return;
 
-	schedule_timer(&p_m_loadtimer, 0, 0); /* no delay the first time */
+	load_start(0); /* no delay the first time */
 }
 
+/* attach port to load tick */
+void PmISDN::load_start(int delay)
+{
+	if (!p_m_load_active) {
+		p_m_load_prev = NULL;
+		p_m_load_next = load_first;
+		if (load_first)
+			load_first->p_m_load_prev = this;
+		load_first = this;
+		p_m_load_active = 1;
+	}
+
+	/* if no delay is requested, all ports are serviced now */
+	if (!delay || !load_tick.active)
+		schedule_timer(&load_tick, 0, (delay) ? PORT_TRANSMIT * 125 : 0);
+}
+
+/* detach port from load tick */
+void PmISDN::load_stop(void)
+{
+	if (!p_m_load_active)
+		return;
+
+	if (p_m_load_prev)
+		p_m_load_prev->p_m_load_next = p_m_load_next;
+	else
+		load_first = p_m_load_next;
+	if (p_m_load_next)
+		p_m_load_next->p_m_load_prev = p_m_load_prev;
+	p_m_load_next = p_m_load_prev = NULL;
+	p_m_load_active = 0;
+}
+
+/* service all ports with one clock */
 int load_timer(struct lcr_timer *timer, void *instance, int index)
 {
-	class PmISDN *isdnport = (class PmISDN *)instance;
+	class PmISDN *isdnport, *next;
+	struct timeval current_time;
+	unsigned long long now;
+
+	/* get sample clock */
+	get_timer_time(&current_time);
+	now = (unsigned long long)current_time.tv_sec * 8000 + current_time.tv_usec * 8 / 1000;
 
-	isdnport->load_tx();
+	/* a port may detach itself while being processed */
+	isdnport = load_first;
+	while(isdnport) {
+		next = isdnport->p_m_load_next;
+		isdnport->load_tx(now);
+		isdnport = next;
+	}
+
+	if (load_first)
+		schedule_timer(&load_tick, 0, PORT_TRANSMIT * 125);
 
 	return 0;
 }
 
-void PmISDN::load_tx(void)
+void PmISDN::load_tx(unsigned long long now)
 {
-	int elapsed = 0;
+	unsigned long long elapsed = 0;
 	int ret;
-	struct timeval current_time;
 
 	/* get elapsed */
-	gettimeofday(&current_time, NULL);
-	if (p_m_last_tv_sec) {
-		elapsed = 8000 * (current_time.tv_sec - p_m_last_tv_sec)
-			+ 8 * (current_time.tv_usec/1000 - p_m_last_tv_msec);
-	}
+	if (p_m_last_sample)
+		elapsed = now - p_m_last_sample;
 	/* set clock of last process! */
-	p_m_last_tv_sec = current_time.tv_sec;
-	p_m_last_tv_msec = current_time.tv_usec/1000;
+	p_m_last_sample = now;
 
 	/* process only if we have samples and we are active */
 	if (elapsed && p_m_mISDNport->b_state[p_m_b_index] == B_STATE_ACTIVE) {
 		/* update load */
-		if (elapsed < p_m_load)
+		if (elapsed < (unsigned long long)p_m_load)
 			p_m_load -= elapsed;
 		else
 			p_m_load = 0;
@@ -1339,9 +1435,8 @@ void PmISDN::load_tx(void)
 		}
 	}
 
-	if (p_tone_name[0] || p_m_crypt_msg_loops || p_m_inband_send_on || p_m_load) {
-		schedule_timer(&p_m_loadtimer, 0, PORT_TRANSMIT * 125);
-	}
+	if (!p_tone_name[0] && !p_m_crypt_msg_loops && !p_m_inband_send_on && !p_m_load)
+		load_stop();
 }
 
 /* handle timeouts */
@@ -2374,8 +2469,10 @@ struct mISDNport *mISDNport_open(struct interface_port *ifport)
 	while(i < mISDNport->b_num) {
 		mISDNport->b_state[i] = B_STATE_IDLE;
 		add_timer(&mISDNport->b_timer[i], b_timer_timeout, mISDNport, i);
+		mISDNport->b_free[i >> 5] |= 1U << (i & 31);
 		i++;
 	}
+	mISDNport->b_free_num = mISDNport->b_num;
 
 	/* if ptp, pull up the link */
 	if (!mISDNport->isloopback && mISDNport->l2hold && (mISDNport->ptp || !mISDNport->ntmode)) {
@@ -2476,6 +2573,10 @@ void mISDNport_close(struct mISDNport *mISDNport)
 		end_trace();
 	}
 
+	/* free bchannels are not available at interface anymore */
+	if (mISDNport->ifport)
+		mISDNport->ifport->interface->b_free -= mISDNport->b_free_num;
+
 	/* free bchannels */
 	i = 0;
 	while(i < mISDNport->b_num) {
@@ -2556,7 +2657,7 @@ int PmISDN::bridge_rx(unsigned char *data, int length)
 		if (ret <= 0)
 			PERROR("Failed to send to socket %d\n", p_m_mISDNport->b_sock[p_m_b_index].fd);
 		p_m_load += ISDN_LOAD;
-		schedule_timer(&p_m_loadtimer, 0, PORT_TRANSMIT * 125);
+		load_start(1);
 	}
 
 	/* drop if load would exceed ISDN_MAXLOAD
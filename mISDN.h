@@ -12,6 +12,9 @@
 #define FROMUP_BUFFER_SIZE 1024
 #define FROMUP_BUFFER_MASK 1023
 
+#define B_FREE_WORDS (128 / 32) /* words of free bchannel bitmap */
+#define L3ID_HASH 256 /* call reference buckets of a port, must be a binary border */
+
 extern int entity;
 extern int mISDNdevice;
 
@@ -53,7 +56,9 @@ struct mISDNport {
 	int earlyb; /* TRUE if tones are received outside connect state */
 	int b_num; /* number of bchannels */
 	int b_reserved; /* number of bchannels reserved or in use */
-	class PmISDN *b_port[128]; /* bchannel assigned to port object */
+	class PmISDN *b_port[128]; /* bchannel assigned to port object, use set_bchannel_port() to change */
+	unsigned int b_free[B_FREE_WORDS]; /* bitmap of bchannels without port object */
+	int b_free_num; /* number of bchannels without port object */
 	struct mqueue upqueue;
 	struct lcr_fd b_sock[128]; /* socket list elements */
 	int b_mode[128]; /* B_MODE_* */
@@ -62,6 +67,8 @@ struct mISDNport {
 	int b_remote_id[128]; /* the socket currently exported (0=none) */
 	unsigned int b_remote_ref[128]; /* the ref currently exported */
 	int locally; /* local causes are sent as local causes not remote */
+	class Pdss1 *l3id_hash[L3ID_HASH]; /* ports by call reference, see Pdss1::set_l3id() */
+	class Pdss1 *hold_first; /* ports on hold, see Pdss1::set_hold() */
 	int los, ais, rdi, slip_rx, slip_tx;
 
 	int lcr_sock; /* socket of loopback on LCR side */
@@ -77,6 +84,9 @@ extern mISDNport *mISDNport_first;
    notes on bchannels:
 
 if a b-channel is in use, the b_port[channel] is linked to the port using it.
+the channels that are not linked are marked in the b_free bitmap, so the first
+free channel is found without walking b_port[]. the free channels are also
+counted for the port and for the interface it is linked to.
 also each used b-channel counts b_inuse.
 to assign a bchannel, that is not jet defined due to remote channel assignment,
 the b_inuse is also increased to reserve channel
@@ -103,6 +113,8 @@ void ph_control_block(struct mISDNport *mISDNport, unsigned int handle, unsigned
 void chan_trace_header(struct mISDNport *mISDNport, class PmISDN *port, const char *msgtext, int direction);
 void l1l2l3_trace_header(struct mISDNport *mISDNport, class PmISDN *port, unsigned int prim, int direction);
 void bchannel_event(struct mISDNport *mISDNport, int i, int event);
+void set_bchannel_port(struct mISDNport *mISDNport, int i, class PmISDN *port);
+int first_free_bchannel(struct mISDNport *mISDNport);
 void message_bchannel_from_remote(class JoinRemote *joinremote, int type, unsigned int handle);
 
 
@@ -131,12 +143,14 @@ class PmISDN : public Port
 
 	int bridge_rx(unsigned char *data, int len);
 
-	struct lcr_timer p_m_loadtimer;		/* timer for audio transmission */
+	class PmISDN *p_m_load_next, *p_m_load_prev; /* list of ports serviced by load tick */
+	int p_m_load_active;			/* port is in list of load tick */
+	void load_start(int delay);
+	void load_stop(void);
 	virtual void update_load(void);
-	void load_tx(void);
+	void load_tx(unsigned long long now);
 	int p_m_load;				/* current data in dsp tx buffer */
-	unsigned int p_m_last_tv_sec;		/* time stamp of last tx_load call, (to sync audio data */
-	unsigned int p_m_last_tv_msec;
+	unsigned long long p_m_last_sample;	/* sample clock of last load_tx call, (to sync audio data) */
 
 	int p_m_crypt;				/* encryption is enabled */
 	int p_m_crypt_msg_loops;		/* sending a message */
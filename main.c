@@ -84,7 +84,6 @@ void debug(const char *file, const char *function, int line, const char *prefix,
 				fprintf(debug_fp, "%s%s(in %s() line %d): %s", prefix?prefix:"", prefix?" ":"", function, line, buffer);
 			else
 				fprintf(debug_fp, "%s%s: %s", prefix?prefix:"", prefix?" ":"", buffer);
-			fflush(debug_fp);
 		}
 	}
 
@@ -187,7 +186,6 @@ int main(int argc, char *argv[])
 #endif
 	char			tracetext[256], lock[128];
 	char			options_error[256];
-	int			polling = 0;
 
 #if 0
 	/* init fdset */
@@ -211,6 +209,13 @@ int main(int argc, char *argv[])
 		printf("interface = Get help of available interface syntax.\n");
 		printf("rules     = Get help of available routing rule syntax.\n");
 		printf("rules [action] = Get individual help for given action.\n");
+#ifdef WITH_CRYPT
+		printf("keybench [count] = Measure latency of key exchanges for encrypted calls.\n");
+#endif
+		printf("lawbench [count] = Check and measure audio conversion kernels.\n");
+#ifdef WITH_SS5
+		printf("ss5bench [rounds] = Compare SS5 decoder with the reference decoder and measure it.\n");
+#endif
 //		printf("route = Show current routing as it is parsed.\n");
 		printf("\n");
 		ret = 999;
@@ -265,12 +270,33 @@ int main(int argc, char *argv[])
 		goto free;
 	}
 
+	/* check and measure audio kernels */
+	if (!(strcasecmp(argv[1],"lawbench"))) {
+		ret = audio_bench((argc > 2) ? atoi(argv[2]) : 100000);
+		goto free;
+	}
+
+#ifdef WITH_SS5
+	/* check and measure ss5 decoder */
+	if (!(strcasecmp(argv[1],"ss5bench"))) {
+		ret = ss5_bench((argc > 2) ? atoi(argv[2]) : 10);
+		goto free;
+	}
+#endif
+
 	/* read options */
 	if (read_options(options_error) == 0) {
 		PERROR("%s", options_error);
 		goto free;
 	}
-	polling = options.polling;
+
+#ifdef WITH_CRYPT
+	/* measure key exchange */
+	if (!(strcasecmp(argv[1],"keybench"))) {
+		ret = keyengine_bench((argc > 2) ? atoi(argv[2]) : KEYENGINE_WORKERS);
+		goto free;
+	}
+#endif
 
 #ifdef WITH_MISDN
 	/* init mISDN */
@@ -366,13 +392,21 @@ int main(int argc, char *argv[])
 		goto free;
 	}
 
+	/* load extensions, if this fails, they are read from disk */
+	extstore_init();
+
+	/* load directory */
+	lookup_init();
+
 	/* generate alaw / ulaw tables */
 	generate_tables(options.law);
 
+	/* select tone detector kernel */
+	goertzel_init();
+
 #ifdef WITH_SIP
 	/* init SIP globals */
 	sip_init();
-	polling = 1; /* must poll, because of SIP events */
 #endif
 
 #ifdef WITH_SS5
@@ -493,16 +527,14 @@ init is done when interface is up
 		}
 #else
 		if (options.polling) {
-			if (!select_main(1, NULL, NULL, NULL)) {
-#ifdef WITH_SIP
-				/* FIXME: check if work was done */
-				sip_handle();
-#endif
+			if (!select_main(1, NULL, NULL, NULL))
 				usleep(10000);
-			}
 		} else
 			select_main(0, NULL, NULL, NULL);
 #endif
+		/* debug file is flushed once per loop, not for every line */
+		if (debug_fp)
+			fflush(debug_fp);
 	}
 	SPRINT(tracetext, "%s terminated", NAME);
 	printf("%s\n", tracetext);
@@ -545,16 +577,36 @@ free:
 	debug_count++;
 	join_free();
 
-	/* free interfaces */
-	if (interface_first)
-		free_interfaces(interface_first);
-	interface_first = NULL;
+	/* forget child processes, they are not waited for */
+	process_exit();
+
+	/* write changed extensions */
+	extstore_exit();
+
+	/* free directory, phonebooks and secrets */
+	lookup_exit();
+
+	/* stop record writer, all recordings are closed */
+	record_exit();
+
+	/* write queued call detail records */
+	cdr_exit();
+
+#ifdef WITH_CRYPT
+	/* stop key engine */
+	keyengine_exit();
+#endif
 
 #ifdef WITH_MISDN
-	/* close isdn ports */
+	/* close isdn ports, before their interfaces are freed */
 	mISDNport_close_all();
 #endif
 
+	/* free interfaces */
+	if (interface_first)
+		free_interfaces(interface_first);
+	interface_first = NULL;
+
 	/* flush messages */
 	debug_count++;
 	i = 0;
@@ -571,8 +623,10 @@ free:
 		cleanup_message();
 
 	/* free tones */
-	if (toneset_first)
-		free_tones();
+	free_tones();
+
+	/* free announcements */
+	announce_exit();
 
 	/* free admin socket */
 	admin_cleanup();
@@ -586,6 +640,9 @@ free:
 		close(lockfd);
 	}
 
+	/* write queued traces, later traces are written directly */
+	trace_exit();
+
 	/* free rulesets */
 	if (ruleset_first)
 		ruleset_free(ruleset_first);
@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
@@ -138,16 +139,28 @@ void debug(const char *file, const char *function, int line, const char *prefix,
 #endif
 #include "macro.h"
 #include "select.h"
+#include "idhash.h"
 #include "options.h"
 #include "interface.h"
 #include "extension.h"
+#include "vboxstore.h"
 #include "message.h"
 #include "endpoint.h"
 #include "endpointapp.h"
+#include "crypt.h"
 #include "apppbx.h"
 #include "appbridge.h"
 #include "callerid.h"
 #include "route.h"
+#include "record.h"
+#include "mixer.h"
+#include "process.h"
+#include "lookup.h"
+#include "cdr.h"
+#include "extstore.h"
+#include "announce.h"
+#include "goertzel.h"
+#include "dtmf_decode.h"
 #include "port.h"
 #ifdef WITH_MISDN
 #include "mISDN.h"
@@ -179,7 +192,6 @@ void debug(const char *file, const char *function, int line, const char *prefix,
 #include "cause.h"
 #include "alawulaw.h"
 #include "tones.h"
-#include "crypt.h"
 #include "socket_server.h"
 #include "trace.h"
 
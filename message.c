@@ -17,17 +17,92 @@ struct lcr_msg *message_first = NULL;
 struct lcr_msg **messagepointer_end = &message_first;
 struct lcr_work message_work;
 
+/* pool of freed messages, so creating a message does not require malloc */
+#define MESSAGE_POOL_MAX 256
+static struct lcr_msg *message_pool = NULL;
+static int message_pool_num = 0;
+unsigned int message_pool_hits = 0; /* messages taken from pool */
+unsigned int message_pool_allocs = 0; /* messages allocated, because pool was empty */
+
+/* size of parameter that must be cleared for types without a specific size */
+static unsigned int message_param_common = sizeof(union parameter);
+
+#define PARAM_SIZE(member) sizeof(((union parameter *)NULL)->member)
+
 static int work_message(struct lcr_work *work, void *instance, int index);
 
 void init_message(void)
 {
+	unsigned int size;
+
 	memset(&message_work, 0, sizeof(message_work));
 	add_work(&message_work, work_message, NULL, 0);
+
+	/* all members, except extension info that is never sent as message */
+	size = PARAM_SIZE(tone);
+	if (PARAM_SIZE(setup) > size) size = PARAM_SIZE(setup);
+	if (PARAM_SIZE(information) > size) size = PARAM_SIZE(information);
+	if (PARAM_SIZE(connectinfo) > size) size = PARAM_SIZE(connectinfo);
+	if (PARAM_SIZE(disconnectinfo) > size) size = PARAM_SIZE(disconnectinfo);
+	if (PARAM_SIZE(notifyinfo) > size) size = PARAM_SIZE(notifyinfo);
+	if (PARAM_SIZE(progressinfo) > size) size = PARAM_SIZE(progressinfo);
+	if (PARAM_SIZE(facilityinfo) > size) size = PARAM_SIZE(facilityinfo);
+	if (PARAM_SIZE(parkinfo) > size) size = PARAM_SIZE(parkinfo);
+	if (PARAM_SIZE(play) > size) size = PARAM_SIZE(play);
+	if (PARAM_SIZE(counter) > size) size = PARAM_SIZE(counter);
+	if (PARAM_SIZE(mISDNsignal) > size) size = PARAM_SIZE(mISDNsignal);
+	if (PARAM_SIZE(crypt) > size) size = PARAM_SIZE(crypt);
+	if (PARAM_SIZE(hello) > size) size = PARAM_SIZE(hello);
+	if (PARAM_SIZE(bchannel) > size) size = PARAM_SIZE(bchannel);
+	if (PARAM_SIZE(newref) > size) size = PARAM_SIZE(newref);
+	message_param_common = size;
 }
 
 void cleanup_message(void)
 {
+	struct lcr_msg *message;
+
 	del_work(&message_work);
+
+	/* free pool */
+	while ((message = message_pool)) {
+		message_pool = message->next;
+		FREE(message, sizeof(struct lcr_msg));
+	}
+	message_pool_num = 0;
+}
+
+/* size of parameter that is used by the given message type
+ * messages are always allocated with the complete parameter union, because
+ * some handlers copy the whole union. only the used part is cleared. */
+static unsigned int message_param_size(int type)
+{
+	switch(type) {
+	case MESSAGE_DTMF:
+		return PARAM_SIZE(dtmf);
+	case MESSAGE_TONE:
+	case MESSAGE_VBOX_TONE:
+		return PARAM_SIZE(tone);
+	case MESSAGE_TONE_COUNTER:
+		return PARAM_SIZE(counter);
+	case MESSAGE_TONE_EOF:
+		return 0;
+	case MESSAGE_AUDIOPATH:
+		return PARAM_SIZE(audiopath);
+	case MESSAGE_TIMEOUT:
+		return PARAM_SIZE(state);
+	case MESSAGE_mISDNSIGNAL:
+		return PARAM_SIZE(mISDNsignal);
+	case MESSAGE_BRIDGE:
+		return PARAM_SIZE(bridge);
+	case MESSAGE_VBOX_PLAY:
+		return PARAM_SIZE(play);
+	case MESSAGE_VBOX_PLAY_SPEED:
+		return PARAM_SIZE(speed);
+	case MESSAGE_CRYPT:
+		return PARAM_SIZE(crypt);
+	}
+	return message_param_common;
 }
 
 /* creates a new message with the given attributes. the message must be filled then. after filling, the message_put must be called */
@@ -35,9 +110,18 @@ struct lcr_msg *message_create(int id_from, int id_to, int flow, int type)
 {
 	struct lcr_msg *message;
 
-	message = (struct lcr_msg *)MALLOC(sizeof(struct lcr_msg));
-	if (!message)
-		FATAL("No memory for message.\n");
+	if (message_pool) {
+		/* reuse message from pool, clear header and used part of parameter */
+		message = message_pool;
+		message_pool = message->next;
+		message_pool_num--;
+		message_pool_hits++;
+		memset(message, 0, (unsigned long)&message->param - (unsigned long)message);
+		memset(&message->param, 0, message_param_size(type));
+	} else {
+		message = (struct lcr_msg *)MALLOC(sizeof(struct lcr_msg));
+		message_pool_allocs++;
+	}
 	mmemuse++;
 
 	message->id_from = id_from;
@@ -108,13 +192,19 @@ struct lcr_msg *message_get(void)
 	return(message);
 }
 
-/* free a message */
+/* free a message, it is kept in pool for reuse */
 void message_free(struct lcr_msg *message)
 {
 	if (message->keep)
 		return;
-	FREE(message, sizeof(struct lcr_msg));
 	mmemuse--;
+	if (message_pool_num >= MESSAGE_POOL_MAX) {
+		FREE(message, 0);
+		return;
+	}
+	message->next = message_pool;
+	message_pool = message;
+	message_pool_num++;
 }
 
 
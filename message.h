@@ -281,6 +281,7 @@ struct message_setup {
 	int port_type; /* type of port (only required if message is port -> epoint) */
 	int partyline; /* if set, call will be a conference room */
 	int partyline_jingle; /* if set, the jingle will be played on conference join */
+	int partyline_talkers; /* if set, only the loudest members are mixed */
 	struct caller_info callerinfo;		/* information about the caller */
 	struct dialing_info dialinginfo;	/* information about dialing */
 	struct redir_info redirinfo;		/* info on redirection (to the calling user) */
@@ -331,6 +332,7 @@ struct param_crypt {
 
 struct param_hello {
 	char application[32]; /* name of remote application */
+	int protocol; /* ADMIN_PROTOCOL_* requested by application (see lcrsocket.h) */
 };
 
 struct param_bchannel {
@@ -349,6 +351,11 @@ struct param_newref {
 	int mode; /* 0 = direct-mode, 1 = PBX mode */
 };
 
+struct param_bridge {
+	unsigned int id; /* bridge to join, 0 to leave */
+	int talkers; /* if mixed, only the loudest members are mixed (0 = all) */
+};
+
 /* structure of message parameter */
 union parameter {
 	struct param_tone tone; /* MESSAGE_TONE */
@@ -373,7 +380,7 @@ union parameter {
 	struct param_hello hello; /* MESSAGE_HELLO */
 	struct param_bchannel bchannel; /* MESSAGE_BCHANNEL */
 	struct param_newref newref; /* MESSAGE_NEWREF */
-	unsigned int bridge_id; /* MESSAGE_BRIDGE */
+	struct param_bridge bridge; /* MESSAGE_BRIDGE */
 };
 
 enum { /* message flow */
@@ -473,5 +480,6 @@ struct lcr_msg *message_get(void);
 void message_free(struct lcr_msg *message);
 void init_message(void);
 void cleanup_message(void);
+extern unsigned int message_pool_hits, message_pool_allocs;
 
 
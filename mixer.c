@@ -0,0 +1,288 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** software mixer for bridges with more than two ports                       **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO mix?
+
+A bridge connects two ports directly. If a third port joins the bridge, a
+mixer is attached to the bridge and all ports become members of it. This
+way conferences work if any member is not an mISDN port, so the DSP of the
+kernel cannot be used.
+
+Received data is decoded into the buffer of the member. A clock takes one
+frame of every member each 20 ms and adds all frames to a sum. Each member
+receives the sum without its own frame (mix-minus).
+
+On large partylines, only the loudest members (talkers) are added to the
+sum. All other members receive the same sum, so it is encoded only once.
+
+*/
+
+#include "main.h"
+
+/* sample clock (8000 Hz) */
+static unsigned long long mixer_clock(void)
+{
+	struct timeval current_time;
+
+	get_timer_time(&current_time);
+	return (unsigned long long)current_time.tv_sec * 8000 + current_time.tv_usec * 8 / 1000;
+}
+
+/* get one frame of each member and select talkers */
+static void mixer_get(struct bridge_mixer *mixer)
+{
+	struct mixer_member *member, *loudest;
+	int fill, n, i, level, score, best, talkers;
+
+	member = mixer->first;
+	while(member) {
+		fill = (member->writep - member->readp) & MIXER_MASK;
+		/* too much delay, skip the oldest samples */
+		if (fill > MIXER_DELAY + MIXER_FRAME) {
+			member->readp = (member->writep - MIXER_DELAY) & MIXER_MASK;
+			fill = MIXER_DELAY;
+		}
+		if (fill < MIXER_FRAME) {
+			member->active = 0;
+			member->level -= member->level >> 3;
+			member = member->next;
+			continue;
+		}
+		n = MIXER_BUFFER - member->readp;
+		if (n > MIXER_FRAME)
+			n = MIXER_FRAME;
+		memcpy(member->frame, member->buffer + member->readp, n * sizeof(signed short));
+		memcpy(member->frame + n, member->buffer, (MIXER_FRAME - n) * sizeof(signed short));
+		member->readp = (member->readp + MIXER_FRAME) & MIXER_MASK;
+		member->active = 1;
+		if (mixer->talkers) {
+			level = 0;
+			for (i = 0; i < MIXER_FRAME; i++)
+				level += abs(member->frame[i]);
+			level /= MIXER_FRAME;
+			member->level += (level - member->level) >> 3;
+		}
+		member = member->next;
+	}
+
+	/* all members are mixed */
+	if (!mixer->talkers || mixer->members <= mixer->talkers) {
+		member = mixer->first;
+		while(member) {
+			member->talker = member->active;
+			member = member->next;
+		}
+		return;
+	}
+
+	/* select the loudest members, talkers stay a bit longer */
+	member = mixer->first;
+	while(member) {
+		/* -1 marks previous talkers */
+		member->talker = (member->talker) ? -1 : 0;
+		member = member->next;
+	}
+	talkers = mixer->talkers;
+	while(talkers--) {
+		loudest = NULL;
+		best = -1;
+		member = mixer->first;
+		while(member) {
+			if (member->active && member->talker <= 0) {
+				score = member->level;
+				if (member->talker < 0)
+					score += score >> 2;
+				if (score > best) {
+					best = score;
+					loudest = member;
+				}
+			}
+			member = member->next;
+		}
+		if (!loudest)
+			break;
+		loudest->talker = 1;
+	}
+	member = mixer->first;
+	while(member) {
+		if (member->talker < 0)
+			member->talker = 0;
+		member = member->next;
+	}
+}
+
+/* mix one frame and send it to all members */
+static void mixer_tick(struct bridge_mixer *mixer)
+{
+	struct mixer_member *member;
+	signed int sum[MIXER_FRAME];
+	signed short mixed[MIXER_FRAME];
+	unsigned char law[MIXER_FRAME], common[MIXER_FRAME];
+	int common_done = 0;
+
+	mixer_get(mixer);
+
+	memset(sum, 0, sizeof(sum));
+	member = mixer->first;
+	while(member) {
+		if (member->talker)
+			audio_sum(sum, member->frame, MIXER_FRAME);
+		member = member->next;
+	}
+
+	member = mixer->first;
+	while(member) {
+		if (member->talker) {
+			/* mix-minus */
+			audio_minus(mixed, sum, member->frame, MIXER_FRAME);
+			audio_encode(law, mixed, MIXER_FRAME);
+			member->port->bridge_rx(law, MIXER_FRAME);
+		} else {
+			/* members that are not mixed hear all talkers */
+			if (!common_done) {
+				audio_minus(mixed, sum, NULL, MIXER_FRAME);
+				audio_encode(common, mixed, MIXER_FRAME);
+				common_done = 1;
+			}
+			member->port->bridge_rx(common, MIXER_FRAME);
+		}
+		member = member->next;
+	}
+}
+
+static int mixer_timer(struct lcr_timer *timer, void *instance, int index)
+{
+	struct bridge_mixer *mixer = (struct bridge_mixer *)instance;
+	unsigned long long now = mixer_clock();
+
+	while (mixer->next <= now) {
+		mixer->next += MIXER_FRAME;
+		mixer_tick(mixer);
+	}
+
+	/* we are late more than a few frames, don't catch up */
+	if (mixer->next + MIXER_FRAME * 4 < now)
+		mixer->next = now + MIXER_FRAME;
+
+	schedule_timer(&mixer->timer, 0, (mixer->next - now) * 125);
+
+	return 0;
+}
+
+/*
+ * create mixer
+ * talkers is the number of loudest members that are mixed, 0 for all
+ */
+struct bridge_mixer *mixer_create(int talkers)
+{
+	struct bridge_mixer *mixer;
+
+	mixer = (struct bridge_mixer *)MALLOC(sizeof(struct bridge_mixer));
+	memuse++;
+	mixer->talkers = talkers;
+	add_timer(&mixer->timer, mixer_timer, mixer, 0);
+	mixer->next = mixer_clock() + MIXER_FRAME;
+	schedule_timer(&mixer->timer, 0, MIXER_FRAME * 125);
+
+	return mixer;
+}
+
+void mixer_destroy(struct bridge_mixer *mixer)
+{
+	struct mixer_member *member;
+
+	while((member = mixer->first)) {
+		mixer->first = member->next;
+		FREE(member, sizeof(struct mixer_member));
+		memuse--;
+	}
+	del_timer(&mixer->timer);
+	FREE(mixer, sizeof(struct bridge_mixer));
+	memuse--;
+}
+
+void mixer_add(struct bridge_mixer *mixer, class Port *port)
+{
+	struct mixer_member *member, **memberp;
+
+	member = (struct mixer_member *)MALLOC(sizeof(struct mixer_member));
+	memuse++;
+	member->port = port;
+
+	/* attach to end of list */
+	memberp = &mixer->first;
+	while(*memberp)
+		memberp = &((*memberp)->next);
+	*memberp = member;
+	mixer->members++;
+}
+
+/* remove member, returns the number of members left */
+int mixer_remove(struct bridge_mixer *mixer, class Port *port)
+{
+	struct mixer_member *member, **memberp;
+
+	memberp = &mixer->first;
+	while(*memberp) {
+		if ((*memberp)->port == port) {
+			member = *memberp;
+			*memberp = member->next;
+			FREE(member, sizeof(struct mixer_member));
+			memuse--;
+			mixer->members--;
+			break;
+		}
+		memberp = &((*memberp)->next);
+	}
+
+	return mixer->members;
+}
+
+int mixer_find(struct bridge_mixer *mixer, class Port *port)
+{
+	struct mixer_member *member = mixer->first;
+
+	while(member) {
+		if (member->port == port)
+			return 1;
+		member = member->next;
+	}
+
+	return 0;
+}
+
+/* store data received by a member */
+void mixer_rx(struct bridge_mixer *mixer, class Port *port, unsigned char *data, int len)
+{
+	struct mixer_member *member = mixer->first;
+	int space, n;
+
+	while(member) {
+		if (member->port == port)
+			break;
+		member = member->next;
+	}
+	if (!member)
+		return;
+
+	/* if the buffer overflows, the data is dropped */
+	space = (member->readp - member->writep - 1) & MIXER_MASK;
+	if (len > space)
+		len = space;
+
+	n = MIXER_BUFFER - member->writep;
+	if (n > len)
+		n = len;
+	audio_decode(member->buffer + member->writep, data, n);
+	audio_decode(member->buffer, data + n, len - n);
+	member->writep = (member->writep + len) & MIXER_MASK;
+}
+
@@ -0,0 +1,44 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** bridge mixer header file                                                  **
+**                                                                           **
+\*****************************************************************************/
+
+#define MIXER_FRAME	160	/* samples mixed at each tick (20 ms) */
+#define MIXER_BUFFER	2048	/* samples buffered for each member, must be a binary border */
+#define MIXER_MASK	(MIXER_BUFFER - 1)
+#define MIXER_DELAY	(MIXER_FRAME * 3) /* more buffered samples are skipped */
+
+/* member of a mixer, each member is one port */
+struct mixer_member {
+	struct mixer_member	*next;
+	class Port		*port;
+	signed short		buffer[MIXER_BUFFER]; /* received samples */
+	int			readp, writep;
+	signed short		frame[MIXER_FRAME]; /* samples of current tick */
+	int			active;		/* frame received for current tick */
+	int			level;		/* average level of recent frames */
+	int			talker;		/* member is mixed into the sum */
+};
+
+/* software conference of ports that are joined in one bridge */
+struct bridge_mixer {
+	struct mixer_member	*first;
+	int			members;
+	int			talkers;	/* mix only the loudest members (0 = all) */
+	struct lcr_timer	timer;
+	unsigned long long	next;		/* sample clock of next tick */
+};
+
+struct bridge_mixer *mixer_create(int talkers);
+void mixer_destroy(struct bridge_mixer *mixer);
+void mixer_add(struct bridge_mixer *mixer, class Port *port);
+int mixer_remove(struct bridge_mixer *mixer, class Port *port);
+int mixer_find(struct bridge_mixer *mixer, class Port *port);
+void mixer_rx(struct bridge_mixer *mixer, class Port *port, unsigned char *data, int len);
+
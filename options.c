@@ -35,9 +35,12 @@ struct options options = {
 	0700,				/* rights of lcr admin socket */
 	-1,                             /* socket user (-1= no change) */
 	-1,                             /* socket group (-1= no change) */
-	1,				/* use polling of main loop */
+	0,				/* use polling of main loop */
 	"mISDN_l1loop.1",		/* GSM/Asterisk side */
 	"mISDN_l1loop.2",		/* LCR side */
+	"",				/* no cdr file */
+	10240,				/* rename cdr file after 10 MB */
+	10240,				/* rename log file after 10 MB */
 };
 
 char options_error[256];
@@ -130,6 +133,14 @@ int read_options(char *options_error)
 			}
 			SCPY(options.log, param);
 
+		} else
+		if (!strcmp(option,"log-size")) {
+			options.log_size = atoi(param);
+			if (options.log_size < 0) {
+				UPRINT(options_error, "Error in %s (line %d): parameter for option %s must be at least '0'.\n", filename,line,option);
+				goto error;
+			}
+
 		} else
 		if (!strcmp(option,"alaw")) {
 			options.law = 'a';
@@ -253,6 +264,22 @@ int read_options(char *options_error)
 			}
 			SCPY(options.loopback_lcr, param);
 
+		} else
+		if (!strcmp(option,"cdr")) {
+			if (param[0]==0) {
+				UPRINT(options_error, "Error in %s (line %d): parameter for option %s missing.\n",filename,line, option);
+				goto error;
+			}
+			SCPY(options.cdr, param);
+
+		} else
+		if (!strcmp(option,"cdr-size")) {
+			options.cdr_size = atoi(param);
+			if (options.cdr_size < 0) {
+				UPRINT(options_error, "Error in %s (line %d): parameter for option %s must be at least '0'.\n", filename,line,option);
+				goto error;
+			}
+
 		} else {
 			UPRINT(options_error, "Error in %s (line %d): wrong option keyword %s.\n", filename,line,option);
 			goto error;
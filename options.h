@@ -32,6 +32,9 @@ struct options {
 	int	polling;
 	char loopback_ext[64];		/* loopback interface GSM side */
 	char loopback_lcr[64];		/* loopback interface LCR side */
+	char	cdr[128];		/* file to write call detail records to */
+	int	cdr_size;		/* size of cdr file in kbytes before it is renamed */
+	int	log_size;		/* size of log file in kbytes before it is renamed */
 };	
 
 extern struct options options;
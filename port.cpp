@@ -47,12 +47,11 @@ Functions:
 
 #include "main.h"
 
-#define SHORT_MIN -32768
-#define SHORT_MAX 32767
 
 class Port *port_first = NULL;
 
 unsigned int port_serial = 1; /* must be 1, because 0== no port */
+static struct id_hash port_hash; /* ports by serial */
 
 struct port_bridge *p_bridge_first;
 
@@ -159,6 +158,7 @@ Port::Port(int type, const char *portname, struct port_settings *settings)
 	p_tone_dir[0] = '\0';
 	p_type = type;
 	p_serial = port_serial++;
+	id_hash_add(&port_hash, &p_id_entry, p_serial, this);
 	p_tone_fh = -1;
 	p_tone_fetched = NULL;
 	p_tone_name[0] = '\0';
@@ -175,7 +175,6 @@ Port::Port(int type, const char *portname, struct port_settings *settings)
 	/* call recording */
 	p_record = NULL;
 	p_record_type = 0;
-	p_record_length = 0;
 	p_record_skip = 0;
 	p_record_filename[0] = '\0';
 	p_record_buffer_readp = 0;
@@ -242,6 +241,7 @@ Port::~Port(void)
 		FATAL("PORT(%s) port not in port's list.\n", p_name);
 	/* detach */
 	*tempp=this->next;
+	id_hash_remove(&port_hash, &p_id_entry);
 
 	/* close open tones file */
 	if (p_tone_fh >= 0) {
@@ -268,16 +268,7 @@ void Port::new_state(int state)
  */ 
 class Port *find_port_id(unsigned int port_id)
 {
-	class Port *port = port_first;
-
-	while(port) {
-//printf("comparing: '%s' with '%s'\n", name, port->name);
-		if (port->p_serial == port_id)
-			return(port);
-		port = port->next;
-	}
-
-	return(NULL);
+	return((class Port *)id_hash_find(&port_hash, port_id));
 }
 
 
@@ -628,8 +619,8 @@ int Port::message_epoint(unsigned int epoint_id, int message_id, union parameter
 		return 1;
 
 	case MESSAGE_BRIDGE: /* create / join / leave / destroy bridge */
-		PDEBUG(DEBUG_PORT, "PORT(%s) bridging to id %d\n", p_name, param->bridge_id);
-		bridge(param->bridge_id);
+		PDEBUG(DEBUG_PORT, "PORT(%s) bridging to id %d\n", p_name, param->bridge.id);
+		bridge(param->bridge.id, param->bridge.talkers);
 		return 1;
 	}
 
@@ -637,17 +628,6 @@ int Port::message_epoint(unsigned int epoint_id, int message_id, union parameter
 }
 
 
-/* wave header structure */
-struct fmt {
-	unsigned short	stereo; /* 1 = mono, 2 = stereo */
-	unsigned short	channels; /* number of channels */
-	unsigned int	sample_rate; /* sample rate */
-	unsigned int	data_rate; /* data rate */
-	unsigned short	bytes_sample; /* bytes per sample (all channels) */
-	unsigned short	bits_sample; /* bits per sample (one channel) */
-};
-
-
 /*
  * open record file (actually a wave file with empty header which will be
  * written before close, because we do not know the size yet)
@@ -655,12 +635,11 @@ struct fmt {
  */
 int Port::open_record(int type, int vbox, int skip, char *extension, int anon_ignore, const char *vbox_email, int vbox_email_file)
 {
-	/* RIFFxxxxWAVEfmt xxxx(fmt-size)dataxxxx... */
-	char dummyheader[8+4+8+sizeof(fmt)+8];
+	unsigned int headersize = RECORD_WAVE_HEADER;
 	char filename[256];
 	time_t now;
 	struct tm *now_tm;
-	int ret;
+	FILE *fp;
 
 	if (!extension) {
 		PERROR("Port(%d) not an extension\n", p_serial);
@@ -704,12 +683,17 @@ int Port::open_record(int type, int vbox, int skip, char *extension, int anon_ig
 
 	/* check, if file exists (especially when an extension calls the same extension) */
 	if (vbox != 1)
-	if ((p_record = fopen(filename, "r"))) {
-		fclose(p_record);
+	if ((fp = fopen(filename, "r"))) {
+		fclose(fp);
 		SCAT(filename, "_2nd");
 	}
-			
-	p_record = fopen(filename, "w");
+
+	/* law is written without header */
+	if (type == CODEC_LAW)
+		headersize = 0;
+
+	/* the file is written by the record writer, header is written on close */
+	p_record = record_open(filename, headersize);
 	if (!p_record) {
 		PERROR("Port(%d) cannot record because file cannot be opened '%s'\n", p_serial, filename);
 		return(0);
@@ -720,17 +704,6 @@ int Port::open_record(int type, int vbox, int skip, char *extension, int anon_ig
 	p_record_type = type;
 	p_record_vbox = vbox;
 	p_record_skip = skip;
-	p_record_length = 0;
-	switch(p_record_type) {
-		case CODEC_MONO:
-		case CODEC_STEREO:
-		case CODEC_8BIT:
-		ret = fwrite(dummyheader, sizeof(dummyheader), 1, p_record);
-		break;
-
-		case CODEC_LAW:
-		break;
-	}
 	UCPY(p_record_filename, filename);
 
 	PDEBUG(DEBUG_PORT, "Port(%d) recording started with file name '%s'\n", p_serial, filename);
@@ -738,22 +711,71 @@ int Port::open_record(int type, int vbox, int skip, char *extension, int anon_ig
 }
 
 
+/* what is needed when the recording is completed, the port may be gone */
+struct port_record_done {
+	int			serial;
+	int			vbox;
+	char			extension[32];
+	int			year, mon, mday, hour, min;
+	char			callerid[256];
+	struct caller_info	callerinfo;
+	char			email[128];
+	int			email_file;
+};
+
+/* the record writer has completed and renamed the file */
+static void port_record_done(void *priv, const char *filename, unsigned int size, int error)
+{
+	struct port_record_done *done = (struct port_record_done *)priv;
+	struct vbox_store_record rec;
+	const char *p;
+
+	if (error) {
+		PERROR("Port(%d) cannot rename recording to '%s' (errno=%d)\n", done->serial, filename, error);
+		goto out;
+	}
+
+	PDEBUG(DEBUG_PORT, "Port(%d) recording is written and renamed to '%s' raw:%u samples:%u\n", done->serial, filename, size, size>>1);
+
+	if (done->vbox == 2) {
+		memset(&rec, 0, sizeof(rec));
+		/* remove path from file name */
+		p = filename;
+		while(strchr(p, '/'))
+			p = strchr(p, '/')+1;
+		SCPY(rec.name, p);
+		rec.year = done->year;
+		rec.mon = done->mon;
+		rec.mday = done->mday;
+		rec.hour = done->hour;
+		rec.min = done->min;
+		SCPY(rec.callerid, done->callerid);
+		if (vbox_store_append(done->extension, &rec))
+			PERROR("Port(%d) cannot add message to voice box store of extension '%s'.\n", done->serial, done->extension);
+
+		/* send email with sample*/
+		if (done->email[0]) {
+			send_mail(done->email_file?(char *)filename:(char *)"", done->callerid, done->callerinfo.extension, done->callerinfo.name, done->email, done->year, done->mon, done->mday, done->hour, done->min, done->extension);
+		}
+	}
+
+out:
+	FREE(done, sizeof(struct port_record_done));
+	memuse--;
+}
+
 /*
- * close the recoding file, put header in front and rename
+ * close the recoding file, the writer puts the header in front and renames it
  */
 void Port::close_record(int beep, int mute)
 {
-	static signed short beep_mono[256];
-	unsigned int size = 0, wsize = 0;
-	struct fmt fmt;
-	char filename[512], indexname[512];
-	FILE *fp;
+	struct port_record_done *done;
+	char filename[512];
 	int i, ii;
 	char number[256], callerid[256];
 	char *p;
 	struct caller_info callerinfo;
 	const char *valid_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890_.-!$%&/()=+*;~";
-	int ret;
 
 	if (!p_record)
 		return;
@@ -799,138 +821,43 @@ void Port::close_record(int beep, int mute)
 		i++;
 	}
 
-	/* mute */
-	if (mute && p_record_type==CODEC_MONO) {
-		i = p_record_length;
-		if (i > mute)
-			i = mute;	
-		fseek(p_record, -(i<<1), SEEK_END);
-		p_record_length -= (i<<1);
-	}
-	/* add beep to the end of recording */
-	if (beep && p_record_type==CODEC_MONO) {
-		i = 0;
-		while(i < 256) {
-			beep_mono[i] = (signed short)(sin((double)i / 5.688888888889 * 2.0 * 3.1415927) * 2000.0);
-			i++;
-		}
-		i = 0;
-		while(i < beep) {
-			ret = fwrite(beep_mono, sizeof(beep_mono), 1, p_record);
-			i += sizeof(beep_mono);
-			p_record_length += sizeof(beep_mono);
-		}
-	}
-
-	/* complete header */
-	switch(p_record_type) {
-		case CODEC_MONO:
-		case CODEC_STEREO:
-		case CODEC_8BIT:
-		/* cue */
-		fprintf(p_record, "cue %c%c%c%c%c%c%c%c", 4, 0, 0, 0, 0,0,0,0);
-
-		/* LIST */
-		fprintf(p_record, "LIST%c%c%c%cadtl", 4, 0, 0, 0);
-
-		/* go to header */
-		fseek(p_record, 0, SEEK_SET);
-
-		/* WAVEfmt xxxx(fmt-size)dataxxxx[data]cue xxxx0000LISTxxxxadtl*/
-		size = p_record_length;
-		wsize = 4+8+sizeof(fmt)+8+size+8+4+8+4;
-
-		/* RIFF */
-		fprintf(p_record, "RIFF%c%c%c%c", (unsigned char)(wsize&0xff), (unsigned char)((wsize>>8)&0xff), (unsigned char)((wsize>>16)&0xff), (unsigned char)(wsize>>24));
-
-		/* WAVE */
-		fprintf(p_record, "WAVE");
-
-		/* fmt */
-		fprintf(p_record, "fmt %c%c%c%c", (unsigned int)sizeof(fmt), 0, 0, 0);
-		switch(p_record_type) {
-			case CODEC_MONO:
-			fmt.stereo = 1;
-			fmt.channels = 1;
-			fmt.sample_rate = 8000; /* samples/sec */
-			fmt.data_rate = 16000; /* full data rate */
-			fmt.bytes_sample = 2; /* all channels */
-			fmt.bits_sample = 16; /* one channel */
-			break;
-
-			case CODEC_STEREO:
-			fmt.stereo = 1;
-			fmt.channels = 2;
-			fmt.sample_rate = 8000; /* samples/sec */
-			fmt.data_rate = 32000; /* full data rate */
-			fmt.bytes_sample = 4; /* all channels */
-			fmt.bits_sample = 16; /* one channel */
-			break;
-
-			case CODEC_8BIT:
-			fmt.stereo = 1;
-			fmt.channels = 1;
-			fmt.sample_rate = 8000; /* samples/sec */
-			fmt.data_rate = 8000; /* full data rate */
-			fmt.bytes_sample = 1; /* all channels */
-			fmt.bits_sample = 8; /* one channel */
-			break;
-		}
-		ret = fwrite(&fmt, sizeof(fmt), 1, p_record);
-
-		/* data */
-		fprintf(p_record, "data%c%c%c%c", (unsigned char)(size&0xff), (unsigned char)((size>>8)&0xff), (unsigned char)((size>>16)&0xff), (unsigned char)(size>>24));
-
-		/* rename file */
-		if (p_record_vbox == 1)
-			SPRINT(filename, "%s.wav", p_record_filename);
-		else
-			SPRINT(filename, "%s_%s-%s.wav", p_record_filename, callerid, number);
-		break;
-
-		case CODEC_LAW:
-		/* rename file */
+	/* final file name */
+	if (p_record_type == CODEC_LAW) {
 		if (p_record_vbox == 1)
 			SPRINT(filename, "%s.isdn", p_record_filename);
 		else
 			SPRINT(filename, "%s_%s-%s.isdn", p_record_filename, callerid, number);
-		break;
+	} else {
+		if (p_record_vbox == 1)
+			SPRINT(filename, "%s.wav", p_record_filename);
+		else
+			SPRINT(filename, "%s_%s-%s.wav", p_record_filename, callerid, number);
 	}
 
-	fclose(p_record);
+	done = (struct port_record_done *)MALLOC(sizeof(struct port_record_done));
+	memuse++;
+	done->serial = p_serial;
+	done->vbox = p_record_vbox;
+	SCPY(done->extension, p_record_extension);
+	done->year = p_record_vbox_year;
+	done->mon = p_record_vbox_mon;
+	done->mday = p_record_vbox_mday;
+	done->hour = p_record_vbox_hour;
+	done->min = p_record_vbox_min;
+	SCPY(done->callerid, callerid);
+	memcpy(&done->callerinfo, &callerinfo, sizeof(struct caller_info));
+	SCPY(done->email, p_record_vbox_email);
+	done->email_file = p_record_vbox_email_file;
+
+	/* mute and beep are only done for mono recordings (in samples/bytes) */
+	if (p_record_type != CODEC_MONO)
+		mute = beep = 0;
+
+	/* the writer completes the file, so a slow disk does not block us */
+	record_finish(p_record, p_record_type, mute<<1, beep, filename, port_record_done, done);
 	fduse--;
 	p_record = NULL;
 	update_rxoff();
-
-	if (rename(p_record_filename, filename) < 0) {
-		PERROR("Port(%d) cannot rename from '%s' to '%s'\n", p_serial, p_record_filename, filename);
-		return;
-	}
-
-	PDEBUG(DEBUG_PORT, "Port(%d) recording is written and renamed to '%s' and must have the following size:%lu raw:%lu samples:%lu\n", p_serial, filename, wsize+8, size, size>>1);
-
-	if (p_record_vbox == 2) {
-		SPRINT(indexname, "%s/%s/vbox/index", EXTENSION_DATA, p_record_extension);
-		if ((fp = fopen(indexname,"a"))) {
-			fduse++;
-
-			/* remove path from file name */
-			p = filename;
-			while(strchr(p, '/'))
-				p = strchr(p, '/')+1;
-			fprintf(fp, "%s %d %d %d %d %d %s\n", p, p_record_vbox_year, p_record_vbox_mon, p_record_vbox_mday, p_record_vbox_hour, p_record_vbox_min, callerid);
-
-			fclose(fp);
-			fduse--;
-		} else {
-			PERROR("Port(%d) cannot open index file '%s' to append.\n", p_serial, indexname);
-		}
-
-		/* send email with sample*/
-		if (p_record_vbox_email[0]) {
-			send_mail(p_record_vbox_email_file?filename:(char *)"", callerid, callerinfo.extension, callerinfo.name, p_record_vbox_email, p_record_vbox_year, p_record_vbox_mon, p_record_vbox_mday, p_record_vbox_hour, p_record_vbox_min, p_record_extension);
-		}
-	}
 }
 
 
@@ -951,9 +878,8 @@ void Port::close_record(int beep, int mute)
 void Port::record(unsigned char *data, int length, int dir_fromup)
 {
 	unsigned char write_buffer[1024], *d;
-	signed short *s;
-	int free, i, ii;
-	signed int sample;
+	signed short buffered[256], decoded[256], *s;
+	int free, i, ii, n;
 	int ret;
 
 	/* no recording */
@@ -986,10 +912,16 @@ same_again:
 //printf("same free=%d length=%d\n", free, length);
 		/* first write what we can to the buffer */
 		while(free && length) {
-			p_record_buffer[p_record_buffer_writep] = audio_law_to_s32[*data++];
-			p_record_buffer_writep = (p_record_buffer_writep + 1) & RECORD_BUFFER_MASK;
-			free--;
-			length--;
+			n = RECORD_BUFFER_LENGTH - p_record_buffer_writep;
+			if (n > free)
+				n = free;
+			if (n > length)
+				n = length;
+			audio_decode(p_record_buffer + p_record_buffer_writep, data, n);
+			p_record_buffer_writep = (p_record_buffer_writep + n) & RECORD_BUFFER_MASK;
+			data += n;
+			free -= n;
+			length -= n;
 		}
 		/* all written, so we return */
 		if (!length)
@@ -1004,8 +936,7 @@ same_again:
 				p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
 				i++;
 			}
-			ret = fwrite(write_buffer, 512, 1, p_record);
-			p_record_length += 512;
+			ret = record_write(p_record, write_buffer, 512);
 			break;
 
 			case CODEC_STEREO:
@@ -1027,8 +958,7 @@ same_again:
 					i++;
 				}
 			}
-			ret = fwrite(write_buffer, 1024, 1, p_record);
-			p_record_length += 1024;
+			ret = record_write(p_record, write_buffer, 1024);
 			break;
 
 			case CODEC_8BIT:
@@ -1039,20 +969,17 @@ same_again:
 				p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
 				i++;
 			}
-			ret = fwrite(write_buffer, 512, 1, p_record);
-			p_record_length += 512;
+			ret = record_write(p_record, write_buffer, 512);
 			break;
 
 			case CODEC_LAW:
-			d = write_buffer;
-			i = 0;
-			while(i < 256) {
-				*d++ = audio_s16_to_law[p_record_buffer[p_record_buffer_readp] & 0xffff];
-				p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
-				i++;
-			}
-			ret = fwrite(write_buffer, 256, 1, p_record);
-			p_record_length += 256;
+			n = RECORD_BUFFER_LENGTH - p_record_buffer_readp;
+			if (n > 256)
+				n = 256;
+			audio_encode(write_buffer, p_record_buffer + p_record_buffer_readp, n);
+			audio_encode(write_buffer + n, p_record_buffer, 256 - n);
+			p_record_buffer_readp = (p_record_buffer_readp + 256) & RECORD_BUFFER_MASK;
+			ret = record_write(p_record, write_buffer, 256);
 			break;
 		}
 		/* because we still have data, we write again */
@@ -1077,22 +1004,21 @@ different_again:
 //printf("same ii=%d length=%d\n", ii, length);
 //PDEBUG(DEBUG_PORT, "record(data,%d,%d): free=%d, p_record_buffer_dir=%d, p_record_buffer_readp=%d, p_record_buffer_writep=%d: mixing %d bytes.\n", length, dir_fromup, free, p_record_buffer_dir, p_record_buffer_readp, p_record_buffer_writep, ii);
 
+	/* get buffered stream and decode this stream */
+	n = RECORD_BUFFER_LENGTH - p_record_buffer_readp;
+	if (n > ii)
+		n = ii;
+	memcpy(buffered, p_record_buffer + p_record_buffer_readp, n * sizeof(signed short));
+	memcpy(buffered + n, p_record_buffer, (ii - n) * sizeof(signed short));
+	p_record_buffer_readp = (p_record_buffer_readp + ii) & RECORD_BUFFER_MASK;
+	audio_decode(decoded, data, ii);
+	data += ii;
+
 	/* write data mixed with the buffer */
 	switch(p_record_type) {
 		case CODEC_MONO:
-		s = (signed short *)write_buffer;
-		i = 0;
-		while(i < ii) {
-			sample = p_record_buffer[p_record_buffer_readp]
-				+ audio_law_to_s32[*data++];
-			p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
-			if (sample < SHORT_MIN) sample = SHORT_MIN;
-			if (sample > SHORT_MAX) sample = SHORT_MAX;
-			*s++ = sample;
-			i++;
-		}
-		ret = fwrite(write_buffer, ii<<1, 1, p_record);
-		p_record_length += (ii<<1);
+		audio_mix(buffered, decoded, ii);
+		ret = record_write(p_record, (unsigned char *)buffered, ii<<1);
 		break;
 		
 		case CODEC_STEREO:
@@ -1100,54 +1026,36 @@ different_again:
 		if (p_record_buffer_dir) {
 			i = 0;
 			while(i < ii) {
-				*s++ = audio_law_to_s32[*data++];
-				*s++ = p_record_buffer[p_record_buffer_readp];
-				p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
+				*s++ = decoded[i];
+				*s++ = buffered[i];
 				i++;
 			}
 		} else {
 			i = 0;
 			while(i < ii) {
-				*s++ = p_record_buffer[p_record_buffer_readp];
-				*s++ = audio_law_to_s32[*data++];
-				p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
+				*s++ = buffered[i];
+				*s++ = decoded[i];
 				i++;
 			}
 		}
-		ret = fwrite(write_buffer, ii<<2, 1, p_record);
-		p_record_length += (ii<<2);
+		ret = record_write(p_record, write_buffer, ii<<2);
 		break;
 		
 		case CODEC_8BIT:
+		audio_mix(buffered, decoded, ii);
 		d = write_buffer;
 		i = 0;
 		while(i < ii) {
-			sample = p_record_buffer[p_record_buffer_readp]
-				+ audio_law_to_s32[*data++];
-			p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
-			if (sample < SHORT_MIN) sample = SHORT_MIN;
-			if (sample > SHORT_MAX) sample = SHORT_MAX;
-			*d++ = (sample+0x8000) >> 8;
+			*d++ = (buffered[i]+0x8000) >> 8;
 			i++;
 		}
-		ret = fwrite(write_buffer, ii, 1, p_record);
-		p_record_length += ii;
+		ret = record_write(p_record, write_buffer, ii);
 		break;
 		
 		case CODEC_LAW:
-		d = write_buffer;
-		i = 0;
-		while(i < ii) {
-			sample = p_record_buffer[p_record_buffer_readp]
-				+ audio_law_to_s32[*data++];
-			p_record_buffer_readp = (p_record_buffer_readp + 1) & RECORD_BUFFER_MASK;
-			if (sample < SHORT_MIN) sample = SHORT_MIN;
-			if (sample > SHORT_MAX) sample = SHORT_MAX;
-			*d++ = audio_s16_to_law[sample & 0xffff];
-			i++;
-		}
-		ret = fwrite(write_buffer, ii, 1, p_record);
-		p_record_length += ii;
+		audio_mix(buffered, decoded, ii);
+		audio_encode(write_buffer, buffered, ii);
+		ret = record_write(p_record, write_buffer, ii);
 		break;
 	}
 	length -= ii;
@@ -1179,6 +1087,19 @@ static void remove_bridge(struct port_bridge *bridge, class Port *port)
 		if (*temp == bridge) {
 			int remove = 0;
 
+			/* Remove us from mixer. If two are left, bridge them directly. */
+			if (bridge->mixer && mixer_remove(bridge->mixer, port) <= 2) {
+				PDEBUG(DEBUG_PORT, "Bridge %u has %d ports left, remove mixer\n", bridge->bridge_id, bridge->mixer->members);
+				if (bridge->mixer->first) {
+					bridge->sunrise = bridge->mixer->first->port;
+					if (bridge->mixer->first->next)
+						bridge->sunset = bridge->mixer->first->next->port;
+				} else
+					remove = 1;
+				mixer_destroy(bridge->mixer);
+				bridge->mixer = NULL;
+			}
+
 			/* Remove us from bridge. If bridge is empty, remove it completely. */
 			if (bridge->sunrise == port) {
 				bridge->sunrise = NULL;
@@ -1203,7 +1124,7 @@ static void remove_bridge(struct port_bridge *bridge, class Port *port)
 	PERROR("Bridge %p not found in list\n", bridge);
 }
 
-void Port::bridge(unsigned int bridge_id)
+void Port::bridge(unsigned int bridge_id, int talkers)
 {
 	/* Remove bridge, if we leave bridge or if we join a different bridge. */
 	if (p_bridge && bridge_id != p_bridge->bridge_id) {
@@ -1237,6 +1158,7 @@ void Port::bridge(unsigned int bridge_id)
 		p_bridge = (struct port_bridge *) MALLOC(sizeof(struct port_bridge));
 		memuse++;
 		p_bridge->bridge_id = bridge_id;
+		p_bridge->talkers = talkers;
 		p_bridge->sunrise = this;
 
 		/* attach bridge instance to list */
@@ -1249,19 +1171,30 @@ void Port::bridge(unsigned int bridge_id)
 	/* already joined */
 	if (p_bridge->sunrise == this || p_bridge->sunset == this)
 		return;
+	if (p_bridge->mixer && mixer_find(p_bridge->mixer, this))
+		return;
 
 	/* join bridge */
-	if (!p_bridge->sunrise) {
-		p_bridge->sunrise = this;
-		return;
+	if (!p_bridge->mixer) {
+		if (!p_bridge->sunrise) {
+			p_bridge->sunrise = this;
+			return;
+		}
+		if (!p_bridge->sunset) {
+			p_bridge->sunset = this;
+			return;
+		}
 	}
-	if (!p_bridge->sunset) {
-		p_bridge->sunset = this;
-		return;
+
+	/* more than two ports, so they are mixed */
+	if (!p_bridge->mixer) {
+		PDEBUG(DEBUG_PORT, "Port %d is the third port of bridge %u, mixing all ports.\n", p_serial, p_bridge->bridge_id);
+		p_bridge->mixer = mixer_create(p_bridge->talkers);
+		mixer_add(p_bridge->mixer, p_bridge->sunrise);
+		mixer_add(p_bridge->mixer, p_bridge->sunset);
+		p_bridge->sunrise = p_bridge->sunset = NULL;
 	}
-	
-	PERROR("Bridge ID %u cannot be joined by port %u, because it is already occupied by ports %u and %u.\n", p_bridge->bridge_id, p_serial, p_bridge->sunrise->p_serial, p_bridge->sunset->p_serial);
-	p_bridge = NULL;
+	mixer_add(p_bridge->mixer, this);
 }
 
 class Port *Port::bridge_remote(void)
@@ -1282,7 +1215,15 @@ class Port *Port::bridge_remote(void)
 /* send data to remote Port */
 int Port::bridge_tx(unsigned char *data, int len)
 {
-	class Port *remote = bridge_remote();
+	class Port *remote;
+
+	/* mixed with other ports */
+	if (p_bridge && p_bridge->mixer) {
+		mixer_rx(p_bridge->mixer, this, data, len);
+		return 0;
+	}
+
+	remote = bridge_remote();
 
 	if (!remote)
 		return -EINVAL;
@@ -155,6 +155,8 @@ struct port_bridge {
 	unsigned int bridge_id;			/* unique ID to identify bridge */
 	class Port *sunrise;			/* one side of the bridge */
 	class Port *sunset;			/* other side of the bridge */
+	struct bridge_mixer *mixer;		/* mixes all ports, if more than two */
+	int talkers;				/* how many members the mixer mixes (0 = all) */
 };
 
 extern struct port_bridge *p_bridge_first;
@@ -196,6 +198,7 @@ class Port
 
 	/* identification */
 	unsigned int p_serial;			/* serial unique id of port */
+	struct id_hash_entry p_id_entry;	/* entry in hash of port serials */
 	char p_name[128];			/* name of port or token (h323) */
 
 	/* endpoint relation */
@@ -203,7 +206,7 @@ class Port
 
 	/* audio bridging */
 	struct port_bridge *p_bridge;		/* linked to a port bridge or NULL */
-	void bridge(unsigned int bridge_id);	/* join a bridge */
+	void bridge(unsigned int bridge_id, int talkers);	/* join a bridge */
 	class Port *bridge_remote(void);	/* get remote port */
 	int bridge_tx(unsigned char *data, int len); /* used to transmit data to remote port */
 	virtual int bridge_rx(unsigned char *data, int len); /* function to be inherited, so data is received */
@@ -222,10 +225,9 @@ class Port
 	int open_record(int type, int mode, int skip, char *terminal, int anon_ignore, const char *vbox_email, int vbox_email_file);
 	void close_record(int beep, int mute);
 	void record(unsigned char *data, int length, int dir_fromup);
-	FILE *p_record;				/* recording fp: if not NULL, recording is enabled */
+	struct record_file *p_record;		/* recording file: if not NULL, recording is enabled */
 	int p_record_type;			/* codec to use: RECORD_MONO, RECORD_STEREO, ... */
 	int p_record_skip;			/* skip bytes before writing the sample */
-	unsigned int p_record_length;		/* size of what's written so far */
 
 	signed short p_record_buffer[RECORD_BUFFER_LENGTH];
 	unsigned int p_record_buffer_readp;
@@ -0,0 +1,263 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** child processes without blocking the main loop                            **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO run a child?
+
+process_start() forks the child and returns at once. If PROCESS_MAX children
+are already running, the child is queued and forked when another one exits.
+
+SIGCHLD writes a byte into a pipe that is watched by the main loop. Then each
+of our children is checked with waitpid(WNOHANG). Children of others (popen
+of mail thread) are not touched.
+
+After the child exited, the callback is called. If the owner of the child is
+gone, it detaches the child, so the exit is just reaped.
+
+*/
+
+#include "main.h"
+
+extern char **environ;
+
+int process_running = 0;
+int process_queued = 0;
+
+static struct lcr_process *process_first = NULL;
+static int process_pipe[2] = { -1, -1 };
+static struct lcr_fd process_fd;
+static struct sigaction process_oldact;
+
+static void process_sigchld(int sig)
+{
+	int errno_save = errno;
+
+	if (write(process_pipe[1], "", 1) < 0)
+		; /* pipe is full, so the main loop will wake up anyway */
+	errno = errno_save;
+}
+
+/* wake the main loop, so it checks all children */
+static void process_wakeup(void)
+{
+	if (write(process_pipe[1], "", 1) < 0)
+		;
+}
+
+static int process_handler(struct lcr_fd *fd, unsigned int what, void *instance, int index);
+static int process_timeout(struct lcr_timer *timer, void *instance, int index);
+
+static int process_init(void)
+{
+	struct sigaction act;
+
+	if (process_pipe[0] >= 0)
+		return 0;
+
+	if (pipe(process_pipe) < 0) {
+		PERROR("Failed to create pipe for child processes (errno=%d)\n", errno);
+		return -1;
+	}
+	fcntl(process_pipe[0], F_SETFL, fcntl(process_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(process_pipe[1], F_SETFL, fcntl(process_pipe[1], F_GETFL) | O_NONBLOCK);
+	fcntl(process_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(process_pipe[1], F_SETFD, FD_CLOEXEC);
+
+	memset(&process_fd, 0, sizeof(process_fd));
+	process_fd.fd = process_pipe[0];
+	register_fd(&process_fd, LCR_FD_READ, process_handler, NULL, 0);
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = process_sigchld;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &act, &process_oldact);
+
+	return 0;
+}
+
+static void process_fork(struct lcr_process *process)
+{
+	pid_t pid;
+
+	switch ((pid = fork())) {
+	case 0:
+		execve(process->argv[0], process->argv, environ);
+		_exit(1);
+	case -1:
+		PERROR("Failed to fork '%s' (errno=%d)\n", process->argv[0], errno);
+		/* the callback is not called from within process_start() */
+		process->failed = 1;
+		process_wakeup();
+		return;
+	}
+
+	process->pid = pid;
+	process_running++;
+	if (process->timeout)
+		schedule_timer(&process->timer, process->timeout, 0);
+}
+
+static void process_free(struct lcr_process *process)
+{
+	del_timer(&process->timer);
+	if (process->args)
+		FREE(process->args, process->args_len);
+	memuse--;
+	FREE(process, sizeof(struct lcr_process));
+	memuse--;
+}
+
+/*
+ * start child
+ * argv[0] is the file to execute, timeout is given in seconds (0 for none)
+ * returns NULL if the child cannot be started
+ */
+struct lcr_process *process_start(char *const argv[], int timeout, void (*cb)(struct lcr_process *process, int status, void *instance), void *instance)
+{
+	struct lcr_process *process, **processp;
+	int i, len = 0;
+	char *p;
+
+	if (process_init())
+		return NULL;
+
+	for (i = 0; argv[i]; i++) {
+		if (i == PROCESS_ARGS) {
+			PERROR("Too many arguments for '%s'\n", argv[0]);
+			return NULL;
+		}
+		len += strlen(argv[i]) + 1;
+	}
+
+	process = (struct lcr_process *)MALLOC(sizeof(struct lcr_process));
+	memuse++;
+	process->args = (char *)MALLOC(len);
+	memuse++;
+	process->args_len = len;
+	p = process->args;
+	for (i = 0; argv[i]; i++) {
+		strcpy(p, argv[i]);
+		process->argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	process->argv[i] = NULL;
+	process->timeout = timeout;
+	process->cb = cb;
+	process->instance = instance;
+	add_timer(&process->timer, process_timeout, process, 0);
+
+	/* attach to end of list, so queued children are started in order */
+	processp = &process_first;
+	while(*processp)
+		processp = &((*processp)->next);
+	*processp = process;
+
+	if (process_running < PROCESS_MAX)
+		process_fork(process);
+	else {
+		PDEBUG(DEBUG_EPOINT, "Too many children running, queueing '%s'\n", argv[0]);
+		process_queued++;
+	}
+
+	return process;
+}
+
+/* the owner is gone, the child will be reaped without callback */
+void process_detach(struct lcr_process *process)
+{
+	process->cb = NULL;
+	process->instance = NULL;
+}
+
+static int process_timeout(struct lcr_timer *timer, void *instance, int index)
+{
+	struct lcr_process *process = (struct lcr_process *)instance;
+
+	PDEBUG(DEBUG_EPOINT, "Child '%s' (pid %d) timed out, killing it\n", process->argv[0], (int)process->pid);
+	kill(process->pid, SIGKILL);
+	process->failed = 1;
+
+	return 0;
+}
+
+static int process_handler(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	struct lcr_process *process, **processp;
+	char buffer[64];
+	int status, result;
+
+	/* drain pipe */
+	while (read(fd->fd, buffer, sizeof(buffer)) > 0)
+		;
+
+	again:
+	processp = &process_first;
+	while((process = *processp)) {
+		if (process->pid > 0) {
+			if (waitpid(process->pid, &status, WNOHANG) != process->pid) {
+				processp = &process->next;
+				continue;
+			}
+			process_running--;
+			if (process->failed || !WIFEXITED(status))
+				result = -1;
+			else
+				result = WEXITSTATUS(status);
+		} else if (process->failed) {
+			/* fork failed */
+			result = -1;
+		} else {
+			/* queued */
+			processp = &process->next;
+			continue;
+		}
+
+		*processp = process->next;
+		if (process->cb)
+			process->cb(process, result, process->instance);
+		process_free(process);
+		/* the callback may have changed the list */
+		goto again;
+	}
+
+	/* start queued children */
+	process = process_first;
+	while(process && process_running < PROCESS_MAX) {
+		if (!process->pid && !process->failed) {
+			process_queued--;
+			process_fork(process);
+		}
+		process = process->next;
+	}
+
+	return 0;
+}
+
+void process_exit(void)
+{
+	struct lcr_process *process;
+
+	while((process = process_first)) {
+		process_first = process->next;
+		process_free(process);
+	}
+	process_running = 0;
+	process_queued = 0;
+
+	if (process_pipe[0] < 0)
+		return;
+	sigaction(SIGCHLD, &process_oldact, NULL);
+	unregister_fd(&process_fd);
+	close(process_pipe[0]);
+	close(process_pipe[1]);
+	process_pipe[0] = process_pipe[1] = -1;
+}
+
@@ -0,0 +1,40 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** child process header file                                                 **
+**                                                                           **
+\*****************************************************************************/
+
+#define PROCESS_MAX	16	/* children running at the same time, others are queued */
+#define PROCESS_ARGS	16	/* maximum number of arguments */
+
+/* a child process that is running or queued
+ *
+ * the callback is called from the main loop after the child exited. status
+ * is the exit code of the child, or -1 if it could not be started or was
+ * killed on timeout.
+ */
+struct lcr_process {
+	struct lcr_process	*next;
+	pid_t			pid;		/* 0, if queued */
+	int			failed;		/* fork failed or child killed */
+	int			timeout;	/* seconds, 0 for none */
+	struct lcr_timer	timer;
+	char			*argv[PROCESS_ARGS + 1];
+	char			*args;		/* copy of all argument strings */
+	int			args_len;
+	void			(*cb)(struct lcr_process *process, int status, void *instance);
+	void			*instance;
+};
+
+extern int process_running;
+extern int process_queued;
+
+struct lcr_process *process_start(char *const argv[], int timeout, void (*cb)(struct lcr_process *process, int status, void *instance), void *instance);
+void process_detach(struct lcr_process *process);
+void process_exit(void);
+
@@ -0,0 +1,468 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** record writer                                                             **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO record?
+
+Recording must not block the audio path, so Port::record() only copies the
+encoded data into the ring of the record file. A writer thread drains the
+rings of all files with one large write per file every RECORD_INTERVAL, or
+earlier, when a ring is half full.
+
+If a ring is full (because the disk stalls), the data is dropped and counted
+in record_dropped. A write that takes longer than RECORD_LATE_MS is counted
+in record_late. Both are shown by lcradmin, to size disks.
+
+Closing a recording must not block either. record_finish() only tells the
+writer how to complete the file. When all data is written, the writer cuts
+the end, appends the beep, writes the header and renames the file. Then the
+main thread is woken through a pipe and calls the done-function of the
+recording, which may add it to the voice box or send it by mail.
+
+If a recording is opened while another one with the same file name is
+completed, a different name is used, so the writer does not rename the new
+file.
+
+*/
+
+#include <sys/uio.h>
+#include "main.h"
+
+#define RECORD_INTERVAL		250	/* ms between writes */
+#define RECORD_LATE_MS		500	/* a write taking longer is late */
+
+volatile unsigned int record_dropped = 0; /* blocks not recorded */
+volatile unsigned int record_late = 0; /* writes that took too long */
+
+static struct record_file *record_first = NULL;
+static struct record_file *record_done_first = NULL; /* completed, done-function not yet called */
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t record_cond = PTHREAD_COND_INITIALIZER; /* wake writer */
+static pthread_t record_tid;
+static int record_running = 0;
+static int record_quit = 0;
+static int record_pipe[2] = { -1, -1 }; /* wakes main thread, when files are completed */
+static struct lcr_fd record_pipe_fd;
+
+/* wave header structure */
+struct fmt {
+	unsigned short	stereo; /* 1 = mono, 2 = stereo */
+	unsigned short	channels; /* number of channels */
+	unsigned int	sample_rate; /* sample rate */
+	unsigned int	data_rate; /* data rate */
+	unsigned short	bytes_sample; /* bytes per sample (all channels) */
+	unsigned short	bits_sample; /* bits per sample (one channel) */
+};
+
+/* write what is in the ring, wrapped data is written with the same call */
+static void record_drain(struct record_file *rec)
+{
+	struct iovec iov[2];
+	struct timespec before, after;
+	unsigned int readp, writep, len;
+	int n, ret, late;
+
+	writep = rec->writep;
+	__sync_synchronize();
+	readp = rec->readp;
+	len = (writep - readp) & RECORD_RING_MASK;
+
+	/* after an error, data is dropped */
+	if (rec->error) {
+		rec->readp = writep;
+		return;
+	}
+
+	if (readp + len > RECORD_RING_SIZE) {
+		iov[0].iov_base = rec->ring + readp;
+		iov[0].iov_len = RECORD_RING_SIZE - readp;
+		iov[1].iov_base = rec->ring;
+		iov[1].iov_len = len - iov[0].iov_len;
+		n = 2;
+	} else {
+		iov[0].iov_base = rec->ring + readp;
+		iov[0].iov_len = len;
+		n = 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	while (n) {
+		ret = writev(rec->fd, iov, n);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			rec->error = errno;
+			__sync_fetch_and_add(&record_dropped, 1);
+			break;
+		}
+		rec->written += ret;
+		/* partial write, skip what is written */
+		while (n && (unsigned int)ret >= iov[0].iov_len) {
+			ret -= iov[0].iov_len;
+			iov[0] = iov[1];
+			n--;
+		}
+		if (n) {
+			iov[0].iov_base = (unsigned char *)iov[0].iov_base + ret;
+			iov[0].iov_len -= ret;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &after);
+	late = (after.tv_sec - before.tv_sec) * 1000 + (after.tv_nsec - before.tv_nsec) / 1000000;
+	if (late > RECORD_LATE_MS)
+		__sync_fetch_and_add(&record_late, 1);
+
+	/* make data read before giving space back to the ring */
+	__sync_synchronize();
+	rec->readp = writep;
+}
+
+/* cut, add beep and header, then rename, this is done by the writer */
+static void record_complete(struct record_file *rec)
+{
+	signed short beep_mono[256];
+	unsigned char header[RECORD_WAVE_HEADER];
+	struct fmt fmt;
+	unsigned int size, wsize, i;
+	int ret;
+
+	if (rec->error)
+		PERROR("failed to write recording: %s\n", strerror(rec->error));
+	size = rec->written;
+
+	/* mute (remove samples at the end) */
+	if (rec->mute) {
+		if (rec->mute > size)
+			rec->mute = size & ~1;
+		size -= rec->mute;
+		if (ftruncate(rec->fd, rec->offset + size) < 0)
+			PERROR("cannot mute end of recording '%s'\n", rec->filename);
+		lseek(rec->fd, rec->offset + size, SEEK_SET);
+	}
+	/* add beep to the end of recording */
+	if (rec->beep) {
+		for (i = 0; i < 256; i++)
+			beep_mono[i] = (signed short)(sin((double)i / 5.688888888889 * 2.0 * 3.1415927) * 2000.0);
+		for (i = 0; i < rec->beep; i += sizeof(beep_mono)) {
+			ret = write(rec->fd, beep_mono, sizeof(beep_mono));
+			if (ret > 0)
+				size += ret;
+		}
+	}
+
+	/* complete header */
+	switch(rec->type) {
+		case CODEC_MONO:
+		case CODEC_STEREO:
+		case CODEC_8BIT:
+		/* chunks must have even size */
+		if ((size & 1))
+			ret = write(rec->fd, "", 1);
+
+		/* cue xxxx0000LISTxxxxadtl */
+		ret = write(rec->fd, "cue \4\0\0\0\0\0\0\0LIST\4\0\0\0adtl", 24);
+
+		/* WAVEfmt xxxx(fmt-size)dataxxxx[data]cue xxxx0000LISTxxxxadtl*/
+		wsize = 4+8+sizeof(fmt)+8+((size+1)&~1)+8+4+8+4;
+
+		/* RIFF */
+		memcpy(header, "RIFF", 4);
+		header[4] = wsize;
+		header[5] = wsize >> 8;
+		header[6] = wsize >> 16;
+		header[7] = wsize >> 24;
+
+		/* WAVE */
+		memcpy(header+8, "WAVE", 4);
+
+		/* fmt */
+		memcpy(header+12, "fmt ", 4);
+		header[16] = sizeof(fmt);
+		header[17] = header[18] = header[19] = 0;
+		memset(&fmt, 0, sizeof(fmt));
+		switch(rec->type) {
+			case CODEC_MONO:
+			fmt.stereo = 1;
+			fmt.channels = 1;
+			fmt.sample_rate = 8000; /* samples/sec */
+			fmt.data_rate = 16000; /* full data rate */
+			fmt.bytes_sample = 2; /* all channels */
+			fmt.bits_sample = 16; /* one channel */
+			break;
+
+			case CODEC_STEREO:
+			fmt.stereo = 1;
+			fmt.channels = 2;
+			fmt.sample_rate = 8000; /* samples/sec */
+			fmt.data_rate = 32000; /* full data rate */
+			fmt.bytes_sample = 4; /* all channels */
+			fmt.bits_sample = 16; /* one channel */
+			break;
+
+			case CODEC_8BIT:
+			fmt.stereo = 1;
+			fmt.channels = 1;
+			fmt.sample_rate = 8000; /* samples/sec */
+			fmt.data_rate = 8000; /* full data rate */
+			fmt.bytes_sample = 1; /* all channels */
+			fmt.bits_sample = 8; /* one channel */
+			break;
+		}
+		memcpy(header+20, &fmt, sizeof(fmt));
+
+		/* data */
+		memcpy(header+20+sizeof(fmt), "data", 4);
+		header[24+sizeof(fmt)] = size;
+		header[25+sizeof(fmt)] = size >> 8;
+		header[26+sizeof(fmt)] = size >> 16;
+		header[27+sizeof(fmt)] = size >> 24;
+
+		/* write header in front of the data */
+		if (pwrite(rec->fd, header, sizeof(header), 0) != sizeof(header))
+			PERROR("cannot write header of recording '%s'\n", rec->filename);
+		break;
+	}
+
+	close(rec->fd);
+	rec->fd = -1;
+	rec->size = size;
+	if (rename(rec->filename, rec->newname) < 0)
+		rec->rename_error = errno;
+}
+
+static void *record_child(void *arg)
+{
+	struct record_file *rec, **recp;
+	struct timespec timeout;
+	char wake = 0;
+	int work;
+
+	pthread_mutex_lock(&record_mutex);
+	while (1) {
+		work = 0;
+		rec = record_first;
+		while (rec) {
+			/* files are only removed by us, so rec stays in the list */
+			if (rec->readp != rec->writep) {
+				pthread_mutex_unlock(&record_mutex);
+				record_drain(rec);
+				pthread_mutex_lock(&record_mutex);
+				work = 1;
+			}
+			if (!rec->finishing || rec->readp != rec->writep) {
+				rec = rec->next;
+				continue;
+			}
+
+			/* all data is written, complete the file */
+			recp = &record_first;
+			while (*recp != rec)
+				recp = &((*recp)->next);
+			*recp = rec->next;
+			pthread_mutex_unlock(&record_mutex);
+			record_complete(rec);
+			pthread_mutex_lock(&record_mutex);
+			rec->next = record_done_first;
+			record_done_first = rec;
+			if (write(record_pipe[1], &wake, 1) < 0)
+				PERROR("cannot wake main thread\n");
+			work = 1;
+			rec = *recp;
+		}
+		if (work)
+			continue;
+		/* files that are not finished are left on quit */
+		if (record_quit)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += RECORD_INTERVAL * 1000000;
+		if (timeout.tv_nsec >= 1000000000) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&record_cond, &record_mutex, &timeout);
+	}
+	pthread_mutex_unlock(&record_mutex);
+
+	return NULL;
+}
+
+/* call done-function of completed files and free them */
+static void record_done_all(void)
+{
+	struct record_file *rec, *next;
+
+	pthread_mutex_lock(&record_mutex);
+	rec = record_done_first;
+	record_done_first = NULL;
+	pthread_mutex_unlock(&record_mutex);
+
+	while (rec) {
+		next = rec->next;
+		if (rec->done)
+			rec->done(rec->priv, rec->newname, rec->size, rec->rename_error);
+		FREE(rec->ring, RECORD_RING_SIZE);
+		FREE(rec, sizeof(struct record_file));
+		memuse -= 2;
+		rec = next;
+	}
+}
+
+static int record_wake(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	char wake[64];
+
+	if (read(record_pipe[0], wake, sizeof(wake)) <= 0)
+		return 0;
+	record_done_all();
+
+	return 0;
+}
+
+/*
+ * create file and attach it to the writer
+ * offset is the space that is left for the header
+ */
+struct record_file *record_open(const char *filename, unsigned int offset)
+{
+	struct record_file *rec, *other;
+	char name[sizeof(rec->filename)];
+	int fd, n = 0;
+
+	if (record_pipe[0] < 0) {
+		if (pipe(record_pipe) < 0) {
+			PERROR("failed to create pipe for record writer.\n");
+			return NULL;
+		}
+		memset(&record_pipe_fd, 0, sizeof(record_pipe_fd));
+		record_pipe_fd.fd = record_pipe[0];
+		register_fd(&record_pipe_fd, LCR_FD_READ, record_wake, NULL, 0);
+	}
+	if (!record_running) {
+		if (pthread_create(&record_tid, NULL, record_child, NULL)) {
+			PERROR("failed to create record writer thread.\n");
+			return NULL;
+		}
+		record_running = 1;
+	}
+
+	/* the writer may still complete a file with the same name */
+	SCPY(name, filename);
+	pthread_mutex_lock(&record_mutex);
+	other = record_first;
+	while (other) {
+		if (other->finishing && !strcmp(other->filename, name)) {
+			SPRINT(name, "%s-%d", filename, ++n);
+			other = record_first;
+			continue;
+		}
+		other = other->next;
+	}
+	pthread_mutex_unlock(&record_mutex);
+
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+	if (offset && lseek(fd, offset, SEEK_SET) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	rec = (struct record_file *)MALLOC(sizeof(struct record_file));
+	rec->ring = (unsigned char *)MALLOC(RECORD_RING_SIZE);
+	memuse += 2;
+	rec->fd = fd;
+	SCPY(rec->filename, name);
+	rec->offset = offset;
+
+	pthread_mutex_lock(&record_mutex);
+	rec->next = record_first;
+	record_first = rec;
+	pthread_mutex_unlock(&record_mutex);
+
+	return rec;
+}
+
+/*
+ * queue data for writing, this is called from the audio path
+ * if there is no space, the data is dropped
+ */
+int record_write(struct record_file *rec, const unsigned char *data, int len)
+{
+	unsigned int readp, writep, space, first;
+
+	readp = rec->readp;
+	writep = rec->writep;
+	space = (readp - writep - 1) & RECORD_RING_MASK;
+	if (rec->error || (unsigned int)len > space) {
+		__sync_fetch_and_add(&record_dropped, 1);
+		return -1;
+	}
+
+	first = RECORD_RING_SIZE - writep;
+	if ((unsigned int)len > first) {
+		memcpy(rec->ring + writep, data, first);
+		memcpy(rec->ring, data + first, len - first);
+	} else
+		memcpy(rec->ring + writep, data, len);
+
+	/* make data visible before the writer sees the new pointer */
+	__sync_synchronize();
+	rec->writep = (writep + len) & RECORD_RING_MASK;
+
+	/* don't wait for the interval, if the ring fills */
+	if (((rec->writep - readp) & RECORD_RING_MASK) >= RECORD_RING_SIZE / 2)
+		pthread_cond_signal(&record_cond);
+
+	return 0;
+}
+
+/*
+ * let the writer complete the file, the recording must not be used anymore
+ * mute is removed from the end, beep is appended (bytes of mono recording)
+ * when done, the file is renamed and the done-function is called
+ */
+void record_finish(struct record_file *rec, int type, unsigned int mute, unsigned int beep, const char *newname, record_done_cb *done, void *priv)
+{
+	pthread_mutex_lock(&record_mutex);
+	rec->type = type;
+	rec->mute = mute;
+	rec->beep = beep;
+	SCPY(rec->newname, newname);
+	rec->done = done;
+	rec->priv = priv;
+	rec->finishing = 1;
+	pthread_cond_signal(&record_cond);
+	pthread_mutex_unlock(&record_mutex);
+}
+
+/* complete all files and stop writer, all recordings must be finished */
+void record_exit(void)
+{
+	if (record_running) {
+		pthread_mutex_lock(&record_mutex);
+		record_quit = 1;
+		pthread_cond_signal(&record_cond);
+		pthread_mutex_unlock(&record_mutex);
+		pthread_join(record_tid, NULL);
+		record_running = 0;
+		record_quit = 0;
+	}
+
+	record_done_all();
+	if (record_pipe[0] >= 0) {
+		unregister_fd(&record_pipe_fd);
+		close(record_pipe[0]);
+		close(record_pipe[1]);
+		record_pipe[0] = record_pipe[1] = -1;
+	}
+}
+
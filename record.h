@@ -0,0 +1,55 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** record writer header file                                                 **
+**                                                                           **
+\*****************************************************************************/
+
+#define RECORD_RING_SIZE	131072	/* must be a binary border, 4 seconds of stereo */
+#define RECORD_RING_MASK	(RECORD_RING_SIZE - 1)
+
+#define RECORD_WAVE_HEADER	44	/* RIFFxxxxWAVEfmt xxxx(fmt-size)dataxxxx */
+
+/* called when a recording is completed, error is the errno of the rename */
+typedef void (record_done_cb)(void *priv, const char *filename, unsigned int size, int error);
+
+/* a file that is written by the record writer thread
+ *
+ * the ring is filled by the audio path only and drained by the writer
+ * thread only, so no lock is required to access the ring.
+ */
+struct record_file {
+	struct record_file	*next;	/* list of files served by writer */
+	int			fd;
+	char			filename[256];
+	unsigned int		offset;	/* where data starts (space for header) */
+	unsigned char		*ring;
+	volatile unsigned int	readp;	/* changed by writer only */
+	volatile unsigned int	writep;	/* changed by audio path only */
+	volatile unsigned int	written; /* bytes written to file */
+	volatile int		error;	/* errno of failed write */
+
+	/* set by record_finish(), the file is completed by the writer */
+	int			finishing;
+	int			type;	/* CODEC_* */
+	unsigned int		mute;	/* bytes to remove at the end */
+	unsigned int		beep;	/* bytes of beep to append */
+	char			newname[512]; /* file is renamed to it */
+	unsigned int		size;	/* bytes of audio in completed file */
+	int			rename_error;
+	record_done_cb		*done;
+	void			*priv;
+};
+
+extern volatile unsigned int record_dropped;
+extern volatile unsigned int record_late;
+
+struct record_file *record_open(const char *filename, unsigned int offset);
+int record_write(struct record_file *rec, const unsigned char *data, int len);
+void record_finish(struct record_file *rec, int type, unsigned int mute, unsigned int beep, const char *newname, record_done_cb *done, void *priv);
+void record_exit(void);
+
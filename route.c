@@ -73,7 +73,7 @@ struct cond_defs cond_defs[] = {
 	{ "file",	MATCH_FILE,	COND_TYPE_STRING,
 	  "file=<path>[,...]", "Mathes is the given file exists and if the first character is '1'."},
 	{ "execute",	MATCH_EXECUTE,	COND_TYPE_STRING,
-	  "execute=<command>[,...]","Matches if the return value of the given command is greater 0."},
+	  "execute=<command>[:<timeout>][,...]","Matches if the return value of the given command is 0. The command is killed after the given timeout in seconds."},
 	{ "default",	MATCH_DEFAULT,	COND_TYPE_NULL,
 	  "default","Matches if no further dialing could match."},
 	{ "timeout",	MATCH_TIMEOUT,	COND_TYPE_INTEGER,
@@ -221,6 +221,9 @@ struct param_defs param_defs[] = {
 	{ PARAM_JINGLE,
 	  "jingle",	PARAM_TYPE_NULL,
 	  "jingle", "Conference members will hear a jingle if a member joins."},
+	{ PARAM_TALKERS,
+	  "talkers",	PARAM_TYPE_INTEGER,
+	  "talkers=<number>", "Only the given number of loudest members are heard. (Conferences with non-ISDN members.)"},
 	{ PARAM_TIMEOUT,
 	  "timeout",	PARAM_TYPE_INTEGER,
 	  "timeout=<seconds>", "Timeout before continue with next action."},
@@ -271,7 +274,7 @@ struct action_defs action_defs[] = {
 	  "Caller is routed to the voice box of given extension."},
 	{ ACTION_PARTYLINE,
 	  "partyline",&EndpointAppPBX::action_init_partyline, NULL, &EndpointAppPBX::action_hangup_call,
-	  PARAM_ROOM | PARAM_JINGLE,
+	  PARAM_ROOM | PARAM_JINGLE | PARAM_TALKERS,
 	  "Caller is participating the conference with the given room number."},
 	{ ACTION_LOGIN,
 	  "login",	NULL, &EndpointAppPBX::action_dialing_login, NULL,
@@ -463,6 +466,293 @@ void doc_rules(const char *name)
 	}
 }
 
+/*
+ * compile ruleset into prefix tries
+ */
+
+/* append rule to sorted list, rules are added in ascending order */
+static void index_append(int **list, int *count, int rule)
+{
+	int *grown;
+
+	if (*count && (*list)[*count - 1] == rule)
+		return;
+	/* grow when count reaches a power of two */
+	if (!(*count & (*count - 1))) {
+		grown = (int *)MALLOC((*count ? *count * 2 : 1) * sizeof(int));
+		rmemuse++;
+		if (*count) {
+			memcpy(grown, *list, *count * sizeof(int));
+			FREE(*list, 0);
+			rmemuse--;
+		}
+		*list = grown;
+	}
+	(*list)[(*count)++] = rule;
+}
+
+static struct route_trie *trie_new(char c)
+{
+	struct route_trie *node;
+
+	node = (struct route_trie *)MALLOC(sizeof(struct route_trie));
+	rmemuse++;
+	node->c = c;
+	return(node);
+}
+
+static void trie_free(struct route_trie *node)
+{
+	struct route_trie *child;
+
+	if (!node)
+		return;
+	while((child = node->child)) {
+		node->child = child->sibling;
+		trie_free(child);
+	}
+	if (node->rules) {
+		FREE(node->rules, 0);
+		rmemuse--;
+	}
+	if (node->below) {
+		FREE(node->below, 0);
+		rmemuse--;
+	}
+	FREE(node, sizeof(struct route_trie));
+	rmemuse--;
+}
+
+static struct route_trie *trie_child(struct route_trie *node, char c)
+{
+	node = node->child;
+	while(node) {
+		if (node->c == c)
+			break;
+		node = node->sibling;
+	}
+	return(node);
+}
+
+static void trie_add(struct route_trie *root, const char *value, int rule)
+{
+	struct route_trie *node = root, *child;
+
+	while(*value) {
+		index_append(&node->below, &node->below_count, rule);
+		child = trie_child(node, *value);
+		if (!child) {
+			child = trie_new(*value);
+			child->sibling = node->child;
+			node->child = child;
+		}
+		node = child;
+		value++;
+	}
+	index_append(&node->rules, &node->rules_count, rule);
+}
+
+/* return the key condition of a rule or NULL */
+static struct route_cond *rule_key(struct route_rule *rule)
+{
+	struct route_cond *cond = rule->cond_first, *first;
+	int indexed, barrier;
+
+	while(cond) {
+		/* check all values of a condition */
+		first = cond;
+		indexed = (first->match == MATCH_DIALING
+			|| first->match == MATCH_CALLERID
+			|| first->match == MATCH_INTERFACE);
+		barrier = 0;
+		while(1) {
+			if (cond->match != first->match || cond->value_type != VALUE_TYPE_STRING)
+				indexed = 0;
+			/* 'could match' or execution must not be skipped */
+			if (cond->match == MATCH_DIALING || cond->match == MATCH_EXECUTE)
+				barrier = 1;
+			if (!cond->value_extension || !cond->next)
+				break;
+			cond = cond->next;
+		}
+		if (indexed)
+			return(first);
+		if (barrier)
+			return(NULL);
+		cond = cond->next;
+	}
+	return(NULL);
+}
+
+static void ruleset_compile(struct route_ruleset *ruleset)
+{
+	struct route_index *index;
+	struct route_rule *rule;
+	struct route_cond *cond;
+	struct route_trie *root;
+	int i;
+
+	index = (struct route_index *)MALLOC(sizeof(struct route_index));
+	rmemuse++;
+	index->dialing = trie_new(0);
+	index->callerid = trie_new(0);
+	index->interface = trie_new(0);
+
+	rule = ruleset->rule_first;
+	while(rule) {
+		index->rules_count++;
+		rule = rule->next;
+	}
+	if (index->rules_count) {
+		index->rules = (struct route_rule **)MALLOC(index->rules_count * sizeof(struct route_rule *));
+		rmemuse++;
+	}
+
+	i = 0;
+	rule = ruleset->rule_first;
+	while(rule) {
+		index->rules[i] = rule;
+		cond = rule_key(rule);
+		if (!cond)
+			index_append(&index->always, &index->always_count, i);
+		else {
+			switch(cond->match) {
+			case MATCH_DIALING:
+				root = index->dialing;
+				break;
+			case MATCH_CALLERID:
+				root = index->callerid;
+				break;
+			default:
+				root = index->interface;
+			}
+			while(1) {
+				trie_add(root, cond->string_value, i);
+				index->values_count++;
+				if (!cond->value_extension || !cond->next)
+					break;
+				cond = cond->next;
+			}
+		}
+		i++;
+		rule = rule->next;
+	}
+
+	if (index->always_count + index->values_count) {
+		index->candidates = (int *)MALLOC((index->always_count + index->values_count) * sizeof(int));
+		rmemuse++;
+	}
+
+	PDEBUG(DEBUG_ROUTE, "ruleset '%s' compiled: %d rules, %d key values, %d rules without key\n", ruleset->name, index->rules_count, index->values_count, index->always_count);
+	ruleset->index = index;
+}
+
+static void ruleset_uncompile(struct route_ruleset *ruleset)
+{
+	struct route_index *index = ruleset->index;
+
+	if (!index)
+		return;
+	trie_free(index->dialing);
+	trie_free(index->callerid);
+	trie_free(index->interface);
+	if (index->rules) {
+		FREE(index->rules, 0);
+		rmemuse--;
+	}
+	if (index->always) {
+		FREE(index->always, 0);
+		rmemuse--;
+	}
+	if (index->candidates) {
+		FREE(index->candidates, 0);
+		rmemuse--;
+	}
+	FREE(index, sizeof(struct route_index));
+	rmemuse--;
+	ruleset->index = NULL;
+}
+
+/* add rules of all nodes along the string, return the node at its end */
+static struct route_trie *trie_walk(struct route_index *index, struct route_trie *node, const char *string, int *count)
+{
+	while(1) {
+		memcpy(index->candidates + *count, node->rules, node->rules_count * sizeof(int));
+		*count += node->rules_count;
+		if (!*string)
+			return(node);
+		node = trie_child(node, *string++);
+		if (!node)
+			return(NULL);
+	}
+}
+
+static int candidate_cmp(const void *a, const void *b)
+{
+	return(*(const int *)a - *(const int *)b);
+}
+
+/*
+ * walk through all rules that can match or could match, in order
+ * rules that can only 'couldmatch' are skipped after a rule could match,
+ * because they don't change the result anymore
+ */
+struct route_rule *route_walk_first(struct route_walk *walk, struct route_ruleset *ruleset, const char *dialing, const char *callerid, const char *interface)
+{
+	struct route_index *index = ruleset->index;
+	struct route_trie *end;
+
+	memset(walk, 0, sizeof(struct route_walk));
+	if (!index) {
+		walk->rule = ruleset->rule_first;
+		return(walk->rule);
+	}
+	walk->index = index;
+	walk->last = -1;
+
+	memcpy(index->candidates, index->always, index->always_count * sizeof(int));
+	walk->count = index->always_count;
+	trie_walk(index, index->callerid, callerid, &walk->count);
+	if (interface[0])
+		trie_walk(index, index->interface, interface, &walk->count);
+	end = trie_walk(index, index->dialing, dialing, &walk->count);
+	if (end) {
+		walk->below = end->below;
+		walk->below_count = end->below_count;
+	}
+	qsort(index->candidates, walk->count, sizeof(int), candidate_cmp);
+
+	return(route_walk_next(walk, 0));
+}
+
+struct route_rule *route_walk_next(struct route_walk *walk, int couldmatch)
+{
+	int candidate, below, next;
+
+	if (!walk->index) {
+		if (walk->rule)
+			walk->rule = walk->rule->next;
+		return(walk->rule);
+	}
+
+	while(1) {
+		candidate = (walk->pos < walk->count) ? walk->index->candidates[walk->pos] : walk->index->rules_count;
+		below = (!couldmatch && walk->below_pos < walk->below_count) ? walk->below[walk->below_pos] : walk->index->rules_count;
+		next = (candidate < below) ? candidate : below;
+		if (next == walk->index->rules_count)
+			return(NULL);
+		if (next == candidate)
+			walk->pos++;
+		if (next == below)
+			walk->below_pos++;
+		/* rule was already returned */
+		if (next <= walk->last)
+			continue;
+		walk->last = next;
+		return(walk->index->rules[next]);
+	}
+}
+
 void ruleset_free(struct route_ruleset *ruleset_start)
 {
 	struct route_ruleset *ruleset;
@@ -510,6 +800,7 @@ void ruleset_free(struct route_ruleset *ruleset_start)
 			FREE(rule, sizeof(struct route_rule));
 			rmemuse--;
 		}
+		ruleset_uncompile(ruleset);
 		FREE(ruleset, sizeof(struct route_ruleset));
 		rmemuse--;
 	}
@@ -556,6 +847,8 @@ void ruleset_debug(struct route_ruleset *ruleset_start)
 
 					case VALUE_TYPE_STRING:
 					printf("'%s'", cond->string_value);
+					if (cond->match == MATCH_EXECUTE && cond->integer_value)
+						printf(":%d", cond->integer_value);
 					break;
 
 					case VALUE_TYPE_STRING_RANGE:
@@ -793,7 +1086,7 @@ struct route_ruleset *ruleset_parse(void)
 				key[1024],
 				key_to[1024],
 				pointer[1024+1],
-				*p;
+				*p, *pp;
 	int			expecting = 1; /* 1 = expecting ruleset */
 	int			index,
 				value_type,
@@ -1209,6 +1502,13 @@ struct route_ruleset *ruleset_parse(void)
 				cond->string_value = (char *)MALLOC(strlen(key)+1);
 				rmemuse++;
 				UCPY(cond->string_value, key);
+				/* timeout of command */
+				if (cond->match == MATCH_EXECUTE && (pp = strrchr(cond->string_value, ':'))) {
+					if (pp[1] && strspn(pp + 1, "0123456789") == strlen(pp + 1)) {
+						cond->integer_value = atoi(pp + 1);
+						*pp = '\0';
+					}
+				}
 				if (value_type == VALUE_TYPE_STRING_RANGE) {
 					cond->string_value_to = (char *)MALLOC(strlen(key_to)+1);
 					rmemuse++;
@@ -1833,6 +2133,11 @@ struct route_ruleset *ruleset_parse(void)
 	if (!ruleset_start) {
 		SPRINT(failure, "No ruleset defined.");
 	}
+	ruleset = ruleset_start;
+	while(ruleset) {
+		ruleset_compile(ruleset);
+		ruleset = ruleset->next;
+	}
 	return(ruleset_start);
 
 	parse_error:
@@ -1883,13 +2188,11 @@ struct route_action *EndpointAppPBX::route(struct route_ruleset *ruleset)
 				couldbetrue,
 				condition,
 				dialing_required;
-	struct route_rule	*rule = ruleset->rule_first;
+	struct route_rule	*rule;
+	struct route_walk	walk;
 	struct route_cond	*cond;
 	struct route_action	*action = NULL;
 	unsigned long		comp_len;
-	int			j;
-	char			isdn_port[10];
-	char			*argv[11]; /* check also number of args below */
 	char			callerid[64], callerid2[64], redirid[64];
 	int			integer;
 	char			*string;
@@ -1900,12 +2203,11 @@ struct route_action *EndpointAppPBX::route(struct route_ruleset *ruleset)
 	struct mISDNport	*mISDNport;
 	int			avail,
 				any;
-	int			jj;
+	int			j, jj;
 #endif
 	struct admin_list	*admin;
 	time_t			now;
 	struct tm		*now_tm;
-	int			pid, status;
 
 	/* reset timeout action */
 	e_match_to_action = NULL;
@@ -1915,6 +2217,7 @@ struct route_action *EndpointAppPBX::route(struct route_ruleset *ruleset)
 	SCPY(redirid, numberrize_callerinfo(e_redirinfo.id, e_redirinfo.ntype, options.national, options.international));
 	
 	PDEBUG(DEBUG_ROUTE, "parsing ruleset '%s'\n", ruleset->name);
+	rule = route_walk_first(&walk, ruleset, e_dialinginfo.id, callerid, e_callerinfo.interface);
 	while(rule) {
 		PDEBUG(DEBUG_ROUTE, "checking rule in line %d\n", rule->line);
 		match = 1; /* this rule matches */
@@ -2077,32 +2380,14 @@ struct route_action *EndpointAppPBX::route(struct route_ruleset *ruleset)
 				break;
 
 				case MATCH_EXECUTE:
-				j = 0;
-#if 0
-				argv[j++] = (char *)"/bin/sh";
-				argv[j++] = (char *)"-c";
-				argv[j++] = cond->string_value;
-#endif
-				argv[j++] = cond->string_value;
-				argv[j++] = e_extdialing;
-				argv[j++] = (char *)numberrize_callerinfo(e_callerinfo.id, e_callerinfo.ntype, options.national, options.international);
-				argv[j++] = e_callerinfo.extension;
-				argv[j++] = e_callerinfo.name;
-				SPRINT(isdn_port, "%d", e_callerinfo.isdn_port);
-				argv[j++] = isdn_port;
-				argv[j++] = e_callerinfo.imsi;
-				argv[j++] = NULL; /* check also number of args above */
-				switch ((pid = fork())) {
+				switch (route_execute(cond)) {
 				case 0:
-					execve(cond->string_value, argv, environ);
-					perror("execve");
-					exit(1);
-				case -1:
+					istrue = 1;
 					break;
-				default:
-					waitpid(pid, &status, 0);
-					if (0 == WEXITSTATUS(status))
-						istrue = 1;
+				case -1:
+					/* command is running, routing continues when it exits */
+					PDEBUG(DEBUG_ROUTE, "waiting for command '%s' in line %d\n", cond->string_value, rule->line);
+					return(NULL);
 				}
 				break;
 
@@ -2348,8 +2633,10 @@ struct route_action *EndpointAppPBX::route(struct route_ruleset *ruleset)
 			/* rule could match if more is dialed */
 			couldmatch = 1;
 		}
-		rule = rule->next;
+		rule = route_walk_next(&walk, couldmatch);
 	}
+	/* routing is done, results of commands are not valid anymore */
+	route_execute_flush();
 	if (match_timeout == 0)
 		unsched_timer(&e_match_timeout); /* no timeout */
 	else {
@@ -2358,6 +2645,103 @@ struct route_action *EndpointAppPBX::route(struct route_ruleset *ruleset)
 	return(action);
 }
 
+/* detach command, if still running, and free it */
+static void route_execute_free(struct route_execute *exec)
+{
+	if (exec->process)
+		process_detach(exec->process);
+	FREE(exec->command, strlen(exec->command) + 1);
+	FREE(exec, sizeof(struct route_execute));
+	memuse -= 2;
+}
+
+/* command of 'execute' condition has exited, continue routing */
+static void route_execute_done(struct lcr_process *process, int status, void *instance)
+{
+	struct route_execute *exec = (struct route_execute *)instance;
+	class EndpointAppPBX *ea = exec->ea;
+
+	PDEBUG(DEBUG_ROUTE, "EPOINT(%d): command '%s' exited with %d\n", ea->ea_endpoint->ep_serial, exec->command, status);
+	exec->process = NULL;
+	exec->status = status;
+
+	if (!ea->e_action)
+		ea->process_dialing(0);
+		/* we must exit, because our endpoint might be gone */
+}
+
+/*
+ * run command of 'execute' condition without blocking
+ * returns the exit code of the command or -1 while the command is running
+ * the result is kept until routing is done or the dialing changes
+ */
+int EndpointAppPBX::route_execute(struct route_cond *cond)
+{
+	struct route_execute *exec, **execp;
+	char isdn_port[10];
+	char *argv[11]; /* check also number of args below */
+	int j = 0;
+
+	execp = &e_execute;
+	while((exec = *execp)) {
+		if (!strcmp(exec->command, cond->string_value) && exec->timeout == cond->integer_value) {
+			if (!strcmp(exec->dialing, e_dialinginfo.id))
+				break;
+			/* dialing has changed, so we must run the command again */
+			*execp = exec->next;
+			route_execute_free(exec);
+			continue;
+		}
+		execp = &exec->next;
+	}
+	if (exec) {
+		if (exec->process)
+			return -1;
+		return (exec->status < 0) ? 1 : exec->status;
+	}
+
+#if 0
+	argv[j++] = (char *)"/bin/sh";
+	argv[j++] = (char *)"-c";
+	argv[j++] = cond->string_value;
+#endif
+	argv[j++] = cond->string_value;
+	argv[j++] = e_extdialing;
+	argv[j++] = (char *)numberrize_callerinfo(e_callerinfo.id, e_callerinfo.ntype, options.national, options.international);
+	argv[j++] = e_callerinfo.extension;
+	argv[j++] = e_callerinfo.name;
+	SPRINT(isdn_port, "%d", e_callerinfo.isdn_port);
+	argv[j++] = isdn_port;
+	argv[j++] = e_callerinfo.imsi;
+	argv[j++] = NULL; /* check also number of args above */
+
+	exec = (struct route_execute *)MALLOC(sizeof(struct route_execute));
+	exec->command = (char *)MALLOC(strlen(cond->string_value) + 1);
+	memuse += 2;
+	UCPY(exec->command, cond->string_value);
+	exec->timeout = cond->integer_value;
+	SCPY(exec->dialing, e_dialinginfo.id);
+	exec->ea = this;
+	exec->process = process_start(argv, exec->timeout, route_execute_done, exec);
+	if (!exec->process)
+		exec->status = 1;
+	exec->next = e_execute;
+	e_execute = exec;
+
+	return (exec->process) ? -1 : exec->status;
+}
+
+/* forget results of commands and detach commands that are still running */
+void EndpointAppPBX::route_execute_flush(void)
+{
+	struct route_execute *exec;
+
+	while((exec = e_execute)) {
+		e_execute = exec->next;
+		route_execute_free(exec);
+	}
+}
+
 /*
  * parses the current action's parameters and return them
  */
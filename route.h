@@ -149,6 +149,7 @@ enum { /* defines when a statement should be executed */
 #define PARAM_EXTEN		(1LL<<46)
 #define PARAM_ON		(1LL<<47)
 #define PARAM_KEYPAD		(1LL<<48)
+#define PARAM_TALKERS		(1LL<<49)
 
 /* action index
  * NOTE: The given index is the actual entry number of action_defs[], so add/remove both lists!!!
@@ -227,12 +228,63 @@ struct route_rule { /* a rule has a list of items and actions */
 //	int			temp_couldmatch;	/* stores, if the dialing could match. this is used to make a list of rules, that could match */
 };
 
+/* compiled form of a ruleset
+ *
+ * The key of a rule is its first condition of dialing, caller ID or
+ * interface with string values only, if all conditions before are just true
+ * or false (no dialing) and execute nothing. If the key does not match, the
+ * rule cannot match or could match, so it is not checked at all. The values
+ * of the keys are stored in prefix tries, rules without key are always
+ * checked.
+ */
+struct route_trie { /* node of a prefix trie */
+	struct route_trie	*child;			/* first node with one more character */
+	struct route_trie	*sibling;		/* next node with the same prefix */
+	char			c;			/* character of this node */
+	int			*rules;			/* rules with a value ending here */
+	int			rules_count;
+	int			*below;			/* rules with a value ending below */
+	int			below_count;
+};
+
+struct route_index { /* compiled ruleset */
+	struct route_rule	**rules;		/* all rules by number */
+	int			rules_count;
+	int			*always;		/* rules without key */
+	int			always_count;
+	int			values_count;		/* number of key values */
+	struct route_trie	*dialing;		/* tries of key values */
+	struct route_trie	*callerid;
+	struct route_trie	*interface;
+	int			*candidates;		/* buffer to collect candidates */
+};
+
+struct route_walk { /* walks through the rules that can match */
+	struct route_index	*index;
+	struct route_rule	*rule;			/* current rule, if not compiled */
+	int			count, pos;		/* candidates */
+	int			*below;			/* rules that can only be 'couldmatch' */
+	int			below_count, below_pos;
+	int			last;			/* number of last rule */
+};
+
+struct route_execute { /* command of 'execute' condition that runs or has exited */
+	struct route_execute	*next;
+	char			*command;		/* command of condition, the ruleset may be reloaded */
+	int			timeout;		/* timeout of condition */
+	char			dialing[256];		/* dialing when command was started */
+	struct lcr_process	*process;		/* NULL, if command has exited */
+	int			status;			/* exit code of command */
+	class EndpointAppPBX	*ea;
+};
+
 struct route_ruleset { /* the ruleset is a list of rules */
 	struct route_ruleset	*next;			/* next item */
 	char			file[128];		/* filename */
 	int			line;			/* line parsed from */
 	char			name[64];		/* name of ruleset */
 	struct route_rule	*rule_first;		/* linke to rule list */
+	struct route_index	*index;			/* compiled ruleset */
 };
 
 struct cond_defs { /* defintion of all conditions */
@@ -285,4 +337,6 @@ void ruleset_debug(struct route_ruleset *ruleset_start);
 extern char ruleset_error[256];
 struct route_ruleset *ruleset_parse(void);
 struct route_ruleset *getrulesetbyname(const char *name);
+struct route_rule *route_walk_first(struct route_walk *walk, struct route_ruleset *ruleset, const char *dialing, const char *callerid, const char *interface);
+struct route_rule *route_walk_next(struct route_walk *walk, int couldmatch);
 
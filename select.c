@@ -6,16 +6,114 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "macro.h"
 #include "select.h"
 
-static int maxfd = 0;
-static int unregistered;
-static struct lcr_fd *fd_first = NULL;
-static struct timeval *nearest_timer(struct timeval *select_timer, int *work);
+#define MAX_EVENTS	64
+
+static int epoll_fd = -1;
+static struct lcr_fd timer_lfd;
+static struct timeval timer_armed; /* absolute time the timerfd is armed for */
+static struct epoll_event events[MAX_EVENTS]; /* events of current wakeup */
+static int events_num = 0, events_index = 0;
+static struct timeval *nearest_timer(int *work);
 static int next_work(void);
 
+/* convert LCR_FD_* into epoll events */
+static unsigned int when2events(int when)
+{
+	unsigned int events = 0;
+
+	if ((when & LCR_FD_READ))
+		events |= EPOLLIN;
+	if ((when & LCR_FD_WRITE))
+		events |= EPOLLOUT;
+	if ((when & LCR_FD_EXCEPT))
+		events |= EPOLLPRI;
+	return events;
+}
+
+/* add, modify or remove fd from epoll set, according to 'when' */
+static void epoll_update(struct lcr_fd *fd, int when)
+{
+	struct epoll_event ev;
+	int op;
+
+	/* an fd without events is not in the epoll set, so hangup will not be reported endlessly */
+	if (!when) {
+		if (fd->events)
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL);
+		fd->events = 0;
+		return;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = when2events(when);
+	ev.data.ptr = fd;
+	op = (fd->events) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(epoll_fd, op, fd->fd, &ev) < 0)
+		FATAL("Failed to add fd %d to epoll set (errno=%d)\n", fd->fd, errno);
+	fd->events = ev.events;
+}
+
+/* read timer expiry, the timers are processed by select_main() */
+static int timer_fd_cb(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	uint64_t expirations;
+
+	if (read(fd->fd, &expirations, sizeof(expirations)) < 0) {
+		/* may happen, if timer was rearmed before reading */
+	}
+	/* timerfd is disarmed now, so it must be armed again */
+	timer_armed.tv_sec = 0;
+	timer_armed.tv_usec = 0;
+	return 0;
+}
+
+/* create epoll set and timerfd at first use */
+static void epoll_init(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		FATAL("Failed to create epoll set (errno=%d)\n", errno);
+
+	memset(&timer_lfd, 0, sizeof(timer_lfd));
+	timer_lfd.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_lfd.fd < 0)
+		FATAL("Failed to create timerfd (errno=%d)\n", errno);
+	timer_armed.tv_sec = 0;
+	timer_armed.tv_usec = 0;
+	register_fd(&timer_lfd, LCR_FD_READ, timer_fd_cb, NULL, 0);
+}
+
+/* arm timerfd to given absolute time, or disarm, if NULL */
+static void arm_timer_fd(struct timeval *timeout)
+{
+	struct itimerspec its;
+
+	if (timeout) {
+		if (timeout->tv_sec == timer_armed.tv_sec && timeout->tv_usec == timer_armed.tv_usec)
+			return;
+		timer_armed = *timeout;
+	} else {
+		if (!timer_armed.tv_sec && !timer_armed.tv_usec)
+			return;
+		timer_armed.tv_sec = 0;
+		timer_armed.tv_usec = 0;
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = timer_armed.tv_sec;
+	its.it_value.tv_nsec = timer_armed.tv_usec * 1000;
+	if (timerfd_settime(timer_lfd.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		FATAL("Failed to arm timerfd (errno=%d)\n", errno);
+}
+
 int _register_fd(struct lcr_fd *fd, int when, int (*cb)(struct lcr_fd *fd, unsigned int what, void *instance, int index), void *instance, int index, const char *func)
 {
 	int flags;
@@ -24,6 +122,9 @@ int _register_fd(struct lcr_fd *fd, int when, int (*cb)(struct lcr_fd *fd, unsig
 		FATAL("FD that is registered in function %s is already in use\n", func);
 //	printf("registering fd %d  %s\n", fd->fd, func);
 
+	if (epoll_fd < 0)
+		epoll_init();
+
 	/* make FD nonblocking */
 	flags = fcntl(fd->fd, F_GETFL);
 	if (flags < 0)
@@ -33,61 +134,72 @@ int _register_fd(struct lcr_fd *fd, int when, int (*cb)(struct lcr_fd *fd, unsig
 	if (flags < 0)
 		FATAL("Failed to F_SETFL O_NONBLOCK\n");
 
-	/* Register FD */
-	if (fd->fd > maxfd)
-		maxfd = fd->fd;
-
-	/* append to list */
+	/* add to epoll set */
 	fd->inuse = 1;
 	fd->when = when;
+	fd->events = 0;
 	fd->cb = cb;
 	fd->cb_instance = instance;
 	fd->cb_index = index;
-	fd->next = fd_first;
-	fd_first = fd;
+	epoll_update(fd, when);
 
 	return 0;
 }
 
+void _update_fd(struct lcr_fd *fd, int when, const char *func)
+{
+	/* not registered yet, register_fd() will set it */
+	if (!fd->inuse) {
+		fd->when = when;
+		return;
+	}
+
+	if (fd->when == when)
+		return;
+	fd->when = when;
+	epoll_update(fd, when);
+}
+
 void _unregister_fd(struct lcr_fd *fd, const char *func)
 {
-	struct lcr_fd **lcr_fdp;
+	int i;
 
-	/* find pointer to fd */
-	lcr_fdp = &fd_first;
-	while(*lcr_fdp) {
-		if (*lcr_fdp == fd)
-			break;
-		lcr_fdp = &((*lcr_fdp)->next);
-	}
-	if (!*lcr_fdp) {
+	if (!fd->inuse) {
 		FATAL("FD unregistered in function %s not in list\n", func);
 	}
 
-	/* remove fd from list */
+	/* remove fd from epoll set, the fd may already be closed */
+	if (fd->events)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd->fd, NULL);
+	fd->events = 0;
 	fd->inuse = 0;
-	*lcr_fdp = fd->next;
-	unregistered = 1;
+
+	/* remove pending events of current wakeup, fd may be freed */
+	for (i = events_index; i < events_num; i++) {
+		if (events[i].data.ptr == fd)
+			events[i].data.ptr = NULL;
+	}
 }
 
 
 int select_main(int polling, int *global_change, void (*lock)(void), void (*unlock)(void))
 {
 	struct lcr_fd *lcr_fd;
-	fd_set readset, writeset, exceptset;
 	int work = 0, temp, rc;
-	struct timeval no_time = {0, 0};
-	struct timeval select_timer, *timer;
+	struct timeval *timer;
 
 	/* goto again;
 	 *
-	 * this ensures that select is only called until:
+	 * this ensures that epoll_wait is only called until:
 	 * - no work event exists
 	 * - and no timeout occurred
 	 *
-	 * if no future timeout exists, select will wait infinit.
+	 * if no future timeout exists, epoll_wait will wait infinit.
 	 */
 
+	if (epoll_fd < 0)
+		epoll_init();
+
 again:
 	/* process all work events */
 	if (next_work()) {
@@ -97,41 +209,18 @@ again:
 
 	/* process timer events and get timeout for next timer event */
 	temp = 0;
-	timer = nearest_timer(&select_timer, &temp);
+	timer = nearest_timer(&temp);
 	if (temp) {
 		work = 1;
 		goto again;
 	}
-	if (polling)
-		timer = &no_time;
-//#warning TESTING
-//	if (!timer)
-//		printf("wait till infinity ..."); fflush(stdout);
-
-	FD_ZERO(&readset);
-	FD_ZERO(&writeset);
-	FD_ZERO(&exceptset);
-
-	/* prepare read and write fdsets */
-	lcr_fd = fd_first;
-	while(lcr_fd) {
-		if (lcr_fd->when & LCR_FD_READ)
-			FD_SET(lcr_fd->fd, &readset);
-		if (lcr_fd->when & LCR_FD_WRITE)
-			FD_SET(lcr_fd->fd, &writeset);
-		if (lcr_fd->when & LCR_FD_EXCEPT)
-			FD_SET(lcr_fd->fd, &exceptset);
-		lcr_fd = lcr_fd->next;
-	}
+	arm_timer_fd(timer);
 
 	if (unlock)
 		unlock();
-	rc = select(maxfd+1, &readset, &writeset, &exceptset, timer);
+	rc = epoll_wait(epoll_fd, events, MAX_EVENTS, (polling) ? 0 : -1);
 	if (lock)
 		lock();
-//#warning TESTING
-//	if (!timer)
-//		printf("interrupted.\n");
 	if (rc < 0)
 		return 0;
 	if (global_change && *global_change) {
@@ -139,44 +228,124 @@ again:
 		return 1;
 	}
 
-	/* fire timers */
-#if 0
-	bsc_update_timers();
-#endif
-
-	/* call registered callback functions */
-restart:
-	unregistered = 0;
-	lcr_fd = fd_first;
-	while(lcr_fd) {
-		int flags = 0;
-
-		if (FD_ISSET(lcr_fd->fd, &readset)) {
+	/* call registered callback functions of all ready fds */
+	events_num = rc;
+	for (events_index = 0; events_index < events_num; events_index++) {
+		unsigned int flags = 0, ev = events[events_index].events;
+
+		lcr_fd = (struct lcr_fd *)events[events_index].data.ptr;
+		/* fd was unregistered by a previous callback */
+		if (!lcr_fd)
+			continue;
+		/* error and hangup are reported as readable/writable, like select() does */
+		if ((ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (lcr_fd->when & LCR_FD_READ))
 			flags |= LCR_FD_READ;
-			FD_CLR(lcr_fd->fd, &readset);
-		}
-		if (FD_ISSET(lcr_fd->fd, &writeset)) {
+		if ((ev & (EPOLLOUT | EPOLLERR)) && (lcr_fd->when & LCR_FD_WRITE))
 			flags |= LCR_FD_WRITE;
-			FD_CLR(lcr_fd->fd, &writeset);
-		}
-		if (FD_ISSET(lcr_fd->fd, &exceptset)) {
+		if ((ev & EPOLLPRI) && (lcr_fd->when & LCR_FD_EXCEPT))
 			flags |= LCR_FD_EXCEPT;
-			FD_CLR(lcr_fd->fd, &exceptset);
-		}
 		if (flags) {
 			work = 1;
 			lcr_fd->cb(lcr_fd, flags, lcr_fd->cb_instance, lcr_fd->cb_index);
-			if (unregistered)
-				goto restart;
-			return 1;
 		}
-		lcr_fd = lcr_fd->next;
 	}
+	events_num = events_index = 0;
+
 	return work;
 }
 
 
-static struct lcr_timer *timer_first = NULL;
+/* active timers are kept in a binary min-heap, ordered by timeout */
+static struct lcr_timer **timer_heap = NULL;
+static int timer_heap_num = 0, timer_heap_size = 0;
+
+/* get current time of the monotonic clock, which all timers use */
+void get_timer_time(struct timeval *tv)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+static inline int timer_before(struct lcr_timer *left, struct lcr_timer *right)
+{
+	if (left->timeout.tv_sec != right->timeout.tv_sec)
+		return left->timeout.tv_sec < right->timeout.tv_sec;
+	return left->timeout.tv_usec < right->timeout.tv_usec;
+}
+
+static inline void heap_set(int index, struct lcr_timer *timer)
+{
+	timer_heap[index] = timer;
+	timer->heap_index = index;
+}
+
+static void heap_up(int index)
+{
+	struct lcr_timer *timer = timer_heap[index];
+	int parent;
+
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (!timer_before(timer, timer_heap[parent]))
+			break;
+		heap_set(index, timer_heap[parent]);
+		index = parent;
+	}
+	heap_set(index, timer);
+}
+
+static void heap_down(int index)
+{
+	struct lcr_timer *timer = timer_heap[index];
+	int child;
+
+	while ((child = index * 2 + 1) < timer_heap_num) {
+		if (child + 1 < timer_heap_num && timer_before(timer_heap[child + 1], timer_heap[child]))
+			child++;
+		if (!timer_before(timer_heap[child], timer))
+			break;
+		heap_set(index, timer_heap[child]);
+		index = child;
+	}
+	heap_set(index, timer);
+}
+
+/* move timer to its position after its timeout has changed */
+static void heap_update(int index)
+{
+	if (index > 0 && timer_before(timer_heap[index], timer_heap[(index - 1) / 2]))
+		heap_up(index);
+	else
+		heap_down(index);
+}
+
+static void heap_insert(struct lcr_timer *timer)
+{
+	if (timer_heap_num == timer_heap_size) {
+		timer_heap_size = (timer_heap_size) ? timer_heap_size * 2 : 64;
+		timer_heap = (struct lcr_timer **)realloc(timer_heap, timer_heap_size * sizeof(struct lcr_timer *));
+		if (!timer_heap)
+			FATAL("No memory for timer heap of %d timers.\n", timer_heap_size);
+	}
+	heap_set(timer_heap_num++, timer);
+	heap_up(timer->heap_index);
+}
+
+static void heap_remove(struct lcr_timer *timer)
+{
+	int index = timer->heap_index;
+	struct lcr_timer *last;
+
+	last = timer_heap[--timer_heap_num];
+	timer->heap_index = -1;
+	if (last == timer)
+		return;
+	heap_set(index, last);
+	heap_update(index);
+}
 
 int _add_timer(struct lcr_timer *timer, int (*cb)(struct lcr_timer *timer, void *instance, int index), void *instance, int index, const char *func)
 {
@@ -184,46 +353,29 @@ int _add_timer(struct lcr_timer *timer, int (*cb)(struct lcr_timer *timer, void
 		FATAL("timer that is registered in function %s is already in use\n", func);
 	}
 
-#if 0
-	struct lcr_timer *test = timer_first;
-	while(test) {
-		if (test == timer)
-			FATAL("Timer already in list %s\n", func);
-		test = test->next;
-	}
-#endif
-
 	timer->inuse = 1;
 	timer->active = 0;
+	timer->heap_index = -1;
 	timer->timeout.tv_sec = 0;
 	timer->timeout.tv_usec = 0;
 	timer->cb = cb;
 	timer->cb_instance = instance;
 	timer->cb_index = index;
-	timer->next = timer_first;
-	timer_first = timer;
 
 	return 0;
 }
 
 void _del_timer(struct lcr_timer *timer, const char *func)
 {
-	struct lcr_timer **lcr_timerp;
-
-	/* find pointer to timer */
-	lcr_timerp = &timer_first;
-	while(*lcr_timerp) {
-		if (*lcr_timerp == timer)
-			break;
-		lcr_timerp = &((*lcr_timerp)->next);
-	}
-	if (!*lcr_timerp) {
+	if (!timer->inuse) {
 		FATAL("timer deleted in function %s not in list\n", func);
 	}
 
-	/* remove timer from list */
+	/* remove timer from heap */
+	if (timer->active)
+		heap_remove(timer);
+	timer->active = 0;
 	timer->inuse = 0;
-	*lcr_timerp = timer->next;
 }
 
 void schedule_timer(struct lcr_timer *timer, int seconds, int microseconds)
@@ -234,59 +386,51 @@ void schedule_timer(struct lcr_timer *timer, int seconds, int microseconds)
 		FATAL("Timer not added\n");
 	}
 
-	gettimeofday(&current_time, NULL);
+	get_timer_time(&current_time);
 	unsigned long long currentTime = current_time.tv_sec * MICRO_SECONDS + current_time.tv_usec;
 	currentTime += seconds * MICRO_SECONDS + microseconds;
 	timer->timeout.tv_sec = currentTime / MICRO_SECONDS;
 	timer->timeout.tv_usec = currentTime % MICRO_SECONDS;
-	timer->active = 1;
+
+	/* reposition in heap, if already active */
+	if (timer->active)
+		heap_update(timer->heap_index);
+	else {
+		heap_insert(timer);
+		timer->active = 1;
+	}
 }
 
 void unsched_timer(struct lcr_timer *timer)
 {
+	if (timer->active)
+		heap_remove(timer);
 	timer->active = 0;
 }
 
-/* if a timeout is reached, process timer, if not, return timer value for select */
-static struct timeval *nearest_timer(struct timeval *select_timer, int *work)
+/* process all expired timers, return absolute time of nearest timer or NULL */
+static struct timeval *nearest_timer(int *work)
 {
 	struct timeval current;
-	struct timeval *nearest = NULL;
-	struct lcr_timer *lcr_timer, *lcr_nearest = NULL;
-
-	/* find nearest timer, or NULL, if no timer active */
-	lcr_timer = timer_first;
-	while(lcr_timer) {
-		if (lcr_timer->active && (!nearest || TIME_SMALLER(&lcr_timer->timeout, nearest))) {
-			nearest = &lcr_timer->timeout;
-			lcr_nearest = lcr_timer;
-		}
-		lcr_timer = lcr_timer->next;
-	}
-
-	select_timer->tv_sec = 0;
-	select_timer->tv_usec = 0;
+	struct lcr_timer *lcr_timer;
 
-	if (!nearest)
+	if (!timer_heap_num)
 		return NULL; /* wait until infinity */
 
-	gettimeofday(&current, NULL);
-	unsigned long long nearestTime = nearest->tv_sec * MICRO_SECONDS + nearest->tv_usec;
-	unsigned long long currentTime = current.tv_sec * MICRO_SECONDS + current.tv_usec;
-
-	if (nearestTime > currentTime) {
-		select_timer->tv_sec = (nearestTime - currentTime) / MICRO_SECONDS;
-		select_timer->tv_usec = (nearestTime - currentTime) % MICRO_SECONDS;
-		return select_timer;
-	} else {
-		lcr_nearest->active = 0;
-		(*lcr_nearest->cb)(lcr_nearest, lcr_nearest->cb_instance, lcr_nearest->cb_index);
+	get_timer_time(&current);
+	/* fire all timers that are due now, callbacks may (re)schedule timers */
+	while (timer_heap_num && TIME_SMALLER(&timer_heap[0]->timeout, &current)) {
+		lcr_timer = timer_heap[0];
+		heap_remove(lcr_timer);
+		lcr_timer->active = 0;
+		(*lcr_timer->cb)(lcr_timer, lcr_timer->cb_instance, lcr_timer->cb_index);
 		/* don't wait so we can process the queues, indicate "work=1" */
-		select_timer->tv_sec = 0;
-		select_timer->tv_usec = 0;
 		*work = 1;
-		return select_timer;
 	}
+
+	if (*work || !timer_heap_num)
+		return NULL;
+	return &timer_heap[0]->timeout;
 }
 
 
@@ -9,10 +9,10 @@
         (((left)->tv_sec*MICRO_SECONDS+(left)->tv_usec) <= ((right)->tv_sec*MICRO_SECONDS+(right)->tv_usec))
 
 struct lcr_fd {
-	struct lcr_fd	*next;	/* pointer to next element in list */
 	int		inuse;	/* if in use */
 	int		fd;	/* file descriptior if in use */
-	int		when;	/* select on what event */
+	int		when;	/* select on what event, use update_fd() to change */
+	unsigned int	events;	/* events currently set in epoll, 0 if not in epoll set */
 	int		(*cb)(struct lcr_fd *fd, unsigned int what, void *instance, int index); /* callback */
 	void		*cb_instance;
 	int		cb_index;
@@ -20,16 +20,18 @@ struct lcr_fd {
 
 #define register_fd(a, b, c, d, e) _register_fd(a, b, c, d, e, __func__);
 int _register_fd(struct lcr_fd *fd, int when, int (*cb)(struct lcr_fd *fd, unsigned int what, void *instance, int index), void *instance, int index, const char *func);
+#define update_fd(a, b) _update_fd(a, b, __func__);
+void _update_fd(struct lcr_fd *fd, int when, const char *func);
 #define unregister_fd(a) _unregister_fd(a, __func__);
 void _unregister_fd(struct lcr_fd *fd, const char *func);
 int select_main(int polling, int *global_change, void (*lock)(void), void (*unlock)(void));
 
 
 struct lcr_timer {
-	struct lcr_timer *next;	/* pointer to next element in list */
+	int		heap_index; /* position in timer heap, if active */
 	int		inuse;	/* if in use */
 	int		active;	/* if timer is currently active */
-	struct timeval	timeout; /* timestamp when to timeout */
+	struct timeval	timeout; /* timestamp when to timeout (monotonic clock) */
 	int		(*cb)(struct lcr_timer *timer, void *instance, int index); /* callback */
 	void		*cb_instance;
 	int		cb_index;
@@ -41,6 +43,7 @@ int _add_timer(struct lcr_timer *timer, int (*cb)(struct lcr_timer *timer, void
 void _del_timer(struct lcr_timer *timer, const char *func);
 void schedule_timer(struct lcr_timer *timer, int seconds, int microseconds);
 void unsched_timer(struct lcr_timer *timer);
+void get_timer_time(struct timeval *tv);
 
 
 struct lcr_work {
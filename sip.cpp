@@ -14,10 +14,28 @@
 #include <sofia-sip/su_log.h>
 #include <sofia-sip/sdp.h>
 #include <sofia-sip/sip_header.h>
+#include <sofia-sip/su_glib.h>
+
+/* HOW TO handle SIP events?
+
+Each SIP interface has its own su_root. All roots are created as glib roots
+and their sources are attached to one main context, so the sockets and timers
+of all SIP stacks can be collected at once.
+
+sip_arm() prepares the context and queries the file descriptors and the
+timeout it needs. Each file descriptor is registered in the event loop of
+LCR, the timeout is scheduled as LCR timer. If a file descriptor becomes
+readable or the timer fires, the sip_work is triggered. It checks and
+dispatches the context, so the SIP stacks process their events, and arms the
+context again. The file descriptors are unregistered before the context is
+dispatched and registered again when it is armed, because a SIP stack may
+close a socket and open another one with the same number. Nothing is
+polled, so the main loop can sleep until an event happens.
+
+*/
 
 #undef NUTAG_AUTO100
 
-unsigned char flip[256];
 
 //pthread_mutex_t mutex_msg;
 su_home_t	sip_home[1];
@@ -30,7 +48,17 @@ struct sip_inst {
 	nua_t			*nua;
 };
 
+static GMainContext	*sip_context = NULL;
+static GPollFD		*sip_pollfds = NULL;	/* file descriptors queried from context */
+static struct lcr_fd	*sip_lfds = NULL;	/* registration of each file descriptor */
+static int		sip_pollfds_num = 0, sip_pollfds_size = 0;
+static int		sip_armed = 0;		/* context is prepared and queried */
+static struct lcr_work	sip_work;
+static struct lcr_timer	sip_timer;
+
 static int delete_event(struct lcr_work *work, void *instance, int index);
+static int jitter_timer(struct lcr_timer *timer, void *instance, int index);
+static void sip_dtmf(void *instance, char digit);
 
 /*
  * initialize SIP port
@@ -59,8 +87,21 @@ Psip::Psip(int type, char *portname, struct port_settings *settings, struct inte
 	p_s_b_index = -1;
 	p_s_b_active = 0;
 	p_s_rxpos = 0;
+	p_s_inband_dtmf = interface->inband_dtmf;
+	dtmf_decoder_init(&p_s_dtmf_decoder, sip_dtmf, this);
 	p_s_rtp_tx_action = 0;
 
+	/* jitter buffer */
+	p_s_jitter = NULL;
+	memset(&p_s_jitter_timer, 0, sizeof(p_s_jitter_timer));
+	add_timer(&p_s_jitter_timer, jitter_timer, this, 0);
+	if (interface->rtp_jitter_min) {
+		p_s_jitter = (struct rtp_jitter *)MALLOC(sizeof(struct rtp_jitter));
+		memuse++;
+		p_s_jitter->min = interface->rtp_jitter_min * 8;
+		p_s_jitter->max = interface->rtp_jitter_max * 8;
+	}
+
 	PDEBUG(DEBUG_SIP, "Created new Psip(%s).\n", portname);
 	if (!p_s_sip_inst)
 		FATAL("No SIP instance for interface\n");
@@ -75,8 +116,15 @@ Psip::~Psip()
 	PDEBUG(DEBUG_SIP, "Destroyed SIP process(%s).\n", p_name);
 
 	del_work(&p_s_delete);
+	dtmf_decoder_exit(&p_s_dtmf_decoder);
 
 	rtp_close();
+
+	del_timer(&p_s_jitter_timer);
+	if (p_s_jitter) {
+		FREE(p_s_jitter, sizeof(struct rtp_jitter));
+		memuse--;
+	}
 }
 
 static const char *media_type2name(uint8_t media_type) {
@@ -111,6 +159,23 @@ static void sip_trace_header(class Psip *sip, const char *message, int direction
 		    message);
 }
 
+/* DTMF decoded from received audio */
+static void sip_dtmf(void *instance, char digit)
+{
+	class Psip *psip = (class Psip *)instance;
+	struct lcr_msg *message;
+
+	sip_trace_header(psip, "DTMF", DIRECTION_IN);
+	add_trace("digit", NULL, "%c", digit);
+	add_trace("source", NULL, "inband");
+	end_trace();
+	if (!psip->p_epointlist)
+		return;
+	message = message_create(psip->p_serial, ACTIVE_EPOINT(psip->p_epointlist), PORT_TO_EPOINT, MESSAGE_DTMF);
+	message->param.dtmf = digit;
+	message_put(message);
+}
+
 /*
  * RTP
  */
@@ -156,7 +221,7 @@ static int rtp_decode(class Psip *psip, unsigned char *data, int len)
 	uint8_t *payload;
 	int payload_len;
 	int x_len;
-	unsigned char *from, *to;
+	unsigned char *from;
 	int n;
 
 	if (len < 12) {
@@ -257,14 +322,19 @@ we only support alaw and ulaw!
 
 	n = payload_len;
 	from = payload;
-	to = payload;
 	if (psip->p_echotest) {
 		/* echo rtp data we just received */
 		psip->rtp_send_frame(from, n, (options.law=='a')?PAYLOAD_TYPE_ALAW:PAYLOAD_TYPE_ULAW);
 		return 0;
 	}
-	while(n--)
-		*to++ = flip[*from++];
+	audio_flip(payload, payload, payload_len);
+	if (psip->p_s_jitter) {
+		/* played by jitter buffer */
+		psip->jitter_rx(ntohs(rtph->sequence), ntohl(rtph->timestamp), payload, payload_len);
+		return 0;
+	}
+	if (psip->p_s_inband_dtmf)
+		dtmf_decode(&psip->p_s_dtmf_decoder, payload, payload_len);
 	psip->bridge_tx(payload, payload_len);
 
 	return 0;
@@ -439,6 +509,10 @@ void Psip::rtp_close(void)
 		PDEBUG(DEBUG_SIP, "rtp closed\n");
 		p_s_rtp_is_connected = 0;
 	}
+	if (p_s_jitter) {
+		unsched_timer(&p_s_jitter_timer);
+		p_s_jitter->active = 0;
+	}
 }
 
 /* "to - from" */
@@ -555,13 +629,22 @@ we only support alaw and ulaw!
 /* receive from remote */
 int Psip::bridge_rx(unsigned char *data, int len)
 {
+	int n;
+
 	/* write to rx buffer */
-	while(len--) {
-		p_s_rxdata[p_s_rxpos++] = flip[*data++];
+	while(len) {
+		n = 160 - p_s_rxpos;
+		if (n > len)
+			n = len;
+		memcpy(p_s_rxdata + p_s_rxpos, data, n);
+		p_s_rxpos += n;
+		data += n;
+		len -= n;
 		if (p_s_rxpos == 160) {
 			p_s_rxpos = 0;
 
 			/* transmit data via rtp */
+			audio_flip(p_s_rxdata, p_s_rxdata, 160);
 			rtp_send_frame(p_s_rxdata, 160, (options.law=='a')?PAYLOAD_TYPE_ALAW:PAYLOAD_TYPE_ULAW);
 		}
 	}
@@ -569,6 +652,203 @@ int Psip::bridge_rx(unsigned char *data, int len)
 	return 0;
 }
 
+/*
+ * jitter buffer
+ *
+ * the received frames are stored at the position of their timestamp. a
+ * clock plays one frame every 20 ms, delayed by the minimum delay that is
+ * configured for the interface. if a frame is received too late, the delay
+ * is increased by inserting concealed frames. if more is buffered than
+ * required during a whole window, the surplus is skipped. this way the
+ * delay follows the jitter and does not grow if the remote clock is faster
+ * than ours.
+ */
+
+#define JITTER_WINDOW	50	/* ticks to find out the surplus */
+
+/* sample clock (8000 Hz) */
+static unsigned long long jitter_clock(void)
+{
+	struct timeval current_time;
+
+	get_timer_time(&current_time);
+	return (unsigned long long)current_time.tv_sec * 8000 + current_time.tv_usec * 8 / 1000;
+}
+
+static int jitter_timer(struct lcr_timer *timer, void *instance, int index)
+{
+	class Psip *psip = (class Psip *)instance;
+
+	psip->jitter_play();
+
+	return 0;
+}
+
+/* store received frame */
+void Psip::jitter_rx(uint16_t seq, uint32_t ts, unsigned char *data, int len)
+{
+	struct rtp_jitter *jb = p_s_jitter;
+	int16_t seq_diff;
+	int32_t offset, delay;
+	uint32_t pos;
+	int i;
+
+	if (len > JITTER_SIZE / 2)
+		return;
+
+	if (!jb->active) {
+		start:
+		/* start playing after minimum delay */
+		jb->active = 1;
+		jb->play_ts = ts - jb->min;
+		jb->end_ts = ts;
+		jb->last_seq = seq - 1;
+		jb->stretch = 0;
+		jb->concealed = 0;
+		jb->min_depth = JITTER_SIZE;
+		jb->window = 0;
+		memset(jb->valid, 0, sizeof(jb->valid));
+		memset(jb->last, (options.law=='a')?0x2a:0xff, sizeof(jb->last));
+		jb->next = jitter_clock() + JITTER_FRAME;
+		schedule_timer(&p_s_jitter_timer, 0, JITTER_FRAME * 125);
+	}
+
+	/* sequence */
+	seq_diff = (int16_t)(seq - jb->last_seq);
+	if (seq_diff == 0)
+		return; /* duplicate */
+	if (seq_diff < 0)
+		jb->reordered++;
+	else
+		jb->last_seq = seq;
+
+	/* position */
+	offset = (int32_t)(ts - jb->play_ts);
+	if (offset + len <= 0) {
+		/* already played, so increase delay by the time it was late */
+		jb->late++;
+		delay = (int32_t)(jb->end_ts - jb->play_ts) + jb->stretch;
+		i = (-offset + JITTER_FRAME) / JITTER_FRAME * JITTER_FRAME;
+		if (delay + i > jb->max)
+			i = jb->max - delay;
+		if (i > jb->stretch)
+			jb->stretch = i;
+		return;
+	}
+	if (offset + len > JITTER_SIZE) {
+		/* timestamp jumps, restart stream */
+		PDEBUG(DEBUG_SIP, "RTP timestamp jumps by %d samples, restarting jitter buffer\n", offset);
+		goto start;
+	}
+	if (offset < 0) {
+		/* partly played */
+		data -= offset;
+		len += offset;
+		ts -= offset;
+	}
+
+	/* store */
+	for (i = 0; i < len; i++) {
+		pos = (ts + i) & JITTER_MASK;
+		jb->samples[pos] = data[i];
+		jb->valid[pos >> 3] |= 1 << (pos & 7);
+	}
+	if ((int32_t)(ts + len - jb->end_ts) > 0)
+		jb->end_ts = ts + len;
+}
+
+/* play one frame at each clock tick */
+void Psip::jitter_play(void)
+{
+	struct rtp_jitter *jb = p_s_jitter;
+	unsigned long long now = jitter_clock();
+	unsigned char frame[JITTER_FRAME];
+	int32_t depth, skip;
+	uint32_t pos;
+	int i, missing;
+
+	if (!jb || !jb->active)
+		return;
+
+	while (jb->next <= now) {
+		jb->next += JITTER_FRAME;
+
+		depth = (int32_t)(jb->end_ts - jb->play_ts);
+
+		/* nothing received for a while (hold, end of stream), stop */
+		if (depth < -jb->max) {
+			jb->active = 0;
+			return;
+		}
+
+		/* skip what is buffered more than required during the window,
+		 * or more than the maximum delay */
+		skip = 0;
+		if (depth < jb->min_depth)
+			jb->min_depth = depth;
+		if (++jb->window == JITTER_WINDOW) {
+			skip = jb->min_depth - ((jb->min > JITTER_FRAME) ? jb->min : JITTER_FRAME);
+			skip /= 2;
+			jb->min_depth = JITTER_SIZE;
+			jb->window = 0;
+		}
+		if (depth - skip > jb->max + JITTER_FRAME)
+			skip = depth - jb->max;
+		if (skip > 0 && !jb->stretch) {
+			for (i = 0; i < skip; i++) {
+				pos = (jb->play_ts + i) & JITTER_MASK;
+				jb->valid[pos >> 3] &= ~(1 << (pos & 7));
+			}
+			jb->play_ts += skip;
+			depth -= skip;
+		}
+
+		/* conceal: repeat last frame once, then silence */
+		if (jb->concealed)
+			memset(jb->last, (options.law=='a')?0x2a:0xff, sizeof(jb->last));
+
+		if (jb->stretch > 0) {
+			/* increase delay by playing a concealed frame */
+			memcpy(frame, jb->last, sizeof(frame));
+			jb->stretch -= JITTER_FRAME;
+			jb->concealed++;
+		} else {
+			/* get frame */
+			missing = 0;
+			for (i = 0; i < JITTER_FRAME; i++) {
+				pos = (jb->play_ts + i) & JITTER_MASK;
+				if ((jb->valid[pos >> 3] & (1 << (pos & 7)))) {
+					frame[i] = jb->samples[pos];
+					jb->valid[pos >> 3] &= ~(1 << (pos & 7));
+				} else {
+					frame[i] = jb->last[i];
+					missing = 1;
+				}
+			}
+			jb->play_ts += JITTER_FRAME;
+
+			if (missing) {
+				/* only count, if there is data after the gap */
+				if (depth > JITTER_FRAME)
+					jb->lost++;
+				jb->concealed++;
+			} else
+				jb->concealed = 0;
+		}
+		memcpy(jb->last, frame, sizeof(frame));
+
+		if (p_s_inband_dtmf)
+			dtmf_decode(&p_s_dtmf_decoder, frame, JITTER_FRAME);
+		bridge_tx(frame, JITTER_FRAME);
+	}
+
+	/* we are late more than a few frames, don't catch up */
+	if (jb->next + JITTER_FRAME * 4 < now)
+		jb->next = now + JITTER_FRAME;
+
+	schedule_timer(&p_s_jitter_timer, 0, (jb->next - now) * 125);
+}
+
 /* taken from freeswitch */
 /* map sip responses to QSIG cause codes ala RFC4497 section 8.4.4 */
 static int status2cause(int status)
@@ -1823,6 +2103,125 @@ void Psip::rtp_shutdown(void)
 	trigger_work(&p_s_delete);
 }
 
+/* remove all file descriptors from event loop */
+static void sip_disarm(void)
+{
+	int i;
+
+	for (i = 0; i < sip_pollfds_num; i++) {
+		if (sip_lfds[i].inuse)
+			unregister_fd(&sip_lfds[i]);
+	}
+	sip_pollfds_num = 0;
+}
+
+static int sip_fd_cb(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	int i;
+
+	/* an fd may be queried twice, but it is registered only once */
+	for (i = index; i < sip_pollfds_num; i++) {
+		if (sip_pollfds[i].fd != fd->fd)
+			continue;
+		if ((what & LCR_FD_READ))
+			sip_pollfds[i].revents |= sip_pollfds[i].events & (G_IO_IN | G_IO_HUP | G_IO_ERR);
+		if ((what & LCR_FD_WRITE))
+			sip_pollfds[i].revents |= sip_pollfds[i].events & G_IO_OUT;
+		if ((what & LCR_FD_EXCEPT))
+			sip_pollfds[i].revents |= sip_pollfds[i].events & G_IO_PRI;
+	}
+	trigger_work(&sip_work);
+
+	return 0;
+}
+
+static int gio2when(gushort events)
+{
+	int when = 0;
+
+	if ((events & (G_IO_IN | G_IO_HUP | G_IO_ERR)))
+		when |= LCR_FD_READ;
+	if ((events & G_IO_OUT))
+		when |= LCR_FD_WRITE;
+	if ((events & G_IO_PRI))
+		when |= LCR_FD_EXCEPT;
+	return when;
+}
+
+/* prepare context and register its file descriptors and timeout */
+static void sip_arm(void)
+{
+	gint priority, timeout, num;
+	int i, j, when;
+
+	g_main_context_prepare(sip_context, &priority);
+	num = g_main_context_query(sip_context, priority, &timeout, sip_pollfds, sip_pollfds_size);
+	/* the array may be shifted or reordered, so all file descriptors are
+	 * registered again */
+	sip_disarm();
+	if (num > sip_pollfds_size) {
+		if (sip_pollfds)
+			FREE(sip_pollfds, sip_pollfds_size * sizeof(GPollFD));
+		if (sip_lfds)
+			FREE(sip_lfds, sip_pollfds_size * sizeof(struct lcr_fd));
+		sip_pollfds_size = num + 4;
+		sip_pollfds = (GPollFD *) MALLOC(sip_pollfds_size * sizeof(GPollFD));
+		sip_lfds = (struct lcr_fd *) MALLOC(sip_pollfds_size * sizeof(struct lcr_fd));
+		num = g_main_context_query(sip_context, priority, &timeout, sip_pollfds, sip_pollfds_size);
+	}
+
+	sip_pollfds_num = num;
+
+	for (i = 0; i < num; i++) {
+		sip_pollfds[i].revents = 0;
+		/* an fd that is queried twice is registered at first position */
+		when = 0;
+		for (j = 0; j < num; j++) {
+			if (sip_pollfds[j].fd == sip_pollfds[i].fd) {
+				if (j < i)
+					break;
+				when |= gio2when(sip_pollfds[j].events);
+			}
+		}
+		if (j < i)
+			continue;
+		sip_lfds[i].fd = sip_pollfds[i].fd;
+		register_fd(&sip_lfds[i], when, sip_fd_cb, NULL, i);
+	}
+
+	sip_armed = 1;
+
+	if (timeout > 0)
+		schedule_timer(&sip_timer, timeout / 1000, (timeout % 1000) * 1000);
+	else
+		unsched_timer(&sip_timer);
+	if (timeout == 0)
+		trigger_work(&sip_work);
+}
+
+/* dispatch events of all SIP stacks */
+static int sip_work_cb(struct lcr_work *work, void *instance, int index)
+{
+	int dispatch = 0;
+
+	if (sip_armed)
+		dispatch = g_main_context_check(sip_context, G_MAXINT, sip_pollfds, sip_pollfds_num);
+	/* sockets may be closed and their numbers reused while dispatching, so
+	 * they are removed from the event loop before */
+	sip_disarm();
+	if (dispatch)
+		g_main_context_dispatch(sip_context);
+	sip_armed = 0;
+	sip_arm();
+
+	return 0;
+}
+
+static int sip_timer_cb(struct lcr_timer *timer, void *instance, int index)
+{
+	return sip_work_cb(&sip_work, NULL, 0);
+}
+
 int sip_init_inst(struct interface *interface)
 {
 	struct sip_inst *inst = (struct sip_inst *) MALLOC(sizeof(*inst));
@@ -1834,7 +2233,7 @@ int sip_init_inst(struct interface *interface)
 	SCPY(inst->remote_peer, interface->sip_remote_peer);
 
 	/* init root object */
-	inst->root = su_root_create(inst);
+	inst->root = su_glib_root_create(inst);
 	if (!inst->root) {
 		PERROR("Failed to create SIP root\n");
 		sip_exit_inst(interface);
@@ -1867,6 +2266,10 @@ int sip_init_inst(struct interface *interface)
 		NUTAG_AUTOANSWER(0),
 		TAG_NULL());
 
+	/* attach to event loop */
+	g_source_attach(su_glib_root_gsource(inst->root), sip_context);
+	trigger_work(&sip_work);
+
 	PDEBUG(DEBUG_SIP, "SIP interface created (inst=%p)\n", inst);
 
 	return 0;
@@ -1878,6 +2281,9 @@ void sip_exit_inst(struct interface *interface)
 
 	if (!inst)
 		return;
+	/* the sockets are closed with the root, so they are armed again */
+	sip_disarm();
+	trigger_work(&sip_work);
 	if (inst->root)
 		su_root_destroy(inst->root);
 	if (inst->nua) {
@@ -1895,21 +2301,24 @@ extern su_log_t nua_log[];
 
 int sip_init(void)
 {
-	int i;
-
 	/* init SOFIA lib */
 	su_init();
 	su_home_init(sip_home);
 
+	/* all SIP stacks are dispatched by one context */
+	sip_context = g_main_context_new();
+	g_main_context_acquire(sip_context);
+	memset(&sip_work, 0, sizeof(sip_work));
+	add_work(&sip_work, sip_work_cb, NULL, 0);
+	memset(&sip_timer, 0, sizeof(sip_timer));
+	add_timer(&sip_timer, sip_timer_cb, NULL, 0);
+
 	if (options.deb & DEBUG_SIP) {
 		su_log_set_level(su_log_default, 9);
 		su_log_set_level(nua_log, 9);
 		//su_log_set_level(soa_log, 9);
 	}
 
-	for (i = 0; i < 256; i++)
-		flip[i] = ((i & 1) << 7) + ((i & 2) << 5) + ((i & 4) << 3) + ((i & 8) << 1) + ((i & 16) >> 1) + ((i & 32) >> 3) + ((i & 64) >> 5) + ((i & 128) >> 7);
-
 	PDEBUG(DEBUG_SIP, "SIP globals initialized\n");
 
 	return 0;
@@ -1917,26 +2326,28 @@ int sip_init(void)
 
 void sip_exit(void)
 {
+	sip_disarm();
+	if (sip_pollfds)
+		FREE(sip_pollfds, sip_pollfds_size * sizeof(GPollFD));
+	if (sip_lfds)
+		FREE(sip_lfds, sip_pollfds_size * sizeof(struct lcr_fd));
+	sip_pollfds = NULL;
+	sip_lfds = NULL;
+	sip_pollfds_size = 0;
+	del_work(&sip_work);
+	del_timer(&sip_timer);
+	if (sip_context) {
+		g_main_context_release(sip_context);
+		g_main_context_unref(sip_context);
+		sip_context = NULL;
+	}
+
 	su_home_deinit(sip_home);
 	su_deinit();
 
 	PDEBUG(DEBUG_SIP, "SIP globals de-initialized\n");
 }
 
-void sip_handle(void)
-{
-	struct interface *interface = interface_first;
-	struct sip_inst *inst;
-
-	while (interface) {
-		if (interface->sip_inst) {
-			inst = (struct sip_inst *) interface->sip_inst;
-			su_root_step(inst->root, 0);
-		}
-		interface = interface->next;
-	}
-}
-
 /* deletes when back in event loop */
 static int delete_event(struct lcr_work *work, void *instance, int index)
 {
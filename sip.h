@@ -11,6 +11,34 @@
 
 #include <sofia-sip/nua.h>
 
+/* RTP jitter buffer
+ * received samples are stored at the position of their timestamp and
+ * played by a clock, so reordered frames are sorted and missing frames
+ * are concealed.
+ */
+#define JITTER_SIZE	8192	/* samples, must be a binary border */
+#define JITTER_MASK	(JITTER_SIZE - 1)
+#define JITTER_FRAME	160	/* samples played at each clock tick */
+
+struct rtp_jitter {
+	int		active;		/* stream is played */
+	int		min, max;	/* limits of delay (samples) */
+	uint32_t	play_ts;	/* timestamp of next sample to play */
+	uint32_t	end_ts;		/* timestamp after latest received sample */
+	uint16_t	last_seq;	/* highest sequence number received */
+	int		stretch;	/* samples to insert, to increase delay */
+	int		min_depth;	/* lowest delay during window */
+	int		window;		/* ticks in current window */
+	int		concealed;	/* number of frames concealed in a row */
+	unsigned long long next;	/* sample clock of next tick */
+	unsigned char	samples[JITTER_SIZE];
+	unsigned char	valid[JITTER_SIZE / 8]; /* bit is set, if sample is received */
+	unsigned char	last[JITTER_FRAME]; /* last frame played, for concealment */
+	unsigned int	late;		/* frames received after they were played */
+	unsigned int	lost;		/* frames concealed */
+	unsigned int	reordered;	/* frames received out of order */
+};
+
 /* SIP port class */
 class Psip : public Port
 {
@@ -55,12 +83,18 @@ class Psip : public Port
 	int rtp_connect(void);
 	void rtp_close(void);
 	int rtp_send_frame(unsigned char *data, unsigned int len, uint8_t payload_type);
+	struct rtp_jitter *p_s_jitter; /* jitter buffer, if enabled for interface */
+	struct lcr_timer p_s_jitter_timer; /* playout clock */
+	void jitter_rx(uint16_t seq, uint32_t ts, unsigned char *data, int len);
+	void jitter_play(void);
 	int p_s_b_sock; /* SIP bchannel socket */
 	struct lcr_fd p_s_b_fd; /* event node */
 	int p_s_b_index; /* SIP bchannel socket index to use */
 	int p_s_b_active; /* SIP bchannel socket is activated */
 	unsigned char p_s_rxdata[160]; /* receive audio buffer */
 	int p_s_rxpos; /* position in audio buffer 0..159 */
+	int p_s_inband_dtmf; /* decode DTMF from received audio */
+	struct dtmf_decoder p_s_dtmf_decoder;
 	int bridge_rx(unsigned char *data, int len);
 	int parse_sdp(sip_t const *sip, unsigned int *ip, unsigned short *port, uint8_t *payload_types, int *media_types, int *payloads, int max_payloads);
 	void rtp_shutdown(void);
@@ -71,4 +105,3 @@ int sip_init_inst(struct interface *interface);
 void sip_exit_inst(struct interface *interface);
 int sip_init(void);
 void sip_exit(void);
-void sip_handle(void);
@@ -167,6 +167,14 @@ void free_connection(struct admin_list *admin)
 		memuse--;
 		response = (struct admin_queue *)temp;
 	}
+	if (admin->in) {
+		FREE(admin->in, ADMIN_BUFFER);
+		memuse--;
+	}
+	if (admin->out) {
+		FREE(admin->out, 0);
+		memuse--;
+	}
 
 	adminp = &admin_first;
 	while(*adminp) {
@@ -241,6 +249,35 @@ int admin_interface(struct admin_queue **responsep)
 }
 
 
+/*
+ * reload tones
+ */
+int admin_tones(struct admin_queue **responsep)
+{
+	struct admin_queue	*response;	/* response pointer */
+	char			err_txt[256] = "";
+	int			err;
+
+	/* tones are loaded in background */
+	err = reload_tones(err_txt, sizeof(err_txt));
+
+	/* create state response */
+	response = (struct admin_queue *)MALLOC(sizeof(struct admin_queue)+sizeof(admin_message));
+	memuse++;
+	response->num = 1;
+	/* message */
+	response->am[0].message = ADMIN_RESPONSE_CMD_TONES;
+	/* error */
+	response->am[0].u.x.error = err;
+	/* message */
+	SCPY(response->am[0].u.x.message, err_txt);
+	/* attach to response chain */
+	*responsep = response;
+	responsep = &response->next;
+	return(0);
+}
+
+
 /*
  * do route reload
  */
@@ -608,7 +645,7 @@ void admin_call_response(int adminid, int message, const char *connected, int ca
 	/* attach to response chain */
 	*responsep = response;
 	responsep = &response->next;
-	admin->fd.when |= LCR_FD_WRITE;
+	update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 }
 
 
@@ -645,6 +682,21 @@ int admin_message_to_lcr(struct admin_msg *msg, struct admin_list *admin)
 		}
 		/* set remote socket instance */
 		SCPY(admin->remote_name, msg->param.hello.application);
+		/* confirm compact protocol, this is the last admin message */
+		if (msg->param.hello.protocol == ADMIN_PROTOCOL_COMPACT) {
+			union parameter param;
+
+			memset(&param, 0, sizeof(param));
+			SCPY(param.hello.application, admin->remote_name);
+			param.hello.protocol = ADMIN_PROTOCOL_COMPACT;
+			admin_message_from_lcr(admin->sock, 0, MESSAGE_HELLO, &param);
+			admin->in = (unsigned char *)MALLOC(ADMIN_BUFFER);
+			memuse++;
+			admin->out = (unsigned char *)MALLOC(ADMIN_BUFFER);
+			memuse++;
+			admin->out_size = ADMIN_BUFFER;
+			admin->compact = 1;
+		}
 		start_trace(-1,
 			NULL,
 			NULL,
@@ -654,6 +706,8 @@ int admin_message_to_lcr(struct admin_msg *msg, struct admin_list *admin)
 			0,
 			"REMOTE APP registers");
 		add_trace("app", "name", "%s", admin->remote_name);
+		if (admin->compact)
+			add_trace("app", "protocol", "compact");
 		end_trace();
 		return(0);
 	}
@@ -799,6 +853,27 @@ int admin_message_from_lcr(int remote_id, unsigned int ref, int message_type, un
 	if (!admin)
 		return(-1);
 
+	/* append frame to output buffer */
+	if (admin->compact) {
+		if (admin->out_len + ADMIN_FRAME_MAX > admin->out_size) {
+			/* remove frames that are sent */
+			memmove(admin->out, admin->out + admin->out_off, admin->out_len - admin->out_off);
+			admin->out_len -= admin->out_off;
+			admin->out_off = 0;
+		}
+		if (admin->out_len + ADMIN_FRAME_MAX > admin->out_size) {
+			/* application does not read, so buffer must grow */
+			unsigned char *out = (unsigned char *)MALLOC(admin->out_size * 2);
+			memcpy(out, admin->out, admin->out_len);
+			FREE(admin->out, 0);
+			admin->out = out;
+			admin->out_size *= 2;
+		}
+		admin->out_len += admin_frame_put(admin->out + admin->out_len, message_type, ref, param);
+		update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
+		return(0);
+	}
+
 	/* seek to end of response list */
 	responsep = &admin->response;
 	while(*responsep) {
@@ -815,7 +890,7 @@ int admin_message_from_lcr(int remote_id, unsigned int ref, int message_type, un
 	(*responsep)->am[0].u.msg.type = message_type;
 	(*responsep)->am[0].u.msg.ref = ref;
 	memcpy(&(*responsep)->am[0].u.msg.param, param, sizeof(union parameter));
-	admin->fd.when |= LCR_FD_WRITE;
+	update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 	return(0);
 }
 
@@ -833,6 +908,9 @@ int admin_state(struct admin_queue **responsep)
 	struct mISDNport	*mISDNport;
 	struct select_channel	*selchannel;
 	int			anybusy;
+#endif
+#ifdef WITH_SIP
+	class Psip		*psip;
 #endif
 	struct interface	*interface;
 	struct interface_port	*ifport;
@@ -904,6 +982,26 @@ int admin_state(struct admin_queue **responsep)
 		port = port->next;
 	}
 	response->am[0].u.s.ports = i;
+	/* statistics */
+	response->am[0].u.s.msg_pool_hits = message_pool_hits;
+	response->am[0].u.s.msg_pool_allocs = message_pool_allocs;
+	response->am[0].u.s.record_dropped = record_dropped;
+	response->am[0].u.s.record_late = record_late;
+	response->am[0].u.s.cdr_depth = cdr_depth;
+	response->am[0].u.s.cdr_depth_max = cdr_depth_max;
+	response->am[0].u.s.cdr_latency = cdr_latency;
+	response->am[0].u.s.cdr_latency_max = cdr_latency_max;
+	response->am[0].u.s.cdr_waits = cdr_waits;
+	response->am[0].u.s.trace_lost = trace_lost;
+#ifdef WITH_CRYPT
+	response->am[0].u.s.key_pool_hits = keyengine_pool_hits;
+	response->am[0].u.s.key_pool_misses = keyengine_pool_misses;
+	response->am[0].u.s.key_latency = keyengine_latency;
+	response->am[0].u.s.key_latency_max = keyengine_latency_max;
+#endif
+#ifdef WITH_MISDN
+	response->am[0].u.s.l3id_lookups = l3id_lookup_rate();
+#endif
 	/* attach to response chain */
 	*responsep = response;
 	responsep = &response->next;
@@ -1204,6 +1302,20 @@ int admin_state(struct admin_queue **responsep)
 			response->am[num].u.p.isdn_hold = pdss1->p_m_hold;
 			response->am[num].u.p.isdn_ces = pdss1->p_m_d_ces;
 		}
+#endif
+#ifdef WITH_SIP
+		/* jitter buffer */
+		if ((port->p_type & PORT_CLASS_MASK) == PORT_CLASS_SIP) {
+			psip = (class Psip *)port;
+			if (psip->p_s_jitter) {
+				response->am[num].u.p.jitter = 1;
+				if (psip->p_s_jitter->active)
+					response->am[num].u.p.jitter_depth = (int32_t)(psip->p_s_jitter->end_ts - psip->p_s_jitter->play_ts) / 8;
+				response->am[num].u.p.jitter_late = psip->p_s_jitter->late;
+				response->am[num].u.p.jitter_lost = psip->p_s_jitter->lost;
+				response->am[num].u.p.jitter_reordered = psip->p_s_jitter->reordered;
+			}
+		}
 #endif
 		/* */
 		port = port->next;
@@ -1252,9 +1364,35 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 	struct admin_list *admin = (struct admin_list *)instance;
 	void			*temp;
 	struct admin_message	msg;
+	struct admin_msg	frame;
 	int			len;
+	unsigned int		off;
 	struct Endpoint		*epoint;
 
+	if ((what & LCR_FD_READ) && admin->compact) {
+		/* read frames, as many as available */
+		len = read(admin->sock, admin->in + admin->in_len, ADMIN_BUFFER - admin->in_len);
+		if (len < 0)
+			goto brokenpipe;
+		if (len == 0)
+			goto end;
+		admin->in_len += len;
+		off = 0;
+		while ((len = admin_frame_get(admin->in + off, admin->in_len - off, &frame.type, &frame.ref, &frame.param)) > 0) {
+			off += len;
+			if (admin_message_to_lcr(&frame, admin) < 0) {
+				PERROR("Failed to deliver message for socket %d.\n", admin->sock);
+				goto end;
+			}
+		}
+		if (len < 0) {
+			PERROR("Invalid frame on socket %d.\n", admin->sock);
+			goto end;
+		}
+		/* keep incomplete frame */
+		memmove(admin->in, admin->in + off, admin->in_len - off);
+		admin->in_len -= off;
+	} else
 	if ((what & LCR_FD_READ)) {
 		/* read command */
 		len = read(admin->sock, &msg, sizeof(msg));
@@ -1291,7 +1429,7 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				PERROR("Failed to create dial response for socket %d.\n", admin->sock);
 				goto response_error;
 			}
-			admin->fd.when |= LCR_FD_WRITE;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 			break;
 
 			case ADMIN_REQUEST_CMD_ROUTE:
@@ -1299,7 +1437,15 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				PERROR("Failed to create dial response for socket %d.\n", admin->sock);
 				goto response_error;
 			}
-			admin->fd.when |= LCR_FD_WRITE;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
+			break;
+
+			case ADMIN_REQUEST_CMD_TONES:
+			if (admin_tones(&admin->response) < 0) {
+				PERROR("Failed to create tones response for socket %d.\n", admin->sock);
+				goto response_error;
+			}
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 			break;
 
 			case ADMIN_REQUEST_CMD_DIAL:
@@ -1307,7 +1453,7 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				PERROR("Failed to create dial response for socket %d.\n", admin->sock);
 				goto response_error;
 			}
-			admin->fd.when |= LCR_FD_WRITE;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 			break;
 
 			case ADMIN_REQUEST_CMD_RELEASE:
@@ -1315,7 +1461,7 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				PERROR("Failed to create release response for socket %d.\n", admin->sock);
 				goto response_error;
 			}
-			admin->fd.when |= LCR_FD_WRITE;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 			break;
 
 			case ADMIN_REQUEST_STATE:
@@ -1323,7 +1469,7 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				PERROR("Failed to create state response for socket %d.\n", admin->sock);
 				goto response_error;
 			}
-			admin->fd.when |= LCR_FD_WRITE;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 			break;
 
 			case ADMIN_TRACE_REQUEST:
@@ -1331,7 +1477,7 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				PERROR("Failed to create trace response for socket %d.\n", admin->sock);
 				goto response_error;
 			}
-			admin->fd.when |= LCR_FD_WRITE;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 			break;
 
 			case ADMIN_REQUEST_CMD_BLOCK:
@@ -1339,7 +1485,7 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				PERROR("Failed to create block response for socket %d.\n", admin->sock);
 				goto response_error;
 			}
-			admin->fd.when |= LCR_FD_WRITE;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 			break;
 
 			case ADMIN_MESSAGE:
@@ -1382,7 +1528,18 @@ int admin_handle_con(struct lcr_fd *fd, unsigned int what, void *instance, int i
 				memuse--;
 			}
 		} else
-			admin->fd.when &= ~LCR_FD_WRITE;
+		if (admin->out_off < admin->out_len) {
+			/* all frames are written at once */
+			len = write(admin->sock, admin->out + admin->out_off, admin->out_len - admin->out_off);
+			if (len < 0)
+				goto brokenpipe;
+			if (len == 0)
+				goto end;
+			admin->out_off += len;
+			if (admin->out_off == admin->out_len)
+				admin->out_off = admin->out_len = 0;
+		} else
+			update_fd(&admin->fd, admin->fd.when & ~LCR_FD_WRITE);
 	}
 
 	return 0;
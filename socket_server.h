@@ -27,6 +27,11 @@ struct admin_list {
 	struct admin_trace_req trace; /* stores trace, if detail != 0 */
 	unsigned int epointid;
 	struct admin_queue *response;
+	int compact; /* remote application uses frames (ADMIN_PROTOCOL_COMPACT) */
+	unsigned char *in; /* received frames, ADMIN_BUFFER bytes */
+	unsigned int in_len;
+	unsigned char *out; /* frames to be sent, after the response queue */
+	unsigned int out_len, out_off, out_size;
 };
 
 extern struct admin_list *admin_first;
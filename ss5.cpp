@@ -374,6 +374,7 @@ Pss5::Pss5(int type, struct mISDNport *mISDNport, char *portname, struct port_se
 Pss5::~Pss5()
 {
 	del_work(&p_m_s_queue);
+	ss5_decode_cancel(this);
 }
 
 
@@ -440,32 +441,47 @@ void Pss5::_new_ss5_signal(int signal, const char *func, int line)
  * signalling receiver
  *
  * this function will be called for every audio received.
+ * each full window is queued to the decoder, which decodes the windows of
+ * all lines at once and calls inband_decoded() with the result.
  */
+static void ss5_decoded(void *instance, const long long *power, int span)
+{
+	class Pss5 *ss5 = (class Pss5 *)instance;
+
+	ss5->inband_decoded(ss5_digit(power, span));
+}
+
 void Pss5::inband_receive(unsigned char *buffer, int len)
 {
 	int count = 0, tocopy, space;
-	char digit;
-
-	again:
-	/* how much to copy ? */
-	tocopy = len - count;
-	space = SS5_DECODER_NPOINTS - p_m_s_decoder_count;
-	if (space < 0)
-		FATAL("p_m_s_decoder_count overflows\n");
-	if (space < tocopy)
-		tocopy = space;
-	/* copy an count */
-	memcpy(p_m_s_decoder_buffer+p_m_s_decoder_count, buffer+count, tocopy);
-	p_m_s_decoder_count += tocopy;
-	count += tocopy;
-	/* decoder buffer not completely filled ? */
-	if (tocopy < space)
-		return;
 
-	/* decode one frame */
-	digit = ss5_decode(p_m_s_decoder_buffer, SS5_DECODER_NPOINTS);
-	p_m_s_decoder_count = 0;
+	while (count < len) {
+		/* how much to copy ? */
+		tocopy = len - count;
+		space = SS5_DECODER_NPOINTS - p_m_s_decoder_count;
+		if (space < 0)
+			FATAL("p_m_s_decoder_count overflows\n");
+		if (space < tocopy)
+			tocopy = space;
+		/* copy an count */
+		memcpy(p_m_s_decoder_buffer+p_m_s_decoder_count, buffer+count, tocopy);
+		p_m_s_decoder_count += tocopy;
+		count += tocopy;
+		/* decoder buffer not completely filled ? */
+		if (tocopy < space)
+			return;
+
+		/* decode one frame */
+		ss5_decode_queue(p_m_s_decoder_buffer, ss5_decoded, this);
+		p_m_s_decoder_count = 0;
+	}
+}
 
+/*
+ * process signal of one decoded window
+ */
+void Pss5::inband_decoded(char digit)
+{
 #ifdef DEBUG_DETECT
 	if (p_m_s_last_digit != digit && digit != ' ')
 		PDEBUG(DEBUG_SS5, "%s: detecting signal '%c' start (state=%s signal=%s)\n", p_name, digit, ss5_state_name[p_m_s_state], ss5_signal_name[p_m_s_signal]);
@@ -950,10 +966,6 @@ void Pss5::inband_receive(unsigned char *buffer, int len)
 			pulse_ind(0);
 		break;
 	}
-
-	/* something more to decode ? */
-	if (count != len)
-		goto again;
 }
 
 
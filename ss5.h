@@ -50,6 +50,7 @@ class Pss5 : public PmISDN
 	void _new_ss5_state(int state, const char *func, int line);
 	void _new_ss5_signal(int signal, const char *func, int line);
 	void inband_receive(unsigned char *buffer, int len);
+	void inband_decoded(char digit);
 	int inband_send(unsigned char *buffer, int len);
 	int inband_dial_mf(unsigned char *buffer, int len, int count);
 	int inband_dial_pulse(unsigned char *buffer, int len, int count);
@@ -23,15 +23,13 @@
 #define NOISE_MIN_DB	(TONE_MIN_DB / 2) /* noise must be higher than the minimum of two tones */
 #define SNR		1.3	/* noise may not exceed signal by that factor */
 
-/* For DTMF recognition:
- * 2 * cos(2 * PI * k / N) precalculated for all k
- */
-static signed long long cos2pik[NCOEFF] =
-{
-	/* k = 2*cos(2*PI*f/8000), k << 15 
-	 * 700, 900, 1100, 1300, 1500, 1700, 2400, 2600 */
-	55879, 49834, 42562, 34242, 25080, 15299, -20252, -29753
-};
+/* frequencies to be analyzed */
+static const double ss5_frequency[NCOEFF] =
+	{ 700, 900, 1100, 1300, 1500, 1700, 2400, 2600 };
+
+static struct goertzel_tones ss5_tones;
+static struct goertzel_batch ss5_batch; /* windows of all SS5 lines */
+static int ss5_tones_init = 0;
 
 /* detection matrix for two frequencies */
 static char decode_two[8][8] =
@@ -48,17 +46,180 @@ static char decode_two[8][8] =
 
 static char decode_one[8] =
 	{' ', ' ', ' ', ' ', ' ', ' ', 'A', 'B'}; /* A = 2400, B = 2600 */
+static void ss5_decode_init(void)
+{
+	if (ss5_tones_init)
+		return;
+	goertzel_tones(&ss5_tones, ss5_frequency, NCOEFF, SS5_DECODER_NPOINTS);
+	/* windows below minimum noise are not filtered, see ss5_digit() */
+	goertzel_batch_init(&ss5_batch, &ss5_tones, (int)ceil(NOISE_MIN_DB * 65536.0));
+	ss5_tones_init = 1;
+}
+
+/* sqrt(a) + sqrt(b) > m, without square root */
+static int sum_above(double a, double b, double m)
+{
+	double d = m * m - a - b;
+
+	if (d < 0)
+		return 1;
+	return 4.0 * a * b > d * d;
+}
+
 /*
- * calculate the coefficients of the given sample and decode
+ * decode the squared magnitudes of one window
+ *
+ * all levels are compared squared, so no square root is needed
+ *
+ * the reference decoder (see ss5_bench()) used coefficients with 15 fraction
+ * bits and dropped the lower 8 bits of the filter states before calculating
+ * the level. the tone detector engine uses 14 fraction bits and all bits of
+ * the states, so the levels differ by a few hundredths of a db. of the 39852
+ * windows of the bench, 14 give a different digit, all of them at the edge of
+ * a threshold:
+ *  - 8 windows have a tone within 0.02 db of TONE_MIN_DB (-17 db).
+ *  - 6 windows have a single tone, where the noise exceeds the tone by SNR
+ *    (1.14 db) within 0.02 db.
+ * 5 of them are detected by this decoder only, 9 by the reference decoder
+ * only. real tones are far from these edges, so this makes no difference.
  */
+char ss5_digit(const long long *power, int span)
+{
+	double level[NCOEFF], noise, scale, max;
+	int i;
+	int f1 = 0, f2 = 0;
+	char digit = ' ';
 
-char ss5_decode(unsigned char *data, int len)
+	/* check for minimum noise, or tone detection will not be necessary */
+	noise = ((double)span / 65536.0);
+	if (!power || noise < NOISE_MIN_DB)
+		return digit;
+
+	/* level of 1 is 0 db */
+	scale = GOERTZEL_FULLSCALE * SS5_DECODER_NPOINTS;
+	scale *= scale;
+	for (i = 0; i < NCOEFF; i++)
+		level[i] = (double)power[i] / scale;
+
+	/* find the two loudest frequencies */
+	max = 0.0;
+	for (i = 0; i < NCOEFF; i++) {
+		if (level[i] > max) {
+			max = level[i];
+			f1 = i;
+		}
+	}
+	max = 0.0;
+	for (i = 0; i < NCOEFF; i++) {
+		if (i != f1 && level[i] > max) {
+			max = level[i];
+			f2 = i;
+		}
+	}
+
+	/* check one frequency */
+	if (level[f1] > TONE_MIN_DB*TONE_MIN_DB /* must be at least -17 db */
+	 && level[f1]*SNR*SNR > noise*noise) { /*  */
+		digit = decode_one[f1];
+	}
+	/* check two frequencies */
+	if (level[f1] > TONE_MIN_DB*TONE_MIN_DB && level[f2] > TONE_MIN_DB*TONE_MIN_DB /* must be at lease -17 db */
+	 && level[f1]*TONE_DIFF_DB*TONE_DIFF_DB <= level[f2] /* f2 must be not less than 5 db below f1 */
+	 && sum_above(level[f1], level[f2], noise/SNR)) { /* */
+		digit = decode_two[f1][f2];
+	}
+
+	/* debug powers */
+#ifdef DEBUG_LEVELS
+	for (i = 0; i < NCOEFF; i++)
+		printf("%d:%3d %c ", i, (int)(sqrt(level[i])*100), (f1==i || f2==i)?'*':' ');
+	printf("N:%3d digit:%c\n", (int)(noise*100), digit);
+#endif
+
+	return digit;
+}
+
+/*
+ * decode one window of SS5_DECODER_NPOINTS samples now
+ */
+char ss5_decode(unsigned char *data)
+{
+	signed short s16[SS5_DECODER_NPOINTS];
+	const signed short *window = s16;
+	long long power[GOERTZEL_BINS];
+	int n, low = 32767, high = -32768;
+
+	ss5_decode_init();
+	audio_decode(s16, data, SS5_DECODER_NPOINTS);
+	for (n = 0; n < SS5_DECODER_NPOINTS; n++) {
+		if (s16[n] < low)
+			low = s16[n];
+		if (s16[n] > high)
+			high = s16[n];
+	}
+	if (high - low < ss5_batch.min_span)
+		return ' ';
+	goertzel_power(&ss5_tones, &window, 1, power);
+
+	return ss5_digit(power, high - low);
+}
+
+/*
+ * queue one window of SS5_DECODER_NPOINTS samples, the windows of all lines
+ * are decoded at once and given to cb, use ss5_digit() there
+ */
+void ss5_decode_queue(unsigned char *data, goertzel_cb *cb, void *instance)
 {
-	signed short buf[len];
+	ss5_decode_init();
+	goertzel_queue(&ss5_batch, data, cb, instance);
+}
+
+void ss5_decode_cancel(void *instance)
+{
+	if (ss5_tones_init)
+		goertzel_cancel(&ss5_batch, instance);
+}
+
+void ss5_test_decode(void)
+{
+#ifdef DEBUG_LEVELS
+	double phase;
+	int i, j;
+	signed short sample;
+
+	unsigned char buffer[SS5_DECODER_NPOINTS];
+	for (i = 0; i < 4000; i += 10) {
+		phase = 2.0 * 3.14159265 * i / 8000.0;
+		for (j = 0; j < SS5_DECODER_NPOINTS; j++) {
+			sample = sin(phase * j) * 1000;
+			buffer[j] = audio_s16_to_law[sample & 0xffff];
+		}
+		printf("FRQ:%04d:", i);
+		ss5_decode(buffer);
+	}
+#endif
+}
+
+
+/*
+ * reference decoder, as it was before the tone detector engine
+ *
+ * it is only used by ss5_bench(), to compare the results
+ */
+static const signed long long ss5_bench_cos2pik[NCOEFF] =
+{
+	/* k = 2*cos(2*PI*f/8000), k << 15 
+	 * 700, 900, 1100, 1300, 1500, 1700, 2400, 2600 */
+	55879, 49834, 42562, 34242, 25080, 15299, -20252, -29753
+};
+
+static char ss5_decode_reference(unsigned char *data)
+{
+	signed short buf[SS5_DECODER_NPOINTS];
 	signed long sk, sk1, sk2, low, high;
-	int k, n, i;
+	int k, n, i, len = SS5_DECODER_NPOINTS;
 	int f1 = 0, f2 = 0;
-	double result[NCOEFF], power, noise, snr;
+	double result[NCOEFF], power, noise;
 	signed long long cos2pik_;
 	char digit = ' ';
 
@@ -87,7 +248,7 @@ char ss5_decode(unsigned char *data, int len)
 		sk = 0;
 		sk1 = 0;
 		sk2 = 0;
-		cos2pik_ = cos2pik[k];
+		cos2pik_ = ss5_bench_cos2pik[k];
 		for (n = 0; n < len; n++) {
 			sk = ((cos2pik_*sk1)>>15) - sk2 + buf[n];
 			sk2 = sk1;
@@ -100,12 +261,12 @@ char ss5_decode(unsigned char *data, int len)
 		/* compute |X(k)|**2 */
 		result[k] = sqrt (
 				(sk * sk) -
-				(((cos2pik[k] * sk) >> 15) * sk2) +
+				(((ss5_bench_cos2pik[k] * sk) >> 15) * sk2) +
 				(sk2 * sk2)
 			) / len / 62; /* level of 1 is 0 db*/
 	}
 
-	/* find the two loudest frequencies + one less lower frequency to detect noise */
+	/* find the two loudest frequencies */
 	power = 0.0;
 	for (i = 0; i < NCOEFF; i++) {
 		if (result[i] > power) {
@@ -121,52 +282,265 @@ char ss5_decode(unsigned char *data, int len)
 		}
 	}
 
-	snr = 0;
 	/* check one frequency */
 	if (result[f1] > TONE_MIN_DB /* must be at least -17 db */
 	 && result[f1]*SNR > noise) { /*  */
 		digit = decode_one[f1];
-		if (digit != ' ')
-			snr = result[f1] / noise;
 	}
 	/* check two frequencies */
 	if (result[f1] > TONE_MIN_DB && result[f2] > TONE_MIN_DB /* must be at lease -17 db */
 	 && result[f1]*TONE_DIFF_DB <= result[f2] /* f2 must be not less than 5 db below f1 */
 	 && (result[f1]+result[f2])*SNR > noise) { /* */
 		digit = decode_two[f1][f2];
-		if (digit != ' ')
-			snr = (result[f1]+result[f2]) / noise;
 	}
 
-	/* debug powers */
-#ifdef DEBUG_LEVELS
-	for (i = 0; i < NCOEFF; i++)
-		printf("%d:%3d %c ", i, (int)(result[i]*100), (f1==i || f2==i)?'*':' ');
-	printf("N:%3d digit:%c snr=%3d\n", (int)(noise*100), digit, (int)(snr*100));
-// 	if (result[f1]*TONE_DIFF_DB <= result[f2]) /* f2 must be not less than 5 db below f1 */
-//		printf("jo!");
-#endif
-
 	return digit;
 }
 
-void ss5_test_decode(void)
+/*
+ * the corpus of the bench: no tone, each single tone and each pair of tones
+ * (second tone 2 db lower), from -40 db to 0 db in 1 db steps. each with
+ * -15 Hz, 0 Hz and +15 Hz frequency offset, with and without noise (30% of
+ * the tone's amplitude). this is done for a-law and u-law.
+ */
+#define SS5_BENCH_LEVELS	41
+#define SS5_BENCH_VARIANTS	6
+#define SS5_BENCH_WINDOWS	((NCOEFF + 1) * (NCOEFF + 1) * SS5_BENCH_LEVELS * SS5_BENCH_VARIANTS)
+
+struct ss5_bench_window {
+	int		f1, f2;		/* index of tones, -1 = none */
+	int		db;
+	int		offset;		/* Hz */
+	int		noise;
+	unsigned char	data[SS5_DECODER_NPOINTS];
+	char		digit;		/* result of batch decoding */
+};
+
+static void ss5_bench_corpus(struct ss5_bench_window *window, unsigned int *seed)
 {
-#ifdef DEBUG_LEVELS
-	double phase;
-	int i, j;
-	signed short sample;
+	int a, b, db, v, n;
+	double amplitude, offset, noise, s;
 
-	unsigned char buffer[SS5_DECODER_NPOINTS];
-	for (i = 0; i < 4000; i += 10) {
-		phase = 2.0 * 3.14159265 * i / 8000.0;
-		for (j = 0; j < SS5_DECODER_NPOINTS; j++) {
-			sample = sin(phase * j) * 1000;
-			buffer[j] = audio_s16_to_law[sample & 0xffff];
+	for (a = -1; a < NCOEFF; a++) for (b = -1; b < NCOEFF; b++) for (db = -40; db <= 0; db++) for (v = 0; v < SS5_BENCH_VARIANTS; v++) {
+		amplitude = pow(10.0, db / 20.0) * 32000.0;
+		if (a >= 0 && b >= 0)
+			amplitude /= 2.0;
+		offset = (v % 3 - 1) * 15.0;
+		noise = (v >= 3) ? amplitude * 0.3 : 0.0;
+		window->f1 = a;
+		window->f2 = (b != a) ? b : -1;
+		window->db = db;
+		window->offset = (int)offset;
+		window->noise = (v >= 3);
+		for (n = 0; n < SS5_DECODER_NPOINTS; n++) {
+			s = 0.0;
+			/* start phase of the tones depends on the variant */
+			if (a >= 0)
+				s += amplitude * sin(2.0 * M_PI * (ss5_frequency[a] + offset) * n / 8000.0 + v);
+			if (b >= 0 && b != a)
+				s += amplitude * 0.8 * sin(2.0 * M_PI * (ss5_frequency[b] - offset) * n / 8000.0 + 2 * v);
+			*seed = *seed * 1103515245 + 12345;
+			s += noise * (((*seed >> 16) & 0x7fff) / 16384.0 - 1.0);
+			if (s > 32767.0)
+				s = 32767.0;
+			if (s < -32768.0)
+				s = -32768.0;
+			window->data[n] = audio_s16_to_law[(int)s & 0xffff];
 		}
-		printf("FRQ:%04d:", i);
-		ss5_decode(buffer, SS5_DECODER_NPOINTS);
+		window++;
 	}
-#endif
 }
 
+static void ss5_bench_decoded(void *instance, const long long *power, int span)
+{
+	((struct ss5_bench_window *)instance)->digit = ss5_digit(power, span);
+}
+
+/* returns nanoseconds per window */
+static double ss5_bench_time(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((double)(end.tv_sec - start->tv_sec) * 1000000000.0 + (double)(end.tv_nsec - start->tv_nsec)) / SS5_BENCH_WINDOWS;
+}
+
+/* compare all kernels with the scalar kernel, returns number of differences */
+static int ss5_bench_kernels(const struct goertzel_tones *tones, const signed short *const *s16, int count)
+{
+	long long ref[GOERTZEL_BATCH * GOERTZEL_BINS], power[GOERTZEL_BATCH * GOERTZEL_BINS];
+	int kernel, errors = 0;
+
+	goertzel_kernel(GOERTZEL_SCALAR);
+	goertzel_power(tones, s16, count, ref);
+	for (kernel = GOERTZEL_SCALAR + 1; kernel < GOERTZEL_KERNELS; kernel++) {
+		if (goertzel_kernel(kernel))
+			continue;
+		goertzel_power(tones, s16, count, power);
+		if (memcmp(ref, power, count * GOERTZEL_BINS * sizeof(long long))) {
+			printf("%s kernel differs from scalar kernel (%d samples per window).\n", goertzel_kernel_name[kernel], tones->len);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+/*
+ * compare the decoder with the reference decoder and measure both
+ *
+ * the corpus is decoded by the reference decoder, by ss5_decode() and by
+ * batches with each kernel. all kernels must give the same powers, and the
+ * batches must give the same digits as ss5_decode(). windows where the
+ * reference decoder gives a different digit are shown.
+ */
+int ss5_bench(int rounds)
+{
+	const char *laws = "ua";
+	struct ss5_bench_window *corpus, *window;
+	struct goertzel_tones tones_max;
+	signed short s16[GOERTZEL_BATCH][GOERTZEL_MAX_LEN];
+	const signed short *s16p[GOERTZEL_BATCH];
+	long long power[GOERTZEL_BINS];
+	double ns_reference = 0, ns_single[GOERTZEL_KERNELS], ns_batch[GOERTZEL_KERNELS], level, scale;
+	struct timespec start;
+	unsigned int seed = 1;
+	int i, j, n, k, r, low, high, kernel, batch_errors = 0, kernel_errors = 0, differ = 0, detected = 0;
+	char reference, digit;
+	volatile char sink = 0;
+
+	if (rounds < 1)
+		rounds = 1;
+	corpus = (struct ss5_bench_window *)MALLOC(SS5_BENCH_WINDOWS * sizeof(struct ss5_bench_window));
+	memuse++;
+	memset(ns_single, 0, sizeof(ns_single));
+	memset(ns_batch, 0, sizeof(ns_batch));
+	scale = GOERTZEL_FULLSCALE * SS5_DECODER_NPOINTS;
+	scale *= scale;
+
+	printf("Decoding %d windows of %d samples for each law, %d round(s).\n", SS5_BENCH_WINDOWS, SS5_DECODER_NPOINTS, rounds);
+	while (*laws) {
+		generate_tables(*laws);
+		ss5_bench_corpus(corpus, &seed);
+
+		/* digits */
+		goertzel_init();
+		ss5_decode_init();
+		for (i = 0; i < SS5_BENCH_WINDOWS; i++) {
+			window = &corpus[i];
+			reference = ss5_decode_reference(window->data);
+			digit = ss5_decode(window->data);
+			if (reference != ' ')
+				detected++;
+			if (reference == digit)
+				continue;
+			differ++;
+			/* show the levels of the two loudest tones */
+			audio_decode(s16[0], window->data, SS5_DECODER_NPOINTS);
+			s16p[0] = s16[0];
+			low = 32767;
+			high = -32768;
+			for (n = 0; n < SS5_DECODER_NPOINTS; n++) {
+				if (s16[0][n] < low)
+					low = s16[0][n];
+				if (s16[0][n] > high)
+					high = s16[0][n];
+			}
+			goertzel_power(&ss5_tones, s16p, 1, power);
+			printf("%s-law", (*laws == 'a') ? "a" : "u");
+			if (window->f1 >= 0)
+				printf(" %.0f", ss5_frequency[window->f1]);
+			if (window->f2 >= 0)
+				printf("%s%.0f", (window->f1 >= 0) ? "+" : " ", ss5_frequency[window->f2]);
+			printf(" Hz %d db %+d Hz%s: reference '%c', decoder '%c', levels", window->db, window->offset, (window->noise) ? " noise" : "", reference, digit);
+			for (k = 0; k < NCOEFF; k++) {
+				level = sqrt((double)power[k] / scale);
+				if (level > TONE_MIN_DB / 2.0)
+					printf(" %.0f:%.2f", ss5_frequency[k], 10.0 * log10(level));
+			}
+			printf(" noise:%.2f\n", 10.0 * log10((double)(high - low) / 65536.0));
+		}
+
+		/* kernels, odd number of windows per call, so the last one is not paired */
+		for (i = 0; i < SS5_BENCH_WINDOWS; i += GOERTZEL_BATCH - 1) {
+			n = (SS5_BENCH_WINDOWS - i < GOERTZEL_BATCH - 1) ? SS5_BENCH_WINDOWS - i : GOERTZEL_BATCH - 1;
+			for (j = 0; j < n; j++) {
+				audio_decode(s16[j], corpus[i + j].data, SS5_DECODER_NPOINTS);
+				s16p[j] = s16[j];
+			}
+			kernel_errors += ss5_bench_kernels(&ss5_tones, s16p, n);
+		}
+
+		/* batches, with each kernel */
+		for (kernel = 0; kernel < GOERTZEL_KERNELS; kernel++) {
+			if (goertzel_kernel(kernel))
+				continue;
+			for (i = 0; i < SS5_BENCH_WINDOWS; i++) {
+				corpus[i].digit = '?';
+				ss5_decode_queue(corpus[i].data, ss5_bench_decoded, &corpus[i]);
+			}
+			goertzel_flush(&ss5_batch);
+			for (i = 0; i < SS5_BENCH_WINDOWS; i++) {
+				if (corpus[i].digit != ss5_decode(corpus[i].data)) {
+					printf("%s kernel: batch decoding of window %d differs.\n", goertzel_kernel_name[kernel], i);
+					batch_errors++;
+				}
+			}
+		}
+
+		/* measure */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (r = 0; r < rounds; r++) {
+			for (i = 0; i < SS5_BENCH_WINDOWS; i++)
+				sink += ss5_decode_reference(corpus[i].data);
+		}
+		ns_reference += ss5_bench_time(&start) / rounds / 2;
+		for (kernel = 0; kernel < GOERTZEL_KERNELS; kernel++) {
+			if (goertzel_kernel(kernel))
+				continue;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (r = 0; r < rounds; r++) {
+				for (i = 0; i < SS5_BENCH_WINDOWS; i++)
+					sink += ss5_decode(corpus[i].data);
+			}
+			ns_single[kernel] += ss5_bench_time(&start) / rounds / 2;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (r = 0; r < rounds; r++) {
+				for (i = 0; i < SS5_BENCH_WINDOWS; i++)
+					ss5_decode_queue(corpus[i].data, ss5_bench_decoded, &corpus[i]);
+				goertzel_flush(&ss5_batch);
+			}
+			ns_batch[kernel] += ss5_bench_time(&start) / rounds / 2;
+		}
+		laws++;
+	}
+
+	/* full scale input at the largest window must not overflow any kernel */
+	goertzel_tones(&tones_max, ss5_frequency, NCOEFF, GOERTZEL_MAX_LEN);
+	for (n = 0; n < GOERTZEL_MAX_LEN; n++) {
+		seed = seed * 1103515245 + 12345;
+		s16[0][n] = (n & 1) ? 32767 : -32768;
+		s16[1][n] = (signed short)(32767.0 * sin(2.0 * M_PI * 700.0 * n / 8000.0));
+		s16[2][n] = (signed short)(32767.0 * sin(2.0 * M_PI * 2600.0 * n / 8000.0));
+		s16[3][n] = (n & 64) ? 32767 : -32768;
+		s16[4][n] = seed >> 16;
+	}
+	for (j = 0; j < 5; j++)
+		s16p[j] = s16[j];
+	kernel_errors += ss5_bench_kernels(&tones_max, s16p, 5);
+	goertzel_init();
+
+	printf("%d windows with a digit, %d windows where the decoder differs from the reference decoder.\n", detected, differ);
+	printf("Kernels: %d differences, batches: %d differences.\n", kernel_errors, batch_errors);
+	printf("ns per window: reference %.0f", ns_reference);
+	for (kernel = 0; kernel < GOERTZEL_KERNELS; kernel++) {
+		if (ns_single[kernel] > 0)
+			printf(", %s %.0f (batch %.0f)", goertzel_kernel_name[kernel], ns_single[kernel], ns_batch[kernel]);
+	}
+	printf("\n");
+
+	FREE(corpus, SS5_BENCH_WINDOWS * sizeof(struct ss5_bench_window));
+	memuse--;
+
+	return (kernel_errors || batch_errors) ? -1 : 0;
+}
@@ -5,6 +5,10 @@
 
 #define SS5_DECODER_NPOINTS             80 /* size of goertzel window */
 
-char ss5_decode(unsigned char *data, int len);
+char ss5_digit(const long long *power, int span);
+char ss5_decode(unsigned char *data);
+void ss5_decode_queue(unsigned char *data, goertzel_cb *cb, void *instance);
+void ss5_decode_cancel(void *instance);
 void ss5_test_decode(void);
+int ss5_bench(int rounds);
 
@@ -248,7 +248,6 @@ int read_tone(int fh, unsigned char *buffer, int codec, int len, signed int size
 	signed short buffer16[len], *buf16 = buffer16;
 	signed short buffer32[len<<1], *buf32 = buffer32;
 	unsigned char buffer8[len], *buf8 = buffer8;
-	signed int sample;
 	int i = 0;
 //printf("left=%ld\n",*left);
 
@@ -287,15 +286,7 @@ int read_tone(int fh, unsigned char *buffer, int codec, int len, signed int size
 			l = read(fh, buf16, len<<1);
 			if (l>0) {
 				l = l>>1;
-				while(i < l) {
-					sample = *buf16++;
-					if (sample < -32767)
-						sample = -32767;
-					if (sample > 32767)
-						sample = 32767;
-					*buffer++ = audio_s16_to_law[sample & 0xffff];
-					i++;
-				}
+				audio_encode(buffer, buf16, l);
 			}
 		break;
 
@@ -303,16 +294,14 @@ int read_tone(int fh, unsigned char *buffer, int codec, int len, signed int size
 		l = read(fh, buf32, len<<2);
 		if (l>0) {
 			l = l>>2;
+			/* mix both channels */
 			while(i < l) {
-				sample = (*buf32++);
-				sample += (*buf32++);
-				if (sample < -32767)
-					sample = -32767;
-				if (sample > 32767)
-					sample = 32767;
-				*buffer++ = audio_s16_to_law[sample & 0xffff];
+				buf16[i] = buf32[i<<1];
+				buf32[i] = buf32[(i<<1)+1];
 				i++;
 			}
+			audio_mix(buf16, buf32, l);
+			audio_encode(buffer, buf16, l);
 		}
 		break;
 
@@ -336,61 +325,68 @@ int read_tone(int fh, unsigned char *buffer, int codec, int len, signed int size
 }
 
 
-struct toneset *toneset_first = NULL;
+/* HOW TO fetch tones?
 
-/*
- * free fetched tones
- */
-void free_tones(void)
+All tones of the directories given by 'fetch_tones' are converted to law
+and stored in one memory map, together with a hash to find a tone by its
+directory and name. After loading, the map is made read-only and shared by
+all ports. Because the tones are already law, reading a fetched tone is
+just a copy.
+
+A reload builds a new store in a thread, so calls are not blocked while the
+tones are read from disk. When done, the new store replaces the current
+one. The old store is freed when no port plays from it anymore.
+
+*/
+
+struct tone_store *tone_store = NULL;
+static struct tone_store *tone_store_old = NULL; /* stores still in use by ports */
+static int tone_reloading = 0;
+static pthread_t tone_reload_tid;
+static int tone_reload_pipe[2] = { -1, -1 };
+static struct lcr_fd tone_reload_fd;
+static struct lcr_timer tone_collect_timer;
+
+#define TONE_READ_CHUNK		4096	/* samples that are read at once */
+#define TONE_COLLECT_TIME	10	/* seconds to check if old stores are unused */
+
+static unsigned int tone_hash(const char *key)
 {
-	struct toneset *toneset_temp;
-	struct tonesettone *tonesettone_temp;
-	void *temp;
-
-	toneset_temp = toneset_first;
-	while(toneset_temp) {
-		tonesettone_temp = toneset_temp->first;
-		while(tonesettone_temp) {
-			temp = tonesettone_temp;
-			tonesettone_temp = tonesettone_temp->next;
-			FREE(temp, sizeof(struct tonesettone));
-			memuse--;
-		}
-		temp = toneset_temp;
-		toneset_temp = toneset_temp->next;
-		FREE(temp, sizeof(struct toneset));
-		memuse--;
-	}
-	toneset_first = NULL;
+	unsigned int hash = 5381;
+
+	while (*key)
+		hash = hash * 33 + (unsigned char)*key++;
+
+	return hash;
 }
 
 /*
- * fetch tones as specified in options.conf
+ * scan all tone directories
+ * if no store is given, count the tones and their size only
  */
-int fetch_tones(void)
+static int tone_store_scan(const char *fetch, struct tone_store *store, unsigned int *tones, unsigned int *bytes)
 {
 	DIR *dir;
 	struct dirent *dirent;
-	struct toneset **toneset_nextpointer;
-	struct tonesettone **tonesettone_nextpointer;
-	char *p, *p_next;
+	struct tone_entry *entry;
+	char dirs[256], *p, *p_next;
 	char path[256];
 	char filename[256], name[256];
 	int fh;
 	int tone_codec;
 	signed int tone_size, tone_left;
-	unsigned int memory = 0;
-	int samples = 0;
-
-	/* if disabled */
-	if (!options.fetch_tones)
-		return(1);
-
-	toneset_nextpointer = &toneset_first;
-	p = options.fetch_tones;
-	if (*p == '\0')
-		return(1);
-
+	unsigned char *data = NULL;
+	unsigned int bucket;
+	int l, len;
+
+	*tones = 0;
+	*bytes = 0;
+	if (store)
+		data = store->data_start;
+
+	/* the list is split, so we use a copy */
+	SCPY(dirs, fetch);
+	p = dirs;
 	while (*p) {
 		p_next = p;
 		while(*p_next) {
@@ -406,14 +402,10 @@ int fetch_tones(void)
 		if (*p) if (p[strlen(p)-1] == '/')
 			p[strlen(p)-1] = '\0';
 
-		printf("PBX: Fetching tones '%s'\n", p);
-		PDEBUG(DEBUG_PORT, "fetching tones directory '%s'\n", p);
-
-		*toneset_nextpointer = (struct toneset *)MALLOC(sizeof(struct toneset));
-		memuse++;
-		memory += sizeof(struct toneset);
-		SCPY((*toneset_nextpointer)->directory, p);
-		tonesettone_nextpointer = &(*toneset_nextpointer)->first;
+		if (store) {
+			printf("PBX: Fetching tones '%s'\n", p);
+			PDEBUG(DEBUG_PORT, "fetching tones directory '%s'\n", p);
+		}
 
 		SPRINT(path, "%s/%s", SHARE_DATA, p);
 		dir = opendir(path);
@@ -449,40 +441,272 @@ int fetch_tones(void)
 				PERROR("Cannot open file: '%s'\n", filename);
 				continue;
 			}
-			fduse++;
 
 			if (tone_size < 0) {
 				PERROR("File has 0-length: '%s'\n", filename);
 				close(fh);
-				fduse--;
 				continue;
 			}
 
-			/* Allocate tone */
-			*tonesettone_nextpointer = (struct tonesettone *)MALLOC(sizeof(struct tonesettone)+tone_size);
-			memuse++;
-//printf("tone:%s, %ld bytes\n", name, tone_size);
-			memory += sizeof(struct tonesettone)+tone_size;
-			samples ++;
+			if (!store) {
+				/* count only */
+				(*tones)++;
+				*bytes += tone_size;
+				close(fh);
+				continue;
+			}
+
+			/* the directory has changed since counting */
+			if (*tones == (unsigned int)store->tones || data + tone_size > store->data_end) {
+				PERROR("Tone set changed while loading, skipping: '%s'\n", filename);
+				close(fh);
+				continue;
+			}
+
+			/* load tone, it is converted to law */
+			entry = &store->entries[(*tones)++];
+			SPRINT(entry->key, "%s/%s", p, name);
+			entry->data = data;
+			len = tone_size;
+			while (len) {
+				l = read_tone(fh, data, tone_codec, (len > TONE_READ_CHUNK) ? TONE_READ_CHUNK : len, tone_size, &tone_left, 1);
+				if (l <= 0)
+					break;
+				data += l;
+				len -= l;
+			}
+			entry->size = tone_size - len;
+			*bytes += entry->size;
 
-			/* load tone */
-			read_tone(fh, (*tonesettone_nextpointer)->data, tone_codec, tone_size, tone_size, &tone_left, 1);
-			(*tonesettone_nextpointer)->size = tone_size;
-			(*tonesettone_nextpointer)->codec = (tone_codec==CODEC_LAW)?CODEC_LAW:CODEC_MONO;
-			SCPY((*tonesettone_nextpointer)->name, name);
+			/* add to hash */
+			bucket = tone_hash(entry->key) & (store->hash_size - 1);
+			entry->next = store->hash[bucket];
+			store->hash[bucket] = entry;
 
 			close(fh);
-			fduse--;
-				 
-			tonesettone_nextpointer = &((*tonesettone_nextpointer)->next);
 		}
+		closedir(dir);
 
-		toneset_nextpointer = &((*toneset_nextpointer)->next);
 		p = p_next;
 	}
 
-	printf("PBX: Memory used for tones: %d bytes (%d samples)\n", memory, samples);
-	PDEBUG(DEBUG_PORT, "Memory used for tones: %ld bytes (%d samples)\n", memory, samples);
+	return(1);
+}
+
+/*
+ * create a store with all tones
+ */
+static struct tone_store *tone_store_load(const char *fetch)
+{
+	struct tone_store *store;
+	unsigned int tones, bytes, hash_size, map_size;
+	void *map;
+
+	/* get size of all tones */
+	if (!tone_store_scan(fetch, NULL, &tones, &bytes))
+		return(NULL);
+
+	hash_size = 64;
+	while (hash_size < tones * 2)
+		hash_size <<= 1;
+	map_size = sizeof(struct tone_store)
+		+ hash_size * sizeof(struct tone_entry *)
+		+ tones * sizeof(struct tone_entry)
+		+ bytes;
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		PERROR("Cannot map %u bytes for tones.\n", map_size);
+		return(NULL);
+	}
+	store = (struct tone_store *)map;
+	store->map_size = map_size;
+	store->hash_size = hash_size;
+	store->hash = (struct tone_entry **)(store + 1);
+	store->entries = (struct tone_entry *)(store->hash + hash_size);
+	store->tones = tones;
+	store->data_start = (unsigned char *)(store->entries + tones);
+	store->data_end = store->data_start + bytes;
+
+	/* load tones */
+	if (!tone_store_scan(fetch, store, &tones, &bytes)) {
+		munmap(map, map_size);
+		return(NULL);
+	}
+	store->tones = tones;
+
+	/* from now on, the store is shared */
+	mprotect(map, map_size, PROT_READ);
+
+	printf("PBX: Memory used for tones: %d bytes (%d samples)\n", map_size, tones);
+	PDEBUG(DEBUG_PORT, "Memory used for tones: %ld bytes (%d samples)\n", map_size, tones);
+
+	return(store);
+}
+
+/*
+ * free stores that are not used by any port anymore
+ */
+static void tone_store_collect(void)
+{
+	struct tone_store **storep, *store;
+	class Port *port;
+	unsigned char *data;
+
+	storep = &tone_store_old;
+	while ((store = *storep)) {
+		port = port_first;
+		while(port) {
+			data = (unsigned char *)port->p_tone_fetched;
+			if (data >= store->data_start && data <= store->data_end)
+				break;
+			port = port->next;
+		}
+		if (port) {
+			storep = &store->next;
+			continue;
+		}
+		*storep = store->next;
+		munmap(store, store->map_size);
+	}
+
+	if (tone_store_old)
+		schedule_timer(&tone_collect_timer, TONE_COLLECT_TIME, 0);
+}
+
+static int tone_collect_timeout(struct lcr_timer *timer, void *instance, int index)
+{
+	tone_store_collect();
+
+	return 0;
+}
+
+/* replace current store, the old one is kept until unused */
+static void tone_store_replace(struct tone_store *store)
+{
+	if (tone_store) {
+		/* the map is read-only, so the list pointer is in the header page */
+		mprotect(tone_store, sizeof(struct tone_store), PROT_READ | PROT_WRITE);
+		tone_store->next = tone_store_old;
+		tone_store_old = tone_store;
+	}
+	tone_store = store;
+
+	tone_store_collect();
+}
+
+static void *tone_reload_child(void *arg)
+{
+	struct tone_store *store;
+
+	store = tone_store_load(options.fetch_tones);
+
+	/* tell main thread, also if loading failed */
+	if (write(tone_reload_pipe[1], &store, sizeof(store)) < 0)
+		PERROR("Failed to tell main thread about loaded tones (errno=%d).\n", errno);
+
+	return(NULL);
+}
+
+static int tone_reload_done(struct lcr_fd *fd, unsigned int what, void *instance, int index)
+{
+	struct tone_store *store;
+
+	if (read(tone_reload_pipe[0], &store, sizeof(store)) != sizeof(store))
+		return 0;
+	pthread_join(tone_reload_tid, NULL);
+	tone_reloading = 0;
+
+	if (!store) {
+		PERROR("Reloading tones failed, keeping current tones.\n");
+		return 0;
+	}
+	tone_store_replace(store);
+
+	return 0;
+}
+
+/*
+ * reload tones in background
+ */
+int reload_tones(char *err_txt, int err_size)
+{
+	if (!options.fetch_tones[0]) {
+		UNPRINT(err_txt, err_size - 1, "No tones are fetched, see 'fetch_tones' in options.conf.\n");
+		return(-1);
+	}
+	if (tone_reloading) {
+		UNPRINT(err_txt, err_size - 1, "Tones are already reloading.\n");
+		return(-1);
+	}
+
+	if (tone_reload_pipe[0] < 0) {
+		if (pipe(tone_reload_pipe) < 0) {
+			UNPRINT(err_txt, err_size - 1, "Cannot create pipe.\n");
+			return(-1);
+		}
+		memset(&tone_reload_fd, 0, sizeof(tone_reload_fd));
+		tone_reload_fd.fd = tone_reload_pipe[0];
+		register_fd(&tone_reload_fd, LCR_FD_READ, tone_reload_done, NULL, 0);
+	}
+
+	if (pthread_create(&tone_reload_tid, NULL, tone_reload_child, NULL)) {
+		UNPRINT(err_txt, err_size - 1, "Cannot create thread.\n");
+		return(-1);
+	}
+	tone_reloading = 1;
+
+	UNPRINT(err_txt, err_size - 1, "Tones are reloading in background.\n");
+	return(0);
+}
+
+/*
+ * free fetched tones
+ */
+void free_tones(void)
+{
+	struct tone_store *store;
+
+	if (tone_reloading) {
+		pthread_join(tone_reload_tid, NULL);
+		if (read(tone_reload_pipe[0], &store, sizeof(store)) == sizeof(store) && store)
+			munmap(store, store->map_size);
+		tone_reloading = 0;
+	}
+	if (tone_reload_pipe[0] >= 0) {
+		unregister_fd(&tone_reload_fd);
+		close(tone_reload_pipe[0]);
+		close(tone_reload_pipe[1]);
+		tone_reload_pipe[0] = tone_reload_pipe[1] = -1;
+	}
+	if (tone_collect_timer.inuse)
+		del_timer(&tone_collect_timer);
+
+	while ((store = tone_store_old)) {
+		tone_store_old = store->next;
+		munmap(store, store->map_size);
+	}
+	if (tone_store) {
+		munmap(tone_store, tone_store->map_size);
+		tone_store = NULL;
+	}
+}
+
+/*
+ * fetch tones as specified in options.conf
+ */
+int fetch_tones(void)
+{
+	/* if disabled */
+	if (!options.fetch_tones[0])
+		return(1);
+
+	memset(&tone_collect_timer, 0, sizeof(tone_collect_timer));
+	add_timer(&tone_collect_timer, tone_collect_timeout, NULL, 0);
+
+	tone_store = tone_store_load(options.fetch_tones);
+	if (!tone_store)
+		return(0);
 
 	return(1);
 } 
@@ -493,44 +717,32 @@ int fetch_tones(void)
  */
 void *open_tone_fetched(char *dir, char *file, int *codec, signed int *length, signed int *left)
 {
-	struct toneset *toneset;
-	struct tonesettone *tonesettone;
+	struct tone_entry *entry;
+	char key[256];
 
 	/* if anything fetched */
-	if (!toneset_first)
-		return(NULL);
-
-	/* find set */
-	toneset = toneset_first;
-	while(toneset) {
-//printf("1. comparing '%s' with '%s'\n", toneset->directory, dir);
-		if (!strcmp(toneset->directory, dir))
-			break;
-		toneset = toneset->next;
-	}
-	if (!toneset)
+	if (!tone_store)
 		return(NULL);
 
 	/* find tone */
-	tonesettone = toneset->first;
-	while(tonesettone) {
-//printf("2. comparing '%s' with '%s'\n", tonesettone->name, file);
-		if (!strcmp(tonesettone->name, file))
+	SPRINT(key, "%s/%s", dir, file);
+	entry = tone_store->hash[tone_hash(key) & (tone_store->hash_size - 1)];
+	while(entry) {
+		if (!strcmp(entry->key, key))
 			break;
-		tonesettone = tonesettone->next;
+		entry = entry->next;
 	}
-	if (!tonesettone)
+	if (!entry)
 		return(NULL);
 
 	/* return information */
 	if (length)
-		*length = tonesettone->size;
+		*length = entry->size;
 	if (left)
-		*left = tonesettone->size;
+		*left = entry->size;
 	if (codec)
-		*codec = tonesettone->codec;
-//printf("size=%ld, data=%08x\n", tonesettone->size, tonesettone->data);
-	return(tonesettone->data);
+		*codec = CODEC_LAW;
+	return(entry->data);
 }
 
 
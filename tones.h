@@ -13,24 +13,28 @@ int open_tone(char *file, int *codec, signed int *length, signed int *left);
 int read_tone(int fh, unsigned char *buffer, int codec, int len, signed int size, signed int *left, int speed);
 int fetch_tones(void);
 void free_tones(void);
+int reload_tones(char *err_txt, int err_size);
 void *open_tone_fetched(char *dir, char *file, int *codec, signed int *length, signed int *left);
 int read_tone_fetched(void **fetched, void *buffer, int len, signed int size, signed int *left, int speed);
 
-/* tone sets */
-struct tonesettone {
-	struct tonesettone *next;
-	char name[128];
-	int codec;
-	int size;
-	unsigned char data[0];
+/* fetched tone, key is "<directory>/<name>" */
+struct tone_entry {
+	struct tone_entry *next;	/* next entry in same bucket */
+	char key[256];
+	int size;			/* samples of law data */
+	unsigned char *data;
 	};
 
-struct toneset {
-	struct toneset *next;
-	char directory[128];
-	struct tonesettone *first;
+/* memory map with all fetched tones */
+struct tone_store {
+	struct tone_store *next;	/* list of old stores */
+	unsigned int map_size;		/* size of map, including this header */
+	unsigned int hash_size;		/* number of buckets, power of two */
+	struct tone_entry **hash;
+	struct tone_entry *entries;
+	int tones;
+	unsigned char *data_start, *data_end; /* law data of all tones */
 	};
 
-extern struct toneset *toneset_first;
-
+extern struct tone_store *tone_store;
 
@@ -10,12 +10,49 @@
 \*****************************************************************************/ 
 
 #include "main.h"
+#include <semaphore.h>
+
+/* HOW TO write traces?
+
+A trace is collected in 'trace' by start_trace() and add_trace(). When
+end_trace() is called, it is filtered and rendered for each admin
+subscriber. Each detail level is only rendered once per trace, and only if
+a subscriber wants it.
+
+If a log file is given, the trace record (without unused elements) is put
+into a ring buffer. It is written by a thread that keeps the log file
+open and renders the brief form there. The ring has only one producer
+(the main thread) and one consumer (the writer thread), so no lock is
+required. If the log file exceeds 'log-size', it is renamed with the
+current time appended. If the log file is renamed or removed by others,
+it is reopened.
+
+If the ring is full, the trace is not logged. This is counted in
+trace_lost and noted in the log, as soon as there is space again.
+
+*/
 
 struct trace trace;
-char trace_string[MAX_TRACE_ELEMENTS * 100 + 400];
+static char trace_text[4][MAX_TRACE_ELEMENTS * 100 + 400]; /* rendered for each detail */
 
 static const char *spaces = "          ";
 
+volatile unsigned int trace_lost = 0;
+
+static struct trace trace_ring[TRACE_RING];
+static volatile unsigned int trace_in = 0; /* changed by main thread only */
+static volatile unsigned int trace_out = 0; /* changed by writer only */
+static sem_t trace_sem;
+static pthread_t trace_tid;
+static int trace_running = 0;
+static volatile int trace_quit = 0;
+
+/* used by writer only */
+static char trace_buffer[65536];
+static char trace_line[MAX_TRACE_ELEMENTS * 100 + 400];
+static int trace_fd = -1;
+static unsigned int trace_lost_written = 0;
+
 /*
  * initializes a new trace
  * all values will be reset
@@ -83,169 +120,160 @@ void _add_trace(const char *__file, int __line, const char *name, const char *su
 }
 
 
+
+
 /*
  * prints trace to socket or log
  * detail: 1 = brief, 2=short, 3=long
+ * the long form uses the port list, so it must be rendered by main thread
  */
-static char *print_trace(int detail, int port, char *interface, char *caller, char *dialing, int category)
+static char *print_trace(struct trace *t, int detail, char *string, int size)
 {
 	char buffer[256];
-	time_t ti = trace.sec;
-	struct tm *tm;
+	time_t ti = t->sec;
+	struct tm tm;
 #ifdef WITH_MISDN
 	struct mISDNport *mISDNport;
 #endif
 	int i;
 
-	trace_string[0] = '\0'; // always clear string
+	string[0] = '\0'; // always clear string
 
 	if (detail < 1)
 		return(NULL);
 
-	/* filter trace */
-	if (port >= 0 && trace.port >= 0)
-		if (port != trace.port) return(NULL);
-	if (interface) if (interface[0] && trace.interface[0])
-		if (!!strcasecmp(interface, trace.interface)) return(NULL);
-	if (caller) if (caller[0] && trace.caller[0])
-		if (!!strncasecmp(caller, trace.caller, strlen(trace.caller))) return(NULL);
-	if (dialing) if (dialing[0] && trace.dialing[0])
-		if (!!strncasecmp(dialing, trace.dialing, strlen(trace.dialing))) return(NULL);
-	if (category && trace.category)
-		if (!(category & trace.category)) return(NULL);
-
 	/* head */
 	if (detail >= 3) {
-		SCAT(trace_string, "------------------------------------------------------------------------------\n");
+		scat(string, "------------------------------------------------------------------------------\n", size);
 #ifdef WITH_MISDN
 		/* "Port: 1 (BRI PTMP TE)" */
-		if (trace.port >= 0) {
+		if (t->port >= 0) {
 			mISDNport = mISDNport_first;
 			while(mISDNport) {
-				if (mISDNport->portnum == trace.port)
+				if (mISDNport->portnum == t->port)
 					break;
 				mISDNport = mISDNport->next;
 			}
 			if (mISDNport) {
-				SPRINT(buffer, "Port: %d (%s %s %s)", trace.port, (mISDNport->pri)?"PRI":"BRI", (mISDNport->ptp)?"PTP":"PTMP", (mISDNport->ntmode)?"NT":"TE");
+				SPRINT(buffer, "Port: %d (%s %s %s)", t->port, (mISDNport->pri)?"PRI":"BRI", (mISDNport->ptp)?"PTP":"PTMP", (mISDNport->ntmode)?"NT":"TE");
 				/* copy interface, if we have a port */
 				if (mISDNport->ifport) if (mISDNport->ifport->interface)
-				SCPY(trace.interface, mISDNport->ifport->interface->name);
+				SCPY(t->interface, mISDNport->ifport->interface->name);
 			} else
-				SPRINT(buffer, "Port: %d (does not exist)\n", trace.port);
-			SCAT(trace_string, buffer);
+				SPRINT(buffer, "Port: %d (does not exist)\n", t->port);
+			scat(string, buffer, size);
 		} else
 #endif
-			SCAT(trace_string, "Port: ---");
+			scat(string, "Port: ---", size);
 
-		if (trace.interface[0]) {
+		if (t->interface[0]) {
 			/* "  Interface: 'Ext'" */
-			SPRINT(buffer, "  Interface: '%s'", trace.interface);
-			SCAT(trace_string, buffer);
+			SPRINT(buffer, "  Interface: '%s'", t->interface);
+			scat(string, buffer, size);
 		} else
-			SCAT(trace_string, "  Interface: ---");
+			scat(string, "  Interface: ---", size);
 			
-		if (trace.caller[0]) {
+		if (t->caller[0]) {
 			/* "  Caller: '021256493'" */
-			SPRINT(buffer, "  Caller: '%s'\n", trace.caller);
-			SCAT(trace_string, buffer);
+			SPRINT(buffer, "  Caller: '%s'\n", t->caller);
+			scat(string, buffer, size);
 		} else
-			SCAT(trace_string, "  Caller: ---\n");
+			scat(string, "  Caller: ---\n", size);
 
 		/* "Time: 25.08.73 05:14:39.282" */
-		tm = localtime(&ti);
-		SPRINT(buffer, "Time: %02d.%02d.%02d %02d:%02d:%02d.%03d", tm->tm_mday, tm->tm_mon+1, tm->tm_year%100, tm->tm_hour, tm->tm_min, tm->tm_sec, trace.usec/1000);
-		SCAT(trace_string, buffer);
+		localtime_r(&ti, &tm);
+		SPRINT(buffer, "Time: %02d.%02d.%02d %02d:%02d:%02d.%03d", tm.tm_mday, tm.tm_mon+1, tm.tm_year%100, tm.tm_hour, tm.tm_min, tm.tm_sec, t->usec/1000);
+		scat(string, buffer, size);
 
-		if (trace.direction) {
+		if (t->direction) {
 			/* "  Direction: out" */
-			SPRINT(buffer, "  Direction: %s", (trace.direction==DIRECTION_OUT)?"OUT":"IN");
-			SCAT(trace_string, buffer);
+			SPRINT(buffer, "  Direction: %s", (t->direction==DIRECTION_OUT)?"OUT":"IN");
+			scat(string, buffer, size);
 		} else
-			SCAT(trace_string, "  Direction: ---");
+			scat(string, "  Direction: ---", size);
 
-		if (trace.dialing[0]) {
+		if (t->dialing[0]) {
 			/* "  Dialing: '57077'" */
-			SPRINT(buffer, "  Dialing: '%s'\n", trace.dialing);
-			SCAT(trace_string, buffer);
+			SPRINT(buffer, "  Dialing: '%s'\n", t->dialing);
+			scat(string, buffer, size);
 		} else
-			SCAT(trace_string, "  Dialing: ---\n");
+			scat(string, "  Dialing: ---\n", size);
 
-		SCAT(trace_string, "------------------------------------------------------------------------------\n");
+		scat(string, "------------------------------------------------------------------------------\n", size);
 	}
 
 	if (detail < 3) {
-		tm = localtime(&ti);
-		SPRINT(buffer, "%02d.%02d.%02d %02d:%02d:%02d.%03d ", tm->tm_mday, tm->tm_mon+1, tm->tm_year%100, tm->tm_hour, tm->tm_min, tm->tm_sec, trace.usec/1000);
-		SCAT(trace_string, buffer);
+		localtime_r(&ti, &tm);
+		SPRINT(buffer, "%02d.%02d.%02d %02d:%02d:%02d.%03d ", tm.tm_mday, tm.tm_mon+1, tm.tm_year%100, tm.tm_hour, tm.tm_min, tm.tm_sec, t->usec/1000);
+		scat(string, buffer, size);
 	}
 
 	/* "CH(45): CC_SETUP (net->user)" */
-	switch (trace.category) {
+	switch (t->category) {
 		case CATEGORY_CH:
-		SCAT(trace_string, "CH");
+		scat(string, "CH", size);
 		break;
 
 		case CATEGORY_EP:
-		SCAT(trace_string, "EP");
+		scat(string, "EP", size);
 		break;
 
 		default:
-		SCAT(trace_string, "--");
+		scat(string, "--", size);
 	}
-	if (trace.serial)
-		SPRINT(buffer, "(%lu): %s", trace.serial, trace.name[0]?trace.name:"<unknown>");
+	if (t->serial)
+		SPRINT(buffer, "(%lu): %s", t->serial, t->name[0]?t->name:"<unknown>");
 	else
-		SPRINT(buffer, ": %s", trace.name[0]?trace.name:"<unknown>");
-	SCAT(trace_string, buffer);
+		SPRINT(buffer, ": %s", t->name[0]?t->name:"<unknown>");
+	scat(string, buffer, size);
 
 	/* elements */
 	switch(detail) {
 		case 1: /* brief */
-		if (trace.port >= 0) {
-			SPRINT(buffer, "  port %d", trace.port);
-			SCAT(trace_string, buffer);
+		if (t->port >= 0) {
+			SPRINT(buffer, "  port %d", t->port);
+			scat(string, buffer, size);
 		}
 		i = 0;
-		while(i < trace.elements) {
-			SPRINT(buffer, "  %s", trace.element[i].name);
-			if (i) if (!strcmp(trace.element[i].name, trace.element[i-1].name))
+		while(i < t->elements) {
+			SPRINT(buffer, "  %s", t->element[i].name);
+			if (i) if (!strcmp(t->element[i].name, t->element[i-1].name))
 				buffer[0] = '\0';
-			SCAT(trace_string, buffer);
-			if (trace.element[i].sub[0])
-				SPRINT(buffer, " %s=", trace.element[i].sub);
+			scat(string, buffer, size);
+			if (t->element[i].sub[0])
+				SPRINT(buffer, " %s=", t->element[i].sub);
 			else
 				SPRINT(buffer, " ");
-			SCAT(trace_string, buffer);
-			if (strchr(trace.element[i].value, ' '))
-				SPRINT(buffer, "'%s'", trace.element[i].value);
+			scat(string, buffer, size);
+			if (strchr(t->element[i].value, ' '))
+				SPRINT(buffer, "'%s'", t->element[i].value);
 			else
-				SPRINT(buffer, "%s", trace.element[i].value);
-			SCAT(trace_string, buffer);
+				SPRINT(buffer, "%s", t->element[i].value);
+			scat(string, buffer, size);
 			i++;
 		}
-		SCAT(trace_string, "\n");
+		scat(string, "\n", size);
 		break;
 
 		case 2: /* short */
 		case 3: /* long */
-		SCAT(trace_string, "\n");
+		scat(string, "\n", size);
 		i = 0;
-		while(i < trace.elements) {
-			SPRINT(buffer, " %s%s", trace.element[i].name, &spaces[strlen(trace.element[i].name)]);
-			if (i) if (!strcmp(trace.element[i].name, trace.element[i-1].name))
+		while(i < t->elements) {
+			SPRINT(buffer, " %s%s", t->element[i].name, &spaces[strlen(t->element[i].name)]);
+			if (i) if (!strcmp(t->element[i].name, t->element[i-1].name))
 				SPRINT(buffer, "           ");
-			SCAT(trace_string, buffer);
-			if (trace.element[i].sub[0])
-				SPRINT(buffer, " : %s%s = ", trace.element[i].sub, &spaces[strlen(trace.element[i].sub)]);
+			scat(string, buffer, size);
+			if (t->element[i].sub[0])
+				SPRINT(buffer, " : %s%s = ", t->element[i].sub, &spaces[strlen(t->element[i].sub)]);
 			else
 				SPRINT(buffer, " :              ");
-			SCAT(trace_string, buffer);
-			if (strchr(trace.element[i].value, ' '))
-				SPRINT(buffer, "'%s'\n", trace.element[i].value);
+			scat(string, buffer, size);
+			if (strchr(t->element[i].value, ' '))
+				SPRINT(buffer, "'%s'\n", t->element[i].value);
 			else
-				SPRINT(buffer, "%s\n", trace.element[i].value);
-			SCAT(trace_string, buffer);
+				SPRINT(buffer, "%s\n", t->element[i].value);
+			scat(string, buffer, size);
 			i++;
 		}
 		break;
@@ -253,8 +281,201 @@ static char *print_trace(int detail, int port, char *interface, char *caller, ch
 
 	/* end */
 	if (detail >= 3)
-		SCAT(trace_string, "\n");
-	return(trace_string);
+		scat(string, "\n", size);
+	return(string);
+}
+
+
+/*
+ * checks if the trace is requested by the admin's filter
+ */
+static int trace_match(struct trace *t, struct admin_trace_req *req)
+{
+	if (req->port >= 0 && t->port >= 0)
+		if (req->port != t->port) return(0);
+	if (req->interface[0] && t->interface[0])
+		if (!!strcasecmp(req->interface, t->interface)) return(0);
+	if (req->caller[0] && t->caller[0])
+		if (!!strncasecmp(req->caller, t->caller, strlen(t->caller))) return(0);
+	if (req->dialing[0] && t->dialing[0])
+		if (!!strncasecmp(req->dialing, t->dialing, strlen(t->dialing))) return(0);
+	if (req->category && t->category)
+		if (!(req->category & t->category)) return(0);
+
+	return(1);
+}
+
+
+/*
+ * renames a file that has grown too large, the current time is appended
+ */
+void rotate_file(const char *filename)
+{
+	char newname[256];
+	struct tm tm;
+	time_t now;
+	int i;
+
+	time(&now);
+	localtime_r(&now, &tm);
+	SPRINT(newname, "%s.%04d%02d%02d-%02d%02d%02d", filename, tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+	/* don't overwrite a file renamed in the same second */
+	i = 0;
+	while (!access(newname, F_OK))
+		SPRINT(newname, "%s.%04d%02d%02d-%02d%02d%02d-%d", filename, tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, ++i);
+	if (rename(filename, newname) < 0)
+		PERROR("Cannot rename \"%s\" (errno=%d)\n", filename, errno);
+}
+
+
+/*
+ * writes to the log file, which is kept open
+ * it is reopened, if it was renamed or removed by others
+ */
+static void trace_write(const char *buffer, int len)
+{
+	struct stat st, st_file;
+	int ret;
+
+	if (trace_fd >= 0) {
+		if (fstat(trace_fd, &st) || stat(options.log, &st_file)
+		 || st.st_ino != st_file.st_ino || st.st_dev != st_file.st_dev) {
+			close(trace_fd);
+			trace_fd = -1;
+		} else
+		if (options.log_size > 0 && st.st_size > 0
+		 && st.st_size + len > (off_t)options.log_size * 1024) {
+			close(trace_fd);
+			trace_fd = -1;
+			rotate_file(options.log);
+		}
+	}
+	if (trace_fd < 0) {
+		trace_fd = open(options.log, O_WRONLY | O_APPEND | O_CREAT, 0666);
+		if (trace_fd < 0)
+			return;
+	}
+
+	while (len > 0) {
+		ret = write(trace_fd, buffer, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buffer += ret;
+		len -= ret;
+	}
+}
+
+static void *trace_child(void *arg)
+{
+	struct trace *t;
+	unsigned int lost;
+	int len, l;
+
+	while (1) {
+		while (sem_wait(&trace_sem) < 0 && errno == EINTR)
+			;
+		/* render all queued traces, write them at once */
+		len = 0;
+		while (trace_out != trace_in) {
+			__sync_synchronize(); /* read record after it was put */
+			t = &trace_ring[trace_out & TRACE_MASK];
+			print_trace(t, 1, trace_line, sizeof(trace_line));
+			l = strlen(trace_line);
+			if (len + l > (int)sizeof(trace_buffer)) {
+				trace_write(trace_buffer, len);
+				len = 0;
+			}
+			memcpy(trace_buffer + len, trace_line, l);
+			len += l;
+			__sync_synchronize(); /* record is read before slot is freed */
+			trace_out++;
+		}
+		lost = trace_lost;
+		if (lost != trace_lost_written) {
+			SPRINT(trace_line, "%u traces were not logged, because the writer was too slow.\n", lost - trace_lost_written);
+			trace_lost_written = lost;
+			l = strlen(trace_line);
+			if (len + l > (int)sizeof(trace_buffer)) {
+				trace_write(trace_buffer, len);
+				len = 0;
+			}
+			memcpy(trace_buffer + len, trace_line, l);
+			len += l;
+		}
+		if (len)
+			trace_write(trace_buffer, len);
+		if (trace_quit && trace_out == trace_in)
+			break;
+	}
+
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+	}
+
+	return NULL;
+}
+
+/*
+ * puts trace into ring of log writer
+ * only the used elements are copied
+ */
+static void trace_log(struct trace *t)
+{
+	int elements = t->elements;
+
+	if (elements > MAX_TRACE_ELEMENTS)
+		elements = MAX_TRACE_ELEMENTS;
+
+	if (!trace_running) {
+		/* after trace_exit() or without thread, we write directly */
+		if (trace_quit || sem_init(&trace_sem, 0, 0) < 0) {
+			direct:
+			print_trace(t, 1, trace_line, sizeof(trace_line));
+			trace_write(trace_line, strlen(trace_line));
+			if (trace_fd >= 0) {
+				close(trace_fd);
+				trace_fd = -1;
+			}
+			return;
+		}
+		if (pthread_create(&trace_tid, NULL, trace_child, NULL)) {
+			sem_destroy(&trace_sem);
+			trace_quit = 1;
+			PERROR("failed to create log writer thread, writing now.\n");
+			goto direct;
+		}
+		trace_running = 1;
+	}
+
+	if (trace_in - trace_out >= TRACE_RING) {
+		trace_lost++;
+		return;
+	}
+	memcpy(&trace_ring[trace_in & TRACE_MASK], t, (char *)&t->element[elements] - (char *)t);
+	trace_ring[trace_in & TRACE_MASK].elements = elements;
+	__sync_synchronize(); /* record is complete before it is put */
+	trace_in++;
+	sem_post(&trace_sem);
+}
+
+/*
+ * writes all queued traces and stops the writer
+ * later traces are written directly
+ */
+void trace_exit(void)
+{
+	trace_quit = 1;
+	if (!trace_running)
+		return;
+
+	sem_post(&trace_sem);
+	pthread_join(trace_tid, NULL);
+	sem_destroy(&trace_sem);
+	trace_running = 0;
 }
 
 
@@ -264,67 +485,60 @@ static char *print_trace(int detail, int port, char *interface, char *caller, ch
  */
 void _end_trace(const char *__file, int __line)
 {
-	char *string;
-	FILE *fp;
+	char *string, *text[4] = { NULL, NULL, NULL, NULL };
 	struct admin_list	*admin;
 	struct admin_queue	*response, **responsep;	/* response pointer */
-	int ret;
+	int detail;
 
 	if (!trace.name[0])
 		PERROR("trace not started in file %s line %d\n", __file, __line);
 	
-	if (options.deb || options.log[0]) {
-		string = print_trace(1, -1, NULL, NULL, NULL, 0);
-		if (string) {
-			/* process debug */
-			if (options.deb)
-				debug(NULL, NULL, 0, "TRACE", string);
-			/* process log */
-			if (options.log[0]) {
-				fp = fopen(options.log, "a");
-				if (fp) {
-					ret = fwrite(string, strlen(string), 1, fp);
-					fclose(fp);
-				}
-			}
-		}
+	/* process debug */
+	if (options.deb) {
+		text[1] = print_trace(&trace, 1, trace_text[1], sizeof(trace_text[1]));
+		debug(NULL, NULL, 0, "TRACE", text[1]);
 	}
 
-	/* process admin */
+	/* process log */
+	if (options.log[0])
+		trace_log(&trace);
+
+	/* process admin, each detail is rendered only once */
 	admin = admin_first;
 	while(admin) {
-		if (admin->trace.detail) {
-			string = print_trace(admin->trace.detail, admin->trace.port, admin->trace.interface, admin->trace.caller, admin->trace.dialing, admin->trace.category);
-			if (string) {
-				/* seek to end of response list */
-				response = admin->response;
-				responsep = &admin->response;
-				while(response) {
-					responsep = &response->next;
-					response = response->next;
-				}
-
-				/* create state response */
-				response = (struct admin_queue *)MALLOC(sizeof(struct admin_queue)+sizeof(admin_message));
-				memuse++;
-				response->num = 1;
-				/* message */
-				response->am[0].message = ADMIN_TRACE_RESPONSE;
-				SCPY(response->am[0].u.trace_rsp.text, string);
-
-				/* attach to response chain */
-				*responsep = response;
+		detail = admin->trace.detail;
+		if (detail > 3)
+			detail = 3;
+		if (detail > 0 && trace_match(&trace, &admin->trace)) {
+			if (!text[detail])
+				text[detail] = print_trace(&trace, detail, trace_text[detail], sizeof(trace_text[detail]));
+			string = text[detail];
+
+			/* seek to end of response list */
+			response = admin->response;
+			responsep = &admin->response;
+			while(response) {
 				responsep = &response->next;
-				admin->fd.when |= LCR_FD_WRITE;
+				response = response->next;
 			}
+
+			/* create state response */
+			response = (struct admin_queue *)MALLOC(sizeof(struct admin_queue)+sizeof(admin_message));
+			memuse++;
+			response->num = 1;
+			/* message */
+			response->am[0].message = ADMIN_TRACE_RESPONSE;
+			SCPY(response->am[0].u.trace_rsp.text, string);
+
+			/* attach to response chain */
+			*responsep = response;
+			responsep = &response->next;
+			update_fd(&admin->fd, admin->fd.when | LCR_FD_WRITE);
 		}
 		admin = admin->next;
 	}
-//	fwrite(string, strlen(string), 1, fp);
 
 	memset(&trace, 0, sizeof(struct trace));
 }
 
 
-
-
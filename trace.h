@@ -129,6 +129,11 @@ struct trace {
 
 
 
+#define TRACE_RING	512	/* traces queued for the log writer, must be a binary border */
+#define TRACE_MASK	(TRACE_RING - 1)
+
+extern volatile unsigned int trace_lost;	/* traces not logged, because the ring was full */
+
 #define	CATEGORY_CH	0x01
 #define	CATEGORY_EP	0x02
 //#define CATEGORY_BC	0x04 check lcradmin help
@@ -140,6 +145,8 @@ struct trace {
 void _start_trace(const char *__file, int line, int port, struct interface *interface, const char *caller, const char *dialing, int direction, int category, int serial, const char *name);
 void _add_trace(const char *__file, int line, const char *name, const char *sub, const char *fmt, ...);
 void _end_trace(const char *__file, int line);
+void trace_exit(void);
+void rotate_file(const char *filename);
 //char *print_trace(int port, char *interface, char *caller, char *dialing, int direction, char *category, char *name);
 
 
@@ -17,7 +17,7 @@
 
 /* note: recording log is written at endpoint */
 
-int announce_timer(struct lcr_timer *timer, void *instance, int index);
+static void vbox_announce(void *instance, const unsigned char *data, int len);
 int record_timeout(struct lcr_timer *timer, void *instance, int index);
 
 /*
@@ -26,12 +26,8 @@ int record_timeout(struct lcr_timer *timer, void *instance, int index);
 VBoxPort::VBoxPort(int type, struct port_settings *settings) : Port(type, "vbox", settings)
 {
 	p_vbox_timeout = 0;
-	p_vbox_announce_fh = -1;
-	p_vbox_audio_start = 0;
-	p_vbox_audio_transferred = 0;
 	p_vbox_record_limit = 0;
-	memset(&p_vbox_announce_timer, 0, sizeof(p_vbox_announce_timer));
-	add_timer(&p_vbox_announce_timer, announce_timer, this, 0);
+	memset(&p_vbox_announce, 0, sizeof(p_vbox_announce));
 	memset(&p_vbox_record_timeout, 0, sizeof(p_vbox_record_timeout));
 	add_timer(&p_vbox_record_timeout, record_timeout, this, 0);
 }
@@ -42,13 +38,8 @@ VBoxPort::VBoxPort(int type, struct port_settings *settings) : Port(type, "vbox"
  */
 VBoxPort::~VBoxPort()
 {
-	del_timer(&p_vbox_announce_timer);
+	announce_stop(&p_vbox_announce);
 	del_timer(&p_vbox_record_timeout);
-	if (p_vbox_announce_fh >= 0) {
-		close(p_vbox_announce_fh);
-		p_vbox_announce_fh = -1;
-		fhuse--;
-	}
 }
 
 
@@ -89,103 +80,69 @@ int record_timeout(struct lcr_timer *timer, void *instance, int index)
 	return 0;
 }
 
-int announce_timer(struct lcr_timer *timer, void *instance, int index)
+static void vbox_announce(void *instance, const unsigned char *data, int len)
 {
 	class VBoxPort *vboxport = (class VBoxPort *)instance;
 
 	/* port my self destruct here */
-	vboxport->send_announcement();
+	if (data)
+		vboxport->announce_data(data, len);
+	else
+		vboxport->announce_end();
+}
 
-	return 0;
+void VBoxPort::announce_data(const unsigned char *data, int len)
+{
+	if (p_record)
+		record((unsigned char *)data, len, 0); // from down
+	/* send to remote, if bridged */
+	bridge_tx((unsigned char *)data, len);
 }
 
-void VBoxPort::send_announcement(void)
+/* end of announcement */
+void VBoxPort::announce_end(void)
 {
 	struct lcr_msg	*message;
-	unsigned int	tosend;
-	unsigned char	buffer[PORT_TRANSMIT + PORT_TRANSMIT]; /* use twice of the buffer, so we can send more in case of delayed main loop execution */
 	class Endpoint	*epoint;
-	int		temp;
-	struct timeval current_time;
-	long long	now;  /* Time in samples */
-
-	/* don't restart timer, if announcement is played */
-	if (p_vbox_announce_fh < 0)
-		return;
-
-	gettimeofday(&current_time, NULL);
-	now = (current_time.tv_sec * MICRO_SECONDS + current_time.tv_usec)/125;
-
-	/* set time the first time */
-	if (!p_vbox_audio_start)
-		p_vbox_audio_start = now - PORT_TRANSMIT;
-	
-	/* calculate the number of bytes */
-	tosend = (unsigned int)(now - p_vbox_audio_start) - p_vbox_audio_transferred;
-	if (tosend > sizeof(buffer))
-		tosend = sizeof(buffer);
-
-	/* schedule next event */
-	temp = PORT_TRANSMIT + PORT_TRANSMIT - tosend;
-	if (temp < 0)
-		temp = 0;
-	schedule_timer(&p_vbox_announce_timer, 0, temp*125);
-
-	/* add the number of samples elapsed */
-	p_vbox_audio_transferred += tosend;
-
-	/* if announcement is currently played, send audio data */
-	tosend = read_tone(p_vbox_announce_fh, buffer, p_vbox_announce_codec, tosend, p_vbox_announce_size, &p_vbox_announce_left, 1);
-	if (tosend <= 0) {
-		/* end of file */
-		close(p_vbox_announce_fh);
-		p_vbox_announce_fh = -1;
-		fhuse--;
-
-		if (p_vbox_record_limit)
-			schedule_timer(&p_vbox_record_timeout, p_vbox_record_limit, 0);
-
-		/* connect if not already */
-		epoint = find_epoint_id(ACTIVE_EPOINT(p_epointlist));
-		if (epoint) {
-			/* if we sent our announcement during ringing, we must now connect */
-			if (p_vbox_ext.vbox_free) {
-				/* send connect message */
-				message = message_create(p_serial, ACTIVE_EPOINT(p_epointlist), PORT_TO_EPOINT, MESSAGE_CONNECT);
-				memcpy(&message->param.connectinfo, &p_connectinfo, sizeof(struct connect_info));
-				message_put(message);
-				vbox_trace_header(this, "CONNECT from VBox (announcement is over)", DIRECTION_IN);
-				end_trace();
-				new_state(PORT_STATE_CONNECT);
-			}
-		}
 
-		/* start recording, if not already */
-		if (p_vbox_mode == VBOX_MODE_NORMAL) {
-			/* recording start */
-			open_record(p_vbox_ext.vbox_codec, 2, 0, p_vbox_ext.number, p_vbox_ext.anon_ignore, p_vbox_ext.vbox_email, p_vbox_ext.vbox_email_file);
-			vbox_trace_header(this, "RECORDING (announcement is over)", DIRECTION_IN);
-			end_trace();
-		} else // else!!
-		if (p_vbox_mode == VBOX_MODE_ANNOUNCEMENT) {
-			/* send release */
-			message = message_create(p_serial, ACTIVE_EPOINT(p_epointlist), PORT_TO_EPOINT, MESSAGE_RELEASE);
-			message->param.disconnectinfo.cause = 16;
-			message->param.disconnectinfo.location = LOCATION_PRIVATE_LOCAL;
+	if (p_vbox_record_limit)
+		schedule_timer(&p_vbox_record_timeout, p_vbox_record_limit, 0);
+
+	/* connect if not already */
+	epoint = find_epoint_id(ACTIVE_EPOINT(p_epointlist));
+	if (epoint) {
+		/* if we sent our announcement during ringing, we must now connect */
+		if (p_vbox_ext.vbox_free) {
+			/* send connect message */
+			message = message_create(p_serial, ACTIVE_EPOINT(p_epointlist), PORT_TO_EPOINT, MESSAGE_CONNECT);
+			memcpy(&message->param.connectinfo, &p_connectinfo, sizeof(struct connect_info));
 			message_put(message);
-			vbox_trace_header(this, "RELEASE from VBox (after annoucement)", DIRECTION_IN);
-			add_trace("cause", "value", "%d", message->param.disconnectinfo.cause);
-			add_trace("cause", "location", "%d", message->param.disconnectinfo.location);
+			vbox_trace_header(this, "CONNECT from VBox (announcement is over)", DIRECTION_IN);
 			end_trace();
-			/* recording is close during destruction */
-			delete this;
-			return; /* must return because port is gone */
+			new_state(PORT_STATE_CONNECT);
 		}
-	} else {
-		if (p_record)
-			record(buffer, tosend, 0); // from down
-		/* send to remote, if bridged */
-		bridge_tx(buffer, tosend);
+	}
+
+	/* start recording, if not already */
+	if (p_vbox_mode == VBOX_MODE_NORMAL) {
+		/* recording start */
+		open_record(p_vbox_ext.vbox_codec, 2, 0, p_vbox_ext.number, p_vbox_ext.anon_ignore, p_vbox_ext.vbox_email, p_vbox_ext.vbox_email_file);
+		vbox_trace_header(this, "RECORDING (announcement is over)", DIRECTION_IN);
+		end_trace();
+	} else // else!!
+	if (p_vbox_mode == VBOX_MODE_ANNOUNCEMENT) {
+		/* send release */
+		message = message_create(p_serial, ACTIVE_EPOINT(p_epointlist), PORT_TO_EPOINT, MESSAGE_RELEASE);
+		message->param.disconnectinfo.cause = 16;
+		message->param.disconnectinfo.location = LOCATION_PRIVATE_LOCAL;
+		message_put(message);
+		vbox_trace_header(this, "RELEASE from VBox (after annoucement)", DIRECTION_IN);
+		add_trace("cause", "value", "%d", message->param.disconnectinfo.cause);
+		add_trace("cause", "location", "%d", message->param.disconnectinfo.location);
+		end_trace();
+		/* recording is close during destruction */
+		delete this;
+		return; /* must return because port is gone */
 	}
 }
 
@@ -303,18 +260,15 @@ int VBoxPort::message_epoint(unsigned int epoint_id, int message_id, union param
 		}
 
 		/* play the announcement */
-		if ((p_vbox_announce_fh = open_tone(filename, &p_vbox_announce_codec, &p_vbox_announce_size, &p_vbox_announce_left)) >= 0) {
-			fhuse++;
-			schedule_timer(&p_vbox_announce_timer, 0, 300000);
-		} 
+		announce_play(&p_vbox_announce, filename, 2400, vbox_announce, this); /* 300 ms */
 		vbox_trace_header(this, "ANNOUNCEMENT", DIRECTION_OUT);
 		add_trace("file", "name", "%s", filename);
-		add_trace("file", "exists", "%s", (p_vbox_announce_fh>=0)?"yes":"no");
+		add_trace("file", "exists", "%s", (p_vbox_announce.file)?"yes":"no");
 		end_trace();
 		/* start recording if desired */
 		p_vbox_mode = p_vbox_ext.vbox_mode;
 		p_vbox_record_limit = p_vbox_ext.vbox_time;
-		if (p_vbox_announce_fh<0 || p_vbox_mode==VBOX_MODE_PARALLEL) {
+		if (!p_vbox_announce.file || p_vbox_mode==VBOX_MODE_PARALLEL) {
 			/* recording start */
 			open_record(p_vbox_ext.vbox_codec, 2, 0, p_vbox_ext.number, p_vbox_ext.anon_ignore, p_vbox_ext.vbox_email, p_vbox_ext.vbox_email_file);
 			vbox_trace_header(this, "RECORDING", DIRECTION_IN);
@@ -16,7 +16,8 @@ class VBoxPort : public Port
 	VBoxPort(int type, struct port_settings *settings);
 	~VBoxPort();
 	int message_epoint(unsigned int epoint_id, int message, union parameter *param);
-	void send_announcement(void);
+	void announce_data(const unsigned char *data, int len);
+	void announce_end(void);
 
 	int bridge_rx(unsigned char *data, int len);
 
@@ -26,14 +27,8 @@ class VBoxPort : public Port
 	char p_vbox_extension[32];			/* current extension */
 
 //	int p_vbox_recording;				/* if currently recording */
-	int p_vbox_announce_fh;				/* the announcement filehandler */
-	int p_vbox_announce_codec;			/* the announcement codec */
-	signed int p_vbox_announce_left;		/* the number of bytes left of announcement sample */
-	signed int p_vbox_announce_size;		/* size of current announcement (in bytes) */
+	struct announce_player p_vbox_announce;		/* the announcement being played */
 	int p_vbox_mode;				/* type of recording VBOX_MODE_* */
-	long long p_vbox_audio_start;			/* time stamp of starting of audio (0 == not yet started) */ 
-	unsigned int p_vbox_audio_transferred;		/* number of samples sent to endpoint */
-	struct lcr_timer p_vbox_announce_timer;		/* timer for sending announcement */
 	struct lcr_timer p_vbox_record_timeout;		/* timer for recording limit */
 	signed int p_vbox_record_limit;		/* limit for recording */
 
@@ -0,0 +1,124 @@
+/*****************************************************************************\
+**                                                                           **
+** LCR                                                                       **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** list, convert and compact voice box message stores                        **
+**                                                                           **
+\*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include "main.h"
+
+int memuse = 0;
+int mmemuse = 0;
+int cmemuse = 0;
+int ememuse = 0;
+int pmemuse = 0;
+int classuse = 0;
+int fduse = 0;
+int fhuse = 0;
+
+void debug(const char *file, const char *function, int line, const char *prefix, char *buffer)
+{
+}
+
+void _printdebug(const char *file, const char *function, int line, unsigned int mask, const char *fmt, ...)
+{
+}
+
+void _printerror(const char *file, const char *function, int line, const char *fmt, ...)
+{
+	char buffer[4096];
+	va_list args;
+
+	va_start(args,fmt);
+	VUNPRINT(buffer,sizeof(buffer)-1,fmt,args);
+	buffer[sizeof(buffer)-1]=0;
+	va_end(args);
+
+	fprintf(stderr, "%s", buffer);
+}
+
+static int list(const char *extension)
+{
+	struct vbox_store store;
+	struct vbox_store_record rec;
+	int i, num;
+
+	vbox_store_init(&store);
+	if (vbox_store_open(&store, extension)) {
+		PERROR("Extension %s has no voice box.\n", extension);
+		return(-1);
+	}
+	num = vbox_store_num(&store);
+	for (i = 0; i < num; i++) {
+		if (vbox_store_get(&store, i, &rec))
+			break;
+		printf("%3d %04d-%02d-%02d %02d:%02d %-20s %s\n", i + 1, rec.year + 1900, rec.mon + 1, rec.mday, rec.hour, rec.min, rec.callerid, rec.name);
+	}
+	printf("Extension %s: %d message(s), %d record(s) in store.\n", extension, num, store.header.count);
+	vbox_store_close(&store);
+
+	return(0);
+}
+
+static int migrate(const char *extension)
+{
+	if (vbox_store_migrate(extension)) {
+		PERROR("Extension %s has no voice box.\n", extension);
+		return(-1);
+	}
+	printf("Extension %s: store is up to date.\n", extension);
+
+	return(0);
+}
+
+static int compact(const char *extension)
+{
+	int messages, removed;
+
+	if (vbox_store_compact(extension, &messages, &removed)) {
+		PERROR("Extension %s: store is not compacted.\n", extension);
+		return(-1);
+	}
+	printf("Extension %s: %d message(s) kept, %d removed message(s) dropped.\n", extension, messages, removed);
+
+	return(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, ret = 0;
+
+	if (argc < 3 || (!!strcmp(argv[1], "list") && !!strcmp(argv[1], "migrate") && !!strcmp(argv[1], "compact"))) {
+		printf("Usage: %s list|migrate|compact <extension> [<extension> ...]\n\n", argv[0]);
+		printf("list: show messages of voice box\n");
+		printf("migrate: convert text index of older versions, this is also done when the\n");
+		printf(" voice box is used the first time\n");
+		printf("compact: drop deleted messages from store, this can be done while LCR is\n");
+		printf(" running\n");
+		return(0);
+	}
+
+	for (i = 2; i < argc; i++) {
+		if (!strcmp(argv[1], "list"))
+			ret |= list(argv[i]);
+		else if (!strcmp(argv[1], "migrate"))
+			ret |= migrate(argv[i]);
+		else
+			ret |= compact(argv[i]);
+	}
+
+	return(ret ? -1 : 0);
+}
+
@@ -0,0 +1,467 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** voice box message store                                                   **
+**                                                                           **
+\*****************************************************************************/
+
+/* HOW TO store voice box messages?
+
+The messages of an extension are stored in 'vbox/index.bin'. A header is
+followed by fixed size records, so message number n is read with a single
+pread, using the list of records that are not removed. The header is read
+each time the menu is used. The list is only built again, if the count or
+the changes of the header differ from what we have seen before.
+
+A new message is appended: The record is written behind the last record
+and synced, then the count of the header is increased and synced. If we
+crash before, the record is not counted and will be overwritten by the next
+message. After the append returns, the message survives a crash.
+A deleted message is only marked as removed. All writers lock the file, so
+recording and deleting at the same time cannot corrupt it.
+
+If the store does not exist, it is created from the text index 'vbox/index'
+of older versions, which is renamed to 'vbox/index.old' afterwards. The
+store is built in a temporary file and linked to its name, so it is only
+created once, even if two processes convert at the same time.
+
+Removed records are dropped by compaction (see 'vboxindex'). The store is
+written to a temporary file, renamed, and the header of the old file is
+marked as replaced. Readers then open the new file. Writers that waited for
+the lock check if they still have the current file.
+
+*/
+
+#include "main.h"
+
+static unsigned int vbox_store_offset(unsigned int record)
+{
+	return sizeof(struct vbox_store_header) + record * sizeof(struct vbox_store_record);
+}
+
+static int vbox_store_header_ok(struct vbox_store_header *header, const char *extension)
+{
+	if (!!memcmp(header->magic, VBOX_STORE_MAGIC, sizeof(VBOX_STORE_MAGIC))
+	 || header->version != VBOX_STORE_VERSION
+	 || header->record_size != sizeof(struct vbox_store_record)) {
+		PERROR("Voice box store of extension '%s' is not compatible.\n", extension);
+		return(0);
+	}
+
+	return(1);
+}
+
+static int vbox_store_read_header(int fd, struct vbox_store_header *header, const char *extension)
+{
+	if (pread(fd, header, sizeof(*header), 0) != sizeof(*header)) {
+		PERROR("Cannot read voice box store of extension '%s'.\n", extension);
+		return(-1);
+	}
+	if (!vbox_store_header_ok(header, extension))
+		return(-1);
+
+	return(0);
+}
+
+/* lock store, get the current file, if it was replaced while waiting */
+static int vbox_store_lock(int *fd, const char *filename)
+{
+	struct stat st_fd, st_file;
+
+	while (1) {
+		if (flock(*fd, LOCK_EX) < 0)
+			return(-1);
+		if (!fstat(*fd, &st_fd) && !stat(filename, &st_file)
+		 && st_fd.st_ino == st_file.st_ino && st_fd.st_dev == st_file.st_dev)
+			return(0);
+		close(*fd);
+		if ((*fd = open(filename, O_RDWR)) < 0) {
+			PERROR("Cannot open voice box store '%s'.\n", filename);
+			return(-1);
+		}
+	}
+}
+
+/*
+ * create store of extension, if it does not exist
+ * messages of the text index are taken over
+ */
+int vbox_store_migrate(const char *extension)
+{
+	FILE *fp;
+	char filename[256], tempname[256], indexname[256], oldname[256];
+	char buffer[256];
+	char name[sizeof(buffer)];
+	char callerid[sizeof(buffer)];
+	struct vbox_store_header header;
+	struct vbox_store_record rec;
+	int year, mon, mday, hour, min;
+	int fd, error;
+
+	SPRINT(filename, "%s/%s/vbox/%s", EXTENSION_DATA, extension, VBOX_STORE_FILE);
+	if (!access(filename, F_OK))
+		return(0);
+
+	SPRINT(tempname, "%s-%d", filename, (int)getpid());
+	if ((fd = open(tempname, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+		/* no vbox directory, so there are no messages */
+		if (errno != ENOENT)
+			PERROR("Cannot create voice box store '%s'.\n", tempname);
+		return(-1);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VBOX_STORE_MAGIC, sizeof(VBOX_STORE_MAGIC));
+	header.version = VBOX_STORE_VERSION;
+	header.record_size = sizeof(struct vbox_store_record);
+
+	SPRINT(indexname, "%s/%s/vbox/index", EXTENSION_DATA, extension);
+	if ((fp = fopen(indexname, "r"))) {
+		fduse++;
+		while((GETLINE(buffer, fp))) {
+			name[0] = callerid[0] = '\0';
+			year = mon = mday = hour = min = 0;
+			sscanf(buffer, "%s %d %d %d %d %d %s", name, &year, &mon, &mday, &hour, &min, callerid);
+
+			if (name[0]=='\0' || name[0]=='#')
+				continue;
+
+			memset(&rec, 0, sizeof(rec));
+			SCPY(rec.name, name);
+			rec.year = year;
+			rec.mon = mon;
+			rec.mday = mday;
+			rec.hour = hour;
+			rec.min = min;
+			SCPY(rec.callerid, callerid);
+			if (pwrite(fd, &rec, sizeof(rec), vbox_store_offset(header.count)) != sizeof(rec))
+				break;
+			header.count++;
+		}
+		fclose(fp);
+		fduse--;
+	}
+
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || fsync(fd) < 0) {
+		PERROR("Cannot write voice box store '%s'.\n", tempname);
+		close(fd);
+		unlink(tempname);
+		return(-1);
+	}
+	close(fd);
+
+	/* fails, if another process has created the store meanwhile */
+	error = (link(tempname, filename) < 0) ? errno : 0;
+	unlink(tempname);
+	if (error == EEXIST)
+		return(0);
+	if (error) {
+		PERROR("Cannot create voice box store '%s'.\n", filename);
+		return(-1);
+	}
+
+	if (fp) {
+		SPRINT(oldname, "%s/%s/vbox/%s", EXTENSION_DATA, extension, VBOX_STORE_OLD);
+		rename(indexname, oldname);
+		PDEBUG(DEBUG_EPOINT, "converted %d messages of text index of extension '%s'\n", header.count, extension);
+	}
+
+	return(0);
+}
+
+void vbox_store_init(struct vbox_store *store)
+{
+	memset(store, 0, sizeof(struct vbox_store));
+	store->fd = -1;
+}
+
+/* build list of messages that are not removed */
+static int vbox_store_load(struct vbox_store *store)
+{
+	struct vbox_store_record rec[64];
+	unsigned int i, n;
+	int j, len;
+
+	if (store->live) {
+		FREE(store->live, 0);
+		memuse--;
+		store->live = NULL;
+	}
+	store->live_num = 0;
+
+	if (vbox_store_read_header(store->fd, &store->header, store->extension))
+		return(-1);
+
+	if (!store->header.count)
+		return(0);
+	store->live = (unsigned int *)MALLOC(store->header.count * sizeof(unsigned int));
+	memuse++;
+	for (i = 0; i < store->header.count; i += n) {
+		n = store->header.count - i;
+		if (n > sizeof(rec) / sizeof(rec[0]))
+			n = sizeof(rec) / sizeof(rec[0]);
+		len = pread(store->fd, rec, n * sizeof(rec[0]), vbox_store_offset(i));
+		if (len != (int)(n * sizeof(rec[0]))) {
+			PERROR("Voice box store of extension '%s' is truncated.\n", store->extension);
+			return(-1);
+		}
+		for (j = 0; j < (int)n; j++) {
+			if (!rec[j].removed)
+				store->live[store->live_num++] = i + j;
+		}
+	}
+
+	return(0);
+}
+
+/*
+ * open store of extension, it is created if it does not exist
+ */
+int vbox_store_open(struct vbox_store *store, const char *extension)
+{
+	char filename[256];
+
+	vbox_store_close(store);
+
+	if (vbox_store_migrate(extension))
+		return(-1);
+
+	SPRINT(filename, "%s/%s/vbox/%s", EXTENSION_DATA, extension, VBOX_STORE_FILE);
+	if ((store->fd = open(filename, O_RDWR)) < 0) {
+		PERROR("Cannot open voice box store '%s'.\n", filename);
+		return(-1);
+	}
+	fhuse++;
+	SCPY(store->extension, extension);
+
+	return(vbox_store_load(store));
+}
+
+void vbox_store_close(struct vbox_store *store)
+{
+	if (store->fd >= 0) {
+		close(store->fd);
+		fhuse--;
+	}
+	if (store->live) {
+		FREE(store->live, 0);
+		memuse--;
+	}
+	vbox_store_init(store);
+}
+
+/*
+ * get number of messages, the list is built again, if the store has changed
+ */
+int vbox_store_num(struct vbox_store *store)
+{
+	struct vbox_store_header header;
+	char extension[sizeof(store->extension)];
+
+	if (store->fd < 0)
+		return(0);
+
+	if (vbox_store_read_header(store->fd, &header, store->extension))
+		return(0);
+	if (header.replaced) {
+		memcpy(extension, store->extension, sizeof(extension));
+		if (vbox_store_open(store, extension))
+			return(0);
+	} else
+	if (header.count != store->header.count || header.changes != store->header.changes) {
+		if (vbox_store_load(store))
+			return(0);
+	}
+
+	return(store->live_num);
+}
+
+/*
+ * read message, the number refers to the list of the last vbox_store_num()
+ */
+int vbox_store_get(struct vbox_store *store, int num, struct vbox_store_record *rec)
+{
+	if (store->fd < 0 || num < 0 || num >= store->live_num)
+		return(-1);
+
+	if (pread(store->fd, rec, sizeof(*rec), vbox_store_offset(store->live[num])) != sizeof(*rec)) {
+		PERROR("Cannot read message #%d of voice box store of extension '%s'.\n", num, store->extension);
+		return(-1);
+	}
+	rec->name[sizeof(rec->name)-1] = '\0';
+	rec->callerid[sizeof(rec->callerid)-1] = '\0';
+
+	return(0);
+}
+
+/*
+ * mark message as removed
+ */
+int vbox_store_remove(struct vbox_store *store, int num)
+{
+	char filename[256];
+	unsigned int record;
+	int removed = 1;
+	int ret = -1;
+
+	if (store->fd < 0 || num < 0 || num >= store->live_num)
+		return(-1);
+
+	SPRINT(filename, "%s/%s/vbox/%s", EXTENSION_DATA, store->extension, VBOX_STORE_FILE);
+	if (vbox_store_lock(&store->fd, filename)) {
+		if (store->fd < 0) {
+			fhuse--;
+			vbox_store_close(store);
+		}
+		return(-1);
+	}
+	record = store->live[num];
+
+	/* the file was replaced or changed since the list was built */
+	if (vbox_store_load(store) || num >= store->live_num)
+		goto unlock;
+	if (store->live[num] != record) {
+		PERROR("Message #%d of voice box store of extension '%s' has changed, not removing.\n", num, store->extension);
+		goto unlock;
+	}
+
+	if (pwrite(store->fd, &removed, sizeof(removed), vbox_store_offset(record) + offsetof(struct vbox_store_record, removed)) != sizeof(removed))
+		goto error;
+	store->header.changes++;
+	if (pwrite(store->fd, &store->header, sizeof(store->header), 0) != sizeof(store->header))
+		goto error;
+	memmove(store->live + num, store->live + num + 1, (store->live_num - num - 1) * sizeof(unsigned int));
+	store->live_num--;
+	ret = 0;
+	goto unlock;
+
+error:
+	PERROR("Cannot write voice box store '%s'.\n", filename);
+unlock:
+	flock(store->fd, LOCK_UN);
+
+	return(ret);
+}
+
+/*
+ * add message to store of extension
+ */
+int vbox_store_append(const char *extension, struct vbox_store_record *rec)
+{
+	char filename[256];
+	struct vbox_store_header header;
+	int fd, ret = -1;
+
+	if (vbox_store_migrate(extension))
+		return(-1);
+
+	SPRINT(filename, "%s/%s/vbox/%s", EXTENSION_DATA, extension, VBOX_STORE_FILE);
+	if ((fd = open(filename, O_RDWR)) < 0) {
+		PERROR("Cannot open voice box store '%s'.\n", filename);
+		return(-1);
+	}
+	if (vbox_store_lock(&fd, filename))
+		goto out;
+	if (vbox_store_read_header(fd, &header, extension))
+		goto out;
+
+	/* the record only counts, after it is written */
+	rec->removed = 0;
+	if (pwrite(fd, rec, sizeof(*rec), vbox_store_offset(header.count)) != sizeof(*rec)
+	 || fdatasync(fd) < 0)
+		goto error;
+	header.count++;
+	header.changes++;
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)
+	 || fdatasync(fd) < 0)
+		goto error;
+	ret = 0;
+	goto out;
+
+error:
+	PERROR("Cannot write voice box store '%s'.\n", filename);
+out:
+	if (fd >= 0)
+		close(fd);
+
+	return(ret);
+}
+
+/*
+ * drop removed messages from store of extension
+ */
+int vbox_store_compact(const char *extension, int *messages, int *removed)
+{
+	char filename[256], tempname[256];
+	struct vbox_store_header header, new_header;
+	struct vbox_store_record rec;
+	unsigned int i;
+	int fd, new_fd = -1, ret = -1;
+
+	*messages = *removed = 0;
+
+	if (vbox_store_migrate(extension))
+		return(-1);
+
+	SPRINT(filename, "%s/%s/vbox/%s", EXTENSION_DATA, extension, VBOX_STORE_FILE);
+	if ((fd = open(filename, O_RDWR)) < 0) {
+		PERROR("Cannot open voice box store '%s'.\n", filename);
+		return(-1);
+	}
+	if (vbox_store_lock(&fd, filename))
+		goto out;
+	if (vbox_store_read_header(fd, &header, extension))
+		goto out;
+
+	SPRINT(tempname, "%s-%d", filename, (int)getpid());
+	if ((new_fd = open(tempname, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+		PERROR("Cannot create voice box store '%s'.\n", tempname);
+		goto out;
+	}
+	memcpy(&new_header, &header, sizeof(new_header));
+	new_header.count = 0;
+	new_header.changes = header.changes + 1;
+	new_header.replaced = 0;
+	for (i = 0; i < header.count; i++) {
+		if (pread(fd, &rec, sizeof(rec), vbox_store_offset(i)) != sizeof(rec)) {
+			PERROR("Voice box store '%s' is truncated.\n", filename);
+			goto remove;
+		}
+		if (rec.removed) {
+			(*removed)++;
+			continue;
+		}
+		if (pwrite(new_fd, &rec, sizeof(rec), vbox_store_offset(new_header.count)) != sizeof(rec))
+			goto error;
+		new_header.count++;
+	}
+	*messages = new_header.count;
+	if (pwrite(new_fd, &new_header, sizeof(new_header), 0) != sizeof(new_header)
+	 || fsync(new_fd) < 0
+	 || rename(tempname, filename) < 0)
+		goto error;
+
+	/* readers of the old file must open the new one */
+	header.replaced = 1;
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		PERROR("Cannot mark voice box store '%s' as replaced.\n", filename);
+	ret = 0;
+	goto out;
+
+error:
+	PERROR("Cannot write voice box store '%s'.\n", tempname);
+remove:
+	unlink(tempname);
+out:
+	if (new_fd >= 0)
+		close(new_fd);
+	if (fd >= 0)
+		close(fd);
+
+	return(ret);
+}
+
@@ -0,0 +1,54 @@
+/*****************************************************************************\
+**                                                                           **
+** Linux Call Router                                                         **
+**                                                                           **
+**---------------------------------------------------------------------------**
+** Copyright: Andreas Eversberg                                              **
+**                                                                           **
+** voice box message store header file                                       **
+**                                                                           **
+\*****************************************************************************/
+
+#define VBOX_STORE_FILE		"index.bin"	/* in vbox directory of extension */
+#define VBOX_STORE_OLD		"index.old"	/* text index after conversion */
+#define VBOX_STORE_MAGIC	"LCRVBOX"
+#define VBOX_STORE_VERSION	1
+
+/* first bytes of store */
+struct vbox_store_header {
+	char		magic[8];
+	unsigned int	version;
+	unsigned int	record_size;	/* to detect incompatible files */
+	unsigned int	count;		/* records written, including removed ones */
+	unsigned int	changes;	/* incremented on every change */
+	unsigned int	replaced;	/* file was replaced by compaction, reopen it */
+	unsigned int	reserved;
+};
+
+/* a message, records follow the header */
+struct vbox_store_record {
+	char		name[128];	/* file in vbox directory */
+	int		year, mon, mday, hour, min;
+	char		callerid[128];
+	int		removed;	/* message was deleted, record is dropped by compaction */
+};
+
+/* store of an extension, opened for reading and removing messages */
+struct vbox_store {
+	int		fd;		/* -1 = not open */
+	char		extension[32];
+	struct vbox_store_header header; /* when live list was built */
+	unsigned int	*live;		/* record of each message that is not removed */
+	int		live_num;
+};
+
+void vbox_store_init(struct vbox_store *store);
+int vbox_store_open(struct vbox_store *store, const char *extension);
+void vbox_store_close(struct vbox_store *store);
+int vbox_store_num(struct vbox_store *store);
+int vbox_store_get(struct vbox_store *store, int num, struct vbox_store_record *rec);
+int vbox_store_remove(struct vbox_store *store, int num);
+int vbox_store_append(const char *extension, struct vbox_store_record *rec);
+int vbox_store_migrate(const char *extension);
+int vbox_store_compact(const char *extension, int *messages, int *removed);
+